@@ -230,6 +230,41 @@ extern const char *(*MEM_name_ptr)(void *vmemh);
 /* Switch allocator to slower but fully guarded mode. */
 void MEM_use_guarded_allocator(void);
 
+/**
+ * Start the sampling allocation profiler, which records allocations by block name and by the
+ * profile context of the allocating thread. On average one allocation every `sample_interval`
+ * bytes is recorded, zero records all of them.
+ *
+ * Only supported by the guarded allocator, returns false when it's not used.
+ * Call before any profile context is entered.
+ */
+bool MEM_profile_enable(size_t sample_interval);
+/** Stop the profiler and discard its statistics, blocks sampled before are not counted. */
+void MEM_profile_disable(void);
+bool MEM_profile_is_enabled(void);
+
+/**
+ * Attribute allocations of the calling thread to `name` (copied), nested in the current context
+ * until #MEM_profile_context_end. Does nothing when the profiler isn't enabled.
+ */
+void MEM_profile_context_begin(const char *name);
+void MEM_profile_context_end(void);
+
+/** Print allocated, live and peak bytes per block name. */
+void MEM_profile_print_stats(void);
+
+/**
+ * Write the estimated bytes allocated by each context and block name as folded stacks
+ * (`context;context;name bytes` lines), as used by flame graph tools.
+ */
+bool MEM_profile_write(const char *filepath);
+
+/**
+ * Write the timeline of each block name as CSV, one `time,name,alloc_bytes,live_bytes,peak_bytes`
+ * line per interval with allocations or frees. Live bytes are unchanged in the intervals between.
+ */
+bool MEM_profile_write_timeline(const char *filepath);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
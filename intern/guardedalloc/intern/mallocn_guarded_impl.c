@@ -108,6 +108,8 @@ typedef struct MemHead {
   short alignment; /* if non-zero aligned alloc was used
                     * and alignment is stored here.
                     */
+  /* Set when sampled by the allocation profiler. */
+  struct MemProfileSite *profile_site;
 #ifdef DEBUG_MEMCOUNTER
   int _count;
 #endif
@@ -481,6 +483,7 @@ static void make_memhead_header(MemHead *memh, size_t len, const char *str)
   memh->mmap = 0;
   memh->alignment = 0;
   memh->tag2 = MEMTAG2;
+  memh->profile_site = UNLIKELY(mem_profile_enabled) ? mem_profile_alloc(len, str) : NULL;
 
 #ifdef DEBUG_MEMDUPLINAME
   memh->need_free_name = 0;
@@ -1093,6 +1096,10 @@ static void rem_memblock(MemHead *memh)
   atomic_sub_and_fetch_u(&totblock, 1);
   atomic_sub_and_fetch_z(&mem_in_use, memh->len);
 
+  if (memh->profile_site) {
+    mem_profile_free(memh->profile_site, memh->len);
+  }
+
 #ifdef DEBUG_MEMDUPLINAME
   if (memh->need_free_name)
     free((char *)memh->name);
@@ -96,6 +96,12 @@ size_t malloc_usable_size(void *ptr);
 #  define MEM_INLINE static inline
 #endif
 
+#ifdef _MSC_VER
+#  define MEM_THREAD_LOCAL __declspec(thread)
+#else
+#  define MEM_THREAD_LOCAL __thread
+#endif
+
 #define IS_POW2(a) (((a) & ((a)-1)) == 0)
 
 /* Extra padding which needs to be applied on MemHead to make it aligned. */
@@ -112,6 +118,12 @@ size_t malloc_usable_size(void *ptr);
 void *aligned_malloc(size_t size, size_t alignment);
 void aligned_free(void *ptr);
 
+/* Allocation profiler, see #MEM_profile_enable. */
+struct MemProfileSite;
+extern bool mem_profile_enabled;
+struct MemProfileSite *mem_profile_alloc(size_t len, const char *name);
+void mem_profile_free(struct MemProfileSite *site, size_t len);
+
 /* Prototypes for counted allocator functions */
 size_t MEM_lockfree_allocN_len(const void *vmemh) ATTR_WARN_UNUSED_RESULT;
 void MEM_lockfree_freeN(void *vmemh);
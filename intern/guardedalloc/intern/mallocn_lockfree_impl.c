@@ -21,10 +21,20 @@
  */
 
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h> /* memcpy */
 #include <sys/types.h>
 
+#if defined(WIN32)
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#endif
+
 #include "MEM_guardedalloc.h"
 
 /* to ensure strict conversions */
@@ -65,6 +75,9 @@ enum {
 /* Uncomment this to have proper peak counter. */
 #define USE_ATOMIC_MAX
 
+/* Recycle small blocks through per-thread caches, see #MemThreadCache. */
+#define USE_THREAD_CACHE
+
 MEM_INLINE void update_maximum(size_t *maximum_value, size_t value)
 {
 #ifdef USE_ATOMIC_MAX
@@ -93,6 +106,389 @@ print_error(const char *str, ...)
   }
 }
 
+#ifdef USE_THREAD_CACHE
+
+/* -------------------------------------------------------------------- */
+/** \name Thread Cache
+ *
+ * Small blocks are rounded up to a size class and recycled through free lists of the thread
+ * freeing them, so most allocations don't go to the system allocator. Threads exchange free
+ * blocks in batches through a shared list per size class, which also takes the free blocks of
+ * exited threads. The size class is found from the length in #MemHead, no extra data is stored.
+ *
+ * The memory in use and number of blocks are counted per thread and only added to the global
+ * counters after changing by #MEM_THREAD_STATS_FLUSH bytes, which is when the peak memory is
+ * updated. Getting the memory in use adds the counts of all threads.
+ * \{ */
+
+/* Blocks of up to this size (including #MemHead) are cached. */
+#define MEM_THREAD_CACHE_SIZE_MAX 1024
+/* 16 byte steps up to 256 bytes, then 64 byte steps. */
+#define MEM_THREAD_CACHE_CLASSES (16 + 12)
+/* Free blocks kept per size class by each thread, in bytes. */
+#define MEM_THREAD_CACHE_CLASS_BYTES (32 * 1024)
+#define MEM_THREAD_CACHE_USE(len) ((len) + sizeof(MemHead) <= MEM_THREAD_CACHE_SIZE_MAX)
+/* Batches of free blocks kept per size class in the shared lists. */
+#define MEM_THREAD_CACHE_SHARED_BATCHES 64
+/* Change of the memory in use of a thread added to the global counters at once. */
+#define MEM_THREAD_STATS_FLUSH (1024 * 1024)
+
+typedef struct MemFreeBlock {
+  struct MemFreeBlock *next;
+} MemFreeBlock;
+
+typedef struct MemFreeList {
+  MemFreeBlock *first;
+  unsigned int len;
+} MemFreeList;
+
+typedef struct MemThreadCache {
+  struct MemThreadCache *next;
+  /** Cleared when the thread exits, the cache is then reused by another thread. */
+  bool in_use;
+  MemFreeList free[MEM_THREAD_CACHE_CLASSES];
+  /** Changes not added to the global counters yet, negative when freeing more than allocating
+   * (blocks allocated by other threads). */
+  ptrdiff_t mem_in_use;
+  int totblock;
+} MemThreadCache;
+
+typedef struct MemSharedList {
+  unsigned int lock;
+  unsigned int batches_len;
+  MemFreeBlock *batches[MEM_THREAD_CACHE_SHARED_BATCHES];
+  unsigned int batches_block_len[MEM_THREAD_CACHE_SHARED_BATCHES];
+} MemSharedList;
+
+static MemSharedList thread_cache_shared[MEM_THREAD_CACHE_CLASSES];
+/* All caches, they're never freed. */
+static MemThreadCache *thread_cache_first = NULL;
+static unsigned int thread_cache_lock = 0;
+static MEM_THREAD_LOCAL MemThreadCache *thread_cache = NULL;
+
+#  if defined(WIN32)
+static DWORD thread_cache_fls = FLS_OUT_OF_INDEXES;
+#  else
+static pthread_key_t thread_cache_key;
+static bool thread_cache_key_created = false;
+#  endif
+
+/* Relaxed atomic access to the counters of thread caches, which are only written by their own
+ * thread, but read by any thread summing the statistics. */
+MEM_INLINE ptrdiff_t mem_load_relaxed_ptrdiff(const ptrdiff_t *p)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+#else
+  /* Aligned word sized volatile accesses are atomic with MSVC. */
+  return *(const volatile ptrdiff_t *)p;
+#endif
+}
+
+MEM_INLINE void mem_store_relaxed_ptrdiff(ptrdiff_t *p, ptrdiff_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  __atomic_store_n(p, value, __ATOMIC_RELAXED);
+#else
+  *(volatile ptrdiff_t *)p = value;
+#endif
+}
+
+MEM_INLINE int mem_load_relaxed_int(const int *p)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+#else
+  return *(const volatile int *)p;
+#endif
+}
+
+MEM_INLINE void mem_store_relaxed_int(int *p, int value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  __atomic_store_n(p, value, __ATOMIC_RELAXED);
+#else
+  *(volatile int *)p = value;
+#endif
+}
+
+MEM_INLINE unsigned int mem_load_relaxed_uint(const unsigned int *p)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+#else
+  return *(const volatile unsigned int *)p;
+#endif
+}
+
+MEM_INLINE void mem_store_relaxed_uint(unsigned int *p, unsigned int value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  __atomic_store_n(p, value, __ATOMIC_RELAXED);
+#else
+  *(volatile unsigned int *)p = value;
+#endif
+}
+
+/* Spin-lock hint for processors with hyper-threading. */
+MEM_INLINE void mem_cpu_pause(void)
+{
+#if defined(_MSC_VER)
+  YieldProcessor();
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+  __builtin_ia32_pause();
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+MEM_INLINE void mem_spin_lock(unsigned int *lock)
+{
+  while (atomic_cas_u(lock, 0, 1) != 0) {
+    /* Wait without writing to the cache line until the lock looks free. */
+    while (mem_load_relaxed_uint(lock) != 0) {
+      mem_cpu_pause();
+    }
+  }
+}
+
+MEM_INLINE void mem_spin_unlock(unsigned int *lock)
+{
+  atomic_cas_u(lock, 1, 0);
+}
+
+/* Size including #MemHead. */
+MEM_INLINE int thread_cache_class(size_t size)
+{
+  if (size <= 256) {
+    return (int)((size + 15) / 16) - 1;
+  }
+  return 16 + (int)((size - 256 + 63) / 64) - 1;
+}
+
+MEM_INLINE size_t thread_cache_class_size(int size_class)
+{
+  if (size_class < 16) {
+    return (size_t)(size_class + 1) * 16;
+  }
+  return 256 + (size_t)(size_class - 15) * 64;
+}
+
+MEM_INLINE unsigned int thread_cache_class_len_max(int size_class)
+{
+  return (unsigned int)(MEM_THREAD_CACHE_CLASS_BYTES / thread_cache_class_size(size_class));
+}
+
+static void thread_cache_stats_flush(MemThreadCache *cache)
+{
+  const ptrdiff_t delta = cache->mem_in_use;
+  const size_t value = atomic_add_and_fetch_z(&mem_in_use, (size_t)delta);
+  atomic_add_and_fetch_u(&totblock, (unsigned int)cache->totblock);
+  mem_store_relaxed_ptrdiff(&cache->mem_in_use, 0);
+  mem_store_relaxed_int(&cache->totblock, 0);
+  /* The global counter goes below zero (wrapping around) when a thread flushes frees of blocks
+   * which are still counted by the threads allocating them, don't take that as a peak. */
+  if (delta > 0 && (ptrdiff_t)value > 0) {
+    update_maximum(&peak_mem, value);
+  }
+}
+
+MEM_INLINE void thread_cache_stats_add(MemThreadCache *cache, ptrdiff_t len, int blocks)
+{
+  /* Only this thread writes the counters, a relaxed load and store is enough. */
+  const ptrdiff_t cache_mem_in_use = cache->mem_in_use + len;
+  mem_store_relaxed_ptrdiff(&cache->mem_in_use, cache_mem_in_use);
+  mem_store_relaxed_int(&cache->totblock, cache->totblock + blocks);
+  if (UNLIKELY(cache_mem_in_use > MEM_THREAD_STATS_FLUSH ||
+               cache_mem_in_use < -MEM_THREAD_STATS_FLUSH)) {
+    thread_cache_stats_flush(cache);
+  }
+}
+
+/* Sum of the global counters and the counters of all threads. */
+static void thread_cache_stats_get(size_t *r_mem_in_use, unsigned int *r_totblock)
+{
+  size_t mem_in_use_sum = atomic_add_and_fetch_z(&mem_in_use, 0);
+  unsigned int totblock_sum = atomic_add_and_fetch_u(&totblock, 0);
+  mem_spin_lock(&thread_cache_lock);
+  for (MemThreadCache *cache = thread_cache_first; cache; cache = cache->next) {
+    mem_in_use_sum += (size_t)mem_load_relaxed_ptrdiff(&cache->mem_in_use);
+    totblock_sum += (unsigned int)mem_load_relaxed_int(&cache->totblock);
+  }
+  mem_spin_unlock(&thread_cache_lock);
+  *r_mem_in_use = mem_in_use_sum;
+  *r_totblock = totblock_sum;
+}
+
+/* Move a chain of free blocks to the shared list, or free them when it's full. */
+static void thread_cache_shared_push(int size_class, MemFreeBlock *first, unsigned int len)
+{
+  MemSharedList *shared = &thread_cache_shared[size_class];
+  mem_spin_lock(&shared->lock);
+  const unsigned int batches_len = shared->batches_len;
+  if (batches_len < MEM_THREAD_CACHE_SHARED_BATCHES) {
+    shared->batches[batches_len] = first;
+    shared->batches_block_len[batches_len] = len;
+    mem_store_relaxed_uint(&shared->batches_len, batches_len + 1);
+    first = NULL;
+  }
+  mem_spin_unlock(&shared->lock);
+
+  while (first) {
+    MemFreeBlock *next = first->next;
+    free(first);
+    first = next;
+  }
+}
+
+static bool thread_cache_shared_pop(int size_class, MemFreeList *list)
+{
+  MemSharedList *shared = &thread_cache_shared[size_class];
+  /* Checked without locking first, most of the time there is nothing to take. */
+  if (mem_load_relaxed_uint(&shared->batches_len) == 0) {
+    return false;
+  }
+  bool found = false;
+  mem_spin_lock(&shared->lock);
+  const unsigned int batches_len = shared->batches_len;
+  if (batches_len != 0) {
+    list->first = shared->batches[batches_len - 1];
+    list->len = shared->batches_block_len[batches_len - 1];
+    mem_store_relaxed_uint(&shared->batches_len, batches_len - 1);
+    found = true;
+  }
+  mem_spin_unlock(&shared->lock);
+  return found;
+}
+
+/* Move all free blocks of the cache to the shared lists. */
+static void thread_cache_release(MemThreadCache *cache)
+{
+  for (int i = 0; i < MEM_THREAD_CACHE_CLASSES; i++) {
+    MemFreeList *list = &cache->free[i];
+    if (list->first) {
+      thread_cache_shared_push(i, list->first, list->len);
+      list->first = NULL;
+      list->len = 0;
+    }
+  }
+}
+
+static void thread_cache_exit(void *data)
+{
+  MemThreadCache *cache = data;
+  thread_cache_release(cache);
+  thread_cache_stats_flush(cache);
+  thread_cache = NULL;
+
+  mem_spin_lock(&thread_cache_lock);
+  cache->in_use = false;
+  mem_spin_unlock(&thread_cache_lock);
+}
+
+#  if defined(WIN32)
+static void WINAPI thread_cache_exit_fls(void *data)
+{
+  if (data) {
+    thread_cache_exit(data);
+  }
+}
+#  endif
+
+static MemThreadCache *thread_cache_claim(void)
+{
+  MemThreadCache *cache = NULL;
+
+  mem_spin_lock(&thread_cache_lock);
+#  if defined(WIN32)
+  if (thread_cache_fls == FLS_OUT_OF_INDEXES) {
+    thread_cache_fls = FlsAlloc(thread_cache_exit_fls);
+  }
+#  else
+  if (!thread_cache_key_created) {
+    pthread_key_create(&thread_cache_key, thread_cache_exit);
+    thread_cache_key_created = true;
+  }
+#  endif
+  for (cache = thread_cache_first; cache; cache = cache->next) {
+    if (!cache->in_use) {
+      break;
+    }
+  }
+  if (cache == NULL) {
+    cache = calloc(1, sizeof(*cache));
+    cache->next = thread_cache_first;
+    thread_cache_first = cache;
+  }
+  cache->in_use = true;
+  mem_spin_unlock(&thread_cache_lock);
+
+  /* Release the cache when the thread exits. */
+#  if defined(WIN32)
+  FlsSetValue(thread_cache_fls, cache);
+#  else
+  pthread_setspecific(thread_cache_key, cache);
+#  endif
+
+  thread_cache = cache;
+  return cache;
+}
+
+MEM_INLINE MemThreadCache *thread_cache_get(void)
+{
+  MemThreadCache *cache = thread_cache;
+  if (UNLIKELY(cache == NULL)) {
+    cache = thread_cache_claim();
+  }
+  return cache;
+}
+
+/* Block of at least `size` bytes, including #MemHead. */
+static MemHead *thread_cache_alloc(MemThreadCache *cache, size_t size)
+{
+  const int size_class = thread_cache_class(size);
+  MemFreeList *list = &cache->free[size_class];
+
+  if (list->first == NULL && !thread_cache_shared_pop(size_class, list)) {
+    return malloc(thread_cache_class_size(size_class));
+  }
+
+  MemFreeBlock *block = list->first;
+  list->first = block->next;
+  list->len--;
+  return (MemHead *)block;
+}
+
+static void thread_cache_free(MemThreadCache *cache, MemHead *memh, size_t size)
+{
+  const int size_class = thread_cache_class(size);
+  MemFreeList *list = &cache->free[size_class];
+  MemFreeBlock *block = (MemFreeBlock *)memh;
+
+  block->next = list->first;
+  list->first = block;
+  list->len++;
+
+  /* Give half of the blocks to other threads. */
+  const unsigned int len_max = thread_cache_class_len_max(size_class);
+  if (UNLIKELY(list->len > len_max)) {
+    const unsigned int batch_len = len_max / 2;
+    MemFreeBlock *batch_last = list->first;
+    for (unsigned int i = 1; i < batch_len; i++) {
+      batch_last = batch_last->next;
+    }
+    MemFreeBlock *batch_first = list->first;
+    list->first = batch_last->next;
+    list->len -= batch_len;
+    batch_last->next = NULL;
+    thread_cache_shared_push(size_class, batch_first, batch_len);
+  }
+}
+
+/** \} */
+
+#endif /* USE_THREAD_CACHE */
+
 #if defined(WIN32)
 static void mem_lock_thread(void)
 {
@@ -130,8 +526,13 @@ void MEM_lockfree_freeN(void *vmemh)
     return;
   }
 
+#ifdef USE_THREAD_CACHE
+  MemThreadCache *cache = thread_cache_get();
+  thread_cache_stats_add(cache, -(ptrdiff_t)len, -1);
+#else
   atomic_sub_and_fetch_u(&totblock, 1);
   atomic_sub_and_fetch_z(&mem_in_use, len);
+#endif
 
   if (MEMHEAD_IS_MMAP(memh)) {
     atomic_sub_and_fetch_z(&mmap_in_use, len);
@@ -153,6 +554,11 @@ void MEM_lockfree_freeN(void *vmemh)
       MemHeadAligned *memh_aligned = MEMHEAD_ALIGNED_FROM_PTR(vmemh);
       aligned_free(MEMHEAD_REAL_PTR(memh_aligned));
     }
+#ifdef USE_THREAD_CACHE
+    else if (MEM_THREAD_CACHE_USE(len)) {
+      thread_cache_free(cache, memh, len + sizeof(MemHead));
+    }
+#endif
     else {
       free(memh);
     }
@@ -264,13 +670,30 @@ void *MEM_lockfree_callocN(size_t len, const char *str)
 
   len = SIZET_ALIGN_4(len);
 
+#ifdef USE_THREAD_CACHE
+  MemThreadCache *cache = thread_cache_get();
+  if (MEM_THREAD_CACHE_USE(len)) {
+    memh = thread_cache_alloc(cache, len + sizeof(MemHead));
+    if (LIKELY(memh)) {
+      memset(memh + 1, 0, len);
+    }
+  }
+  else {
+    memh = (MemHead *)calloc(1, len + sizeof(MemHead));
+  }
+#else
   memh = (MemHead *)calloc(1, len + sizeof(MemHead));
+#endif
 
   if (LIKELY(memh)) {
     memh->len = len;
+#ifdef USE_THREAD_CACHE
+    thread_cache_stats_add(cache, (ptrdiff_t)len, 1);
+#else
     atomic_add_and_fetch_u(&totblock, 1);
     atomic_add_and_fetch_z(&mem_in_use, len);
     update_maximum(&peak_mem, mem_in_use);
+#endif
 
     return PTR_FROM_MEMHEAD(memh);
   }
@@ -305,7 +728,17 @@ void *MEM_lockfree_mallocN(size_t len, const char *str)
 
   len = SIZET_ALIGN_4(len);
 
+#ifdef USE_THREAD_CACHE
+  MemThreadCache *cache = thread_cache_get();
+  if (MEM_THREAD_CACHE_USE(len)) {
+    memh = thread_cache_alloc(cache, len + sizeof(MemHead));
+  }
+  else {
+    memh = (MemHead *)malloc(len + sizeof(MemHead));
+  }
+#else
   memh = (MemHead *)malloc(len + sizeof(MemHead));
+#endif
 
   if (LIKELY(memh)) {
     if (UNLIKELY(malloc_debug_memset && len)) {
@@ -313,9 +746,13 @@ void *MEM_lockfree_mallocN(size_t len, const char *str)
     }
 
     memh->len = len;
+#ifdef USE_THREAD_CACHE
+    thread_cache_stats_add(cache, (ptrdiff_t)len, 1);
+#else
     atomic_add_and_fetch_u(&totblock, 1);
     atomic_add_and_fetch_z(&mem_in_use, len);
     update_maximum(&peak_mem, mem_in_use);
+#endif
 
     return PTR_FROM_MEMHEAD(memh);
   }
@@ -421,11 +858,18 @@ void *MEM_lockfree_mapallocN(size_t len, const char *str)
   if (memh != (MemHead *)-1) {
     memh->len = len | (size_t)MEMHEAD_MMAP_FLAG;
     atomic_add_and_fetch_u(&totblock, 1);
-    atomic_add_and_fetch_z(&mem_in_use, len);
-    atomic_add_and_fetch_z(&mmap_in_use, len);
+    const size_t mem_in_use_value = atomic_add_and_fetch_z(&mem_in_use, len);
+    const size_t mmap_in_use_value = atomic_add_and_fetch_z(&mmap_in_use, len);
 
-    update_maximum(&peak_mem, mem_in_use);
-    update_maximum(&peak_mem, mmap_in_use);
+#ifdef USE_THREAD_CACHE
+    /* Can be below zero, see #thread_cache_stats_flush. */
+    if ((ptrdiff_t)mem_in_use_value > 0) {
+      update_maximum(&peak_mem, mem_in_use_value);
+    }
+#else
+    update_maximum(&peak_mem, mem_in_use_value);
+#endif
+    update_maximum(&peak_mem, mmap_in_use_value);
 
     return PTR_FROM_MEMHEAD(memh);
   }
@@ -454,8 +898,10 @@ void MEM_lockfree_callbackmemlist(void (*func)(void *))
 
 void MEM_lockfree_printmemlist_stats(void)
 {
-  printf("\ntotal memory len: %.3f MB\n", (double)mem_in_use / (double)(1024 * 1024));
-  printf("peak memory len: %.3f MB\n", (double)peak_mem / (double)(1024 * 1024));
+  printf("\ntotal memory len: %.3f MB\n",
+         (double)MEM_lockfree_get_memory_in_use() / (double)(1024 * 1024));
+  printf("peak memory len: %.3f MB\n",
+         (double)MEM_lockfree_get_peak_memory() / (double)(1024 * 1024));
   printf(
       "\nFor more detailed per-block statistics run Blender with memory debugging command line "
       "argument.\n");
@@ -489,7 +935,14 @@ void MEM_lockfree_set_memory_debug(void)
 
 size_t MEM_lockfree_get_memory_in_use(void)
 {
+#ifdef USE_THREAD_CACHE
+  size_t mem_in_use_sum;
+  unsigned int totblock_sum;
+  thread_cache_stats_get(&mem_in_use_sum, &totblock_sum);
+  return mem_in_use_sum;
+#else
   return mem_in_use;
+#endif
 }
 
 size_t MEM_lockfree_get_mapped_memory_in_use(void)
@@ -499,18 +952,31 @@ size_t MEM_lockfree_get_mapped_memory_in_use(void)
 
 unsigned int MEM_lockfree_get_memory_blocks_in_use(void)
 {
+#ifdef USE_THREAD_CACHE
+  size_t mem_in_use_sum;
+  unsigned int totblock_sum;
+  thread_cache_stats_get(&mem_in_use_sum, &totblock_sum);
+  return totblock_sum;
+#else
   return totblock;
+#endif
 }
 
 /* dummy */
 void MEM_lockfree_reset_peak_memory(void)
 {
-  peak_mem = mem_in_use;
+  peak_mem = MEM_lockfree_get_memory_in_use();
 }
 
 size_t MEM_lockfree_get_peak_memory(void)
 {
+#ifdef USE_THREAD_CACHE
+  /* The peak is only updated when the counters of a thread are flushed. */
+  const size_t mem_in_use_sum = MEM_lockfree_get_memory_in_use();
+  return peak_mem > mem_in_use_sum ? peak_mem : mem_in_use_sum;
+#else
   return peak_mem;
+#endif
 }
 
 #ifndef NDEBUG
@@ -0,0 +1,600 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** \file
+ * \ingroup MEM
+ *
+ * Sampling allocation profiler, used by the guarded allocator.
+ *
+ * Each block is sampled at random with a probability of `len / sample_interval` (or always
+ * when larger), so on average once every `sample_interval` bytes without being biased by
+ * periodic allocation patterns. Each sample is attributed to a site: the block name and the
+ * profile context of the allocating thread. A sampled block stands for `len / p` bytes and
+ * `1 / p` allocations, `p` being its probability to be sampled, which gives unbiased estimates
+ * of allocation rates and live bytes.
+ *
+ * Each block name also keeps a timeline of the bytes allocated and live bytes per interval.
+ * Intervals start at #PROFILE_TIMELINE_INTERVAL seconds and double in length when the timeline
+ * is full, so it covers the whole session at a bounded size.
+ *
+ * Profile contexts form a tree, a thread only keeps a pointer to its current context.
+ * The profiler data is allocated with the system allocator, contexts and sites are never freed.
+ */
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "MEM_guardedalloc.h"
+
+/* to ensure strict conversions */
+#include "../../source/blender/blenlib/BLI_strict_flags.h"
+
+#include "atomic_ops.h"
+#include "mallocn_intern.h"
+
+/* -------------------------------------------------------------------- */
+/** \name Data
+ * \{ */
+
+/* Length of the first timeline intervals in seconds. */
+#define PROFILE_TIMELINE_INTERVAL 0.01
+/* Maximum number of intervals in the timeline of a block name. */
+#define PROFILE_TIMELINE_LEN 1024
+
+/* Entries of the hash tables, chained in buckets. */
+typedef struct MemProfileEntry {
+  struct MemProfileEntry *next;
+  unsigned int hash;
+} MemProfileEntry;
+
+typedef struct MemProfileHash {
+  MemProfileEntry **buckets;
+  unsigned int buckets_len;
+  unsigned int entries_len;
+} MemProfileHash;
+
+typedef struct MemProfileContext {
+  MemProfileEntry entry;
+  struct MemProfileContext *parent;
+  /* Stored after the context. */
+  const char *name;
+} MemProfileContext;
+
+/* Interval of a block name timeline, only intervals with allocations or frees are stored. */
+typedef struct MemProfileTimelinePoint {
+  /* Start of the interval, seconds since the profiler was enabled. */
+  double time;
+  double alloc_bytes;
+  /* Live bytes at the end of the interval, and the highest live bytes within it. */
+  double live_bytes;
+  double peak_bytes;
+} MemProfileTimelinePoint;
+
+/* Statistics per block name. Names are compared by content and copied, block names are not
+ * always static strings. */
+typedef struct MemProfileName {
+  MemProfileEntry entry;
+  /* Stored after the statistics. */
+  const char *name;
+  double alloc_count;
+  double alloc_bytes;
+  double live_bytes;
+  double peak_bytes;
+  /* Seconds since the profiler was enabled. */
+  double peak_time;
+  /* Intervals in time order, see #profile_timeline_add. */
+  MemProfileTimelinePoint *timeline;
+  unsigned int timeline_len;
+  unsigned int timeline_len_alloc;
+  double timeline_interval;
+} MemProfileName;
+
+typedef struct MemProfileSite {
+  MemProfileEntry entry;
+  MemProfileContext *context;
+  MemProfileName *name;
+  double alloc_count;
+  double alloc_bytes;
+  /* Set when the profiler was disabled, blocks of the site are not counted anymore. */
+  bool retired;
+} MemProfileSite;
+
+bool mem_profile_enabled = false;
+
+static struct {
+  unsigned int lock;
+  size_t sample_interval;
+  double start_time;
+  MemProfileHash contexts;
+  MemProfileHash names;
+  MemProfileHash sites;
+  double live_bytes;
+  double peak_bytes;
+  double peak_time;
+} profile = {0};
+
+static MEM_THREAD_LOCAL MemProfileContext *profile_context = NULL;
+static MEM_THREAD_LOCAL uint64_t profile_rng = 0;
+
+static void profile_lock(void)
+{
+  while (atomic_cas_u(&profile.lock, 0, 1) != 0) {
+    /* pass */
+  }
+}
+
+static void profile_unlock(void)
+{
+  atomic_cas_u(&profile.lock, 1, 0);
+}
+
+static double profile_time(void)
+{
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Uniform in [0, 1). */
+static double profile_random(void)
+{
+  if (UNLIKELY(profile_rng == 0)) {
+    profile_rng = (uint64_t)(uintptr_t)&profile_rng ^ 0x9E3779B97F4A7C15ull;
+  }
+  /* xorshift64* */
+  profile_rng ^= profile_rng >> 12;
+  profile_rng ^= profile_rng << 25;
+  profile_rng ^= profile_rng >> 27;
+  const uint64_t value = profile_rng * 0x2545F4914F6CDD1Dull;
+  return (double)(value >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static unsigned int profile_hash_ptr(const void *ptr)
+{
+  uintptr_t value = (uintptr_t)ptr;
+  value ^= value >> 17;
+  value *= 0x9E3779B1u;
+  return (unsigned int)(value ^ (value >> 15));
+}
+
+static unsigned int profile_hash_str(const char *str)
+{
+  unsigned int hash = 5381;
+  for (; *str; str++) {
+    hash = hash * 33 + (unsigned int)(unsigned char)*str;
+  }
+  return hash;
+}
+
+static void profile_hash_insert(MemProfileHash *table, MemProfileEntry *entry)
+{
+  if (table->entries_len >= table->buckets_len) {
+    const unsigned int buckets_len = table->buckets_len ? table->buckets_len * 2 : 1024;
+    MemProfileEntry **buckets = calloc(buckets_len, sizeof(*buckets));
+    for (unsigned int i = 0; i < table->buckets_len; i++) {
+      MemProfileEntry *other = table->buckets[i];
+      while (other) {
+        MemProfileEntry *next = other->next;
+        other->next = buckets[other->hash & (buckets_len - 1)];
+        buckets[other->hash & (buckets_len - 1)] = other;
+        other = next;
+      }
+    }
+    free(table->buckets);
+    table->buckets = buckets;
+    table->buckets_len = buckets_len;
+  }
+  MemProfileEntry **bucket = &table->buckets[entry->hash & (table->buckets_len - 1)];
+  entry->next = *bucket;
+  *bucket = entry;
+  table->entries_len++;
+}
+
+MEM_INLINE MemProfileEntry *profile_hash_bucket(const MemProfileHash *table, unsigned int hash)
+{
+  return table->buckets_len ? table->buckets[hash & (table->buckets_len - 1)] : NULL;
+}
+
+static MemProfileContext *profile_context_ensure(MemProfileContext *parent, const char *name)
+{
+  const unsigned int hash = profile_hash_str(name) ^ profile_hash_ptr(parent);
+  for (MemProfileEntry *entry = profile_hash_bucket(&profile.contexts, hash); entry;
+       entry = entry->next) {
+    MemProfileContext *context = (MemProfileContext *)entry;
+    if (entry->hash == hash && context->parent == parent && strcmp(context->name, name) == 0) {
+      return context;
+    }
+  }
+
+  const size_t name_len = strlen(name);
+  MemProfileContext *context = malloc(sizeof(*context) + name_len + 1);
+  context->entry.hash = hash;
+  context->parent = parent;
+  memcpy(context + 1, name, name_len + 1);
+  context->name = (const char *)(context + 1);
+  profile_hash_insert(&profile.contexts, &context->entry);
+  return context;
+}
+
+static MemProfileName *profile_name_ensure(const char *name)
+{
+  const unsigned int hash = profile_hash_str(name);
+  for (MemProfileEntry *entry = profile_hash_bucket(&profile.names, hash); entry;
+       entry = entry->next) {
+    MemProfileName *profile_name = (MemProfileName *)entry;
+    if (entry->hash == hash && strcmp(profile_name->name, name) == 0) {
+      return profile_name;
+    }
+  }
+
+  const size_t name_len = strlen(name);
+  MemProfileName *profile_name = calloc(1, sizeof(*profile_name) + name_len + 1);
+  profile_name->entry.hash = hash;
+  memcpy(profile_name + 1, name, name_len + 1);
+  profile_name->name = (const char *)(profile_name + 1);
+  profile_name->timeline_interval = PROFILE_TIMELINE_INTERVAL;
+  profile_hash_insert(&profile.names, &profile_name->entry);
+  return profile_name;
+}
+
+static MemProfileSite *profile_site_ensure(MemProfileContext *context, const char *name)
+{
+  MemProfileName *profile_name = profile_name_ensure(name);
+  const unsigned int hash = profile_hash_ptr(profile_name) ^ (profile_hash_ptr(context) * 31);
+  for (MemProfileEntry *entry = profile_hash_bucket(&profile.sites, hash); entry;
+       entry = entry->next) {
+    MemProfileSite *site = (MemProfileSite *)entry;
+    if (site->context == context && site->name == profile_name) {
+      return site;
+    }
+  }
+
+  MemProfileSite *site = calloc(1, sizeof(*site));
+  site->entry.hash = hash;
+  site->context = context;
+  site->name = profile_name;
+  profile_hash_insert(&profile.sites, &site->entry);
+  return site;
+}
+
+/* Inverse of the probability of a block to be sampled. */
+static double profile_sample_weight(size_t len)
+{
+  if (len >= profile.sample_interval || len == 0) {
+    return 1.0;
+  }
+  return (double)profile.sample_interval / (double)len;
+}
+
+/* Merge pairs of intervals, doubling their length. */
+static void profile_timeline_compact(MemProfileName *profile_name)
+{
+  profile_name->timeline_interval *= 2.0;
+  const double interval = profile_name->timeline_interval;
+  unsigned int len = 0;
+  for (unsigned int i = 0; i < profile_name->timeline_len; i++) {
+    MemProfileTimelinePoint point = profile_name->timeline[i];
+    point.time = (double)(uint64_t)(point.time / interval) * interval;
+    MemProfileTimelinePoint *prev = len ? &profile_name->timeline[len - 1] : NULL;
+    if (prev && prev->time == point.time) {
+      prev->alloc_bytes += point.alloc_bytes;
+      prev->live_bytes = point.live_bytes;
+      if (point.peak_bytes > prev->peak_bytes) {
+        prev->peak_bytes = point.peak_bytes;
+      }
+    }
+    else {
+      profile_name->timeline[len++] = point;
+    }
+  }
+  profile_name->timeline_len = len;
+}
+
+/* Record the live bytes of the name after allocating or freeing at `time`. */
+static void profile_timeline_add(MemProfileName *profile_name, double time, double alloc_bytes)
+{
+  for (;;) {
+    const double interval = profile_name->timeline_interval;
+    const double interval_time = (double)(uint64_t)(time / interval) * interval;
+    MemProfileTimelinePoint *last = profile_name->timeline_len ?
+                                        &profile_name->timeline[profile_name->timeline_len - 1] :
+                                        NULL;
+    /* Threads may get the time in a different order than they take the lock. */
+    if (last && interval_time <= last->time) {
+      last->alloc_bytes += alloc_bytes;
+      last->live_bytes = profile_name->live_bytes;
+      if (profile_name->live_bytes > last->peak_bytes) {
+        last->peak_bytes = profile_name->live_bytes;
+      }
+      return;
+    }
+    if (profile_name->timeline_len == PROFILE_TIMELINE_LEN) {
+      profile_timeline_compact(profile_name);
+      continue;
+    }
+    if (profile_name->timeline_len == profile_name->timeline_len_alloc) {
+      profile_name->timeline_len_alloc = profile_name->timeline_len_alloc ?
+                                             profile_name->timeline_len_alloc * 2 :
+                                             16;
+      profile_name->timeline = realloc(profile_name->timeline,
+                                       sizeof(*profile_name->timeline) *
+                                           profile_name->timeline_len_alloc);
+    }
+    MemProfileTimelinePoint *point = &profile_name->timeline[profile_name->timeline_len++];
+    point->time = interval_time;
+    point->alloc_bytes = alloc_bytes;
+    point->live_bytes = profile_name->live_bytes;
+    point->peak_bytes = profile_name->live_bytes;
+    return;
+  }
+}
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name Allocator Hooks
+ * \{ */
+
+MemProfileSite *mem_profile_alloc(size_t len, const char *name)
+{
+  if (len < profile.sample_interval &&
+      profile_random() * (double)profile.sample_interval >= (double)len) {
+    return NULL;
+  }
+
+  const double weight = profile_sample_weight(len);
+  const double bytes = weight * (double)len;
+
+  profile_lock();
+  const double time = profile_time() - profile.start_time;
+  MemProfileSite *site = profile_site_ensure(profile_context, name);
+  MemProfileName *profile_name = site->name;
+  site->alloc_count += weight;
+  site->alloc_bytes += bytes;
+  profile_name->alloc_count += weight;
+  profile_name->alloc_bytes += bytes;
+  profile_name->live_bytes += bytes;
+  profile.live_bytes += bytes;
+  if (profile_name->live_bytes > profile_name->peak_bytes) {
+    profile_name->peak_bytes = profile_name->live_bytes;
+    profile_name->peak_time = time;
+  }
+  if (profile.live_bytes > profile.peak_bytes) {
+    profile.peak_bytes = profile.live_bytes;
+    profile.peak_time = time;
+  }
+  profile_timeline_add(profile_name, time, bytes);
+  profile_unlock();
+
+  return site;
+}
+
+void mem_profile_free(MemProfileSite *site, size_t len)
+{
+  const double bytes = profile_sample_weight(len) * (double)len;
+
+  profile_lock();
+  if (!site->retired) {
+    site->name->live_bytes -= bytes;
+    profile.live_bytes -= bytes;
+    profile_timeline_add(site->name, profile_time() - profile.start_time, 0.0);
+  }
+  profile_unlock();
+}
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name Public API
+ * \{ */
+
+bool MEM_profile_enable(size_t sample_interval)
+{
+  if (MEM_allocN_len != MEM_guarded_allocN_len) {
+    return false;
+  }
+  profile.sample_interval = sample_interval;
+  profile.start_time = profile_time();
+  mem_profile_enabled = true;
+  return true;
+}
+
+void MEM_profile_disable(void)
+{
+  profile_lock();
+  mem_profile_enabled = false;
+  /* Sampled blocks may still be freed, keep their sites. */
+  for (unsigned int i = 0; i < profile.sites.buckets_len; i++) {
+    for (MemProfileEntry *entry = profile.sites.buckets[i]; entry; entry = entry->next) {
+      ((MemProfileSite *)entry)->retired = true;
+    }
+  }
+  for (unsigned int i = 0; i < profile.names.buckets_len; i++) {
+    MemProfileEntry *entry = profile.names.buckets[i];
+    while (entry) {
+      MemProfileEntry *next = entry->next;
+      free(((MemProfileName *)entry)->timeline);
+      free(entry);
+      entry = next;
+    }
+  }
+  free(profile.names.buckets);
+  free(profile.sites.buckets);
+  memset(&profile.names, 0, sizeof(profile.names));
+  memset(&profile.sites, 0, sizeof(profile.sites));
+  profile.live_bytes = 0.0;
+  profile.peak_bytes = 0.0;
+  profile.peak_time = 0.0;
+  profile_unlock();
+}
+
+bool MEM_profile_is_enabled(void)
+{
+  return mem_profile_enabled;
+}
+
+void MEM_profile_context_begin(const char *name)
+{
+  if (!mem_profile_enabled) {
+    return;
+  }
+  profile_lock();
+  profile_context = profile_context_ensure(profile_context, name);
+  profile_unlock();
+}
+
+void MEM_profile_context_end(void)
+{
+  if (!mem_profile_enabled) {
+    return;
+  }
+  assert(profile_context != NULL);
+  profile_context = profile_context->parent;
+}
+
+static int profile_name_compare(const void *a, const void *b)
+{
+  const double peak_a = (*(const MemProfileName **)a)->peak_bytes;
+  const double peak_b = (*(const MemProfileName **)b)->peak_bytes;
+  return (peak_a < peak_b) - (peak_a > peak_b);
+}
+
+void MEM_profile_print_stats(void)
+{
+  if (!mem_profile_enabled) {
+    return;
+  }
+
+  profile_lock();
+  const double duration = profile_time() - profile.start_time;
+  MemProfileName **names = malloc(sizeof(*names) * (profile.names.entries_len + 1));
+  unsigned int names_len = 0;
+  for (unsigned int i = 0; i < profile.names.buckets_len; i++) {
+    for (MemProfileEntry *entry = profile.names.buckets[i]; entry; entry = entry->next) {
+      names[names_len++] = (MemProfileName *)entry;
+    }
+  }
+  qsort(names, names_len, sizeof(*names), profile_name_compare);
+
+  printf("\nAllocation profile over %.2fs, sample interval " SIZET_FORMAT " bytes:\n",
+         duration,
+         SIZET_ARG(profile.sample_interval));
+  printf("peak live: %.3f MB at %.2fs, live: %.3f MB\n",
+         profile.peak_bytes / (1024.0 * 1024.0),
+         profile.peak_time,
+         profile.live_bytes / (1024.0 * 1024.0));
+  printf(" %12s %12s %12s %12s %10s  %s\n",
+         "allocs",
+         "alloc MB",
+         "live MB",
+         "peak MB",
+         "peak at s",
+         "name");
+  for (unsigned int i = 0; i < names_len; i++) {
+    const MemProfileName *name = names[i];
+    printf(" %12.0f %12.3f %12.3f %12.3f %10.2f  %s\n",
+           name->alloc_count,
+           name->alloc_bytes / (1024.0 * 1024.0),
+           name->live_bytes / (1024.0 * 1024.0),
+           name->peak_bytes / (1024.0 * 1024.0),
+           name->peak_time,
+           name->name);
+  }
+  profile_unlock();
+
+  free(names);
+}
+
+/* Frames are separated by ';' and the count by the last space. */
+static void profile_write_frame(FILE *file, const char *name)
+{
+  for (; *name; name++) {
+    fputc((*name == ';' || *name == '\n') ? ':' : *name, file);
+  }
+}
+
+static void profile_write_context(FILE *file, const MemProfileContext *context)
+{
+  if (context == NULL) {
+    return;
+  }
+  profile_write_context(file, context->parent);
+  profile_write_frame(file, context->name);
+  fputc(';', file);
+}
+
+bool MEM_profile_write(const char *filepath)
+{
+  if (!mem_profile_enabled) {
+    return false;
+  }
+  FILE *file = fopen(filepath, "w");
+  if (file == NULL) {
+    return false;
+  }
+
+  profile_lock();
+  for (unsigned int i = 0; i < profile.sites.buckets_len; i++) {
+    for (MemProfileEntry *entry = profile.sites.buckets[i]; entry; entry = entry->next) {
+      const MemProfileSite *site = (const MemProfileSite *)entry;
+      profile_write_context(file, site->context);
+      profile_write_frame(file, site->name->name);
+      fprintf(file, " %.0f\n", site->alloc_bytes);
+    }
+  }
+  profile_unlock();
+
+  return fclose(file) == 0;
+}
+
+bool MEM_profile_write_timeline(const char *filepath)
+{
+  if (!mem_profile_enabled) {
+    return false;
+  }
+  FILE *file = fopen(filepath, "w");
+  if (file == NULL) {
+    return false;
+  }
+
+  fputs("time,name,alloc_bytes,live_bytes,peak_bytes\n", file);
+  profile_lock();
+  for (unsigned int i = 0; i < profile.names.buckets_len; i++) {
+    for (MemProfileEntry *entry = profile.names.buckets[i]; entry; entry = entry->next) {
+      const MemProfileName *name = (const MemProfileName *)entry;
+      for (unsigned int j = 0; j < name->timeline_len; j++) {
+        const MemProfileTimelinePoint *point = &name->timeline[j];
+        fprintf(file, "%.3f,\"", point->time);
+        for (const char *c = name->name; *c; c++) {
+          fputc((*c == '"' || *c == '\n') ? '\'' : *c, file);
+        }
+        fprintf(file,
+                "\",%.0f,%.0f,%.0f\n",
+                point->alloc_bytes,
+                point->live_bytes,
+                point->peak_bytes);
+      }
+    }
+  }
+  profile_unlock();
+
+  return fclose(file) == 0;
+}
+
+/** \} */
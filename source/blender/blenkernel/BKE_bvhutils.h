@@ -248,6 +248,9 @@ bool bvhcache_has_tree(const BVHCache *cache, const BVHTree *tree);
 void bvhcache_insert(BVHCache **cache_p, BVHTree *tree, int type);
 void bvhcache_free(BVHCache **cache_p);
 
+BVHCache *bvhcache_detach(struct Mesh *mesh);
+void bvhcache_reuse_deformed(BVHCache **cache_p, struct Mesh *mesh);
+
 #ifdef __cplusplus
 }
 #endif
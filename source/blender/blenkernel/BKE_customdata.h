@@ -73,6 +73,11 @@ typedef enum eCDAllocType {
   CD_REFERENCE = 3,
   /** Do a full copy of all layers, only allowed if source has same number of elements. */
   CD_DUPLICATE = 4,
+  /** Share data of all layers, set layer flag SHARED on the destination. The source keeps owning
+   * the data. Either side duplicates it before writing, by
+   * #CustomData_duplicate_referenced_layer, other in-place writes are seen by both.
+   * Layers which are references already are duplicated instead. */
+  CD_SHARED = 5,
 } eCDAllocType;
 
 #define CD_TYPE_AS_MASK(_type) (CustomDataMask)((CustomDataMask)1 << (CustomDataMask)(_type))
@@ -217,7 +222,8 @@ bool CustomData_has_layer(const struct CustomData *data, int type);
 int CustomData_number_of_layers(const struct CustomData *data, int type);
 int CustomData_number_of_layers_typemask(const struct CustomData *data, CustomDataMask mask);
 
-/* duplicate data of a layer with flag NOFREE, and remove that flag.
+/* duplicate data of a layer with flag NOFREE or SHARED, and remove that flag.
+ * a layer sharing its data with SHARED layers gets a copy of its own.
  * returns the layer data */
 void *CustomData_duplicate_referenced_layer(struct CustomData *data,
                                             const int type,
@@ -372,7 +378,9 @@ void CustomData_bmesh_set_n(
  */
 void CustomData_bmesh_set_layer_n(struct CustomData *data, void *block, int n, const void *source);
 
-/* set the pointer of to the first layer of type. the old data is not freed.
+/* set the pointer of to the first layer of type. the old data is not freed, unless the layer
+ * was the last one sharing it. data shared with other layers must be duplicated before taking it
+ * over, see #CustomData_duplicate_referenced_layer.
  * returns the value of ptr if the layer is found, NULL otherwise
  */
 void *CustomData_set_layer(const struct CustomData *data, int type, void *ptr);
@@ -446,6 +454,10 @@ void CustomData_bmesh_update_active_layers(struct CustomData *fdata, struct Cust
 void CustomData_bmesh_do_versions_update_active_layers(struct CustomData *fdata,
                                                        struct CustomData *ldata);
 void CustomData_bmesh_init_pool(struct CustomData *data, int totelem, const char htype);
+void CustomData_bmesh_init_pool_ex(struct CustomData *data,
+                                   int totelem,
+                                   const char htype,
+                                   const int mempool_flag);
 
 #ifndef NDEBUG
 bool CustomData_from_bmeshpoly_test(CustomData *fdata, CustomData *ldata, bool fallback);
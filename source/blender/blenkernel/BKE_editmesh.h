@@ -84,8 +84,29 @@ typedef struct BMEditMesh {
    */
   char needs_flush_to_id;
 
+  /** Whether #undo_cd_dirty_mask can be used, see #eEditMeshUndoDirtyState. */
+  char undo_cd_dirty_state;
+  /** Custom-data layers changed since the last undo push, see #EDBM_undo_tag_cd_dirty. */
+  CustomData_MeshMasks undo_cd_dirty_mask;
+  /**
+   * Session UUID of the undo mesh this edit-mesh was last stored to or restored from,
+   * zero when unknown. Owned by the edit-mesh undo system, the undo mesh may have been freed
+   * since, so it is looked up by this ID rather than by pointer.
+   */
+  unsigned int undo_mesh_ref_uuid;
+
 } BMEditMesh;
 
+/** #BMEditMesh.undo_cd_dirty_state, reset on each undo push. */
+typedef enum eEditMeshUndoDirtyState {
+  /** Changes since the last undo push are unknown, all layers are stored. */
+  EM_UNDO_CD_DIRTY_UNKNOWN = 0,
+  /** #BMEditMesh.undo_cd_dirty_mask covers all changes since the last undo push. */
+  EM_UNDO_CD_DIRTY_MASK = 1,
+  /** Changed in an unknown way (even if layers were tagged), all layers are stored. */
+  EM_UNDO_CD_DIRTY_ALL = 2,
+} eEditMeshUndoDirtyState;
+
 /* editmesh.c */
 void BKE_editmesh_looptri_calc(BMEditMesh *em);
 BMEditMesh *BKE_editmesh_create(BMesh *bm, const bool do_tessellate);
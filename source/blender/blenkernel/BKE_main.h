@@ -104,6 +104,11 @@ typedef struct Main {
    * instead do a complete full re-read/update from stored memfile.
    */
   char use_memfile_full_barrier;
+  /**
+   * Main was read from the file at `name` and no depsgraph relations were tagged for update
+   * since, so relations built for the same file can be reused from the depsgraph build cache.
+   */
+  char use_depsgraph_build_cache;
 
   BlendThumbnail *blen_thumb;
 
@@ -860,6 +860,24 @@ static void mesh_calc_finalize(const Mesh *mesh_input, Mesh *mesh_eval)
   mesh_eval->edit_mesh = mesh_input->edit_mesh;
 }
 
+typedef struct MeshCalcSharedNormalsData {
+  Mesh *mesh_input;
+  const CustomData_MeshMasks *final_datamask;
+  bool sculpt_dyntopo;
+} MeshCalcSharedNormalsData;
+
+/* Evaluate a mesh without modifiers shared by all its users, called with its mutex locked. */
+static void mesh_calc_shared_normals_isolated(void *userdata)
+{
+  MeshCalcSharedNormalsData *data = userdata;
+  Mesh *mesh_input = data->mesh_input;
+  Mesh *mesh_final = BKE_mesh_copy_for_eval(mesh_input, true);
+  mesh_calc_modifier_final_normals(
+      mesh_input, data->final_datamask, data->sculpt_dyntopo, mesh_final);
+  mesh_calc_finalize(mesh_input, mesh_final);
+  mesh_input->runtime.mesh_eval = mesh_final;
+}
+
 static void mesh_calc_modifiers(struct Depsgraph *depsgraph,
                                 Scene *scene,
                                 Object *ob,
@@ -1335,10 +1353,10 @@ static void mesh_calc_modifiers(struct Depsgraph *depsgraph,
       BLI_assert(runtime->eval_mutex != NULL);
       BLI_mutex_lock(runtime->eval_mutex);
       if (runtime->mesh_eval == NULL) {
-        mesh_final = BKE_mesh_copy_for_eval(mesh_input, true);
-        mesh_calc_modifier_final_normals(mesh_input, &final_datamask, sculpt_dyntopo, mesh_final);
-        mesh_calc_finalize(mesh_input, mesh_final);
-        runtime->mesh_eval = mesh_final;
+        /* Normals are computed in parallel, don't let this thread run tasks of other objects
+         * using the same mesh while waiting, they would lock the same mutex. */
+        MeshCalcSharedNormalsData data = {mesh_input, &final_datamask, sculpt_dyntopo};
+        BLI_task_isolate(mesh_calc_shared_normals_isolated, &data);
       }
       BLI_mutex_unlock(runtime->eval_mutex);
     }
@@ -1749,6 +1767,14 @@ static void mesh_build_data(struct Depsgraph *depsgraph,
    * they aren't cleaned up properly on mode switch, causing crashes, e.g T58150. */
   BLI_assert(ob->id.tag & LIB_TAG_COPIED_ON_WRITE);
 
+  /* Keep the BVH trees of the previous evaluation, to refit them in case only the vertex
+   * positions changed (deforming modifiers, shape keys, animated armatures...). */
+  BVHCache *bvh_cache_prev = NULL;
+  if (ob->runtime.data_eval != NULL && ob->runtime.is_data_eval_owned &&
+      GS(ob->runtime.data_eval->name) == ID_ME) {
+    bvh_cache_prev = bvhcache_detach((Mesh *)ob->runtime.data_eval);
+  }
+
   BKE_object_free_derived_caches(ob);
   if (DEG_is_active(depsgraph)) {
     BKE_sculpt_update_object_before_eval(ob);
@@ -1786,6 +1812,10 @@ static void mesh_build_data(struct Depsgraph *depsgraph,
   const bool is_mesh_eval_owned = (mesh_eval != mesh->runtime.mesh_eval);
   BKE_object_eval_assign_data(ob, &mesh_eval->id, is_mesh_eval_owned);
 
+  if (bvh_cache_prev != NULL) {
+    bvhcache_reuse_deformed(&bvh_cache_prev, is_mesh_eval_owned ? mesh_eval : NULL);
+  }
+
   ob->runtime.mesh_deform_eval = mesh_deform_eval;
   ob->runtime.last_data_mask = *dataMask;
   ob->runtime.last_need_mapping = need_mapping;
@@ -451,6 +451,7 @@ int BKE_blendfile_read(bContext *C,
       bfd = NULL;
     }
     else {
+      bfd->main->use_depsgraph_build_cache = true;
       setup_app_blend_file_data(C, bfd, filepath, params, reports);
       BLO_blendfiledata_free(bfd);
       success = true;
@@ -29,8 +29,10 @@
 #include "DNA_mesh_types.h"
 #include "DNA_meshdata_types.h"
 
+#include "BLI_hash_mm2a.h"
 #include "BLI_linklist.h"
 #include "BLI_math.h"
+#include "BLI_task.h"
 #include "BLI_threads.h"
 #include "BLI_utildefines.h"
 
@@ -43,6 +45,9 @@
 
 static ThreadRWMutex cache_rwlock = BLI_RWLOCK_INITIALIZER;
 
+static bool bvhcache_has_deformed(const BVHCache *cache, int type);
+static bool bvhcache_refit_deformed(BVHCache **cache_p, Mesh *mesh, int type, BVHTree **r_tree);
+
 /* -------------------------------------------------------------------- */
 /** \name Local Callbacks
  * \{ */
@@ -1319,8 +1324,16 @@ BVHTree *BKE_bvhtree_from_mesh_get(struct BVHTreeFromMesh *data,
 
   BLI_rw_mutex_lock(&cache_rwlock, THREAD_LOCK_READ);
   bool is_cached = bvhcache_find(*bvh_cache, bvh_cache_type, &tree);
+  const bool is_deformed = !is_cached && bvhcache_has_deformed(*bvh_cache, bvh_cache_type);
   BLI_rw_mutex_unlock(&cache_rwlock);
 
+  if (is_deformed) {
+    /* Refit the tree of the previous evaluation, unless the topology changed. */
+    BLI_rw_mutex_lock(&cache_rwlock, THREAD_LOCK_WRITE);
+    is_cached = bvhcache_refit_deformed(bvh_cache, mesh, bvh_cache_type, &tree);
+    BLI_rw_mutex_unlock(&cache_rwlock);
+  }
+
   if (is_cached && tree == NULL) {
     memset(data, 0, sizeof(*data));
     return tree;
@@ -1620,12 +1633,70 @@ void free_bvhtree_from_mesh(struct BVHTreeFromMesh *data)
 /** \name BVHCache
  * \{ */
 
+/**
+ * Identifies the topology of a mesh. The element counts are compared exactly, so a hash
+ * collision can never make a refit use elements out of range.
+ */
+typedef struct BVHCacheTopology {
+  int totvert, totedge, totface, totpoly, totloop;
+  uint hash;
+} BVHCacheTopology;
+
 typedef struct BVHCacheItem {
   int type;
   BVHTree *tree;
 
+  /** Cost of the tree when it was built, see #BLI_bvhtree_cost. */
+  float cost_build;
+  /** Topology of the mesh the tree was built for, see #bvhcache_detach. */
+  BVHCacheTopology topology;
+  bool has_topology;
+  /** The tree was built for the mesh evaluated before, it must be refit before use. */
+  bool is_deformed;
+  /** The topology of the mesh is known to match #BVHCacheItem.topology. */
+  bool is_topology_checked;
 } BVHCacheItem;
 
+/* Rebuild refit trees once their cost grows this much compared to the cost after building. */
+#define BVHCACHE_REFIT_COST_FACTOR 1.5f
+
+/**
+ * frees a bvhcache
+ */
+static void bvhcacheitem_free(void *_item)
+{
+  BVHCacheItem *item = (BVHCacheItem *)_item;
+
+  BLI_bvhtree_free(item->tree);
+  MEM_freeN(item);
+}
+
+static bool bvhcache_has_deformed(const BVHCache *cache, int type)
+{
+  while (cache) {
+    const BVHCacheItem *item = cache->link;
+    if (item->type == type && item->is_deformed) {
+      return true;
+    }
+    cache = cache->next;
+  }
+  return false;
+}
+
+static void bvhcache_remove_deformed(BVHCache **cache_p, int type)
+{
+  for (LinkNode **link_p = cache_p; *link_p; link_p = &(*link_p)->next) {
+    BVHCacheItem *item = (*link_p)->link;
+    if (item->type == type && item->is_deformed) {
+      LinkNode *link = *link_p;
+      *link_p = link->next;
+      bvhcacheitem_free(item);
+      MEM_freeN(link);
+      return;
+    }
+  }
+}
+
 /**
  * Queries a bvhcache for the cache bvhtree of the request type
  */
@@ -1633,7 +1704,7 @@ bool bvhcache_find(const BVHCache *cache, int type, BVHTree **r_tree)
 {
   while (cache) {
     const BVHCacheItem *item = cache->link;
-    if (item->type == type) {
+    if (item->type == type && !item->is_deformed) {
       *r_tree = item->tree;
       return true;
     }
@@ -1668,23 +1739,271 @@ void bvhcache_insert(BVHCache **cache_p, BVHTree *tree, int type)
 
   BLI_assert(bvhcache_find(*cache_p, type, &(BVHTree *){0}) == false);
 
-  item = MEM_mallocN(sizeof(BVHCacheItem), "BVHCacheItem");
+  /* A tree of the mesh evaluated before which wasn't refit, replace it. */
+  bvhcache_remove_deformed(cache_p, type);
+
+  item = MEM_callocN(sizeof(BVHCacheItem), "BVHCacheItem");
 
   item->type = type;
   item->tree = tree;
+  item->cost_build = tree ? BLI_bvhtree_cost(tree) : 0.0f;
 
   BLI_linklist_prepend(cache_p, item);
 }
 
+static void bvhcache_topology_get(const Mesh *mesh, BVHCacheTopology *r_topology)
+{
+  r_topology->totvert = mesh->totvert;
+  r_topology->totedge = mesh->totedge;
+  r_topology->totface = mesh->totface;
+  r_topology->totpoly = mesh->totpoly;
+  r_topology->totloop = mesh->totloop;
+
+  BLI_HashMurmur2A mm2;
+  BLI_hash_mm2a_init(&mm2, 0);
+  if (mesh->medge) {
+    BLI_hash_mm2a_add(&mm2, (const uchar *)mesh->medge, sizeof(MEdge) * (size_t)mesh->totedge);
+  }
+  if (mesh->mface) {
+    BLI_hash_mm2a_add(&mm2, (const uchar *)mesh->mface, sizeof(MFace) * (size_t)mesh->totface);
+  }
+  if (mesh->mpoly) {
+    BLI_hash_mm2a_add(&mm2, (const uchar *)mesh->mpoly, sizeof(MPoly) * (size_t)mesh->totpoly);
+  }
+  if (mesh->mloop) {
+    BLI_hash_mm2a_add(&mm2, (const uchar *)mesh->mloop, sizeof(MLoop) * (size_t)mesh->totloop);
+  }
+  r_topology->hash = BLI_hash_mm2a_end(&mm2);
+}
+
+static bool bvhcache_topology_equals(const BVHCacheTopology *a, const BVHCacheTopology *b)
+{
+  return (a->totvert == b->totvert && a->totedge == b->totedge && a->totface == b->totface &&
+          a->totpoly == b->totpoly && a->totloop == b->totloop && a->hash == b->hash);
+}
+
 /**
- * frees a bvhcache
+ * Takes the cache of an evaluated mesh which is about to be freed,
+ * to reuse its trees for the next evaluation with #bvhcache_reuse_deformed.
  */
-static void bvhcacheitem_free(void *_item)
+BVHCache *bvhcache_detach(Mesh *mesh)
 {
-  BVHCacheItem *item = (BVHCacheItem *)_item;
+  BVHCache *cache = mesh->runtime.bvh_cache;
+  mesh->runtime.bvh_cache = NULL;
+
+  bool has_topology = false;
+  BVHCacheTopology topology;
+  for (LinkNode *link = cache; link; link = link->next) {
+    BVHCacheItem *item = link->link;
+    if (item->has_topology && (!item->is_deformed || item->is_topology_checked)) {
+      continue;
+    }
+    /* Trees built for this mesh, or reused but never checked against it,
+     * the topology of the mesh is only hashed once. */
+    if (!has_topology) {
+      bvhcache_topology_get(mesh, &topology);
+      has_topology = true;
+    }
+    if (item->is_deformed && !bvhcache_topology_equals(&item->topology, &topology)) {
+      /* Never checked, the tree doesn't match this mesh. */
+      item->has_topology = false;
+    }
+    else {
+      item->topology = topology;
+      item->has_topology = true;
+    }
+  }
+  return cache;
+}
 
-  BLI_bvhtree_free(item->tree);
-  MEM_freeN(item);
+/**
+ * Moves the trees detached from the mesh evaluated before to the cache of `mesh`,
+ * they're refit when used, or rebuilt in case the topology of the meshes differs.
+ */
+void bvhcache_reuse_deformed(BVHCache **cache_p, Mesh *mesh)
+{
+  BVHCache *cache = *cache_p;
+  *cache_p = NULL;
+
+  if (mesh == NULL || mesh->runtime.bvh_cache != NULL) {
+    bvhcache_free(&cache);
+    return;
+  }
+
+  BVHCache *cache_reuse = NULL;
+  while (cache) {
+    LinkNode *link = cache;
+    BVHCacheItem *item = link->link;
+    cache = link->next;
+
+    const bool is_editmesh = ELEM(
+        item->type, BVHTREE_FROM_EM_VERTS, BVHTREE_FROM_EM_EDGES, BVHTREE_FROM_EM_LOOPTRI);
+    if (is_editmesh || item->tree == NULL || !item->has_topology) {
+      bvhcacheitem_free(item);
+      MEM_freeN(link);
+      continue;
+    }
+    item->is_deformed = true;
+    item->is_topology_checked = false;
+    BLI_linklist_prepend_nlink(&cache_reuse, item, link);
+  }
+
+  BLI_rw_mutex_lock(&cache_rwlock, THREAD_LOCK_WRITE);
+  mesh->runtime.bvh_cache = cache_reuse;
+  BLI_rw_mutex_unlock(&cache_rwlock);
+}
+
+typedef struct BVHCacheRefitData {
+  const MVert *vert;
+  const MEdge *edge;
+  const MFace *face;
+  const MLoop *loop;
+  const MLoopTri *looptri;
+} BVHCacheRefitData;
+
+static int bvhcache_refit_verts_cb(void *userdata, int index, float r_co[BVH_REFIT_POINTS_MAX][3])
+{
+  const BVHCacheRefitData *data = userdata;
+  copy_v3_v3(r_co[0], data->vert[index].co);
+  return 1;
+}
+
+static int bvhcache_refit_edges_cb(void *userdata, int index, float r_co[BVH_REFIT_POINTS_MAX][3])
+{
+  const BVHCacheRefitData *data = userdata;
+  const MEdge *edge = &data->edge[index];
+  copy_v3_v3(r_co[0], data->vert[edge->v1].co);
+  copy_v3_v3(r_co[1], data->vert[edge->v2].co);
+  return 2;
+}
+
+static int bvhcache_refit_faces_cb(void *userdata, int index, float r_co[BVH_REFIT_POINTS_MAX][3])
+{
+  const BVHCacheRefitData *data = userdata;
+  const MFace *face = &data->face[index];
+  copy_v3_v3(r_co[0], data->vert[face->v1].co);
+  copy_v3_v3(r_co[1], data->vert[face->v2].co);
+  copy_v3_v3(r_co[2], data->vert[face->v3].co);
+  if (face->v4) {
+    copy_v3_v3(r_co[3], data->vert[face->v4].co);
+    return 4;
+  }
+  return 3;
+}
+
+static int bvhcache_refit_looptri_cb(void *userdata,
+                                     int index,
+                                     float r_co[BVH_REFIT_POINTS_MAX][3])
+{
+  const BVHCacheRefitData *data = userdata;
+  const MLoopTri *lt = &data->looptri[index];
+  copy_v3_v3(r_co[0], data->vert[data->loop[lt->tri[0]].v].co);
+  copy_v3_v3(r_co[1], data->vert[data->loop[lt->tri[1]].v].co);
+  copy_v3_v3(r_co[2], data->vert[data->loop[lt->tri[2]].v].co);
+  return 3;
+}
+
+typedef struct BVHCacheRefitTaskData {
+  BVHTree *tree;
+  BVHTree_RefitCallback callback;
+  BVHCacheRefitData *data;
+} BVHCacheRefitTaskData;
+
+static void bvhcache_refit_isolated(void *userdata)
+{
+  BVHCacheRefitTaskData *task_data = userdata;
+  BLI_bvhtree_refit(task_data->tree, task_data->callback, task_data->data);
+}
+
+/**
+ * Refits the tree of the given type moved from the mesh evaluated before, the caller must hold
+ * the cache lock for writing. Returns false when the tree must be built again.
+ */
+static bool bvhcache_refit_deformed(BVHCache **cache_p, Mesh *mesh, int type, BVHTree **r_tree)
+{
+  /* Another thread may have handled the tree meanwhile. */
+  if (bvhcache_find(*cache_p, type, r_tree)) {
+    return true;
+  }
+
+  /* All deformed trees are checked at once, hashing the topology once per mesh. */
+  bool has_topology = false;
+  BVHCacheTopology topology;
+  for (LinkNode **link_p = cache_p; *link_p;) {
+    LinkNode *link = *link_p;
+    BVHCacheItem *item_iter = link->link;
+    if (item_iter->is_deformed && !item_iter->is_topology_checked) {
+      if (!has_topology) {
+        bvhcache_topology_get(mesh, &topology);
+        has_topology = true;
+      }
+      if (!bvhcache_topology_equals(&item_iter->topology, &topology)) {
+        /* The topology changed, the tree is built again when used. */
+        *link_p = link->next;
+        bvhcacheitem_free(item_iter);
+        MEM_freeN(link);
+        continue;
+      }
+      item_iter->is_topology_checked = true;
+    }
+    link_p = &link->next;
+  }
+
+  BVHCacheItem *item = NULL;
+  for (LinkNode *link = *cache_p; link; link = link->next) {
+    BVHCacheItem *item_iter = link->link;
+    if (item_iter->type == type && item_iter->is_deformed) {
+      item = item_iter;
+      break;
+    }
+  }
+  if (item == NULL) {
+    return false;
+  }
+
+  BVHCacheRefitData data = {
+      .vert = mesh->mvert,
+      .edge = mesh->medge,
+      .face = mesh->mface,
+      .loop = mesh->mloop,
+  };
+  BVHCacheRefitTaskData task_data = {.tree = item->tree, .data = &data};
+
+  switch (type) {
+    case BVHTREE_FROM_VERTS:
+    case BVHTREE_FROM_LOOSEVERTS:
+      task_data.callback = bvhcache_refit_verts_cb;
+      break;
+    case BVHTREE_FROM_EDGES:
+    case BVHTREE_FROM_LOOSEEDGES:
+      task_data.callback = bvhcache_refit_edges_cb;
+      break;
+    case BVHTREE_FROM_FACES:
+      task_data.callback = bvhcache_refit_faces_cb;
+      break;
+    case BVHTREE_FROM_LOOPTRI:
+    case BVHTREE_FROM_LOOPTRI_NO_HIDDEN:
+      data.looptri = BKE_mesh_runtime_looptri_ensure(mesh);
+      task_data.callback = bvhcache_refit_looptri_cb;
+      break;
+    default:
+      BLI_assert(false);
+      bvhcache_remove_deformed(cache_p, type);
+      return false;
+  }
+
+  /* The lock is held while refitting, don't let this thread run unrelated tasks meanwhile. */
+  BLI_task_isolate(bvhcache_refit_isolated, &task_data);
+
+  if (BLI_bvhtree_cost(item->tree) > item->cost_build * BVHCACHE_REFIT_COST_FACTOR) {
+    /* Deformed too much, queries on a new tree are faster. */
+    bvhcache_remove_deformed(cache_p, type);
+    return false;
+  }
+
+  item->is_deformed = false;
+  *r_tree = item->tree;
+  return true;
 }
 
 void bvhcache_free(BVHCache **cache_p)
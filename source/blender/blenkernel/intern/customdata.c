@@ -35,12 +35,15 @@
 #include "DNA_meshdata_types.h"
 #include "DNA_pointcloud_types.h"
 
+#include "BLI_ghash.h"
 #include "BLI_math.h"
 #include "BLI_math_color_blend.h"
 #include "BLI_mempool.h"
 #include "BLI_path_util.h"
 #include "BLI_string.h"
 #include "BLI_string_utils.h"
+#include "BLI_task.h"
+#include "BLI_threads.h"
 #include "BLI_utildefines.h"
 
 #include "BLT_translation.h"
@@ -54,6 +57,8 @@
 
 #include "bmesh.h"
 
+#include "atomic_ops.h"
+
 #include "CLG_log.h"
 
 /* only for customdata_data_transfer_interp_normal_normals */
@@ -62,6 +67,10 @@
 /* number of layers to add when growing a CustomData object */
 #define CUSTOMDATA_GROW 5
 
+/* Layer data of copy-on-write copies larger than twice this size is duplicated in chunks of this
+ * size in parallel. */
+#define CUSTOMDATA_PARALLEL_COPY_CHUNK_SIZE (1 << 20)
+
 /* ensure typemap size is ok */
 BLI_STATIC_ASSERT(ARRAY_SIZE(((CustomData *)NULL)->typemap) == CD_NUMTYPES, "size mismatch");
 
@@ -1842,6 +1851,196 @@ static CustomDataLayer *customData_add_layer__internal(CustomData *data,
                                                        void *layerdata,
                                                        int totelem,
                                                        const char *name);
+static void *customData_duplicate_referenced_layer_index(CustomData *data,
+                                                         const int layer_index,
+                                                         const int totelem);
+
+/* -------------------------------------------------------------------- */
+/* Shared layers.
+ *
+ * Layers copied with CD_SHARED use the same data array as their source. The source layer keeps
+ * owning the array and is not modified, only the copies have the CD_FLAG_SHARED flag set.
+ * Shared arrays are registered here with the number of copies using them, for as long as the
+ * arrays exist, so a registered pointer can't be reused by another allocation meanwhile:
+ * - A copy which stops using the array releases its share, the last one frees the array when
+ *   its owner released it already.
+ * - The owner checks the registry before it frees, reallocates or duplicates the array, and
+ *   leaves the array to the copies when they still use it.
+ * Copies duplicate the array before writing to it, see
+ * customData_duplicate_referenced_layer_index(). */
+
+typedef struct CustomDataSharedArray {
+  /** Number of layers sharing the array, not counting its owner. */
+  int users;
+  /** The owner of the array stopped using it, the last user frees it. */
+  bool is_orphan;
+} CustomDataSharedArray;
+
+static ThreadMutex customdata_shared_mutex = BLI_MUTEX_INITIALIZER;
+/** Shared arrays, with their #CustomDataSharedArray. */
+static GHash *customdata_shared_arrays = NULL;
+/** Number of shared arrays, to skip the lookup for layers owning their array when zero. */
+static int customdata_shared_arrays_len = 0;
+
+static void customData_shared_add_user(void *layerdata)
+{
+  CustomDataSharedArray **shared_p;
+
+  BLI_mutex_lock(&customdata_shared_mutex);
+  if (customdata_shared_arrays == NULL) {
+    customdata_shared_arrays = BLI_ghash_ptr_new(__func__);
+  }
+  if (!BLI_ghash_ensure_p(customdata_shared_arrays, layerdata, (void ***)&shared_p)) {
+    *shared_p = MEM_callocN(sizeof(**shared_p), __func__);
+    atomic_add_and_fetch_int32(&customdata_shared_arrays_len, 1);
+  }
+  (*shared_p)->users++;
+  BLI_mutex_unlock(&customdata_shared_mutex);
+}
+
+/* Returns true when the caller was the last user of an array released by its owner, and has to
+ * free it. */
+static bool customData_shared_remove_user(void *layerdata)
+{
+  CustomDataSharedArray *shared;
+  bool do_free = false;
+
+  BLI_mutex_lock(&customdata_shared_mutex);
+  shared = BLI_ghash_lookup(customdata_shared_arrays, layerdata);
+  BLI_assert(shared != NULL);
+  if (--shared->users == 0) {
+    do_free = shared->is_orphan;
+    BLI_ghash_remove(customdata_shared_arrays, layerdata, NULL, MEM_freeN);
+    if (atomic_sub_and_fetch_int32(&customdata_shared_arrays_len, 1) == 0) {
+      BLI_ghash_free(customdata_shared_arrays, NULL, NULL);
+      customdata_shared_arrays = NULL;
+    }
+  }
+  BLI_mutex_unlock(&customdata_shared_mutex);
+
+  return do_free;
+}
+
+/* Called by the layer owning the array when it stops using it. Returns true when other layers
+ * still share the array, the last of them frees it then. */
+static bool customData_shared_release_owner(void *layerdata)
+{
+  CustomDataSharedArray *shared = NULL;
+
+  if (atomic_add_and_fetch_int32(&customdata_shared_arrays_len, 0) == 0) {
+    return false;
+  }
+
+  BLI_mutex_lock(&customdata_shared_mutex);
+  if (customdata_shared_arrays != NULL) {
+    shared = BLI_ghash_lookup(customdata_shared_arrays, layerdata);
+  }
+  if (shared != NULL) {
+    BLI_assert(!shared->is_orphan);
+    shared->is_orphan = true;
+  }
+  BLI_mutex_unlock(&customdata_shared_mutex);
+
+  return shared != NULL;
+}
+
+#ifndef NDEBUG
+static bool customData_shared_has_users(void *layerdata)
+{
+  bool has_users;
+
+  BLI_mutex_lock(&customdata_shared_mutex);
+  has_users = (customdata_shared_arrays != NULL) &&
+              BLI_ghash_haskey(customdata_shared_arrays, layerdata);
+  BLI_mutex_unlock(&customdata_shared_mutex);
+
+  return has_users;
+}
+#endif
+
+static void customData_free_layer_data(int type, void *layerdata, int totelem)
+{
+  const LayerTypeInfo *typeInfo = layerType_getInfo(type);
+
+  if (typeInfo->free) {
+    typeInfo->free(layerdata, totelem, typeInfo->size);
+  }
+  MEM_freeN(layerdata);
+}
+
+/* Number of elements of a layer, for the few cases where the caller does not know it. */
+static int customData_layer_totelem_from_alloc(const CustomDataLayer *layer)
+{
+  const LayerTypeInfo *typeInfo = layerType_getInfo(layer->type);
+
+  if (layer->data == NULL || typeInfo->size == 0) {
+    return 0;
+  }
+  return (int)(MEM_allocN_len(layer->data) / typeInfo->size);
+}
+
+typedef struct CustomDataCopyChunksData {
+  const LayerTypeInfo *typeInfo;
+  const void *source;
+  void *dest;
+  int totelem;
+  int chunk_totelem;
+} CustomDataCopyChunksData;
+
+static void customData_copy_layer_data_chunk_cb(void *__restrict userdata,
+                                                const int chunk,
+                                                const TaskParallelTLS *__restrict UNUSED(tls))
+{
+  const CustomDataCopyChunksData *data = userdata;
+  const int start = chunk * data->chunk_totelem;
+  const int count = min_ii(data->chunk_totelem, data->totelem - start);
+  const size_t offset = (size_t)start * data->typeInfo->size;
+
+  if (data->typeInfo->copy) {
+    data->typeInfo->copy(
+        POINTER_OFFSET(data->source, offset), POINTER_OFFSET(data->dest, offset), count);
+  }
+  else {
+    memcpy(POINTER_OFFSET(data->dest, offset),
+           POINTER_OFFSET(data->source, offset),
+           (size_t)count * data->typeInfo->size);
+  }
+}
+
+/* Duplicate the data of a layer into an allocated array. With \a use_threading large layers are
+ * copied in parallel, only done for copy-on-write copies, which are made by their own depsgraph
+ * operation. Only types copied with memcpy are split, copy callbacks may allocate (or use
+ * non thread-safe state) per element, they're called once for the whole layer.
+ */
+static void customData_copy_layer_data(const LayerTypeInfo *typeInfo,
+                                       const void *source,
+                                       void *dest,
+                                       const int totelem,
+                                       const bool use_threading)
+{
+  CustomDataCopyChunksData data;
+  data.typeInfo = typeInfo;
+  data.source = source;
+  data.dest = dest;
+  data.totelem = totelem;
+  data.chunk_totelem = max_ii(1, CUSTOMDATA_PARALLEL_COPY_CHUNK_SIZE / max_ii(1, typeInfo->size));
+
+  if (!use_threading || typeInfo->copy != NULL ||
+      (size_t)totelem * typeInfo->size < 2 * CUSTOMDATA_PARALLEL_COPY_CHUNK_SIZE) {
+    data.chunk_totelem = totelem;
+    customData_copy_layer_data_chunk_cb(&data, 0, NULL);
+    return;
+  }
+
+  TaskParallelSettings settings;
+  BLI_parallel_range_settings_defaults(&settings);
+  settings.min_iter_per_thread = 1;
+  BLI_task_parallel_range(0,
+                          (totelem + data.chunk_totelem - 1) / data.chunk_totelem,
+                          &data,
+                          customData_copy_layer_data_chunk_cb,
+                          &settings);
+}
 
 void CustomData_update_typemap(CustomData *data)
 {
@@ -1921,6 +2120,7 @@ bool CustomData_merge(const struct CustomData *source,
       case CD_ASSIGN:
       case CD_REFERENCE:
       case CD_DUPLICATE:
+      case CD_SHARED:
         data = layer->data;
         break;
       default:
@@ -1932,8 +2132,39 @@ bool CustomData_merge(const struct CustomData *source,
       newlayer = customData_add_layer__internal(
           dest, type, CD_REFERENCE, data, totelem, layer->name);
     }
+    else if (alloctype == CD_SHARED) {
+      if (data && !(flag & CD_FLAG_NOFREE)) {
+        newlayer = customData_add_layer__internal(
+            dest, type, CD_ASSIGN, data, totelem, layer->name);
+        if (newlayer && newlayer->data == data) {
+          customData_shared_add_user(data);
+          newlayer->flag |= CD_FLAG_SHARED;
+        }
+      }
+      else if (data && totelem > 0 && layerType_getInfo(type)->size > 0) {
+        /* Referenced layers of the source are duplicated, in parallel since this is only used
+         * for copy-on-write copies. */
+        const LayerTypeInfo *typeInfo = layerType_getInfo(type);
+        void *data_copy = MEM_malloc_arrayN(
+            (size_t)totelem, typeInfo->size, layerType_getName(type));
+        customData_copy_layer_data(typeInfo, data, data_copy, totelem, true);
+        newlayer = customData_add_layer__internal(
+            dest, type, CD_ASSIGN, data_copy, totelem, layer->name);
+        if (newlayer == NULL || newlayer->data != data_copy) {
+          customData_free_layer_data(type, data_copy, totelem);
+        }
+      }
+      else {
+        newlayer = customData_add_layer__internal(
+            dest, type, CD_DUPLICATE, data, totelem, layer->name);
+      }
+    }
     else {
       newlayer = customData_add_layer__internal(dest, type, alloctype, data, totelem, layer->name);
+      if (newlayer && (alloctype == CD_ASSIGN)) {
+        /* The reference to the shared data moves to the new layer. */
+        newlayer->flag |= flag & CD_FLAG_SHARED;
+      }
     }
 
     if (newlayer) {
@@ -1952,7 +2183,7 @@ bool CustomData_merge(const struct CustomData *source,
   return changed;
 }
 
-/* NOTE: Take care of referenced layers by yourself! */
+/* NOTE: Take care of referenced layers by yourself! Shared layers are duplicated. */
 void CustomData_realloc(CustomData *data, int totelem)
 {
   int i;
@@ -1962,6 +2193,9 @@ void CustomData_realloc(CustomData *data, int totelem)
     if (layer->flag & CD_FLAG_NOFREE) {
       continue;
     }
+    /* Stop sharing the array first, the copy or the owner may still use it. */
+    customData_duplicate_referenced_layer_index(
+        data, i, customData_layer_totelem_from_alloc(layer));
     typeInfo = layerType_getInfo(layer->type);
     layer->data = MEM_reallocN(layer->data, (size_t)totelem * typeInfo->size);
   }
@@ -1984,18 +2218,19 @@ void CustomData_copy(const struct CustomData *source,
 
 static void customData_free_layer__internal(CustomDataLayer *layer, int totelem)
 {
-  const LayerTypeInfo *typeInfo;
-
   if (!(layer->flag & CD_FLAG_NOFREE) && layer->data) {
-    typeInfo = layerType_getInfo(layer->type);
-
-    if (typeInfo->free) {
-      typeInfo->free(layer->data, totelem, typeInfo->size);
+    if (layer->flag & CD_FLAG_SHARED) {
+      if (!customData_shared_remove_user(layer->data)) {
+        /* The owner or other copies still use the data. */
+        return;
+      }
     }
-
-    if (layer->data) {
-      MEM_freeN(layer->data);
+    else if (customData_shared_release_owner(layer->data)) {
+      /* Copies still use the data, the last one frees it. */
+      return;
     }
+
+    customData_free_layer_data(layer->type, layer->data, totelem);
   }
 }
 
@@ -2349,12 +2584,7 @@ static CustomDataLayer *customData_add_layer__internal(CustomData *data,
   }
 
   if (alloctype == CD_DUPLICATE && layerdata) {
-    if (typeInfo->copy) {
-      typeInfo->copy(layerdata, newlayerdata, totelem);
-    }
-    else {
-      memcpy(newlayerdata, layerdata, (size_t)totelem * typeInfo->size);
-    }
+    customData_copy_layer_data(typeInfo, layerdata, newlayerdata, totelem, false);
   }
   else if (alloctype == CD_DEFAULT) {
     if (typeInfo->set_default) {
@@ -2562,6 +2792,7 @@ static void *customData_duplicate_referenced_layer_index(CustomData *data,
                                                          const int totelem)
 {
   CustomDataLayer *layer;
+  void *shared_data = NULL;
 
   if (layer_index == -1) {
     return NULL;
@@ -2569,26 +2800,38 @@ static void *customData_duplicate_referenced_layer_index(CustomData *data,
 
   layer = &data->layers[layer_index];
 
+  if (layer->flag & CD_FLAG_SHARED) {
+    /* Duplicate it as a referenced layer, and only release the shared data afterwards, it may
+     * be freed meanwhile by its owner otherwise. */
+    shared_data = layer->data;
+    layer->flag &= ~CD_FLAG_SHARED;
+    layer->flag |= CD_FLAG_NOFREE;
+  }
+  else if (!(layer->flag & CD_FLAG_NOFREE) && layer->data &&
+           customData_shared_release_owner(layer->data)) {
+    /* The owner of a shared array writes to a copy, leaving the array to the layers sharing it
+     * which free it. */
+    layer->flag |= CD_FLAG_NOFREE;
+  }
+
   if (layer->flag & CD_FLAG_NOFREE) {
-    /* MEM_dupallocN won't work in case of complex layers, like e.g.
+    /* Plain MEM_dupallocN won't work in case of complex layers, like e.g.
      * CD_MDEFORMVERT, which has pointers to allocated data...
-     * So in case a custom copy function is defined, use it!
+     * So the layer copy function is used, which also copies large plain layers in parallel chunks.
      */
     const LayerTypeInfo *typeInfo = layerType_getInfo(layer->type);
+    void *dst_data = MEM_malloc_arrayN((size_t)totelem, typeInfo->size, "CD duplicate ref layer");
 
-    if (typeInfo->copy) {
-      void *dst_data = MEM_malloc_arrayN(
-          (size_t)totelem, typeInfo->size, "CD duplicate ref layer");
-      typeInfo->copy(layer->data, dst_data, totelem);
-      layer->data = dst_data;
-    }
-    else {
-      layer->data = MEM_dupallocN(layer->data);
-    }
-
+    /* Copy-on-write copies stop sharing the data of the original in parallel. */
+    customData_copy_layer_data(typeInfo, layer->data, dst_data, totelem, shared_data != NULL);
+    layer->data = dst_data;
     layer->flag &= ~CD_FLAG_NOFREE;
   }
 
+  if (shared_data && customData_shared_remove_user(shared_data)) {
+    customData_free_layer_data(layer->type, shared_data, totelem);
+  }
+
   return layer->data;
 }
 
@@ -2641,7 +2884,7 @@ bool CustomData_is_referenced_layer(struct CustomData *data, int type)
 
   layer = &data->layers[layer_index];
 
-  return (layer->flag & CD_FLAG_NOFREE) != 0;
+  return (layer->flag & (CD_FLAG_NOFREE | CD_FLAG_SHARED)) != 0;
 }
 
 void CustomData_free_temporary(CustomData *data, int totelem)
@@ -2829,6 +3072,10 @@ void CustomData_free_elem(CustomData *data, int index, int count)
       if (typeInfo->free) {
         size_t offset = (size_t)index * typeInfo->size;
 
+        /* The elements are shared with other layers otherwise. */
+        customData_duplicate_referenced_layer_index(
+            data, i, customData_layer_totelem_from_alloc(&data->layers[i]));
+
         typeInfo->free(POINTER_OFFSET(data->layers[i].data, offset), count, typeInfo->size);
       }
     }
@@ -3066,6 +3313,24 @@ const char *CustomData_get_layer_name(const CustomData *data, int type, int n)
   return (layer_index == -1) ? NULL : data->layers[layer_index].name;
 }
 
+static void customData_set_layer_data(CustomDataLayer *layer, void *ptr)
+{
+  if (layer->flag & CD_FLAG_SHARED) {
+    /* The layer does not own the replaced data, it only stops sharing it. */
+    if (customData_shared_remove_user(layer->data)) {
+      customData_free_layer_data(
+          layer->type, layer->data, customData_layer_totelem_from_alloc(layer));
+    }
+    layer->flag &= ~CD_FLAG_SHARED;
+  }
+  else {
+    /* The caller takes over the replaced data, which can't be left to other layers. */
+    BLI_assert((layer->flag & CD_FLAG_NOFREE) || layer->data == NULL ||
+               !customData_shared_has_users(layer->data));
+  }
+  layer->data = ptr;
+}
+
 void *CustomData_set_layer(const CustomData *data, int type, void *ptr)
 {
   /* get the layer index of the first layer of type */
@@ -3075,7 +3340,7 @@ void *CustomData_set_layer(const CustomData *data, int type, void *ptr)
     return NULL;
   }
 
-  data->layers[layer_index].data = ptr;
+  customData_set_layer_data(&data->layers[layer_index], ptr);
 
   return ptr;
 }
@@ -3088,7 +3353,7 @@ void *CustomData_set_layer_n(const struct CustomData *data, int type, int n, voi
     return NULL;
   }
 
-  data->layers[layer_index].data = ptr;
+  customData_set_layer_data(&data->layers[layer_index], ptr);
 
   return ptr;
 }
@@ -3280,7 +3545,14 @@ void CustomData_bmesh_do_versions_update_active_layers(CustomData *fdata, Custom
   }
 }
 
-void CustomData_bmesh_init_pool(CustomData *data, int totelem, const char htype)
+/**
+ * \param mempool_flag: Flags for the pool, #BLI_MEMPOOL_THREADED allows blocks to be allocated
+ * from multiple threads at once.
+ */
+void CustomData_bmesh_init_pool_ex(CustomData *data,
+                                   int totelem,
+                                   const char htype,
+                                   const int mempool_flag)
 {
   int chunksize;
 
@@ -3308,10 +3580,15 @@ void CustomData_bmesh_init_pool(CustomData *data, int totelem, const char htype)
 
   /* If there are no layers, no pool is needed just yet */
   if (data->totlayer) {
-    data->pool = BLI_mempool_create(data->totsize, totelem, chunksize, BLI_MEMPOOL_NOP);
+    data->pool = BLI_mempool_create(data->totsize, totelem, chunksize, (uint)mempool_flag);
   }
 }
 
+void CustomData_bmesh_init_pool(CustomData *data, int totelem, const char htype)
+{
+  CustomData_bmesh_init_pool_ex(data, totelem, htype, BLI_MEMPOOL_NOP);
+}
+
 bool CustomData_bmesh_merge(const CustomData *source,
                             CustomData *dest,
                             CustomDataMask mask,
@@ -3704,7 +3981,7 @@ bool CustomData_has_referenced(const struct CustomData *data)
 {
   int i;
   for (i = 0; i < data->totlayer; i++) {
-    if (data->layers[i].flag & CD_FLAG_NOFREE) {
+    if (data->layers[i].flag & (CD_FLAG_NOFREE | CD_FLAG_SHARED)) {
       return true;
     }
   }
@@ -405,6 +405,10 @@ void BKE_mesh_ensure_normals_for_display(Mesh *mesh)
     if (do_add_poly_nors_cddata) {
       poly_nors = MEM_malloc_arrayN((size_t)mesh->totpoly, sizeof(*poly_nors), __func__);
     }
+    if (do_vert_normals) {
+      /* Vertices of evaluated meshes may be referenced or shared with the original mesh. */
+      mesh->mvert = CustomData_duplicate_referenced_layer(&mesh->vdata, CD_MVERT, mesh->totvert);
+    }
 
     /* calculate poly/vert normals */
     BKE_mesh_calc_normals_poly(mesh->mvert,
@@ -433,6 +437,8 @@ void BKE_mesh_calc_normals(Mesh *mesh)
 #ifdef DEBUG_TIME
   TIMEIT_START_AVERAGED(BKE_mesh_calc_normals);
 #endif
+  /* This will just return the pointer if it wasn't a referenced layer. */
+  mesh->mvert = CustomData_duplicate_referenced_layer(&mesh->vdata, CD_MVERT, mesh->totvert);
   BKE_mesh_calc_normals_poly(mesh->mvert,
                              NULL,
                              mesh->totvert,
@@ -1408,7 +1414,7 @@ static bool loop_split_generator_check_cyclic_smooth_fan(const MLoop *mloops,
   }
 }
 
-static void loop_split_generator(TaskPool *pool, LoopSplitTaskDataCommon *common_data)
+static void loop_split_generator(TaskGroup *group, LoopSplitTaskDataCommon *common_data)
 {
   MLoopNorSpaceArray *lnors_spacearr = common_data->lnors_spacearr;
   float(*loopnors)[3] = common_data->loopnors;
@@ -1441,7 +1447,7 @@ static void loop_split_generator(TaskPool *pool, LoopSplitTaskDataCommon *common
   TIMEIT_START_AVERAGED(loop_split_generator);
 #endif
 
-  if (!pool) {
+  if (!group) {
     if (lnors_spacearr) {
       edge_vectors = BLI_stack_new(sizeof(float[3]), __func__);
     }
@@ -1502,7 +1508,7 @@ static void loop_split_generator(TaskPool *pool, LoopSplitTaskDataCommon *common
 
         //              printf("PROCESSING!\n");
 
-        if (pool) {
+        if (group) {
           if (data_idx == 0) {
             data_buff = MEM_calloc_arrayN(
                 LOOP_SPLIT_TASK_BLOCK_SIZE, sizeof(*data_buff), __func__);
@@ -1552,10 +1558,10 @@ static void loop_split_generator(TaskPool *pool, LoopSplitTaskDataCommon *common
           }
         }
 
-        if (pool) {
+        if (group) {
           data_idx++;
           if (data_idx == LOOP_SPLIT_TASK_BLOCK_SIZE) {
-            BLI_task_pool_push(pool, loop_split_worker, data_buff, true, NULL);
+            BLI_task_group_push(group, loop_split_worker, data_buff, true, NULL);
             data_idx = 0;
           }
         }
@@ -1571,8 +1577,8 @@ static void loop_split_generator(TaskPool *pool, LoopSplitTaskDataCommon *common
 
   /* Last block of data... Since it is calloc'ed and we use first NULL item as stopper,
    * everything is fine. */
-  if (pool && data_idx) {
-    BLI_task_pool_push(pool, loop_split_worker, data_buff, true, NULL);
+  if (group && data_idx) {
+    BLI_task_group_push(group, loop_split_worker, data_buff, true, NULL);
   }
 
   if (edge_vectors) {
@@ -1706,14 +1712,21 @@ void BKE_mesh_normals_loop_split(const MVert *mverts,
   else {
     TaskScheduler *task_scheduler;
     TaskPool *task_pool;
+    TaskGroup *task_group;
 
     task_scheduler = BLI_task_scheduler_get();
     task_pool = BLI_task_pool_create(task_scheduler, &common_data, TASK_PRIORITY_HIGH);
+    /* Push tasks to the queue of this thread while generating them, when called from a task
+     * this avoids the global queue, and waiting keeps the thread busy. */
+    task_group = BLI_task_group_create(task_pool, BLI_task_pool_creator_thread_id(task_pool));
 
-    loop_split_generator(task_pool, &common_data);
+    loop_split_generator(task_group, &common_data);
 
-    BLI_task_pool_work_and_wait(task_pool);
+    /* No lock is taken here, so other tasks can run meanwhile. Callers holding a lock isolate
+     * this, see #mesh_calc_shared_normals_isolated. */
+    BLI_task_group_work_and_wait_reentrant(task_group);
 
+    BLI_task_group_free(task_group);
     BLI_task_pool_free(task_pool);
   }
 
@@ -78,6 +78,41 @@ static bool mesh_remap_bvhtree_query_nearest(BVHTreeFromMesh *treedata,
   }
 }
 
+/**
+ * Query the nearest source item of all destination vertices at once,
+ * nearby vertices share their traversal of the tree.
+ *
+ * \param r_cos: The vertices in tree coordinates.
+ * \param r_nearest: Vertices with an index of -1 have no source within \a max_dist_sq.
+ */
+static void mesh_remap_bvhtree_query_nearest_verts(BVHTreeFromMesh *treedata,
+                                                   const MVert *verts_dst,
+                                                   const int numverts_dst,
+                                                   const SpaceTransform *space_transform,
+                                                   const float max_dist_sq,
+                                                   float (*r_cos)[3],
+                                                   BVHTreeNearest *r_nearest)
+{
+  for (int i = 0; i < numverts_dst; i++) {
+    copy_v3_v3(r_cos[i], verts_dst[i].co);
+
+    /* Convert the vertex to tree coordinates, if needed. */
+    if (space_transform) {
+      BLI_space_transform_apply(space_transform, r_cos[i]);
+    }
+
+    r_nearest[i].index = -1;
+    r_nearest[i].dist_sq = max_dist_sq;
+  }
+
+  BLI_bvhtree_find_nearest_batch(treedata->tree,
+                                 (const float(*)[3])r_cos,
+                                 numverts_dst,
+                                 r_nearest,
+                                 treedata->nearest_callback,
+                                 treedata);
+}
+
 static bool mesh_remap_bvhtree_query_raycast(BVHTreeFromMesh *treedata,
                                              BVHTreeRayHit *rayhit,
                                              const float co[3],
@@ -519,57 +554,66 @@ void BKE_mesh_remap_calc_verts_from_mesh(const int mode,
   }
   else {
     BVHTreeFromMesh treedata = {NULL};
-    BVHTreeNearest nearest = {0};
     BVHTreeRayHit rayhit = {0};
     float hit_dist;
     float tmp_co[3], tmp_no[3];
 
     if (mode == MREMAP_MODE_VERT_NEAREST) {
+      float(*tmp_cos)[3] = MEM_mallocN(sizeof(*tmp_cos) * (size_t)numverts_dst, __func__);
+      BVHTreeNearest *nearest_verts = MEM_mallocN(sizeof(*nearest_verts) * (size_t)numverts_dst,
+                                                  __func__);
+
       BKE_bvhtree_from_mesh_get(&treedata, me_src, BVHTREE_FROM_VERTS, 2);
-      nearest.index = -1;
+      mesh_remap_bvhtree_query_nearest_verts(&treedata,
+                                             verts_dst,
+                                             numverts_dst,
+                                             space_transform,
+                                             max_dist_sq,
+                                             tmp_cos,
+                                             nearest_verts);
 
       for (i = 0; i < numverts_dst; i++) {
-        copy_v3_v3(tmp_co, verts_dst[i].co);
-
-        /* Convert the vertex to tree coordinates, if needed. */
-        if (space_transform) {
-          BLI_space_transform_apply(space_transform, tmp_co);
-        }
-
-        if (mesh_remap_bvhtree_query_nearest(
-                &treedata, &nearest, tmp_co, max_dist_sq, &hit_dist)) {
-          mesh_remap_item_define(r_map, i, hit_dist, 0, 1, &nearest.index, &full_weight);
+        if (nearest_verts[i].index != -1) {
+          hit_dist = sqrtf(nearest_verts[i].dist_sq);
+          mesh_remap_item_define(r_map, i, hit_dist, 0, 1, &nearest_verts[i].index, &full_weight);
         }
         else {
           /* No source for this dest vertex! */
           BKE_mesh_remap_item_define_invalid(r_map, i);
         }
       }
+
+      MEM_freeN(tmp_cos);
+      MEM_freeN(nearest_verts);
     }
     else if (ELEM(mode, MREMAP_MODE_VERT_EDGE_NEAREST, MREMAP_MODE_VERT_EDGEINTERP_NEAREST)) {
       MEdge *edges_src = me_src->medge;
       float(*vcos_src)[3] = BKE_mesh_vert_coords_alloc(me_src, NULL);
 
+      float(*tmp_cos)[3] = MEM_mallocN(sizeof(*tmp_cos) * (size_t)numverts_dst, __func__);
+      BVHTreeNearest *nearest_verts = MEM_mallocN(sizeof(*nearest_verts) * (size_t)numverts_dst,
+                                                  __func__);
+
       BKE_bvhtree_from_mesh_get(&treedata, me_src, BVHTREE_FROM_EDGES, 2);
-      nearest.index = -1;
+      mesh_remap_bvhtree_query_nearest_verts(&treedata,
+                                             verts_dst,
+                                             numverts_dst,
+                                             space_transform,
+                                             max_dist_sq,
+                                             tmp_cos,
+                                             nearest_verts);
 
       for (i = 0; i < numverts_dst; i++) {
-        copy_v3_v3(tmp_co, verts_dst[i].co);
-
-        /* Convert the vertex to tree coordinates, if needed. */
-        if (space_transform) {
-          BLI_space_transform_apply(space_transform, tmp_co);
-        }
-
-        if (mesh_remap_bvhtree_query_nearest(
-                &treedata, &nearest, tmp_co, max_dist_sq, &hit_dist)) {
-          MEdge *me = &edges_src[nearest.index];
+        if (nearest_verts[i].index != -1) {
+          MEdge *me = &edges_src[nearest_verts[i].index];
           const float *v1cos = vcos_src[me->v1];
           const float *v2cos = vcos_src[me->v2];
 
+          hit_dist = sqrtf(nearest_verts[i].dist_sq);
+
           if (mode == MREMAP_MODE_VERT_EDGE_NEAREST) {
-            const float dist_v1 = len_squared_v3v3(tmp_co, v1cos);
-            const float dist_v2 = len_squared_v3v3(tmp_co, v2cos);
+            const float dist_v1 = len_squared_v3v3(tmp_cos[i], v1cos);
+            const float dist_v2 = len_squared_v3v3(tmp_cos[i], v2cos);
             const int index = (int)((dist_v1 > dist_v2) ? me->v2 : me->v1);
             mesh_remap_item_define(r_map, i, hit_dist, 0, 1, &index, &full_weight);
           }
@@ -581,7 +625,7 @@ void BKE_mesh_remap_calc_verts_from_mesh(const int mode,
             indices[1] = (int)me->v2;
 
             /* Weight is inverse of point factor here... */
-            weights[0] = line_point_factor_v3(tmp_co, v2cos, v1cos);
+            weights[0] = line_point_factor_v3(tmp_cos[i], v2cos, v1cos);
             CLAMP(weights[0], 0.0f, 1.0f);
             weights[1] = 1.0f - weights[0];
 
@@ -595,6 +639,8 @@ void BKE_mesh_remap_calc_verts_from_mesh(const int mode,
       }
 
       MEM_freeN(vcos_src);
+      MEM_freeN(tmp_cos);
+      MEM_freeN(nearest_verts);
     }
     else if (ELEM(mode,
                   MREMAP_MODE_VERT_POLY_NEAREST,
@@ -647,27 +693,32 @@ void BKE_mesh_remap_calc_verts_from_mesh(const int mode,
         }
       }
       else {
-        nearest.index = -1;
+        float(*tmp_cos)[3] = MEM_mallocN(sizeof(*tmp_cos) * (size_t)numverts_dst, __func__);
+        BVHTreeNearest *nearest_verts = MEM_mallocN(
+            sizeof(*nearest_verts) * (size_t)numverts_dst, __func__);
+
+        mesh_remap_bvhtree_query_nearest_verts(&treedata,
+                                               verts_dst,
+                                               numverts_dst,
+                                               space_transform,
+                                               max_dist_sq,
+                                               tmp_cos,
+                                               nearest_verts);
 
         for (i = 0; i < numverts_dst; i++) {
-          copy_v3_v3(tmp_co, verts_dst[i].co);
-
-          /* Convert the vertex to tree coordinates, if needed. */
-          if (space_transform) {
-            BLI_space_transform_apply(space_transform, tmp_co);
-          }
-
-          if (mesh_remap_bvhtree_query_nearest(
-                  &treedata, &nearest, tmp_co, max_dist_sq, &hit_dist)) {
-            const MLoopTri *lt = &treedata.looptri[nearest.index];
+          if (nearest_verts[i].index != -1) {
+            const BVHTreeNearest *nearest_vert = &nearest_verts[i];
+            const MLoopTri *lt = &treedata.looptri[nearest_vert->index];
             MPoly *mp = &polys_src[lt->poly];
 
+            hit_dist = sqrtf(nearest_vert->dist_sq);
+
             if (mode == MREMAP_MODE_VERT_POLY_NEAREST) {
               int index;
               mesh_remap_interp_poly_data_get(mp,
                                               loops_src,
                                               (const float(*)[3])vcos_src,
-                                              nearest.co,
+                                              nearest_vert->co,
                                               &tmp_buff_size,
                                               &vcos,
                                               false,
@@ -682,7 +733,7 @@ void BKE_mesh_remap_calc_verts_from_mesh(const int mode,
               const int sources_num = mesh_remap_interp_poly_data_get(mp,
                                                                       loops_src,
                                                                       (const float(*)[3])vcos_src,
-                                                                      nearest.co,
+                                                                      nearest_vert->co,
                                                                       &tmp_buff_size,
                                                                       &vcos,
                                                                       false,
@@ -699,6 +750,8 @@ void BKE_mesh_remap_calc_verts_from_mesh(const int mode,
             BKE_mesh_remap_item_define_invalid(r_map, i);
           }
         }
+        MEM_freeN(tmp_cos);
+        MEM_freeN(nearest_verts);
       }
 
       MEM_freeN(vcos_src);
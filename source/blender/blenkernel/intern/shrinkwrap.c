@@ -91,6 +91,19 @@ typedef struct ShrinkwrapCalcData {
   float keepDist;  // Distance to keep above target surface (units are in local space)
 } ShrinkwrapCalcData;
 
+/**
+ * Vertices moved by the modifier (non-zero weight) in target space,
+ * to find the nearest points of all of them at once.
+ */
+typedef struct ShrinkwrapNearestBatch {
+  /** Index of the vertex of each query. */
+  int *vert_index;
+  float *weight;
+  float (*co)[3];
+  BVHTreeNearest *nearest;
+  int len;
+} ShrinkwrapNearestBatch;
+
 typedef struct ShrinkwrapCalcCBData {
   ShrinkwrapCalcData *calc;
 
@@ -99,6 +112,8 @@ typedef struct ShrinkwrapCalcCBData {
 
   float *proj_axis;
   SpaceTransform *local2aux;
+
+  ShrinkwrapNearestBatch *nearest_batch;
 } ShrinkwrapCalcCBData;
 
 /* Checks if the modifier needs target normals with these settings. */
@@ -337,6 +352,54 @@ void BKE_shrinkwrap_compute_boundary_data(struct Mesh *mesh)
   mesh->runtime.shrinkwrap_data = shrinkwrap_build_boundary_data(mesh);
 }
 
+static void shrinkwrap_nearest_batch_init(const ShrinkwrapCalcData *calc,
+                                          ShrinkwrapNearestBatch *batch)
+{
+  const size_t verts_len = (size_t)calc->numVerts;
+  batch->vert_index = MEM_malloc_arrayN(verts_len, sizeof(*batch->vert_index), __func__);
+  batch->weight = MEM_malloc_arrayN(verts_len, sizeof(*batch->weight), __func__);
+  batch->co = MEM_malloc_arrayN(verts_len, sizeof(*batch->co), __func__);
+  batch->nearest = MEM_malloc_arrayN(verts_len, sizeof(*batch->nearest), __func__);
+  batch->len = 0;
+
+  for (int i = 0; i < calc->numVerts; i++) {
+    float weight = BKE_defvert_array_find_weight_safe(calc->dvert, i, calc->vgroup);
+
+    if (calc->invert_vgroup) {
+      weight = 1.0f - weight;
+    }
+
+    if (weight == 0.0f) {
+      continue;
+    }
+
+    const int j = batch->len++;
+    batch->vert_index[j] = i;
+    batch->weight[j] = weight;
+
+    /* Convert the vertex to tree coordinates */
+    if (calc->vert) {
+      copy_v3_v3(batch->co[j], calc->vert[i].co);
+    }
+    else {
+      copy_v3_v3(batch->co[j], calc->vertexCos[i]);
+    }
+    BLI_space_transform_apply(&calc->local2target, batch->co[j]);
+
+    memset(&batch->nearest[j], 0, sizeof(batch->nearest[j]));
+    batch->nearest[j].index = -1;
+    batch->nearest[j].dist_sq = FLT_MAX;
+  }
+}
+
+static void shrinkwrap_nearest_batch_free(ShrinkwrapNearestBatch *batch)
+{
+  MEM_freeN(batch->vert_index);
+  MEM_freeN(batch->weight);
+  MEM_freeN(batch->co);
+  MEM_freeN(batch->nearest);
+}
+
 /*
  * Shrinkwrap to the nearest vertex
  *
@@ -345,48 +408,17 @@ void BKE_shrinkwrap_compute_boundary_data(struct Mesh *mesh)
  */
 static void shrinkwrap_calc_nearest_vertex_cb_ex(void *__restrict userdata,
                                                  const int i,
-                                                 const TaskParallelTLS *__restrict tls)
+                                                 const TaskParallelTLS *__restrict UNUSED(tls))
 {
   ShrinkwrapCalcCBData *data = userdata;
 
   ShrinkwrapCalcData *calc = data->calc;
-  BVHTreeFromMesh *treeData = &data->tree->treeData;
-  BVHTreeNearest *nearest = tls->userdata_chunk;
+  const ShrinkwrapNearestBatch *batch = data->nearest_batch;
+  const BVHTreeNearest *nearest = &batch->nearest[i];
 
-  float *co = calc->vertexCos[i];
+  float *co = calc->vertexCos[batch->vert_index[i]];
   float tmp_co[3];
-  float weight = BKE_defvert_array_find_weight_safe(calc->dvert, i, calc->vgroup);
-
-  if (calc->invert_vgroup) {
-    weight = 1.0f - weight;
-  }
-
-  if (weight == 0.0f) {
-    return;
-  }
-
-  /* Convert the vertex to tree coordinates */
-  if (calc->vert) {
-    copy_v3_v3(tmp_co, calc->vert[i].co);
-  }
-  else {
-    copy_v3_v3(tmp_co, co);
-  }
-  BLI_space_transform_apply(&calc->local2target, tmp_co);
-
-  /* Use local proximity heuristics (to reduce the nearest search)
-   *
-   * If we already had an hit before.. we assume this vertex is going to have a close hit to that
-   * other vertex so we can initiate the "nearest.dist" with the expected value to that last hit.
-   * This will lead in pruning of the search tree. */
-  if (nearest->index != -1) {
-    nearest->dist_sq = len_squared_v3v3(tmp_co, nearest->co);
-  }
-  else {
-    nearest->dist_sq = FLT_MAX;
-  }
-
-  BLI_bvhtree_find_nearest(treeData->tree, tmp_co, nearest, treeData->nearest_callback, treeData);
+  float weight = batch->weight[i];
 
   /* Found the nearest vertex */
   if (nearest->index != -1) {
@@ -407,23 +439,29 @@ static void shrinkwrap_calc_nearest_vertex_cb_ex(void *__restrict userdata,
 
 static void shrinkwrap_calc_nearest_vertex(ShrinkwrapCalcData *calc)
 {
-  BVHTreeNearest nearest = NULL_BVHTreeNearest;
-
-  /* Setup nearest */
-  nearest.index = -1;
-  nearest.dist_sq = FLT_MAX;
+  BVHTreeFromMesh *treeData = &calc->tree->treeData;
+  ShrinkwrapNearestBatch batch;
+
+  /* Nearby vertices are searched together, sharing their traversal of the tree. */
+  shrinkwrap_nearest_batch_init(calc, &batch);
+  BLI_bvhtree_find_nearest_batch(treeData->tree,
+                                 (const float(*)[3])batch.co,
+                                 batch.len,
+                                 batch.nearest,
+                                 treeData->nearest_callback,
+                                 treeData);
 
   ShrinkwrapCalcCBData data = {
       .calc = calc,
       .tree = calc->tree,
+      .nearest_batch = &batch,
   };
   TaskParallelSettings settings;
   BLI_parallel_range_settings_defaults(&settings);
-  settings.use_threading = (calc->numVerts > BKE_MESH_OMP_LIMIT);
-  settings.userdata_chunk = &nearest;
-  settings.userdata_chunk_size = sizeof(nearest);
-  BLI_task_parallel_range(
-      0, calc->numVerts, &data, shrinkwrap_calc_nearest_vertex_cb_ex, &settings);
+  settings.use_threading = (batch.len > BKE_MESH_OMP_LIMIT);
+  BLI_task_parallel_range(0, batch.len, &data, shrinkwrap_calc_nearest_vertex_cb_ex, &settings);
+
+  shrinkwrap_nearest_batch_free(&batch);
 }
 
 /*
@@ -1121,55 +1159,25 @@ void BKE_shrinkwrap_find_nearest_surface(struct ShrinkwrapTreeData *tree,
  */
 static void shrinkwrap_calc_nearest_surface_point_cb_ex(void *__restrict userdata,
                                                         const int i,
-                                                        const TaskParallelTLS *__restrict tls)
+                                                        const TaskParallelTLS *__restrict
+                                                            UNUSED(tls))
 {
   ShrinkwrapCalcCBData *data = userdata;
 
   ShrinkwrapCalcData *calc = data->calc;
-  BVHTreeNearest *nearest = tls->userdata_chunk;
+  const ShrinkwrapNearestBatch *batch = data->nearest_batch;
+  BVHTreeNearest *nearest = &batch->nearest[i];
 
-  float *co = calc->vertexCos[i];
+  float *co = calc->vertexCos[batch->vert_index[i]];
   float tmp_co[3];
-  float weight = BKE_defvert_array_find_weight_safe(calc->dvert, i, calc->vgroup);
-
-  if (calc->invert_vgroup) {
-    weight = 1.0f - weight;
-  }
-
-  if (weight == 0.0f) {
-    return;
-  }
 
-  /* Convert the vertex to tree coordinates */
-  if (calc->vert) {
-    copy_v3_v3(tmp_co, calc->vert[i].co);
-  }
-  else {
-    copy_v3_v3(tmp_co, co);
-  }
-  BLI_space_transform_apply(&calc->local2target, tmp_co);
+  copy_v3_v3(tmp_co, batch->co[i]);
 
-  /* Use local proximity heuristics (to reduce the nearest search)
-   *
-   * If we already had an hit before.. we assume this vertex is going to have a close hit to that
-   * other vertex so we can initiate the "nearest.dist" with the expected value to that last hit.
-   * This will lead in pruning of the search tree. */
-  if (nearest->index != -1) {
-    if (calc->smd->shrinkType == MOD_SHRINKWRAP_TARGET_PROJECT) {
-      /* Heuristic doesn't work because of additional restrictions. */
-      nearest->index = -1;
-      nearest->dist_sq = FLT_MAX;
-    }
-    else {
-      nearest->dist_sq = len_squared_v3v3(tmp_co, nearest->co);
-    }
-  }
-  else {
-    nearest->dist_sq = FLT_MAX;
+  /* Target projection has additional restrictions, it isn't searched in batches. */
+  if (calc->smd->shrinkType == MOD_SHRINKWRAP_TARGET_PROJECT) {
+    BKE_shrinkwrap_find_nearest_surface(data->tree, nearest, tmp_co, calc->smd->shrinkType);
   }
 
-  BKE_shrinkwrap_find_nearest_surface(data->tree, nearest, tmp_co, calc->smd->shrinkType);
-
   /* Found the nearest vertex */
   if (nearest->index != -1) {
     BKE_shrinkwrap_snap_point_to_surface(data->tree,
@@ -1184,7 +1192,7 @@ static void shrinkwrap_calc_nearest_surface_point_cb_ex(void *__restrict userdat
 
     /* Convert the coordinates back to mesh coordinates */
     BLI_space_transform_invert(&calc->local2target, tmp_co);
-    interp_v3_v3v3(co, co, tmp_co, weight); /* linear interpolation */
+    interp_v3_v3v3(co, co, tmp_co, batch->weight[i]); /* linear interpolation */
   }
 }
 
@@ -1376,24 +1384,33 @@ void BKE_shrinkwrap_snap_point_to_surface(const struct ShrinkwrapTreeData *tree,
 
 static void shrinkwrap_calc_nearest_surface_point(ShrinkwrapCalcData *calc)
 {
-  BVHTreeNearest nearest = NULL_BVHTreeNearest;
+  ShrinkwrapTreeData *tree = calc->tree;
+  ShrinkwrapNearestBatch batch;
 
-  /* Setup nearest */
-  nearest.index = -1;
-  nearest.dist_sq = FLT_MAX;
+  /* Find the nearest surface points, nearby vertices are searched together sharing their
+   * traversal of the tree. */
+  shrinkwrap_nearest_batch_init(calc, &batch);
+  if (calc->smd->shrinkType != MOD_SHRINKWRAP_TARGET_PROJECT) {
+    BLI_bvhtree_find_nearest_batch(tree->bvh,
+                                   (const float(*)[3])batch.co,
+                                   batch.len,
+                                   batch.nearest,
+                                   tree->treeData.nearest_callback,
+                                   &tree->treeData);
+  }
 
-  /* Find the nearest vertex */
   ShrinkwrapCalcCBData data = {
       .calc = calc,
-      .tree = calc->tree,
+      .tree = tree,
+      .nearest_batch = &batch,
   };
   TaskParallelSettings settings;
   BLI_parallel_range_settings_defaults(&settings);
-  settings.use_threading = (calc->numVerts > BKE_MESH_OMP_LIMIT);
-  settings.userdata_chunk = &nearest;
-  settings.userdata_chunk_size = sizeof(nearest);
+  settings.use_threading = (batch.len > BKE_MESH_OMP_LIMIT);
   BLI_task_parallel_range(
-      0, calc->numVerts, &data, shrinkwrap_calc_nearest_surface_point_cb_ex, &settings);
+      0, batch.len, &data, shrinkwrap_calc_nearest_surface_point_cb_ex, &settings);
+
+  shrinkwrap_nearest_batch_free(&batch);
 }
 
 /* Main shrinkwrap function */
@@ -41,6 +41,7 @@ BArrayState *BLI_array_store_state_add(BArrayStore *bs,
                                        const void *data,
                                        const size_t data_len,
                                        const BArrayState *state_reference);
+BArrayState *BLI_array_store_state_add_shared(BArrayStore *bs, const BArrayState *state_reference);
 void BLI_array_store_state_remove(BArrayStore *bs, BArrayState *state);
 
 size_t BLI_array_store_state_size_get(BArrayState *state);
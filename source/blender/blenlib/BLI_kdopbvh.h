@@ -102,6 +102,14 @@ enum {
   /* calculate IsectRayPrecalc data */
   BVH_RAYCAST_WATERTIGHT = (1 << 0),
 };
+enum {
+  /* Split nodes with a binned surface area heuristic instead of at the median, slower to build
+   * but faster to query (trees with x/y/z axes only, others use the default build). */
+  BVH_BALANCE_SAH = (1 << 0),
+  /* Keep the bounds of all children of a node next to each other, so ray-casts and nearest
+   * queries test them all at once with SIMD (quad and oct trees with x/y/z axes only). */
+  BVH_BALANCE_WIDE = (1 << 1),
+};
 #define BVH_RAYCAST_DEFAULT (BVH_RAYCAST_WATERTIGHT)
 #define BVH_RAYCAST_DIST_MAX (FLT_MAX / 2.0f)
 
@@ -131,6 +139,13 @@ typedef void (*BVHTree_NearestProjectedCallback)(void *userdata,
                                                  const int clip_plane_len,
                                                  BVHTreeNearest *nearest);
 
+/* callback to get the points of the item of a leaf for BLI_bvhtree_refit,
+ * returns their number (at most BVH_REFIT_POINTS_MAX) */
+#define BVH_REFIT_POINTS_MAX 4
+typedef int (*BVHTree_RefitCallback)(void *userdata,
+                                     int index,
+                                     float r_co[BVH_REFIT_POINTS_MAX][3]);
+
 /* callbacks to BLI_bvhtree_walk_dfs */
 /* return true to traverse into this nodes children, else skip. */
 typedef bool (*BVHTree_WalkParentCallback)(const BVHTreeAxisRange *bounds, void *userdata);
@@ -149,11 +164,18 @@ void BLI_bvhtree_free(BVHTree *tree);
 /* construct: first insert points, then call balance */
 void BLI_bvhtree_insert(BVHTree *tree, int index, const float co[3], int numpoints);
 void BLI_bvhtree_balance(BVHTree *tree);
+void BLI_bvhtree_balance_ex(BVHTree *tree, const int flag);
 
 /* update: first update points/nodes, then call update_tree to refit the bounding volumes */
 bool BLI_bvhtree_update_node(
     BVHTree *tree, int index, const float co[3], const float co_moving[3], int numpoints);
 void BLI_bvhtree_update_tree(BVHTree *tree);
+/* update all leafs with the points given by the callback and refit the bounding volumes,
+ * in parallel (the callback must be thread-safe) */
+void BLI_bvhtree_refit(BVHTree *tree, BVHTree_RefitCallback callback, void *userdata);
+/* expected cost of queries relative to testing the root (surface area heuristic),
+ * to compare a refit tree with the tree as it was built */
+float BLI_bvhtree_cost(const BVHTree *tree);
 
 int BLI_bvhtree_overlap_thread_num(const BVHTree *tree);
 
@@ -192,6 +214,16 @@ int BLI_bvhtree_find_nearest(BVHTree *tree,
                              BVHTreeNearest *nearest,
                              BVHTree_NearestPointCallback callback,
                              void *userdata);
+/* find the nearest node for each of the given coordinates, queries close to each other share
+ * their traversal of the tree. \a r_nearest must be initialized like the nearest argument of
+ * #BLI_bvhtree_find_nearest (index and dist_sq at least), it's updated with the results.
+ * The callback is called from multiple threads and must be thread-safe. */
+void BLI_bvhtree_find_nearest_batch(BVHTree *tree,
+                                    const float (*co)[3],
+                                    int co_len,
+                                    BVHTreeNearest *r_nearest,
+                                    BVHTree_NearestPointCallback callback,
+                                    void *userdata);
 
 int BLI_bvhtree_find_nearest_first(BVHTree *tree,
                                    const float co[3],
@@ -214,6 +246,17 @@ int BLI_bvhtree_ray_cast(BVHTree *tree,
                          BVHTreeRayHit *hit,
                          BVHTree_RayCastCallback callback,
                          void *userdata);
+/* ray-cast all the given rays, rays with similar origins and directions share their traversal
+ * of the tree. \a r_hits must be initialized like the hit argument of #BLI_bvhtree_ray_cast
+ * (index and dist at least), it's updated with the results.
+ * The callback is called from multiple threads and must be thread-safe. */
+void BLI_bvhtree_ray_cast_batch(BVHTree *tree,
+                                const BVHTreeRay *rays,
+                                int rays_len,
+                                BVHTreeRayHit *r_hits,
+                                BVHTree_RayCastCallback callback,
+                                void *userdata,
+                                int flag);
 
 void BLI_bvhtree_ray_cast_all_ex(BVHTree *tree,
                                  const float co[3],
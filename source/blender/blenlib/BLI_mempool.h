@@ -84,6 +84,13 @@ enum {
    * order of allocation when no chunks have been freed.
    */
   BLI_MEMPOOL_ALLOW_ITER = (1 << 0),
+  /** allow allocating and freeing from multiple threads at once.
+   *
+   * \note each thread takes whole chunks, iteration order follows chunk claiming.
+   * \note #BLI_mempool_clear and #BLI_mempool_destroy must not run concurrently with other
+   * operations, chunks are only freed by them.
+   */
+  BLI_MEMPOOL_THREADED = (1 << 1),
 };
 
 void BLI_mempool_iternew(BLI_mempool *pool, BLI_mempool_iter *iter) ATTR_NONNULL();
@@ -36,8 +36,10 @@ struct BLI_mempool;
 
 /* Task Scheduler
  *
- * Central scheduler that holds running threads ready to execute tasks. A single
- * queue holds the task from all pools.
+ * Central scheduler that holds running threads ready to execute tasks. Each
+ * thread has its own queue for the tasks it pushes, idle threads steal tasks
+ * from the queues of busy ones. Tasks pushed from other threads go to a global
+ * queue.
  *
  * Init/exit must be called before/after any task pools are created/freed, and
  * must be called from the main threads. All other scheduler and pool functions
@@ -50,6 +52,12 @@ void BLI_task_scheduler_free(TaskScheduler *scheduler);
 
 int BLI_task_scheduler_num_threads(TaskScheduler *scheduler);
 
+/* On systems with multiple NUMA nodes, worker threads are pinned to the nodes
+ * proportionally to their number of processors, the main thread is not. Without
+ * NUMA there is a single node with all threads. */
+int BLI_task_scheduler_num_numa_nodes(TaskScheduler *scheduler);
+int BLI_task_scheduler_numa_node_num_threads(TaskScheduler *scheduler, int node);
+
 /* Task Pool
  *
  * Pool of tasks that will be executed by the central TaskScheduler. For each
@@ -93,6 +101,15 @@ void BLI_task_pool_push_from_thread(TaskPool *pool,
                                     bool free_taskdata,
                                     TaskFreeFunction freedata,
                                     int thread_id);
+/* Push a task to be run by the threads of a NUMA node, so memory it touches first is
+ * allocated on that node. The thread waiting for the pool still runs it when it has
+ * nothing else to do. Not supported for suspended pools. */
+void BLI_task_pool_push_on_numa_node(TaskPool *pool,
+                                     TaskRunFunction run,
+                                     void *taskdata,
+                                     bool free_taskdata,
+                                     TaskFreeFunction freedata,
+                                     int numa_node);
 
 /* work and wait until all tasks are done */
 void BLI_task_pool_work_and_wait(TaskPool *pool);
@@ -113,13 +130,45 @@ ThreadMutex *BLI_task_pool_user_mutex(TaskPool *pool);
 /* Thread ID of thread that created the task pool. */
 int BLI_task_pool_creator_thread_id(TaskPool *pool);
 
-/* Delayed push, use that to reduce thread overhead by accumulating
- * all new tasks into local queue first and pushing it to scheduler
- * from within a single mutex lock.
+/* Allow threads waiting inside a task of this pool to run other tasks of it,
+ * for the waits which opt in to it. */
+void BLI_task_pool_set_reentrant(TaskPool *pool, bool is_reentrant);
+/* Work and wait, running other tasks of the reentrant pool the calling task belongs to
+ * meanwhile. The caller must not hold a lock which these tasks may need. */
+void BLI_task_pool_work_and_wait_reentrant(TaskPool *pool);
+
+/* Delayed push, use that to reduce thread overhead when pushing many
+ * tasks at once from a task: sleeping threads are woken up only once
+ * all new tasks are pushed.
  */
 void BLI_task_pool_delayed_push_begin(TaskPool *pool, int thread_id);
 void BLI_task_pool_delayed_push_end(TaskPool *pool, int thread_id);
 
+/* Task Group
+ *
+ * Fork-join within a pool: a running task pushes sub-tasks to a group and waits
+ * for these only. Waiting does not block the thread, it runs tasks of the group
+ * while they are not all taken by other threads. With the reentrant variant of the
+ * wait it also runs other tasks of a reentrant pool meanwhile, so nested parallel
+ * loops keep all threads busy.
+ */
+
+typedef struct TaskGroup TaskGroup;
+
+TaskGroup *BLI_task_group_create(TaskPool *pool, int thread_id);
+void BLI_task_group_free(TaskGroup *group);
+void BLI_task_group_push(TaskGroup *group,
+                         TaskRunFunction run,
+                         void *taskdata,
+                         bool free_taskdata,
+                         TaskFreeFunction freedata);
+void BLI_task_group_work_and_wait(TaskGroup *group);
+void BLI_task_group_work_and_wait_reentrant(TaskGroup *group);
+
+/* Run func without letting waits inside it run other tasks of reentrant pools,
+ * for code using reentrant waits called while holding a lock. */
+void BLI_task_isolate(void (*func)(void *userdata), void *userdata);
+
 /* Parallel for routines */
 
 typedef enum eTaskSchedulingMode {
@@ -134,6 +183,13 @@ typedef enum eTaskSchedulingMode {
    * part of the work requires totally different amount of compute power.
    */
   TASK_SCHEDULING_DYNAMIC,
+  /* The range is split into one contiguous part per NUMA node, proportionally to
+   * the number of threads of each node, and parts are dynamically scheduled on the
+   * threads of their node. Loops using this mode over the same range process each
+   * item on the same node, so memory first written in such a loop ends up on the
+   * node using it in the next ones. Same as dynamic scheduling without NUMA.
+   */
+  TASK_SCHEDULING_NUMA_LOCAL,
 } eTaskSchedulingMode;
 
 /* Per-thread specific data passed to the callback. */
@@ -183,6 +239,9 @@ typedef struct TaskParallelSettings {
    * having a global use_threading switch based on just range size.
    */
   int min_iter_per_thread;
+  /* When called from a task of a reentrant pool, run other tasks of that pool while waiting for
+   * the range to be done. Only set this when no lock is held which these tasks may need. */
+  bool use_reentrant;
 } TaskParallelSettings;
 
 BLI_INLINE void BLI_parallel_range_settings_defaults(TaskParallelSettings *settings);
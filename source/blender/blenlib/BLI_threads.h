@@ -202,6 +202,12 @@ void BLI_thread_queue_nowait(ThreadQueue *queue);
 void BLI_thread_put_process_on_fast_node(void);
 void BLI_thread_put_thread_on_fast_node(void);
 
+/* NUMA topology, a single node with all processors when NUMA is not available. */
+int BLI_system_numa_num_nodes(void);
+int BLI_system_numa_node_num_processors(int node);
+/* Restrict the calling thread to the processors of the node. */
+bool BLI_thread_run_on_numa_node(int node);
+
 #ifdef __cplusplus
 }
 #endif
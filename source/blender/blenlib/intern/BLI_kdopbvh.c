@@ -36,12 +36,18 @@
  *   #BLI_bvhtree_overlap, #BVHOverlapData_Shared, #BVHOverlapData_Thread
  * - Range Query:
  *   #BLI_bvhtree_range_query
+ *
+ * Trees are built with median splits by default, #BVH_BALANCE_SAH uses a binned surface area
+ * heuristic instead and #BVH_BALANCE_WIDE stores the bounds of the children of each branch
+ * together, for SIMD traversal.
  */
 
 #include <assert.h>
 
 #include "MEM_guardedalloc.h"
 
+#include "atomic_ops.h"
+
 #include "BLI_alloca.h"
 #include "BLI_heap_simple.h"
 #include "BLI_kdopbvh.h"
@@ -52,6 +58,10 @@
 
 #include "BLI_strict_flags.h"
 
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
 /* used for iterative_raycast */
 // #define USE_SKIP_LINKS
 
@@ -72,6 +82,11 @@
 #  define KDOPBVH_THREAD_LEAF_THRESHOLD 1024
 #endif
 
+/* Number of bins used to evaluate split positions of the SAH build. */
+#define KDOPBVH_SAH_BINS 16
+/* Depth after which the SAH build splits at the median, limiting the recursion depth. */
+#define KDOPBVH_SAH_MAX_DEPTH 64
+
 /* -------------------------------------------------------------------- */
 /** \name Struct Definitions
  * \{ */
@@ -96,6 +111,7 @@ struct BVHTree {
   BVHNode *nodearray;  /* pre-alloc branch nodes */
   BVHNode **nodechild; /* pre-alloc childs for nodes */
   float *nodebv;       /* pre-alloc bounding-volumes for nodes */
+  float *nodebv_wide;  /* bounds of the children of branches, see #BVH_BALANCE_WIDE */
   float epsilon;       /* epslion is used for inflation of the k-dop      */
   int totleaf;         /* leafs */
   int totbranch;
@@ -105,8 +121,8 @@ struct BVHTree {
 };
 
 /* optimization, ensure we stay small */
-BLI_STATIC_ASSERT((sizeof(void *) == 8 && sizeof(BVHTree) <= 48) ||
-                      (sizeof(void *) == 4 && sizeof(BVHTree) <= 32),
+BLI_STATIC_ASSERT((sizeof(void *) == 8 && sizeof(BVHTree) <= 56) ||
+                      (sizeof(void *) == 4 && sizeof(BVHTree) <= 36),
                   "over sized")
 
 /* avoid duplicating vars in BVHOverlapData_Thread */
@@ -859,6 +875,487 @@ static void non_recursive_bvh_div_nodes(const BVHTree *tree,
 
 /** \} */
 
+/* -------------------------------------------------------------------- */
+/** \name SAH Build
+ *
+ * Top-down build splitting the leafs of every branch so the sum of the surface areas of the
+ * children, weighted by their number of leafs, is minimal. This is the expected cost of a
+ * query going through the branch (surface area heuristic). Split positions are only evaluated
+ * between #KDOPBVH_SAH_BINS bins along the axis with the largest spread of leaf centers.
+ *
+ * Branches with more than two children are built by splitting the group of leafs with the
+ * largest area until there are as many groups as the tree type allows, children are then
+ * ordered along the largest axis of the branch. Unlike the implicit build, children may have
+ * any number of leafs, branches are allocated as they are created and still always have a
+ * greater index than their parent, as #BLI_bvhtree_update_tree expects.
+ *
+ * Only the x/y/z axes are used, as for traversal.
+ * \{ */
+
+typedef struct BVHSAHBin {
+  float bv[6];
+  int count;
+} BVHSAHBin;
+
+typedef struct BVHSAHBinData {
+  BVHNode **leafs_array;
+  int begin;
+  int axis;
+  float center_min;
+  float center_scale;
+  /* Centers bounds, from the first pass. */
+  float center_bounds[2][3];
+  BVHSAHBin bins[KDOPBVH_SAH_BINS];
+} BVHSAHBinData;
+
+typedef struct BVHSAHBuildData {
+  const BVHTree *tree;
+  BVHNode **leafs_array;
+  BVHNode *branches_array;
+  /* Number of allocated branches, atomically incremented. */
+  int num_branches;
+  TaskPool *task_pool;
+} BVHSAHBuildData;
+
+typedef struct BVHSAHBuildTask {
+  BVHNode *node;
+  int begin, end;
+  int depth;
+} BVHSAHBuildTask;
+
+BLI_INLINE float bvh_sah_leaf_center(const BVHNode *leaf, const int axis)
+{
+  return (leaf->bv[2 * axis] + leaf->bv[2 * axis + 1]) * 0.5f;
+}
+
+BLI_INLINE int bvh_sah_leaf_bin(const BVHSAHBinData *data, const BVHNode *leaf)
+{
+  const int bin = (int)((bvh_sah_leaf_center(leaf, data->axis) - data->center_min) *
+                        data->center_scale);
+  return CLAMPIS(bin, 0, KDOPBVH_SAH_BINS - 1);
+}
+
+/* Half of the surface area of the x/y/z bounds. */
+BLI_INLINE float bvh_sah_half_area(const float bv[6])
+{
+  const float dx = bv[1] - bv[0];
+  const float dy = bv[3] - bv[2];
+  const float dz = bv[5] - bv[4];
+  return dx * dy + dy * dz + dz * dx;
+}
+
+BLI_INLINE void bvh_sah_bv_init(float bv[6])
+{
+  for (int i = 0; i < 6; i += 2) {
+    bv[i] = FLT_MAX;
+    bv[i + 1] = -FLT_MAX;
+  }
+}
+
+BLI_INLINE void bvh_sah_bv_join(float bv[6], const float other_bv[6])
+{
+  for (int i = 0; i < 6; i += 2) {
+    bv[i] = min_ff(bv[i], other_bv[i]);
+    bv[i + 1] = max_ff(bv[i + 1], other_bv[i + 1]);
+  }
+}
+
+static void bvh_sah_center_bounds_cb(void *__restrict userdata,
+                                     const int i,
+                                     const TaskParallelTLS *__restrict tls)
+{
+  const BVHSAHBinData *data = userdata;
+  float(*center_bounds)[3] = tls->userdata_chunk;
+  const BVHNode *leaf = data->leafs_array[data->begin + i];
+  for (int axis = 0; axis < 3; axis++) {
+    const float center = bvh_sah_leaf_center(leaf, axis);
+    center_bounds[0][axis] = min_ff(center_bounds[0][axis], center);
+    center_bounds[1][axis] = max_ff(center_bounds[1][axis], center);
+  }
+}
+
+static void bvh_sah_center_bounds_finalize(void *__restrict userdata,
+                                           void *__restrict userdata_chunk)
+{
+  BVHSAHBinData *data = userdata;
+  float(*center_bounds)[3] = userdata_chunk;
+  for (int axis = 0; axis < 3; axis++) {
+    data->center_bounds[0][axis] = min_ff(data->center_bounds[0][axis], center_bounds[0][axis]);
+    data->center_bounds[1][axis] = max_ff(data->center_bounds[1][axis], center_bounds[1][axis]);
+  }
+}
+
+static void bvh_sah_bins_fill_cb(void *__restrict userdata,
+                                 const int i,
+                                 const TaskParallelTLS *__restrict tls)
+{
+  const BVHSAHBinData *data = userdata;
+  BVHSAHBin *bins = tls->userdata_chunk;
+  const BVHNode *leaf = data->leafs_array[data->begin + i];
+  BVHSAHBin *bin = &bins[bvh_sah_leaf_bin(data, leaf)];
+  bvh_sah_bv_join(bin->bv, leaf->bv);
+  bin->count++;
+}
+
+static void bvh_sah_bins_fill_finalize(void *__restrict userdata, void *__restrict userdata_chunk)
+{
+  BVHSAHBinData *data = userdata;
+  const BVHSAHBin *bins = userdata_chunk;
+  for (int i = 0; i < KDOPBVH_SAH_BINS; i++) {
+    bvh_sah_bv_join(data->bins[i].bv, bins[i].bv);
+    data->bins[i].count += bins[i].count;
+  }
+}
+
+static void bvh_sah_leafs_bv(BVHNode **leafs_array, int begin, int end, float r_bv[6])
+{
+  bvh_sah_bv_init(r_bv);
+  for (int i = begin; i < end; i++) {
+    bvh_sah_bv_join(r_bv, leafs_array[i]->bv);
+  }
+}
+
+/**
+ * Split the leafs in [begin, end) in two parts, either with the surface area heuristic or at
+ * the median when \a use_median is set or no good split can be found.
+ *
+ * \param r_bv: The x/y/z bounds of both parts.
+ * \return The first leaf of the second part.
+ */
+static int bvh_sah_split(const BVHTree *tree,
+                         BVHNode **leafs_array,
+                         int begin,
+                         int end,
+                         bool use_median,
+                         float r_bv[2][6])
+{
+  BVHSAHBinData data = {
+      .leafs_array = leafs_array,
+      .begin = begin,
+  };
+  const int num_leafs = end - begin;
+
+  TaskParallelSettings settings;
+  BLI_parallel_range_settings_defaults(&settings);
+  settings.use_threading = (num_leafs > KDOPBVH_THREAD_LEAF_THRESHOLD);
+
+  /* Split along the axis with the largest spread of leaf centers. */
+  float center_bounds[2][3];
+  INIT_MINMAX(data.center_bounds[0], data.center_bounds[1]);
+  INIT_MINMAX(center_bounds[0], center_bounds[1]);
+  settings.userdata_chunk = center_bounds;
+  settings.userdata_chunk_size = sizeof(center_bounds);
+  settings.func_finalize = bvh_sah_center_bounds_finalize;
+  BLI_task_parallel_range(0, num_leafs, &data, bvh_sah_center_bounds_cb, &settings);
+
+  float extent[3];
+  sub_v3_v3v3(extent, data.center_bounds[1], data.center_bounds[0]);
+  const int axis = (int)max_axis_v3(extent);
+
+  if (!(extent[axis] > 0.0f)) {
+    /* All centers are the same, any split is as good. */
+    const int mid = begin + num_leafs / 2;
+    bvh_sah_leafs_bv(leafs_array, begin, mid, r_bv[0]);
+    bvh_sah_leafs_bv(leafs_array, mid, end, r_bv[1]);
+    return mid;
+  }
+
+  int best_bin = -1;
+  if (!use_median) {
+    data.axis = axis;
+    data.center_min = data.center_bounds[0][axis];
+    data.center_scale = (float)KDOPBVH_SAH_BINS / extent[axis];
+
+    BVHSAHBin bins[KDOPBVH_SAH_BINS];
+    for (int i = 0; i < KDOPBVH_SAH_BINS; i++) {
+      bvh_sah_bv_init(data.bins[i].bv);
+      data.bins[i].count = 0;
+    }
+    memcpy(bins, data.bins, sizeof(bins));
+    settings.userdata_chunk = bins;
+    settings.userdata_chunk_size = sizeof(bins);
+    settings.func_finalize = bvh_sah_bins_fill_finalize;
+    BLI_task_parallel_range(0, num_leafs, &data, bvh_sah_bins_fill_cb, &settings);
+
+    /* Bounds of the part after each bin boundary, then find the cheapest boundary. */
+    float right_bv[KDOPBVH_SAH_BINS][6];
+    float bv[6];
+    bvh_sah_bv_init(bv);
+    for (int i = KDOPBVH_SAH_BINS - 1; i > 0; i--) {
+      bvh_sah_bv_join(bv, data.bins[i].bv);
+      memcpy(right_bv[i], bv, sizeof(bv));
+    }
+
+    /* Leafs are counted by groups of the tree type, the number of branches they end up in,
+     * to favor full branches. */
+    const int tree_type = tree->tree_type;
+    float best_cost = FLT_MAX;
+    int count = 0;
+    bvh_sah_bv_init(bv);
+    for (int i = 0; i < KDOPBVH_SAH_BINS - 1; i++) {
+      bvh_sah_bv_join(bv, data.bins[i].bv);
+      count += data.bins[i].count;
+      if (count == 0 || count == num_leafs) {
+        continue;
+      }
+      const float cost = bvh_sah_half_area(bv) * (float)((count + tree_type - 1) / tree_type) +
+                         bvh_sah_half_area(right_bv[i + 1]) *
+                             (float)((num_leafs - count + tree_type - 1) / tree_type);
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_bin = i;
+        memcpy(r_bv[0], bv, sizeof(bv));
+        memcpy(r_bv[1], right_bv[i + 1], sizeof(bv));
+      }
+    }
+  }
+
+  if (best_bin == -1) {
+    const int mid = begin + num_leafs / 2;
+    partition_nth_element(leafs_array, begin, end, mid, axis * 2 + 1);
+    bvh_sah_leafs_bv(leafs_array, begin, mid, r_bv[0]);
+    bvh_sah_leafs_bv(leafs_array, mid, end, r_bv[1]);
+    return mid;
+  }
+
+  /* Move the leafs of the bins up to the best one to the front. */
+  int i = begin, j = end - 1;
+  while (i <= j) {
+    if (bvh_sah_leaf_bin(&data, leafs_array[i]) <= best_bin) {
+      i++;
+    }
+    else {
+      SWAP(BVHNode *, leafs_array[i], leafs_array[j]);
+      j--;
+    }
+  }
+  BLI_assert(i > begin && i < end);
+  return i;
+}
+
+static void bvh_sah_build_node(
+    BVHSAHBuildData *data, BVHNode *node, int begin, int end, int depth, int thread_id);
+
+static void bvh_sah_build_task(TaskPool *__restrict pool, void *taskdata, int thread_id)
+{
+  BVHSAHBuildData *data = BLI_task_pool_userdata(pool);
+  BVHSAHBuildTask *task = taskdata;
+  bvh_sah_build_node(data, task->node, task->begin, task->end, task->depth, thread_id);
+}
+
+static void bvh_sah_build_node(
+    BVHSAHBuildData *data, BVHNode *node, int begin, int end, int depth, int thread_id)
+{
+  const BVHTree *tree = data->tree;
+  const int tree_type = tree->tree_type;
+  const bool use_median = (depth >= KDOPBVH_SAH_MAX_DEPTH);
+
+  refit_kdop_hull(tree, node, begin, end);
+
+  /* Children leafs are groups_begin[i] to groups_begin[i + 1]. */
+  int groups_begin[MAX_TREETYPE + 1];
+  float groups_bv[MAX_TREETYPE][6];
+  int groups_num = 1;
+  groups_begin[0] = begin;
+  groups_begin[1] = end;
+  memcpy(groups_bv[0], node->bv, sizeof(*groups_bv));
+
+  /* Split the group with the largest area, as when collapsing a binary tree. */
+  while (groups_num < tree_type) {
+    int group = -1;
+    float group_half_area = 0.0f;
+    for (int i = 0; i < groups_num; i++) {
+      if (groups_begin[i + 1] - groups_begin[i] > 1) {
+        const float half_area = bvh_sah_half_area(groups_bv[i]);
+        if (group == -1 || half_area > group_half_area) {
+          group = i;
+          group_half_area = half_area;
+        }
+      }
+    }
+    if (group == -1) {
+      break;
+    }
+
+    float bv[2][6];
+    const int mid = bvh_sah_split(
+        tree, data->leafs_array, groups_begin[group], groups_begin[group + 1], use_median, bv);
+    memmove(&groups_begin[group + 2],
+            &groups_begin[group + 1],
+            sizeof(*groups_begin) * (size_t)(groups_num - group));
+    memmove(&groups_bv[group + 2],
+            &groups_bv[group + 1],
+            sizeof(*groups_bv) * (size_t)(groups_num - group - 1));
+    groups_begin[group + 1] = mid;
+    memcpy(groups_bv[group], bv, sizeof(bv));
+    groups_num++;
+  }
+
+  /* Order children along the largest axis, traversal relies on this to visit the children
+   * closest to the ray origin first. */
+  const int main_axis = get_largest_axis(node->bv) / 2;
+  int groups_order[MAX_TREETYPE];
+  float groups_center[MAX_TREETYPE];
+  for (int i = 0; i < groups_num; i++) {
+    groups_center[i] = groups_bv[i][2 * main_axis] + groups_bv[i][2 * main_axis + 1];
+    int j = i;
+    for (; j > 0 && groups_center[groups_order[j - 1]] > groups_center[i]; j--) {
+      groups_order[j] = groups_order[j - 1];
+    }
+    groups_order[j] = i;
+  }
+  node->main_axis = (char)main_axis;
+
+  for (int i = 0; i < groups_num; i++) {
+    const int child_begin = groups_begin[groups_order[i]];
+    const int child_end = groups_begin[groups_order[i] + 1];
+    BVHNode *child;
+    if (child_end - child_begin == 1) {
+      child = data->leafs_array[child_begin];
+    }
+    else {
+      child = &data->branches_array[atomic_fetch_and_add_int32(&data->num_branches, 1)];
+    }
+    node->children[i] = child;
+    child->parent = node;
+  }
+  node->totnode = (char)groups_num;
+
+  for (int i = 0; i < groups_num; i++) {
+    const int child_begin = groups_begin[groups_order[i]];
+    const int child_end = groups_begin[groups_order[i] + 1];
+    if (child_end - child_begin == 1) {
+      continue;
+    }
+    if (data->task_pool != NULL && child_end - child_begin > KDOPBVH_THREAD_LEAF_THRESHOLD) {
+      BVHSAHBuildTask *task = MEM_mallocN(sizeof(*task), __func__);
+      task->node = node->children[i];
+      task->begin = child_begin;
+      task->end = child_end;
+      task->depth = depth + 1;
+      BLI_task_pool_push_from_thread(
+          data->task_pool, bvh_sah_build_task, task, true, NULL, thread_id);
+    }
+    else {
+      bvh_sah_build_node(data, node->children[i], child_begin, child_end, depth + 1, thread_id);
+    }
+  }
+}
+
+/* Make room for the given number of branches, which the implicit build never needs more of. */
+static void bvhtree_ensure_branches_len(BVHTree *tree, const int branches_len)
+{
+  const int numnodes_alloc = (int)(MEM_allocN_len(tree->nodes) / sizeof(*tree->nodes));
+  const int numnodes = tree->totleaf + branches_len + tree->tree_type;
+  if (numnodes <= numnodes_alloc) {
+    return;
+  }
+
+  const size_t numnodes_size = (size_t)numnodes;
+  tree->nodes = MEM_recallocN(tree->nodes, sizeof(*tree->nodes) * numnodes_size);
+  tree->nodebv = MEM_recallocN(tree->nodebv,
+                               sizeof(*tree->nodebv) * (size_t)tree->axis * numnodes_size);
+  tree->nodechild = MEM_recallocN(
+      tree->nodechild, sizeof(*tree->nodechild) * (size_t)tree->tree_type * numnodes_size);
+  tree->nodearray = MEM_recallocN(tree->nodearray, sizeof(*tree->nodearray) * numnodes_size);
+
+  /* Link the moved arrays again, leafs are not balanced yet so they are still in order. */
+  for (int i = 0; i < numnodes; i++) {
+    tree->nodearray[i].bv = &tree->nodebv[i * tree->axis];
+    tree->nodearray[i].children = &tree->nodechild[i * tree->tree_type];
+  }
+  for (int i = 0; i < tree->totleaf; i++) {
+    tree->nodes[i] = &tree->nodearray[i];
+  }
+}
+
+/**
+ * Build the tree with the SAH, returns the number of branches.
+ */
+static int bvh_sah_build(BVHTree *tree)
+{
+  /* Any branch has at least two children. */
+  bvhtree_ensure_branches_len(tree, tree->totleaf - 1);
+
+  BVHSAHBuildData data = {
+      .tree = tree,
+      .leafs_array = tree->nodes,
+      .branches_array = tree->nodearray + tree->totleaf,
+      .num_branches = 1,
+      .task_pool = NULL,
+  };
+
+  BVHNode *root = &data.branches_array[0];
+  root->parent = NULL;
+
+  if (tree->totleaf > KDOPBVH_THREAD_LEAF_THRESHOLD) {
+    data.task_pool = BLI_task_pool_create(BLI_task_scheduler_get(), &data, TASK_PRIORITY_HIGH);
+    bvh_sah_build_node(
+        &data, root, 0, tree->totleaf, 0, BLI_task_pool_creator_thread_id(data.task_pool));
+    BLI_task_pool_work_and_wait(data.task_pool);
+    BLI_task_pool_free(data.task_pool);
+  }
+  else {
+    bvh_sah_build_node(&data, root, 0, tree->totleaf, 0, 0);
+  }
+
+  return data.num_branches;
+}
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name Wide Nodes
+ *
+ * With #BVH_BALANCE_WIDE the x/y/z bounds of the children of each branch are stored together,
+ * in rows of tree_type floats: x min, x max, y min, y max, z min and z max of all children.
+ * Ray-casts and nearest queries then test all children of a branch at once, ray-casts visit
+ * the closest children first. The results are the same as testing the children one by one.
+ * \{ */
+
+BLI_INLINE bool bvhtree_use_wide(const BVHTree *tree)
+{
+  return ELEM(tree->tree_type, 4, 8) && tree->start_axis == 0 && tree->totbranch > 0;
+}
+
+BLI_INLINE float *bvhtree_wide_bv(const BVHTree *tree, const BVHNode *node)
+{
+  const size_t branch_index = (size_t)(node - tree->nodearray) - (size_t)tree->totleaf;
+  return tree->nodebv_wide + branch_index * 6 * (size_t)tree->tree_type;
+}
+
+static void bvhtree_wide_update_node(const BVHTree *tree, const BVHNode *node)
+{
+  const int tree_type = tree->tree_type;
+  float *wide_bv = bvhtree_wide_bv(tree, node);
+  for (int j = 0; j < tree_type; j++) {
+    for (int bound = 0; bound < 6; bound += 2) {
+      /* Unused children get empty bounds. */
+      wide_bv[bound * tree_type + j] = (j < node->totnode) ? node->children[j]->bv[bound] :
+                                                             FLT_MAX;
+      wide_bv[(bound + 1) * tree_type + j] = (j < node->totnode) ?
+                                                 node->children[j]->bv[bound + 1] :
+                                                 -FLT_MAX;
+    }
+  }
+}
+
+static void bvhtree_wide_update(BVHTree *tree)
+{
+  for (int i = 0; i < tree->totbranch; i++) {
+    bvhtree_wide_update_node(tree, tree->nodes[tree->totleaf + i]);
+  }
+}
+
+static void bvhtree_wide_create(BVHTree *tree)
+{
+  tree->nodebv_wide = MEM_mallocN_aligned(
+      sizeof(float) * 6 * (size_t)tree->tree_type * (size_t)tree->totbranch, 16, __func__);
+  bvhtree_wide_update(tree);
+}
+
+/** \} */
+
 /* -------------------------------------------------------------------- */
 /** \name BLI_bvhtree API
  * \{ */
@@ -945,11 +1442,21 @@ void BLI_bvhtree_free(BVHTree *tree)
     MEM_SAFE_FREE(tree->nodearray);
     MEM_SAFE_FREE(tree->nodebv);
     MEM_SAFE_FREE(tree->nodechild);
+    MEM_SAFE_FREE(tree->nodebv_wide);
     MEM_freeN(tree);
   }
 }
 
 void BLI_bvhtree_balance(BVHTree *tree)
+{
+  BLI_bvhtree_balance_ex(tree, 0);
+}
+
+/**
+ * \param flag: #BVH_BALANCE_SAH, #BVH_BALANCE_WIDE, both only apply to trees using the
+ * x/y/z axes first (axis 6, 8, 14 or 26), other trees are built as with #BLI_bvhtree_balance.
+ */
+void BLI_bvhtree_balance_ex(BVHTree *tree, const int flag)
 {
   BVHNode **leafs_array = tree->nodes;
 
@@ -957,17 +1464,26 @@ void BLI_bvhtree_balance(BVHTree *tree)
    * (some big bug goes here if its being called more than once per tree) */
   BLI_assert(tree->totbranch == 0);
 
-  /* Build the implicit tree */
-  non_recursive_bvh_div_nodes(
-      tree, tree->nodearray + (tree->totleaf - 1), leafs_array, tree->totleaf);
+  if ((flag & BVH_BALANCE_SAH) && tree->start_axis == 0 && tree->totleaf >= 2) {
+    tree->totbranch = bvh_sah_build(tree);
+  }
+  else {
+    /* Build the implicit tree */
+    non_recursive_bvh_div_nodes(
+        tree, tree->nodearray + (tree->totleaf - 1), leafs_array, tree->totleaf);
+    tree->totbranch = implicit_needed_branches(tree->tree_type, tree->totleaf);
+  }
 
   /* current code expects the branches to be linked to the nodes array
    * we perform that linkage here */
-  tree->totbranch = implicit_needed_branches(tree->tree_type, tree->totleaf);
   for (int i = 0; i < tree->totbranch; i++) {
     tree->nodes[tree->totleaf + i] = &tree->nodearray[tree->totleaf + i];
   }
 
+  if ((flag & BVH_BALANCE_WIDE) && bvhtree_use_wide(tree)) {
+    bvhtree_wide_create(tree);
+  }
+
 #ifdef USE_SKIP_LINKS
   build_skip_links(tree, tree->nodes[tree->totleaf], NULL, NULL);
 #endif
@@ -1045,7 +1561,159 @@ void BLI_bvhtree_update_tree(BVHTree *tree)
   for (; index >= root; index--) {
     node_join(tree, *index);
   }
+
+  if (tree->nodebv_wide) {
+    bvhtree_wide_update(tree);
+  }
+}
+
+/* Number of sub-trees refit in parallel by #BLI_bvhtree_refit, the levels above them are joined
+ * afterwards, they only hold a small part of the branches. */
+#define KDOPBVH_REFIT_SUBTREES 64
+
+typedef struct BVHRefitData {
+  BVHTree *tree;
+  BVHTree_RefitCallback callback;
+  void *userdata;
+  BVHNode **subtrees;
+} BVHRefitData;
+
+static void bvhtree_refit_node(const BVHRefitData *data, BVHNode *node)
+{
+  BVHTree *tree = data->tree;
+
+  if (node->totnode == 0) {
+    float co[BVH_REFIT_POINTS_MAX][3];
+    const int numpoints = data->callback(data->userdata, node->index, co);
+    BLI_assert(numpoints > 0 && numpoints <= BVH_REFIT_POINTS_MAX);
+    create_kdop_hull(tree, node, co[0], numpoints, 0);
+
+    /* inflate the bv with some epsilon */
+    for (axis_t axis_iter = tree->start_axis; axis_iter < tree->stop_axis; axis_iter++) {
+      node->bv[(2 * axis_iter)] -= tree->epsilon;     /* minimum */
+      node->bv[(2 * axis_iter) + 1] += tree->epsilon; /* maximum */
+    }
+    return;
+  }
+
+  for (int i = 0; i < node->totnode; i++) {
+    bvhtree_refit_node(data, node->children[i]);
+  }
+  node_join(tree, node);
+  if (tree->nodebv_wide) {
+    bvhtree_wide_update_node(tree, node);
+  }
+}
+
+/* Collect the nodes at `depth` (or leafs above it) in `subtrees`. */
+static void bvhtree_refit_collect(BVHNode *node, const int depth, BVHNode **subtrees, int *len)
+{
+  if (depth == 0 || node->totnode == 0) {
+    subtrees[(*len)++] = node;
+    return;
+  }
+  for (int i = 0; i < node->totnode; i++) {
+    bvhtree_refit_collect(node->children[i], depth - 1, subtrees, len);
+  }
+}
+
+/* Join the levels above the sub-trees, bottom-up. */
+static void bvhtree_refit_join(BVHTree *tree, BVHNode *node, const int depth)
+{
+  if (depth == 0 || node->totnode == 0) {
+    return;
+  }
+  for (int i = 0; i < node->totnode; i++) {
+    bvhtree_refit_join(tree, node->children[i], depth - 1);
+  }
+  node_join(tree, node);
+  if (tree->nodebv_wide) {
+    bvhtree_wide_update_node(tree, node);
+  }
+}
+
+static void bvhtree_refit_task_cb(void *__restrict userdata,
+                                  const int i,
+                                  const TaskParallelTLS *__restrict UNUSED(tls))
+{
+  const BVHRefitData *data = userdata;
+  bvhtree_refit_node(data, data->subtrees[i]);
+}
+
+/**
+ * Refit the tree after the items moved, without changing its structure.
+ *
+ * Unlike #BLI_bvhtree_update_node and #BLI_bvhtree_update_tree, the leafs and branches are
+ * updated in parallel, sub-trees are handled by separate tasks.
+ * Refitting keeps the tree valid, but queries get slower when items move far from the items
+ * they were grouped with, see #BLI_bvhtree_cost to decide when to rebuild the tree.
+ *
+ * \param callback: Gets the points of the item of each leaf, it's called from multiple threads.
+ */
+void BLI_bvhtree_refit(BVHTree *tree, BVHTree_RefitCallback callback, void *userdata)
+{
+  if (tree->totbranch == 0) {
+    return;
+  }
+
+  BVHNode *root = tree->nodes[tree->totleaf];
+
+  int depth = 0;
+  for (int subtrees_max = 1; subtrees_max < KDOPBVH_REFIT_SUBTREES; depth++) {
+    subtrees_max *= tree->tree_type;
+  }
+
+  int subtrees_len = 1;
+  for (int i = 0; i < depth; i++) {
+    subtrees_len *= tree->tree_type;
+  }
+
+  BVHRefitData data = {
+      .tree = tree,
+      .callback = callback,
+      .userdata = userdata,
+      .subtrees = MEM_mallocN(sizeof(BVHNode *) * (size_t)subtrees_len, __func__),
+  };
+
+  subtrees_len = 0;
+  bvhtree_refit_collect(root, depth, data.subtrees, &subtrees_len);
+
+  TaskParallelSettings settings;
+  BLI_parallel_range_settings_defaults(&settings);
+  settings.use_threading = (tree->totleaf > KDOPBVH_THREAD_LEAF_THRESHOLD);
+  settings.scheduling_mode = TASK_SCHEDULING_DYNAMIC;
+  BLI_task_parallel_range(0, subtrees_len, &data, bvhtree_refit_task_cb, &settings);
+
+  bvhtree_refit_join(tree, root, depth);
+
+  MEM_freeN(data.subtrees);
 }
+
+/**
+ * Expected cost of a query relative to testing the root node, the sum of the surface areas of
+ * the branches divided by the area of the root (only the x/y/z axes are taken into account).
+ *
+ * The value doesn't mean much by itself, refitting a tree after large deformations increases it
+ * compared to the value when the tree was built. Trees not using the x/y/z axes return zero.
+ */
+float BLI_bvhtree_cost(const BVHTree *tree)
+{
+  if (tree->totbranch == 0 || tree->start_axis != 0) {
+    return 0.0f;
+  }
+
+  const float root_area = bvh_sah_half_area(tree->nodes[tree->totleaf]->bv);
+  if (root_area <= 0.0f) {
+    return 1.0f;
+  }
+
+  float area = 0.0f;
+  for (int i = 0; i < tree->totbranch; i++) {
+    area += bvh_sah_half_area(tree->nodes[tree->totleaf + i]->bv);
+  }
+  return area / root_area;
+}
+
 /**
  * Number of times #BLI_bvhtree_insert has been called.
  * mainly useful for asserts functions to check we added the correct number.
@@ -1416,6 +2084,42 @@ static float calc_nearest_point_squared(const float proj[3], BVHNode *node, floa
   return len_squared_v3v3(proj, nearest);
 }
 
+/**
+ * #calc_nearest_point_squared for all children of a branch of a wide tree.
+ */
+static void calc_nearest_point_squared_wide(const BVHTree *tree,
+                                            const float proj[3],
+                                            const BVHNode *node,
+                                            float r_dist_sq[MAX_TREETYPE])
+{
+  const int tree_type = tree->tree_type;
+  const float *wide_bv = bvhtree_wide_bv(tree, node);
+
+#ifdef __SSE2__
+  for (int j = 0; j < tree_type; j += 4) {
+    __m128 dist_sq = _mm_setzero_ps();
+    for (int i = 0; i != 3; i++) {
+      const __m128 co = _mm_set1_ps(proj[i]);
+      const __m128 bv_min = _mm_load_ps(&wide_bv[(2 * i) * tree_type + j]);
+      const __m128 bv_max = _mm_load_ps(&wide_bv[(2 * i + 1) * tree_type + j]);
+      const __m128 delta = _mm_sub_ps(co, _mm_min_ps(bv_max, _mm_max_ps(bv_min, co)));
+      dist_sq = (i == 0) ? _mm_mul_ps(delta, delta) :
+                           _mm_add_ps(dist_sq, _mm_mul_ps(delta, delta));
+    }
+    _mm_storeu_ps(&r_dist_sq[j], dist_sq);
+  }
+#else
+  for (int j = 0; j < node->totnode; j++) {
+    float nearest[3];
+    for (int i = 0; i != 3; i++) {
+      nearest[i] = min_ff(wide_bv[(2 * i + 1) * tree_type + j],
+                          max_ff(wide_bv[(2 * i) * tree_type + j], proj[i]));
+    }
+    r_dist_sq[j] = len_squared_v3v3(proj, nearest);
+  }
+#endif
+}
+
 /* Depth first search method */
 static void dfs_find_nearest_dfs(BVHNearestData *data, BVHNode *node)
 {
@@ -1432,12 +2136,21 @@ static void dfs_find_nearest_dfs(BVHNearestData *data, BVHNode *node)
     /* Better heuristic to pick the closest node to dive on */
     int i;
     float nearest[3];
+    float dist_sq[MAX_TREETYPE];
+
+    if (data->tree->nodebv_wide) {
+      calc_nearest_point_squared_wide(data->tree, data->proj, node, dist_sq);
+    }
+    else {
+      for (i = 0; i != node->totnode; i++) {
+        dist_sq[i] = calc_nearest_point_squared(data->proj, node->children[i], nearest);
+      }
+    }
 
     if (data->proj[node->main_axis] <= node->children[0]->bv[node->main_axis * 2 + 1]) {
 
       for (i = 0; i != node->totnode; i++) {
-        if (calc_nearest_point_squared(data->proj, node->children[i], nearest) >=
-            data->nearest.dist_sq) {
+        if (dist_sq[i] >= data->nearest.dist_sq) {
           continue;
         }
         dfs_find_nearest_dfs(data, node->children[i]);
@@ -1445,8 +2158,7 @@ static void dfs_find_nearest_dfs(BVHNearestData *data, BVHNode *node)
     }
     else {
       for (i = node->totnode - 1; i >= 0; i--) {
-        if (calc_nearest_point_squared(data->proj, node->children[i], nearest) >=
-            data->nearest.dist_sq) {
+        if (dist_sq[i] >= data->nearest.dist_sq) {
           continue;
         }
         dfs_find_nearest_dfs(data, node->children[i]);
@@ -1479,12 +2191,20 @@ static void heap_find_nearest_inner(BVHNearestData *data, HeapSimple *heap, BVHN
   }
   else {
     float nearest[3];
+    float dist_sq[MAX_TREETYPE];
 
-    for (int i = 0; i != node->totnode; i++) {
-      float dist_sq = calc_nearest_point_squared(data->proj, node->children[i], nearest);
+    if (data->tree->nodebv_wide) {
+      calc_nearest_point_squared_wide(data->tree, data->proj, node, dist_sq);
+    }
+    else {
+      for (int i = 0; i != node->totnode; i++) {
+        dist_sq[i] = calc_nearest_point_squared(data->proj, node->children[i], nearest);
+      }
+    }
 
-      if (dist_sq < data->nearest.dist_sq) {
-        BLI_heapsimple_insert(heap, dist_sq, node->children[i]);
+    for (int i = 0; i != node->totnode; i++) {
+      if (dist_sq[i] < data->nearest.dist_sq) {
+        BLI_heapsimple_insert(heap, dist_sq[i], node->children[i]);
       }
     }
   }
@@ -1737,18 +2457,102 @@ static float fast_ray_nearest_hit(const BVHRayCastData *data, const BVHNode *nod
   }
 }
 
-static void dfs_raycast(BVHRayCastData *data, BVHNode *node)
-{
-  int i;
+/**
+ * #fast_ray_nearest_hit for all children of a branch of a wide tree.
+ */
+static void fast_ray_nearest_hit_wide(const BVHRayCastData *data,
+                                      const BVHNode *node,
+                                      float r_dist[MAX_TREETYPE])
+{
+  const int tree_type = data->tree->tree_type;
+  const float *wide_bv = bvhtree_wide_bv(data->tree, node);
+  const float *bv[6];
+  for (int i = 0; i < 6; i++) {
+    bv[i] = &wide_bv[data->index[i] * tree_type];
+  }
+
+#ifdef __SSE2__
+  const __m128 origin_x = _mm_set1_ps(data->ray.origin[0]);
+  const __m128 origin_y = _mm_set1_ps(data->ray.origin[1]);
+  const __m128 origin_z = _mm_set1_ps(data->ray.origin[2]);
+  const __m128 idot_x = _mm_set1_ps(data->idot_axis[0]);
+  const __m128 idot_y = _mm_set1_ps(data->idot_axis[1]);
+  const __m128 idot_z = _mm_set1_ps(data->idot_axis[2]);
+  const __m128 hit_dist = _mm_set1_ps(data->hit.dist);
+  const __m128 zero = _mm_setzero_ps();
+
+  for (int j = 0; j < tree_type; j += 4) {
+    const __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bv[0] + j), origin_x), idot_x);
+    const __m128 t2x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bv[1] + j), origin_x), idot_x);
+    const __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bv[2] + j), origin_y), idot_y);
+    const __m128 t2y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bv[3] + j), origin_y), idot_y);
+    const __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bv[4] + j), origin_z), idot_z);
+    const __m128 t2z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bv[5] + j), origin_z), idot_z);
+
+    /* Same tests as #fast_ray_nearest_hit. */
+    __m128 miss = _mm_or_ps(_mm_cmpgt_ps(t1x, t2y), _mm_cmplt_ps(t2x, t1y));
+    miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmpgt_ps(t1x, t2z), _mm_cmplt_ps(t2x, t1z)));
+    miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmpgt_ps(t1y, t2z), _mm_cmplt_ps(t2y, t1z)));
+    miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmplt_ps(t2x, zero), _mm_cmplt_ps(t2y, zero)));
+    miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmplt_ps(t2z, zero), _mm_cmpgt_ps(t1x, hit_dist)));
+    miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmpgt_ps(t1y, hit_dist), _mm_cmpgt_ps(t1z, hit_dist)));
+
+    const __m128 dist = _mm_max_ps(_mm_max_ps(t1x, t1y), t1z);
+    _mm_storeu_ps(&r_dist[j],
+                  _mm_or_ps(_mm_and_ps(miss, _mm_set1_ps(FLT_MAX)), _mm_andnot_ps(miss, dist)));
+  }
+#else
+  for (int j = 0; j < node->totnode; j++) {
+    const float t1x = (bv[0][j] - data->ray.origin[0]) * data->idot_axis[0];
+    const float t2x = (bv[1][j] - data->ray.origin[0]) * data->idot_axis[0];
+    const float t1y = (bv[2][j] - data->ray.origin[1]) * data->idot_axis[1];
+    const float t2y = (bv[3][j] - data->ray.origin[1]) * data->idot_axis[1];
+    const float t1z = (bv[4][j] - data->ray.origin[2]) * data->idot_axis[2];
+    const float t2z = (bv[5][j] - data->ray.origin[2]) * data->idot_axis[2];
+
+    if ((t1x > t2y || t2x < t1y || t1x > t2z || t2x < t1z || t1y > t2z || t2y < t1z) ||
+        (t2x < 0.0f || t2y < 0.0f || t2z < 0.0f) ||
+        (t1x > data->hit.dist || t1y > data->hit.dist || t1z > data->hit.dist)) {
+      r_dist[j] = FLT_MAX;
+    }
+    else {
+      r_dist[j] = max_fff(t1x, t1y, t1z);
+    }
+  }
+#endif
+}
 
-  /* ray-bv is really fast.. and simple tests revealed its worth to test it
-   * before calling the ray-primitive functions */
-  /* XXX: temporary solution for particles until fast_ray_nearest_hit supports ray.radius */
-  float dist = (data->ray.radius == 0.0f) ? fast_ray_nearest_hit(data, node) :
-                                            ray_nearest_hit(data, node->bv);
-  if (dist >= data->hit.dist) {
-    return;
+/**
+ * Distances to the bounding volumes of the children of \a node,
+ * the children of wide trees are tested all at once.
+ */
+static void ray_nearest_hit_children(const BVHRayCastData *data,
+                                     const BVHNode *node,
+                                     float r_dist[MAX_TREETYPE])
+{
+  if (data->ray.radius == 0.0f) {
+    if (data->tree->nodebv_wide) {
+      fast_ray_nearest_hit_wide(data, node, r_dist);
+    }
+    else {
+      for (int i = 0; i != node->totnode; i++) {
+        r_dist[i] = fast_ray_nearest_hit(data, node->children[i]);
+      }
+    }
   }
+  else {
+    for (int i = 0; i != node->totnode; i++) {
+      r_dist[i] = ray_nearest_hit(data, node->children[i]->bv);
+    }
+  }
+}
+
+/**
+ * \param dist: The distance to the bounding volume of \a node, known to be closer than the hit.
+ */
+static void dfs_raycast_node(BVHRayCastData *data, BVHNode *node, float dist)
+{
+  int i;
 
   if (node->totnode == 0) {
     if (data->callback) {
@@ -1761,27 +2565,48 @@ static void dfs_raycast(BVHRayCastData *data, BVHNode *node)
     }
   }
   else {
+    /* Distances of all children are known before visiting any of them,
+     * compare them with the hit again as it may have gotten closer since. */
+    float children_dist[MAX_TREETYPE];
+    ray_nearest_hit_children(data, node, children_dist);
+
+    if (data->tree->nodebv_wide) {
+      /* Visit the closest children first, all distances are known already. */
+      int order[MAX_TREETYPE];
+      for (i = 0; i != node->totnode; i++) {
+        int j = i;
+        for (; j > 0 && children_dist[order[j - 1]] > children_dist[i]; j--) {
+          order[j] = order[j - 1];
+        }
+        order[j] = i;
+      }
+      for (i = 0; i != node->totnode; i++) {
+        if (children_dist[order[i]] >= data->hit.dist) {
+          break;
+        }
+        dfs_raycast_node(data, node->children[order[i]], children_dist[order[i]]);
+      }
+    }
     /* pick loop direction to dive into the tree (based on ray direction and split axis) */
-    if (data->ray_dot_axis[node->main_axis] > 0.0f) {
+    else if (data->ray_dot_axis[node->main_axis] > 0.0f) {
       for (i = 0; i != node->totnode; i++) {
-        dfs_raycast(data, node->children[i]);
+        if (children_dist[i] < data->hit.dist) {
+          dfs_raycast_node(data, node->children[i], children_dist[i]);
+        }
       }
     }
     else {
       for (i = node->totnode - 1; i >= 0; i--) {
-        dfs_raycast(data, node->children[i]);
+        if (children_dist[i] < data->hit.dist) {
+          dfs_raycast_node(data, node->children[i], children_dist[i]);
+        }
       }
     }
   }
 }
 
-/**
- * A version of #dfs_raycast with minor changes to reset the index & dist each ray cast.
- */
-static void dfs_raycast_all(BVHRayCastData *data, BVHNode *node)
+static void dfs_raycast(BVHRayCastData *data, BVHNode *node)
 {
-  int i;
-
   /* ray-bv is really fast.. and simple tests revealed its worth to test it
    * before calling the ray-primitive functions */
   /* XXX: temporary solution for particles until fast_ray_nearest_hit supports ray.radius */
@@ -1790,6 +2615,15 @@ static void dfs_raycast_all(BVHRayCastData *data, BVHNode *node)
   if (dist >= data->hit.dist) {
     return;
   }
+  dfs_raycast_node(data, node, dist);
+}
+
+/**
+ * A version of #dfs_raycast_node with minor changes to reset the index & dist each ray cast.
+ */
+static void dfs_raycast_all_node(BVHRayCastData *data, BVHNode *node, float dist)
+{
+  int i;
 
   if (node->totnode == 0) {
     /* no need to check for 'data->callback' (using 'all' only makes sense with a callback). */
@@ -1799,20 +2633,37 @@ static void dfs_raycast_all(BVHRayCastData *data, BVHNode *node)
     data->hit.dist = dist;
   }
   else {
+    float children_dist[MAX_TREETYPE];
+    ray_nearest_hit_children(data, node, children_dist);
+
     /* pick loop direction to dive into the tree (based on ray direction and split axis) */
     if (data->ray_dot_axis[node->main_axis] > 0.0f) {
       for (i = 0; i != node->totnode; i++) {
-        dfs_raycast_all(data, node->children[i]);
+        if (children_dist[i] < data->hit.dist) {
+          dfs_raycast_all_node(data, node->children[i], children_dist[i]);
+        }
       }
     }
     else {
       for (i = node->totnode - 1; i >= 0; i--) {
-        dfs_raycast_all(data, node->children[i]);
+        if (children_dist[i] < data->hit.dist) {
+          dfs_raycast_all_node(data, node->children[i], children_dist[i]);
+        }
       }
     }
   }
 }
 
+static void dfs_raycast_all(BVHRayCastData *data, BVHNode *node)
+{
+  float dist = (data->ray.radius == 0.0f) ? fast_ray_nearest_hit(data, node) :
+                                            ray_nearest_hit(data, node->bv);
+  if (dist >= data->hit.dist) {
+    return;
+  }
+  dfs_raycast_all_node(data, node, dist);
+}
+
 static void bvhtree_ray_cast_data_precalc(BVHRayCastData *data, int flag)
 {
   int i;
@@ -1989,6 +2840,488 @@ void BLI_bvhtree_ray_cast_all(BVHTree *tree,
 
 /** \} */
 
+/* -------------------------------------------------------------------- */
+/** \name BLI_bvhtree_find_nearest_batch / BLI_bvhtree_ray_cast_batch
+ *
+ * Queries are sorted along a Morton curve of their coordinates (rays by the octant of their
+ * direction first), then processed in packets of #BVH_BATCH_PACKET_SIZE consecutive queries.
+ *
+ * A packet traverses the tree once: each node is tested against the queries of the packet that
+ * reached its parent, only those still closer to the node than to their current result go on to
+ * its children. Nodes are fetched once per packet rather than once per query.
+ *
+ * Each query prunes with its own result only, results are not shared between the queries of a
+ * packet: callbacks may skip elements for some queries, so the result of one query is no bound
+ * for another. Spatial sorting still makes the queries of a packet visit mostly the same nodes.
+ *
+ * \{ */
+
+#define BVH_BATCH_PACKET_SIZE 32
+/* Bits per axis of the Morton codes, the three bits above are used for ray directions. */
+#define BVH_BATCH_MORTON_BITS 9
+/* Largest tree type of wide trees, see #bvhtree_use_wide. */
+#define BVH_BATCH_WIDE_MAX 8
+
+typedef struct BVHBatchKey {
+  uint key;
+  int index;
+} BVHBatchKey;
+
+/* Spread the lower 10 bits of \a v so there are two zero bits between each of them. */
+BLI_INLINE uint bvh_batch_morton_expand(uint v)
+{
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+/**
+ * Order of the queries along a Morton curve.
+ *
+ * \param co, dir: First coordinates and optional direction, following ones are \a stride bytes
+ * apart.
+ * \return Indices of the queries in spatial order, to be freed by the caller.
+ */
+static int *bvh_batch_order(const float *co, const float *dir, const size_t stride, const int len)
+{
+  BVHBatchKey *keys = MEM_mallocN(sizeof(*keys) * (size_t)len, __func__);
+  BVHBatchKey *keys_tmp = MEM_mallocN(sizeof(*keys) * (size_t)len, __func__);
+  int *order = MEM_mallocN(sizeof(*order) * (size_t)len, __func__);
+  float min[3], max[3], scale[3];
+
+  INIT_MINMAX(min, max);
+  for (int i = 0; i < len; i++) {
+    minmax_v3v3_v3(min, max, (const float *)((const char *)co + stride * (size_t)i));
+  }
+  for (int axis = 0; axis < 3; axis++) {
+    const float extent = max[axis] - min[axis];
+    scale[axis] = (extent > 0.0f) ? (float)((1 << BVH_BATCH_MORTON_BITS) - 1) / extent : 0.0f;
+  }
+
+  for (int i = 0; i < len; i++) {
+    const float *v = (const float *)((const char *)co + stride * (size_t)i);
+    uint key = 0;
+    for (int axis = 0; axis < 3; axis++) {
+      key |= bvh_batch_morton_expand((uint)((v[axis] - min[axis]) * scale[axis])) << axis;
+    }
+    if (dir) {
+      const float *d = (const float *)((const char *)dir + stride * (size_t)i);
+      for (int axis = 0; axis < 3; axis++) {
+        key |= (uint)(d[axis] < 0.0f) << (3 * BVH_BATCH_MORTON_BITS + axis);
+      }
+    }
+    keys[i].key = key;
+    keys[i].index = i;
+  }
+
+  /* LSD radix sort, 8 bits at a time. */
+  for (uint shift = 0; shift < 32; shift += 8) {
+    int offset[257] = {0};
+    for (int i = 0; i < len; i++) {
+      offset[((keys[i].key >> shift) & 0xFFu) + 1]++;
+    }
+    for (int i = 1; i < 257; i++) {
+      offset[i] += offset[i - 1];
+    }
+    for (int i = 0; i < len; i++) {
+      keys_tmp[offset[(keys[i].key >> shift) & 0xFFu]++] = keys[i];
+    }
+    SWAP(BVHBatchKey *, keys, keys_tmp);
+  }
+
+  for (int i = 0; i < len; i++) {
+    order[i] = keys[i].index;
+  }
+
+  MEM_freeN(keys);
+  MEM_freeN(keys_tmp);
+  return order;
+}
+
+/**
+ * \param active: The queries of \a packet for which \a node is closer than their current result.
+ */
+static void bvh_nearest_packet_node(BVHNearestData *packet,
+                                    BVHNode *node,
+                                    const uchar *active,
+                                    const int active_len)
+{
+  uchar child_active[BVH_BATCH_PACKET_SIZE];
+  int child_active_len;
+  float nearest[3];
+
+  if (node->totnode == 0) {
+    for (int i = 0; i < active_len; i++) {
+      BVHNearestData *data = &packet[active[i]];
+      if (data->callback) {
+        data->callback(data->userdata, node->index, data->co, &data->nearest);
+      }
+      else {
+        data->nearest.index = node->index;
+        data->nearest.dist_sq = calc_nearest_point_squared(data->proj, node, data->nearest.co);
+      }
+    }
+  }
+  else if (packet[active[0]].tree->nodebv_wide) {
+    /* Test all children for each query with SIMD, then visit the children closest to any query
+     * of the packet first. Wide trees are quad or oct trees. */
+    float children_dist_sq[BVH_BATCH_PACKET_SIZE][BVH_BATCH_WIDE_MAX];
+    float children_dist_sq_min[BVH_BATCH_WIDE_MAX];
+    int order[BVH_BATCH_WIDE_MAX];
+
+    copy_vn_fl(children_dist_sq_min, BVH_BATCH_WIDE_MAX, FLT_MAX);
+    for (int i = 0; i < active_len; i++) {
+      const BVHNearestData *data = &packet[active[i]];
+      calc_nearest_point_squared_wide(data->tree, data->proj, node, children_dist_sq[i]);
+      for (int j = 0; j != node->totnode; j++) {
+        children_dist_sq_min[j] = min_ff(children_dist_sq_min[j], children_dist_sq[i][j]);
+      }
+    }
+
+    for (int i = 0; i != node->totnode; i++) {
+      int j = i;
+      for (; j > 0 && children_dist_sq_min[order[j - 1]] > children_dist_sq_min[i]; j--) {
+        order[j] = order[j - 1];
+      }
+      order[j] = i;
+    }
+
+    for (int j = 0; j != node->totnode; j++) {
+      const int child = order[j];
+      child_active_len = 0;
+      for (int i = 0; i < active_len; i++) {
+        /* Compare with the result again as it may have gotten closer since. */
+        if (children_dist_sq[i][child] < packet[active[i]].nearest.dist_sq) {
+          child_active[child_active_len++] = active[i];
+        }
+      }
+      if (child_active_len != 0) {
+        bvh_nearest_packet_node(packet, node->children[child], child_active, child_active_len);
+      }
+    }
+  }
+  else {
+    /* Same heuristic as #dfs_find_nearest_dfs, for the first query of the packet. */
+    const BVHNearestData *data_first = &packet[active[0]];
+    const bool forward = data_first->proj[node->main_axis] <=
+                         node->children[0]->bv[node->main_axis * 2 + 1];
+    for (int j = 0; j != node->totnode; j++) {
+      BVHNode *child = node->children[forward ? j : node->totnode - 1 - j];
+      child_active_len = 0;
+      for (int i = 0; i < active_len; i++) {
+        const BVHNearestData *data = &packet[active[i]];
+        if (calc_nearest_point_squared(data->proj, child, nearest) < data->nearest.dist_sq) {
+          child_active[child_active_len++] = active[i];
+        }
+      }
+      if (child_active_len != 0) {
+        bvh_nearest_packet_node(packet, child, child_active, child_active_len);
+      }
+    }
+  }
+}
+
+static void bvh_nearest_packet(BVHNearestData *packet, BVHNode *root, const int packet_len)
+{
+  uchar active[BVH_BATCH_PACKET_SIZE];
+  int active_len = 0;
+  float nearest[3];
+
+  for (int i = 0; i < packet_len; i++) {
+    const BVHNearestData *data = &packet[i];
+    if (calc_nearest_point_squared(data->proj, root, nearest) < data->nearest.dist_sq) {
+      active[active_len++] = (uchar)i;
+    }
+  }
+  if (active_len != 0) {
+    bvh_nearest_packet_node(packet, root, active, active_len);
+  }
+}
+
+typedef struct BVHNearestBatchData {
+  const BVHTree *tree;
+  const float (*co)[3];
+  const int *order;
+  int co_len;
+  BVHTreeNearest *nearest;
+  BVHTree_NearestPointCallback callback;
+  void *userdata;
+} BVHNearestBatchData;
+
+static void bvhtree_find_nearest_batch_cb(void *__restrict userdata,
+                                          const int packet_index,
+                                          const TaskParallelTLS *__restrict UNUSED(tls))
+{
+  const BVHNearestBatchData *batch = userdata;
+  const BVHTree *tree = batch->tree;
+  const int begin = packet_index * BVH_BATCH_PACKET_SIZE;
+  const int packet_len = min_ii(BVH_BATCH_PACKET_SIZE, batch->co_len - begin);
+
+  BVHNearestData packet[BVH_BATCH_PACKET_SIZE];
+
+  for (int i = 0; i < packet_len; i++) {
+    const int index = batch->order[begin + i];
+    BVHNearestData *data = &packet[i];
+
+    data->tree = tree;
+    data->co = batch->co[index];
+    data->callback = batch->callback;
+    data->userdata = batch->userdata;
+    for (axis_t axis_iter = tree->start_axis; axis_iter != tree->stop_axis; axis_iter++) {
+      data->proj[axis_iter] = dot_v3v3(data->co, bvhtree_kdop_axes[axis_iter]);
+    }
+    memcpy(&data->nearest, &batch->nearest[index], sizeof(data->nearest));
+  }
+
+  bvh_nearest_packet(packet, tree->nodes[tree->totleaf], packet_len);
+
+  for (int i = 0; i < packet_len; i++) {
+    BVHTreeNearest *nearest = &batch->nearest[batch->order[begin + i]];
+    memcpy(nearest, &packet[i].nearest, sizeof(*nearest));
+  }
+}
+
+void BLI_bvhtree_find_nearest_batch(BVHTree *tree,
+                                    const float (*co)[3],
+                                    int co_len,
+                                    BVHTreeNearest *r_nearest,
+                                    BVHTree_NearestPointCallback callback,
+                                    void *userdata)
+{
+  if (co_len == 0 || tree->nodes[tree->totleaf] == NULL) {
+    return;
+  }
+
+  BVHNearestBatchData batch = {
+      .tree = tree,
+      .co = co,
+      .order = bvh_batch_order(co[0], NULL, sizeof(*co), co_len),
+      .co_len = co_len,
+      .nearest = r_nearest,
+      .callback = callback,
+      .userdata = userdata,
+  };
+
+  TaskParallelSettings settings;
+  BLI_parallel_range_settings_defaults(&settings);
+  settings.use_threading = (co_len > KDOPBVH_THREAD_LEAF_THRESHOLD);
+  BLI_task_parallel_range(0,
+                          (co_len + BVH_BATCH_PACKET_SIZE - 1) / BVH_BATCH_PACKET_SIZE,
+                          &batch,
+                          bvhtree_find_nearest_batch_cb,
+                          &settings);
+
+  MEM_freeN((void *)batch.order);
+}
+
+/**
+ * \param active, dist: The rays of \a packet for which \a node is closer than their current hit,
+ * and the distance to the bounding volume of \a node for each of them.
+ */
+static void bvh_raycast_packet_node(BVHRayCastData *packet,
+                                    BVHNode *node,
+                                    const uchar *active,
+                                    const float *dist,
+                                    const int active_len)
+{
+  uchar child_active[BVH_BATCH_PACKET_SIZE];
+  float child_dist[BVH_BATCH_PACKET_SIZE];
+  int child_active_len;
+
+  if (node->totnode == 0) {
+    for (int i = 0; i < active_len; i++) {
+      BVHRayCastData *data = &packet[active[i]];
+      if (data->callback) {
+        data->callback(data->userdata, node->index, &data->ray, &data->hit);
+      }
+      else {
+        data->hit.index = node->index;
+        data->hit.dist = dist[i];
+        madd_v3_v3v3fl(data->hit.co, data->ray.origin, data->ray.direction, dist[i]);
+      }
+    }
+  }
+  else if (packet[active[0]].tree->nodebv_wide) {
+    /* Test all children for each ray with SIMD, then visit the children closest to any ray of the
+     * packet first. Wide trees are quad or oct trees. */
+    float children_dist[BVH_BATCH_PACKET_SIZE][BVH_BATCH_WIDE_MAX];
+    float children_dist_min[BVH_BATCH_WIDE_MAX];
+    int order[BVH_BATCH_WIDE_MAX];
+
+    copy_vn_fl(children_dist_min, BVH_BATCH_WIDE_MAX, FLT_MAX);
+    for (int i = 0; i < active_len; i++) {
+      const BVHRayCastData *data = &packet[active[i]];
+      if (data->ray.radius == 0.0f) {
+        fast_ray_nearest_hit_wide(data, node, children_dist[i]);
+      }
+      else {
+        for (int j = 0; j != node->totnode; j++) {
+          children_dist[i][j] = ray_nearest_hit(data, node->children[j]->bv);
+        }
+      }
+      for (int j = 0; j != node->totnode; j++) {
+        children_dist_min[j] = min_ff(children_dist_min[j], children_dist[i][j]);
+      }
+    }
+
+    for (int i = 0; i != node->totnode; i++) {
+      int j = i;
+      for (; j > 0 && children_dist_min[order[j - 1]] > children_dist_min[i]; j--) {
+        order[j] = order[j - 1];
+      }
+      order[j] = i;
+    }
+
+    for (int j = 0; j != node->totnode; j++) {
+      const int child = order[j];
+      if (children_dist_min[child] == FLT_MAX) {
+        break;
+      }
+      child_active_len = 0;
+      for (int i = 0; i < active_len; i++) {
+        /* Compare with the hit again as it may have gotten closer since. */
+        if (children_dist[i][child] < packet[active[i]].hit.dist) {
+          child_active[child_active_len] = active[i];
+          child_dist[child_active_len] = children_dist[i][child];
+          child_active_len++;
+        }
+      }
+      if (child_active_len != 0) {
+        bvh_raycast_packet_node(
+            packet, node->children[child], child_active, child_dist, child_active_len);
+      }
+    }
+  }
+  else {
+    /* Same heuristic as #dfs_raycast_node, for the first ray of the packet. */
+    const bool forward = packet[active[0]].ray_dot_axis[node->main_axis] > 0.0f;
+    for (int j = 0; j != node->totnode; j++) {
+      BVHNode *child = node->children[forward ? j : node->totnode - 1 - j];
+      child_active_len = 0;
+      for (int i = 0; i < active_len; i++) {
+        const BVHRayCastData *data = &packet[active[i]];
+        const float d = (data->ray.radius == 0.0f) ? fast_ray_nearest_hit(data, child) :
+                                                     ray_nearest_hit(data, child->bv);
+        if (d < data->hit.dist) {
+          child_active[child_active_len] = active[i];
+          child_dist[child_active_len] = d;
+          child_active_len++;
+        }
+      }
+      if (child_active_len != 0) {
+        bvh_raycast_packet_node(packet, child, child_active, child_dist, child_active_len);
+      }
+    }
+  }
+}
+
+static void bvh_raycast_packet(BVHRayCastData *packet, BVHNode *root, const int packet_len)
+{
+  uchar active[BVH_BATCH_PACKET_SIZE];
+  float dist[BVH_BATCH_PACKET_SIZE];
+  int active_len = 0;
+
+  for (int i = 0; i < packet_len; i++) {
+    const BVHRayCastData *data = &packet[i];
+    const float d = (data->ray.radius == 0.0f) ? fast_ray_nearest_hit(data, root) :
+                                                 ray_nearest_hit(data, root->bv);
+    if (d < data->hit.dist) {
+      active[active_len] = (uchar)i;
+      dist[active_len] = d;
+      active_len++;
+    }
+  }
+  if (active_len != 0) {
+    bvh_raycast_packet_node(packet, root, active, dist, active_len);
+  }
+}
+
+typedef struct BVHRayCastBatchData {
+  const BVHTree *tree;
+  const BVHTreeRay *rays;
+  const int *order;
+  int rays_len;
+  BVHTreeRayHit *hits;
+  BVHTree_RayCastCallback callback;
+  void *userdata;
+  int flag;
+} BVHRayCastBatchData;
+
+static void bvhtree_ray_cast_batch_cb(void *__restrict userdata,
+                                      const int packet_index,
+                                      const TaskParallelTLS *__restrict UNUSED(tls))
+{
+  const BVHRayCastBatchData *batch = userdata;
+  const BVHTree *tree = batch->tree;
+  const int begin = packet_index * BVH_BATCH_PACKET_SIZE;
+  const int packet_len = min_ii(BVH_BATCH_PACKET_SIZE, batch->rays_len - begin);
+
+  BVHRayCastData packet[BVH_BATCH_PACKET_SIZE];
+
+  for (int i = 0; i < packet_len; i++) {
+    const int index = batch->order[begin + i];
+    const BVHTreeRay *ray = &batch->rays[index];
+    BVHRayCastData *data = &packet[i];
+
+    BLI_ASSERT_UNIT_V3(ray->direction);
+
+    data->tree = tree;
+    data->callback = batch->callback;
+    data->userdata = batch->userdata;
+    copy_v3_v3(data->ray.origin, ray->origin);
+    copy_v3_v3(data->ray.direction, ray->direction);
+    data->ray.radius = ray->radius;
+    bvhtree_ray_cast_data_precalc(data, batch->flag);
+    memcpy(&data->hit, &batch->hits[index], sizeof(data->hit));
+  }
+
+  bvh_raycast_packet(packet, tree->nodes[tree->totleaf], packet_len);
+
+  for (int i = 0; i < packet_len; i++) {
+    BVHTreeRayHit *hit = &batch->hits[batch->order[begin + i]];
+    memcpy(hit, &packet[i].hit, sizeof(*hit));
+  }
+}
+
+void BLI_bvhtree_ray_cast_batch(BVHTree *tree,
+                                const BVHTreeRay *rays,
+                                int rays_len,
+                                BVHTreeRayHit *r_hits,
+                                BVHTree_RayCastCallback callback,
+                                void *userdata,
+                                int flag)
+{
+  if (rays_len == 0 || tree->nodes[tree->totleaf] == NULL) {
+    return;
+  }
+
+  BVHRayCastBatchData batch = {
+      .tree = tree,
+      .rays = rays,
+      .order = bvh_batch_order(rays[0].origin, rays[0].direction, sizeof(*rays), rays_len),
+      .rays_len = rays_len,
+      .hits = r_hits,
+      .callback = callback,
+      .userdata = userdata,
+      .flag = flag,
+  };
+
+  TaskParallelSettings settings;
+  BLI_parallel_range_settings_defaults(&settings);
+  settings.use_threading = (rays_len > KDOPBVH_THREAD_LEAF_THRESHOLD);
+  BLI_task_parallel_range(0,
+                          (rays_len + BVH_BATCH_PACKET_SIZE - 1) / BVH_BATCH_PACKET_SIZE,
+                          &batch,
+                          bvhtree_ray_cast_batch_cb,
+                          &settings);
+
+  MEM_freeN((void *)batch.order);
+}
+
+/** \} */
+
 /* -------------------------------------------------------------------- */
 /** \name BLI_bvhtree_range_query
  *
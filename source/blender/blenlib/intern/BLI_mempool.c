@@ -27,6 +27,8 @@
  * - Freeing chunks.
  * - Iterating over allocated chunks
  *   (optionally when using the #BLI_MEMPOOL_ALLOW_ITER flag).
+ * - Allocating and freeing from multiple threads at once
+ *   (optionally when using the #BLI_MEMPOOL_THREADED flag).
  */
 
 #include <stdlib.h>
@@ -86,6 +88,12 @@
 static bool mempool_debug_memset = false;
 #endif
 
+#ifdef _MSC_VER
+#  define MEMPOOL_THREAD_LOCAL __declspec(thread)
+#else
+#  define MEMPOOL_THREAD_LOCAL __thread
+#endif
+
 /**
  * A free element from #BLI_mempool_chunk. Data is cast to this type and stored in
  * #BLI_mempool.free as a single linked list, each item #BLI_mempool.esize large.
@@ -106,6 +114,47 @@ typedef struct BLI_mempool_chunk {
   struct BLI_mempool_chunk *next;
 } BLI_mempool_chunk;
 
+/**
+ * Free elements of a thread, for pools using #BLI_MEMPOOL_THREADED.
+ *
+ * Threads allocate from and free to their own list without synchronization, new elements are
+ * taken a whole chunk at a time. Elements freed by another thread than the one allocating them
+ * stay with the freeing thread.
+ */
+typedef struct BLI_mempool_thread {
+  struct BLI_mempool_thread *next;
+  /** The #mempool_thread_owner_id of the thread using these free elements. */
+  uint64_t owner_id;
+  BLI_freenode *free;
+  /** Number of elements in \a free. */
+  uint totfree;
+  /** Elements allocated minus freed by this thread, negative when freeing more. */
+  int totused;
+} BLI_mempool_thread;
+
+/**
+ * Per-thread lookup of #BLI_mempool_thread, by #BLI_mempool.thread_pool_id.
+ * Ids are never reused, so entries of destroyed pools never match.
+ */
+#define MEMPOOL_THREAD_SLOTS 16
+typedef struct BLI_mempool_thread_slot {
+  uint64_t pool_id;
+  BLI_mempool_thread *thread;
+} BLI_mempool_thread_slot;
+
+static MEMPOOL_THREAD_LOCAL BLI_mempool_thread_slot mempool_thread_slots[MEMPOOL_THREAD_SLOTS];
+static uint64_t mempool_thread_pool_id_last = 0;
+
+/** Unique id of the calling thread, assigned on first use of a threaded pool. */
+static MEMPOOL_THREAD_LOCAL uint64_t mempool_thread_owner_id = 0;
+static uint64_t mempool_thread_owner_id_last = 0;
+
+/**
+ * Free elements a thread keeps before handing a chunk worth of them back to the pool,
+ * in chunks. Threads freeing more than they allocate otherwise hold on to the memory.
+ */
+#define MEMPOOL_THREAD_FREE_CHUNKS_MAX 2
+
 /**
  * The mempool, stores and tracks memory \a chunks and elements within those chunks \a free.
  */
@@ -135,6 +184,22 @@ struct BLI_mempool {
   /** Number of elements allocated in total. */
   uint totalloc;
 #endif
+
+  /* Only used with #BLI_MEMPOOL_THREADED, \a free and \a totused are unused then. */
+
+  /** Unique id, to find the #BLI_mempool_thread of the pool. */
+  uint64_t thread_pool_id;
+  /** Free elements of each thread using the pool. */
+  BLI_mempool_thread *threads;
+  /** Chunks allocated by #BLI_mempool_create or kept by #BLI_mempool_clear, not used by any
+   * thread yet. Their elements are only linked within each chunk. */
+  BLI_mempool_chunk *chunks_unclaimed;
+  uint chunks_unclaimed_len;
+  /** Free elements released by threads, claimed before the unclaimed chunks. */
+  BLI_freenode *free_released;
+  uint free_released_len;
+  /** Protects \a chunks, \a threads, the unclaimed chunks and the released elements. */
+  uint thread_lock;
 };
 
 #define MEMPOOL_ELEM_SIZE_MIN (sizeof(void *) * 2)
@@ -193,13 +258,13 @@ static BLI_mempool_chunk *mempool_chunk_alloc(BLI_mempool *pool)
  * (used when building free chunks initially)
  * \return The last chunk,
  */
+static BLI_freenode *mempool_chunk_nodes_init(BLI_mempool *pool, BLI_mempool_chunk *mpchunk);
+
 static BLI_freenode *mempool_chunk_add(BLI_mempool *pool,
                                        BLI_mempool_chunk *mpchunk,
                                        BLI_freenode *last_tail)
 {
-  const uint esize = pool->esize;
-  BLI_freenode *curnode = CHUNK_DATA(mpchunk);
-  uint j;
+  BLI_freenode *curnode;
 
   /* append */
   if (pool->chunk_tail) {
@@ -213,10 +278,40 @@ static BLI_freenode *mempool_chunk_add(BLI_mempool *pool,
   mpchunk->next = NULL;
   pool->chunk_tail = mpchunk;
 
+  if (pool->flag & BLI_MEMPOOL_THREADED) {
+    /* Each chunk is used by a single thread, don't link it to the previous one. */
+    if (pool->chunks_unclaimed == NULL) {
+      pool->chunks_unclaimed = mpchunk;
+    }
+    pool->chunks_unclaimed_len++;
+    return mempool_chunk_nodes_init(pool, mpchunk);
+  }
+
   if (UNLIKELY(pool->free == NULL)) {
-    pool->free = curnode;
+    pool->free = CHUNK_DATA(mpchunk);
+  }
+
+  curnode = mempool_chunk_nodes_init(pool, mpchunk);
+
+  /* final pointer in the previously allocated chunk is wrong */
+  if (last_tail) {
+    last_tail->next = CHUNK_DATA(mpchunk);
   }
 
+  return curnode;
+}
+
+/**
+ * Link the elements of a chunk into a free list.
+ *
+ * \return The last element.
+ */
+static BLI_freenode *mempool_chunk_nodes_init(BLI_mempool *pool, BLI_mempool_chunk *mpchunk)
+{
+  const uint esize = pool->esize;
+  BLI_freenode *curnode = CHUNK_DATA(mpchunk);
+  uint j;
+
   /* loop through the allocated data, building the pointer structures */
   j = pool->pchunk;
   if (pool->flag & BLI_MEMPOOL_ALLOW_ITER) {
@@ -242,11 +337,6 @@ static BLI_freenode *mempool_chunk_add(BLI_mempool *pool,
   pool->totalloc += pool->pchunk;
 #endif
 
-  /* final pointer in the previously allocated chunk is wrong */
-  if (last_tail) {
-    last_tail->next = CHUNK_DATA(mpchunk);
-  }
-
   return curnode;
 }
 
@@ -316,6 +406,17 @@ BLI_mempool *BLI_mempool_create(uint esize, uint totelem, uint pchunk, uint flag
 #endif
   pool->totused = 0;
 
+  pool->thread_pool_id = 0;
+  pool->threads = NULL;
+  pool->chunks_unclaimed = NULL;
+  pool->chunks_unclaimed_len = 0;
+  pool->free_released = NULL;
+  pool->free_released_len = 0;
+  pool->thread_lock = 0;
+  if (flag & BLI_MEMPOOL_THREADED) {
+    pool->thread_pool_id = atomic_add_and_fetch_uint64(&mempool_thread_pool_id_last, 1);
+  }
+
   if (totelem) {
     /* Allocate the actual chunks. */
     for (i = 0; i < maxchunks; i++) {
@@ -331,10 +432,186 @@ BLI_mempool *BLI_mempool_create(uint esize, uint totelem, uint pchunk, uint flag
   return pool;
 }
 
+/* -------------------------------------------------------------------- */
+/** \name Threaded Pools
+ * \{ */
+
+/* Not using #SpinLock since this file is also built without the threading API (makesdna). */
+BLI_INLINE void mempool_thread_lock(BLI_mempool *pool)
+{
+  while (atomic_cas_u(&pool->thread_lock, 0, 1) != 0) {
+    /* pass */
+  }
+}
+
+BLI_INLINE void mempool_thread_unlock(BLI_mempool *pool)
+{
+  atomic_cas_u(&pool->thread_lock, 1, 0);
+}
+
+static BLI_mempool_thread *mempool_thread_ensure(BLI_mempool *pool)
+{
+  BLI_mempool_thread_slot *slot =
+      &mempool_thread_slots[pool->thread_pool_id % MEMPOOL_THREAD_SLOTS];
+  if (LIKELY(slot->pool_id == pool->thread_pool_id)) {
+    return slot->thread;
+  }
+
+  if (UNLIKELY(mempool_thread_owner_id == 0)) {
+    mempool_thread_owner_id = atomic_add_and_fetch_uint64(&mempool_thread_owner_id_last, 1);
+  }
+
+  /* First use of the pool by this thread, or the slot was taken by another pool since,
+   * in which case the free elements of this thread are still in the list. */
+  BLI_mempool_thread *thread;
+  mempool_thread_lock(pool);
+  for (thread = pool->threads; thread; thread = thread->next) {
+    if (thread->owner_id == mempool_thread_owner_id) {
+      break;
+    }
+  }
+  mempool_thread_unlock(pool);
+
+  if (thread == NULL) {
+    thread = MEM_callocN(sizeof(*thread), __func__);
+    thread->owner_id = mempool_thread_owner_id;
+    mempool_thread_lock(pool);
+    thread->next = pool->threads;
+    pool->threads = thread;
+    mempool_thread_unlock(pool);
+  }
+
+  slot->pool_id = pool->thread_pool_id;
+  slot->thread = thread;
+  return thread;
+}
+
+/**
+ * Take the elements released by other threads, an unclaimed chunk or allocate a new one.
+ *
+ * \return The free elements, \a r_totfree is set to their number.
+ */
+static BLI_freenode *mempool_thread_chunk_claim(BLI_mempool *pool, uint *r_totfree)
+{
+  BLI_mempool_chunk *mpchunk = NULL;
+
+  mempool_thread_lock(pool);
+  if (pool->free_released != NULL) {
+    BLI_freenode *free = pool->free_released;
+    *r_totfree = pool->free_released_len;
+    pool->free_released = NULL;
+    pool->free_released_len = 0;
+    mempool_thread_unlock(pool);
+    return free;
+  }
+  if (pool->chunks_unclaimed_len != 0) {
+    mpchunk = pool->chunks_unclaimed;
+    pool->chunks_unclaimed = mpchunk->next;
+    pool->chunks_unclaimed_len--;
+  }
+  mempool_thread_unlock(pool);
+
+  if (mpchunk == NULL) {
+    /* Elements are initialized before the chunk can be iterated over. */
+    mpchunk = mempool_chunk_alloc(pool);
+    mempool_chunk_nodes_init(pool, mpchunk);
+    mpchunk->next = NULL;
+
+    mempool_thread_lock(pool);
+    if (pool->chunk_tail) {
+      pool->chunk_tail->next = mpchunk;
+    }
+    else {
+      pool->chunks = mpchunk;
+    }
+    pool->chunk_tail = mpchunk;
+    mempool_thread_unlock(pool);
+  }
+
+  *r_totfree = pool->pchunk;
+  return CHUNK_DATA(mpchunk);
+}
+
+/**
+ * Hand a chunk worth of free elements back to the pool, for other threads to allocate.
+ */
+static void mempool_thread_chunk_release(BLI_mempool *pool, BLI_mempool_thread *thread)
+{
+  BLI_freenode *free_first = thread->free;
+  BLI_freenode *free_last = free_first;
+  for (uint i = 1; i < pool->pchunk; i++) {
+    free_last = free_last->next;
+  }
+  thread->free = free_last->next;
+  thread->totfree -= pool->pchunk;
+
+  mempool_thread_lock(pool);
+  free_last->next = pool->free_released;
+  pool->free_released = free_first;
+  pool->free_released_len += pool->pchunk;
+  mempool_thread_unlock(pool);
+}
+
+static void *mempool_thread_alloc(BLI_mempool *pool)
+{
+  BLI_mempool_thread *thread = mempool_thread_ensure(pool);
+  BLI_freenode *free_pop;
+
+  if (UNLIKELY(thread->free == NULL)) {
+    thread->free = mempool_thread_chunk_claim(pool, &thread->totfree);
+  }
+
+  free_pop = thread->free;
+
+  if (pool->flag & BLI_MEMPOOL_ALLOW_ITER) {
+    free_pop->freeword = USEDWORD;
+  }
+
+  thread->free = free_pop->next;
+  thread->totfree--;
+  thread->totused++;
+
+  return (void *)free_pop;
+}
+
+static void mempool_thread_free(BLI_mempool *pool, BLI_freenode *newhead)
+{
+  BLI_mempool_thread *thread = mempool_thread_ensure(pool);
+
+  newhead->next = thread->free;
+  thread->free = newhead;
+  thread->totfree++;
+  thread->totused--;
+
+  if (UNLIKELY(thread->totfree > pool->pchunk * MEMPOOL_THREAD_FREE_CHUNKS_MAX)) {
+    mempool_thread_chunk_release(pool, thread);
+  }
+}
+
+/* Forget the free elements of all threads, when re-initializing the chunks. */
+static void mempool_thread_clear(BLI_mempool *pool)
+{
+  for (BLI_mempool_thread *thread = pool->threads; thread; thread = thread->next) {
+    thread->free = NULL;
+    thread->totfree = 0;
+    thread->totused = 0;
+  }
+  pool->free_released = NULL;
+  pool->free_released_len = 0;
+  pool->chunks_unclaimed = NULL;
+  pool->chunks_unclaimed_len = 0;
+}
+
+/** \} */
+
 void *BLI_mempool_alloc(BLI_mempool *pool)
 {
   BLI_freenode *free_pop;
 
+  if (pool->flag & BLI_MEMPOOL_THREADED) {
+    return mempool_thread_alloc(pool);
+  }
+
   if (UNLIKELY(pool->free == NULL)) {
     /* Need to allocate a new chunk. */
     BLI_mempool_chunk *mpchunk = mempool_chunk_alloc(pool);
@@ -379,12 +656,18 @@ void BLI_mempool_free(BLI_mempool *pool, void *addr)
   {
     BLI_mempool_chunk *chunk;
     bool found = false;
+    if (pool->flag & BLI_MEMPOOL_THREADED) {
+      mempool_thread_lock(pool);
+    }
     for (chunk = pool->chunks; chunk; chunk = chunk->next) {
       if (ARRAY_HAS_ITEM((char *)addr, (char *)CHUNK_DATA(chunk), pool->csize)) {
         found = true;
         break;
       }
     }
+    if (pool->flag & BLI_MEMPOOL_THREADED) {
+      mempool_thread_unlock(pool);
+    }
     if (!found) {
       BLI_assert(!"Attempt to free data which is not in pool.\n");
     }
@@ -404,6 +687,11 @@ void BLI_mempool_free(BLI_mempool *pool, void *addr)
     newhead->freeword = FREEWORD;
   }
 
+  if (pool->flag & BLI_MEMPOOL_THREADED) {
+    mempool_thread_free(pool, newhead);
+    return;
+  }
+
   newhead->next = pool->free;
   pool->free = newhead;
 
@@ -453,6 +741,15 @@ void BLI_mempool_free(BLI_mempool *pool, void *addr)
 
 int BLI_mempool_len(BLI_mempool *pool)
 {
+  if (pool->flag & BLI_MEMPOOL_THREADED) {
+    int totused = 0;
+    mempool_thread_lock(pool);
+    for (const BLI_mempool_thread *thread = pool->threads; thread; thread = thread->next) {
+      totused += thread->totused;
+    }
+    mempool_thread_unlock(pool);
+    return totused;
+  }
   return (int)pool->totused;
 }
 
@@ -460,7 +757,7 @@ void *BLI_mempool_findelem(BLI_mempool *pool, uint index)
 {
   BLI_assert(pool->flag & BLI_MEMPOOL_ALLOW_ITER);
 
-  if (index < pool->totused) {
+  if (index < (uint)BLI_mempool_len(pool)) {
     /* We could have some faster mem chunk stepping code inline. */
     BLI_mempool_iter iter;
     void *elem;
@@ -491,7 +788,7 @@ void BLI_mempool_as_table(BLI_mempool *pool, void **data)
   while ((elem = BLI_mempool_iterstep(&iter))) {
     *p++ = elem;
   }
-  BLI_assert((uint)(p - data) == pool->totused);
+  BLI_assert((p - data) == BLI_mempool_len(pool));
 }
 
 /**
@@ -499,7 +796,7 @@ void BLI_mempool_as_table(BLI_mempool *pool, void **data)
  */
 void **BLI_mempool_as_tableN(BLI_mempool *pool, const char *allocstr)
 {
-  void **data = MEM_mallocN((size_t)pool->totused * sizeof(void *), allocstr);
+  void **data = MEM_mallocN((size_t)BLI_mempool_len(pool) * sizeof(void *), allocstr);
   BLI_mempool_as_table(pool, data);
   return data;
 }
@@ -518,7 +815,7 @@ void BLI_mempool_as_array(BLI_mempool *pool, void *data)
     memcpy(p, elem, (size_t)esize);
     p = NODE_STEP_NEXT(p);
   }
-  BLI_assert((uint)(p - (char *)data) == pool->totused * esize);
+  BLI_assert((uint)(p - (char *)data) == (uint)BLI_mempool_len(pool) * esize);
 }
 
 /**
@@ -526,7 +823,7 @@ void BLI_mempool_as_array(BLI_mempool *pool, void *data)
  */
 void *BLI_mempool_as_arrayN(BLI_mempool *pool, const char *allocstr)
 {
-  char *data = MEM_malloc_arrayN(pool->totused, pool->esize, allocstr);
+  char *data = MEM_malloc_arrayN((size_t)BLI_mempool_len(pool), pool->esize, allocstr);
   BLI_mempool_as_array(pool, data);
   return data;
 }
@@ -729,6 +1026,9 @@ void BLI_mempool_clear_ex(BLI_mempool *pool, const int totelem_reserve)
   /* re-initialize */
   pool->free = NULL;
   pool->totused = 0;
+  if (pool->flag & BLI_MEMPOOL_THREADED) {
+    mempool_thread_clear(pool);
+  }
 #ifdef USE_TOTALLOC
   pool->totalloc = 0;
 #endif
@@ -758,6 +1058,14 @@ void BLI_mempool_destroy(BLI_mempool *pool)
 {
   mempool_chunk_free_all(pool->chunks);
 
+  if (pool->flag & BLI_MEMPOOL_THREADED) {
+    BLI_mempool_thread *thread_next;
+    for (BLI_mempool_thread *thread = pool->threads; thread; thread = thread_next) {
+      thread_next = thread->next;
+      MEM_freeN(thread);
+    }
+  }
+
 #ifdef WITH_MEM_VALGRIND
   VALGRIND_DESTROY_MEMPOOL(pool);
 #endif
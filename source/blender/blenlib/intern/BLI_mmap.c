@@ -0,0 +1,243 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** \file
+ * \ingroup bli
+ *
+ * Read-only memory mapping of files.
+ * Pages are only loaded from disk when they are first accessed,
+ * so reading a small part of a large file only costs the IO of that part.
+ *
+ * Loading a page may fail, when the file is truncated by another process or when the disk or
+ * network share it's stored on has an error. This raises SIGBUS on POSIX systems and an
+ * EXCEPTION_IN_PAGE_ERROR on Windows, instead of a read error. Both are caught and set the
+ * #BLI_mmap_file.io_error flag of the mapping, which makes all further reads fail.
+ */
+
+#include "BLI_fileops.h"
+#include "BLI_listbase.h"
+#include "BLI_mmap.h"
+
+#include "MEM_guardedalloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#  include <signal.h>
+#  include <sys/mman.h>
+#  include <unistd.h>
+#else
+#  include "BLI_winstuff.h"
+#  include <io.h>
+#endif
+
+struct BLI_mmap_file {
+  /* The address to which the file was mapped. */
+  char *memory;
+
+  /* The length of the file (and therefore the mapped region). */
+  size_t length;
+
+#ifdef WIN32
+  /* Handle to the file mapping object. */
+  HANDLE handle;
+#endif
+
+  /* Set when loading a page of the file failed, written from the signal handler. */
+  volatile bool io_error;
+};
+
+#ifndef WIN32
+static struct {
+  /* Mappings which are currently open, as #LinkData. */
+  ListBase open_mmaps;
+  bool is_setup;
+  /* Handler which was installed before, for errors outside of the mapped files. */
+  struct sigaction next_action;
+} sigbus_handler_data = {{NULL}};
+
+static void sigbus_handler(int sig, siginfo_t *siginfo, void *context)
+{
+  const char *error_address = (const char *)siginfo->si_addr;
+  LISTBASE_FOREACH (LinkData *, link, &sigbus_handler_data.open_mmaps) {
+    BLI_mmap_file *file = link->data;
+    if (error_address >= file->memory && error_address < file->memory + file->length) {
+      file->io_error = true;
+      /* Replace the mapping by zeroed memory, so the faulting read can complete. */
+      if (mmap(file->memory,
+               file->length,
+               PROT_READ,
+               MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS,
+               -1,
+               0) == MAP_FAILED) {
+        abort();
+      }
+      return;
+    }
+  }
+
+  const struct sigaction *next_action = &sigbus_handler_data.next_action;
+  if (next_action->sa_flags & SA_SIGINFO) {
+    next_action->sa_sigaction(sig, siginfo, context);
+  }
+  else if (next_action->sa_handler != SIG_DFL && next_action->sa_handler != SIG_IGN) {
+    next_action->sa_handler(sig);
+  }
+  else {
+    /* Restore the default action, it's taken when the faulting read runs again. */
+    sigaction(SIGBUS, next_action, NULL);
+  }
+}
+
+static bool sigbus_handler_add(BLI_mmap_file *file)
+{
+  if (!sigbus_handler_data.is_setup) {
+    struct sigaction action = {{0}};
+    action.sa_sigaction = sigbus_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGBUS, &action, &sigbus_handler_data.next_action) != 0) {
+      return false;
+    }
+    sigbus_handler_data.is_setup = true;
+  }
+  BLI_addtail(&sigbus_handler_data.open_mmaps, BLI_genericNodeN(file));
+  return true;
+}
+
+static void sigbus_handler_remove(BLI_mmap_file *file)
+{
+  LinkData *link = BLI_findptr(&sigbus_handler_data.open_mmaps, file, offsetof(LinkData, data));
+  BLI_freelinkN(&sigbus_handler_data.open_mmaps, link);
+}
+#endif
+
+BLI_mmap_file *BLI_mmap_open(int fd)
+{
+  void *memory;
+  const int64_t length = BLI_lseek(fd, 0, SEEK_END);
+
+  /* Ensure that the file size is representable (empty files can't be mapped). */
+  if (length <= 0 || (uint64_t)length > SIZE_MAX) {
+    return NULL;
+  }
+
+#ifndef WIN32
+  memory = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (memory == MAP_FAILED) {
+    return NULL;
+  }
+#else
+  HANDLE file_handle = (HANDLE)_get_osfhandle(fd);
+  if (file_handle == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+
+  HANDLE handle = CreateFileMapping(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (handle == NULL) {
+    return NULL;
+  }
+
+  memory = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+  if (memory == NULL) {
+    CloseHandle(handle);
+    return NULL;
+  }
+#endif
+
+  BLI_mmap_file *file = MEM_callocN(sizeof(BLI_mmap_file), __func__);
+  file->memory = memory;
+  file->length = (size_t)length;
+#ifdef WIN32
+  file->handle = handle;
+#else
+  if (!sigbus_handler_add(file)) {
+    munmap(memory, (size_t)length);
+    MEM_freeN(file);
+    return NULL;
+  }
+#endif
+
+  return file;
+}
+
+bool BLI_mmap_read(BLI_mmap_file *file, void *dest, size_t offset, size_t length)
+{
+  /* If the requested range starts or ends beyond the end of the file, fail. */
+  if (offset > file->length || length > file->length - offset) {
+    return false;
+  }
+  if (file->io_error) {
+    return false;
+  }
+
+#ifndef WIN32
+  memcpy(dest, file->memory + offset, length);
+#else
+  __try {
+    memcpy(dest, file->memory + offset, length);
+  }
+  __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER :
+                                                             EXCEPTION_CONTINUE_SEARCH) {
+    file->io_error = true;
+  }
+#endif
+
+  return !file->io_error;
+}
+
+const void *BLI_mmap_get_pointer(BLI_mmap_file *file, size_t offset, size_t length)
+{
+  /* If the requested range starts or ends beyond the end of the file, return NULL. */
+  if (offset > file->length || length > file->length - offset) {
+    return NULL;
+  }
+#ifdef WIN32
+  /* Errors are only caught inside #BLI_mmap_read. */
+  UNUSED_VARS(file);
+  return NULL;
+#else
+  if (file->io_error) {
+    return NULL;
+  }
+  return file->memory + offset;
+#endif
+}
+
+bool BLI_mmap_any_io_error(const BLI_mmap_file *file)
+{
+  return file->io_error;
+}
+
+size_t BLI_mmap_get_length(const BLI_mmap_file *file)
+{
+  return file->length;
+}
+
+void BLI_mmap_free(BLI_mmap_file *file)
+{
+#ifndef WIN32
+  sigbus_handler_remove(file);
+  munmap((void *)file->memory, file->length);
+#else
+  UnmapViewOfFile(file->memory);
+  CloseHandle(file->handle);
+#endif
+
+  MEM_freeN(file);
+}
@@ -1599,6 +1599,29 @@ BArrayState *BLI_array_store_state_add(BArrayStore *bs,
   return state;
 }
 
+/**
+ * Add a state with the same contents as \a state_reference without reading any data,
+ * for callers that know their data is unchanged since \a state_reference was added.
+ *
+ * \return The new state, which may be removed independently of \a state_reference.
+ */
+BArrayState *BLI_array_store_state_add_shared(BArrayStore *bs, const BArrayState *state_reference)
+{
+#ifdef USE_PARANOID_CHECKS
+  BLI_assert(BLI_findindex(&bs->states, state_reference) != -1);
+#endif
+
+  BChunkList *chunk_list = state_reference->chunk_list;
+  chunk_list->users += 1;
+
+  BArrayState *state = MEM_callocN(sizeof(BArrayState), __func__);
+  state->chunk_list = chunk_list;
+
+  BLI_addtail(&bs->states, state);
+
+  return state;
+}
+
 /**
  * Remove a state and free any unused #BChunk data.
  *
@@ -22,6 +22,7 @@
 
 #include "BLI_kdtree_impl.h"
 #include "BLI_math.h"
+#include "BLI_task.h"
 #include "BLI_strict_flags.h"
 #include "BLI_utildefines.h"
 
@@ -58,6 +59,11 @@ struct KDTree {
 
 #define KD_NODE_UNSET ((uint)-1)
 
+/* Sub-trees with more nodes are balanced by separate tasks. */
+#define KD_BALANCE_THREAD_NODES_MIN 4096
+/* Batched queries use threads for more queries. */
+#define KD_BATCH_THREAD_QUERIES_MIN 256
+
 /**
  * When set we know all values are unbalanced,
  * otherwise clear them when re-balancing: see T62210.
@@ -145,7 +151,40 @@ void BLI_kdtree_nd_(insert)(KDTree *tree, int index, const float co[KD_DIMS])
 #endif
 }
 
-static uint kdtree_balance(KDTreeNode *nodes, uint nodes_len, uint axis, const uint ofs)
+typedef struct KDTreeBalanceTask {
+  KDTreeNode *nodes;
+  uint nodes_len, axis, ofs;
+} KDTreeBalanceTask;
+
+static uint kdtree_balance(
+    TaskPool *pool, int thread_id, KDTreeNode *nodes, uint nodes_len, uint axis, const uint ofs);
+
+static void kdtree_balance_task(TaskPool *__restrict pool, void *taskdata, int thread_id)
+{
+  const KDTreeBalanceTask *task = taskdata;
+  kdtree_balance(pool, thread_id, task->nodes, task->nodes_len, task->axis, task->ofs);
+}
+
+/* Balance the sub-tree in a separate task when it's large enough,
+ * its root is known in advance since it's always at the median. */
+static uint kdtree_balance_subtree(
+    TaskPool *pool, int thread_id, KDTreeNode *nodes, uint nodes_len, uint axis, const uint ofs)
+{
+  if (pool == NULL || nodes_len < KD_BALANCE_THREAD_NODES_MIN) {
+    return kdtree_balance(pool, thread_id, nodes, nodes_len, axis, ofs);
+  }
+
+  KDTreeBalanceTask *task = MEM_mallocN(sizeof(*task), __func__);
+  task->nodes = nodes;
+  task->nodes_len = nodes_len;
+  task->axis = axis;
+  task->ofs = ofs;
+  BLI_task_pool_push_from_thread(pool, kdtree_balance_task, task, true, NULL, thread_id);
+  return (nodes_len / 2) + ofs;
+}
+
+static uint kdtree_balance(
+    TaskPool *pool, int thread_id, KDTreeNode *nodes, uint nodes_len, uint axis, const uint ofs)
 {
   KDTreeNode *node;
   float co;
@@ -194,13 +233,23 @@ static uint kdtree_balance(KDTreeNode *nodes, uint nodes_len, uint axis, const u
   node = &nodes[median];
   node->d = axis;
   axis = (axis + 1) % KD_DIMS;
-  node->left = kdtree_balance(nodes, median, axis, ofs);
-  node->right = kdtree_balance(
-      nodes + median + 1, (nodes_len - (median + 1)), axis, (median + 1) + ofs);
+  node->left = kdtree_balance_subtree(pool, thread_id, nodes, median, axis, ofs);
+  node->right = kdtree_balance_subtree(pool,
+                                       thread_id,
+                                       nodes + median + 1,
+                                       (nodes_len - (median + 1)),
+                                       axis,
+                                       (median + 1) + ofs);
 
   return median + ofs;
 }
 
+/**
+ * Large trees are balanced in parallel, the result is the same as balancing on a single thread.
+ *
+ * Nodes are kept in-order (each node is at the median of its sub-tree), so every sub-tree is
+ * stored contiguously and the nodes visited last by queries are close in memory.
+ */
 void BLI_kdtree_nd_(balance)(KDTree *tree)
 {
   if (tree->root != KD_NODE_ROOT_IS_INIT) {
@@ -210,7 +259,16 @@ void BLI_kdtree_nd_(balance)(KDTree *tree)
     }
   }
 
-  tree->root = kdtree_balance(tree->nodes, tree->nodes_len, 0, 0);
+  if (tree->nodes_len >= 2 * KD_BALANCE_THREAD_NODES_MIN) {
+    TaskPool *pool = BLI_task_pool_create(BLI_task_scheduler_get(), NULL, TASK_PRIORITY_HIGH);
+    tree->root = kdtree_balance(
+        pool, BLI_task_pool_creator_thread_id(pool), tree->nodes, tree->nodes_len, 0, 0);
+    BLI_task_pool_work_and_wait(pool);
+    BLI_task_pool_free(pool);
+  }
+  else {
+    tree->root = kdtree_balance(NULL, 0, tree->nodes, tree->nodes_len, 0, 0);
+  }
 
 #ifdef DEBUG
   tree->is_balanced = true;
@@ -806,6 +864,139 @@ finally:
   }
 }
 
+/* -------------------------------------------------------------------- */
+/** \name Batched Queries
+ *
+ * Run many queries on the task scheduler, each thread handles consecutive queries so
+ * coherent input (neighboring points one after another) keeps the visited nodes in cache.
+ * \{ */
+
+typedef struct KDTreeBatchData {
+  const KDTree *tree;
+  const float (*co)[KD_DIMS];
+  KDTreeNearest *nearest;
+  KDTreeNearest **nearest_range;
+  int *nearest_len;
+  uint nearest_len_capacity;
+  float range;
+} KDTreeBatchData;
+
+static void kdtree_batch_settings(TaskParallelSettings *settings, const uint co_len)
+{
+  BLI_parallel_range_settings_defaults(settings);
+  settings->use_threading = (co_len >= KD_BATCH_THREAD_QUERIES_MIN);
+  settings->scheduling_mode = TASK_SCHEDULING_DYNAMIC;
+}
+
+static void kdtree_find_nearest_batch_cb(void *__restrict userdata,
+                                         const int i,
+                                         const TaskParallelTLS *__restrict UNUSED(tls))
+{
+  const KDTreeBatchData *data = userdata;
+  if (BLI_kdtree_nd_(find_nearest)(data->tree, data->co[i], &data->nearest[i]) == -1) {
+    data->nearest[i].index = -1;
+  }
+}
+
+/**
+ * Batched version of #BLI_kdtree_3d_find_nearest.
+ *
+ * \param r_nearest: An array of \a co_len results, the index is -1 when the tree is empty.
+ */
+void BLI_kdtree_nd_(find_nearest_batch)(const KDTree *tree,
+                                        const float (*co)[KD_DIMS],
+                                        const uint co_len,
+                                        KDTreeNearest *r_nearest)
+{
+  KDTreeBatchData data = {
+      .tree = tree,
+      .co = co,
+      .nearest = r_nearest,
+  };
+
+  TaskParallelSettings settings;
+  kdtree_batch_settings(&settings, co_len);
+  BLI_task_parallel_range(0, (int)co_len, &data, kdtree_find_nearest_batch_cb, &settings);
+}
+
+static void kdtree_find_nearest_n_batch_cb(void *__restrict userdata,
+                                           const int i,
+                                           const TaskParallelTLS *__restrict UNUSED(tls))
+{
+  const KDTreeBatchData *data = userdata;
+  data->nearest_len[i] = BLI_kdtree_nd_(find_nearest_n)(
+      data->tree,
+      data->co[i],
+      &data->nearest[(size_t)i * data->nearest_len_capacity],
+      data->nearest_len_capacity);
+}
+
+/**
+ * Batched version of #BLI_kdtree_3d_find_nearest_n.
+ *
+ * \param r_nearest: An array of \a co_len * \a nearest_len_capacity results,
+ * the results of each query are stored one after another.
+ * \param r_nearest_len: The number of results of each query.
+ */
+void BLI_kdtree_nd_(find_nearest_n_batch)(const KDTree *tree,
+                                          const float (*co)[KD_DIMS],
+                                          const uint co_len,
+                                          KDTreeNearest *r_nearest,
+                                          const uint nearest_len_capacity,
+                                          int *r_nearest_len)
+{
+  KDTreeBatchData data = {
+      .tree = tree,
+      .co = co,
+      .nearest = r_nearest,
+      .nearest_len = r_nearest_len,
+      .nearest_len_capacity = nearest_len_capacity,
+  };
+
+  TaskParallelSettings settings;
+  kdtree_batch_settings(&settings, co_len);
+  BLI_task_parallel_range(0, (int)co_len, &data, kdtree_find_nearest_n_batch_cb, &settings);
+}
+
+static void kdtree_range_search_batch_cb(void *__restrict userdata,
+                                         const int i,
+                                         const TaskParallelTLS *__restrict UNUSED(tls))
+{
+  const KDTreeBatchData *data = userdata;
+  data->nearest_range[i] = NULL;
+  data->nearest_len[i] = BLI_kdtree_nd_(range_search)(
+      data->tree, data->co[i], &data->nearest_range[i], data->range);
+}
+
+/**
+ * Batched version of #BLI_kdtree_3d_range_search.
+ *
+ * \param r_nearest: An array of \a co_len allocated arrays of results, NULL when nothing is
+ * found in range (caller is responsible for freeing).
+ * \param r_nearest_len: The number of results of each query.
+ */
+void BLI_kdtree_nd_(range_search_batch)(const KDTree *tree,
+                                        const float (*co)[KD_DIMS],
+                                        const uint co_len,
+                                        const float range,
+                                        KDTreeNearest **r_nearest,
+                                        int *r_nearest_len)
+{
+  KDTreeBatchData data = {
+      .tree = tree,
+      .co = co,
+      .nearest_range = r_nearest,
+      .nearest_len = r_nearest_len,
+      .range = range,
+  };
+
+  TaskParallelSettings settings;
+  kdtree_batch_settings(&settings, co_len);
+  BLI_task_parallel_range(0, (int)co_len, &data, kdtree_range_search_batch_cb, &settings);
+}
+
+/** \} */
+
 /**
  * Use when we want to loop over nodes ordered by index.
  * Requires indices to be aligned with nodes.
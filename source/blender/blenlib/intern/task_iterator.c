@@ -156,6 +156,7 @@ BLI_INLINE void task_parallel_calc_chunk_size(const TaskParallelSettings *settin
         *r_chunk_size = max_ii(chunk_size, tot_items / num_tasks);
         break;
       case TASK_SCHEDULING_DYNAMIC:
+      case TASK_SCHEDULING_NUMA_LOCAL:
         *r_chunk_size = chunk_size;
         break;
     }
@@ -276,6 +277,129 @@ static void parallel_range_single_thread(TaskParallelRangePool *range_pool)
   }
 }
 
+/* Part of the range processed by the threads of a NUMA node, padded since these are updated
+ * from different nodes. */
+typedef struct TaskParallelRangeNumaPart {
+  /* Next value to process, shared between the threads of the node (atomically updated). */
+  int iter_value;
+  int stop;
+  char _pad[64 - 2 * sizeof(int)];
+} TaskParallelRangeNumaPart;
+
+typedef struct TaskParallelRangeNuma {
+  TaskParallelRangeState *state;
+  int chunk_size;
+  TaskParallelRangeNumaPart *parts;
+  /* Part processed by each task. */
+  int *task_parts;
+} TaskParallelRangeNuma;
+
+static void parallel_range_numa_func(TaskPool *__restrict pool, void *task_index, int thread_id)
+{
+  TaskParallelRangeNuma *range_numa = BLI_task_pool_userdata(pool);
+  TaskParallelRangeState *state = range_numa->state;
+  const int index = POINTER_AS_INT(task_index);
+  TaskParallelRangeNumaPart *part = &range_numa->parts[range_numa->task_parts[index]];
+  const int chunk_size = range_numa->chunk_size;
+  TaskParallelTLS tls = {
+      .thread_id = thread_id,
+      .userdata_chunk = (char *)state->flatten_tls_storage +
+                        ((size_t)index * state->tls_data_size),
+  };
+  while (true) {
+    const int iter = atomic_fetch_and_add_int32(&part->iter_value, chunk_size);
+    if (iter >= part->stop) {
+      break;
+    }
+    const int stop = min_ii(iter + chunk_size, part->stop);
+    for (int i = iter; i < stop; i++) {
+      state->func(state->userdata_shared, i, &tls);
+    }
+  }
+}
+
+/**
+ * #TASK_SCHEDULING_NUMA_LOCAL: split the range between NUMA nodes, proportionally to the
+ * number of threads of each node, always in the same way for the same range.
+ */
+static void parallel_range_numa(TaskScheduler *task_scheduler,
+                                TaskParallelRangeState *state,
+                                const int chunk_size,
+                                const bool use_reentrant)
+{
+  const int num_nodes = BLI_task_scheduler_num_numa_nodes(task_scheduler);
+  const int64_t num_iters = (int64_t)state->stop - state->start;
+
+  int num_threads = 0;
+  for (int node = 0; node < num_nodes; node++) {
+    num_threads += BLI_task_scheduler_numa_node_num_threads(task_scheduler, node);
+  }
+
+  TaskParallelRangeNumaPart *parts = MEM_mallocN(sizeof(*parts) * (size_t)num_nodes, __func__);
+  int *task_parts = MEM_mallocN(sizeof(*task_parts) * (size_t)num_threads, __func__);
+  int num_tasks = 0;
+  int node_threads_start = 0;
+  for (int node = 0; node < num_nodes; node++) {
+    const int node_num_threads = BLI_task_scheduler_numa_node_num_threads(task_scheduler, node);
+    TaskParallelRangeNumaPart *part = &parts[node];
+    part->iter_value = state->start + (int)(num_iters * node_threads_start / num_threads);
+    node_threads_start += node_num_threads;
+    part->stop = state->start + (int)(num_iters * node_threads_start / num_threads);
+
+    /* No more tasks than chunks, small parts would not be worth the threading overhead. */
+    const int part_num_tasks = min_ii(node_num_threads,
+                                      (part->stop - part->iter_value + chunk_size - 1) /
+                                          chunk_size);
+    for (int i = 0; i < part_num_tasks; i++) {
+      task_parts[num_tasks++] = node;
+    }
+  }
+
+  TaskParallelRangeNuma range_numa = {
+      .state = state,
+      .chunk_size = chunk_size,
+      .parts = parts,
+      .task_parts = task_parts,
+  };
+
+  const size_t tls_data_size = state->tls_data_size;
+  const bool use_tls_data = (tls_data_size != 0) && (state->initial_tls_memory != NULL);
+  if (use_tls_data) {
+    state->flatten_tls_storage = MALLOCA(tls_data_size * (size_t)num_tasks);
+    for (int i = 0; i < num_tasks; i++) {
+      memcpy((char *)state->flatten_tls_storage + (tls_data_size * (size_t)i),
+             state->initial_tls_memory,
+             tls_data_size);
+    }
+  }
+
+  TaskPool *task_pool = BLI_task_pool_create(task_scheduler, &range_numa, TASK_PRIORITY_HIGH);
+  for (int i = 0; i < num_tasks; i++) {
+    BLI_task_pool_push_on_numa_node(
+        task_pool, parallel_range_numa_func, POINTER_FROM_INT(i), false, NULL, task_parts[i]);
+  }
+  if (use_reentrant) {
+    BLI_task_pool_work_and_wait_reentrant(task_pool);
+  }
+  else {
+    BLI_task_pool_work_and_wait(task_pool);
+  }
+  BLI_task_pool_free(task_pool);
+
+  if (use_tls_data) {
+    if (state->func_finalize != NULL) {
+      for (int i = 0; i < num_tasks; i++) {
+        state->func_finalize(state->userdata_shared,
+                             (char *)state->flatten_tls_storage + (tls_data_size * (size_t)i));
+      }
+    }
+    MALLOCA_FREE(state->flatten_tls_storage, tls_data_size * (size_t)num_tasks);
+  }
+
+  MEM_freeN(parts);
+  MEM_freeN(task_parts);
+}
+
 /**
  * This function allows to parallelized for loops in a similar way to OpenMP's
  * 'parallel for' statement.
@@ -343,6 +467,13 @@ void BLI_task_parallel_range(const int start,
     return;
   }
 
+  if (settings->scheduling_mode == TASK_SCHEDULING_NUMA_LOCAL &&
+      BLI_task_scheduler_num_numa_nodes(task_scheduler) > 1) {
+    parallel_range_numa(
+        task_scheduler, &state, range_pool.chunk_size, settings->use_reentrant);
+    return;
+  }
+
   TaskPool *task_pool = range_pool.pool = BLI_task_pool_create_suspended(
       task_scheduler, &range_pool, TASK_PRIORITY_HIGH);
 
@@ -364,7 +495,12 @@ void BLI_task_parallel_range(const int start,
         task_pool, parallel_range_func, POINTER_FROM_INT(i), false, NULL, thread_id);
   }
 
-  BLI_task_pool_work_and_wait(task_pool);
+  if (settings->use_reentrant) {
+    BLI_task_pool_work_and_wait_reentrant(task_pool);
+  }
+  else {
+    BLI_task_pool_work_and_wait(task_pool);
+  }
   BLI_task_pool_free(task_pool);
 
   if (use_tls_data) {
@@ -18,8 +18,19 @@
  * \ingroup bli
  *
  * A generic task system which can be used for any task based subsystem.
+ *
+ * Every scheduler thread (including the main thread) owns a work-stealing deque. Tasks pushed
+ * from a scheduler thread go to its own deque, the owner takes them back in LIFO order and
+ * idle threads steal the oldest ones. A global queue is kept for tasks pushed from outside of
+ * the scheduler threads, for background pools and for tasks which have to be handed over to
+ * other threads.
+ *
+ * On systems with multiple NUMA nodes worker threads are pinned to the nodes, they steal from
+ * threads of their own node first and each node has a queue for tasks which should only run
+ * there, see #BLI_task_pool_push_on_numa_node.
  */
 
+#include <atomic>
 #include <stdlib.h>
 
 #include "MEM_guardedalloc.h"
@@ -45,18 +56,15 @@
  */
 #define MEMPOOL_SIZE 256
 
-/* Number of tasks which are pushed directly to local thread queue.
- *
- * This allows thread to fetch next task without locking the whole queue.
- */
-#define LOCAL_QUEUE_SIZE 1
+/* Initial number of tasks a thread deque can hold, it grows when needed. */
+#define TASK_DEQUE_INITIAL_SIZE 256
 
-/* Number of tasks which are allowed to be scheduled in a delayed manner.
- *
- * This allows to use less locks per graph node children schedule. More details
- * could be found at TaskThreadLocalStorage::do_delayed_push.
- */
-#define DELAYED_QUEUE_SIZE 4096
+/* Padding to keep data written by different threads in different cache lines. */
+#define TASK_CACHE_LINE_SIZE 64
+
+/* Maximum number of tasks a thread runs on top of each other, when waiting inside a task of a
+ * reentrant pool. Limits the stack usage. */
+#define TASK_REENTRANT_MAX_DEPTH 8
 
 #ifndef NDEBUG
 #  define ASSERT_THREAD_ID(scheduler, thread_id) \
@@ -86,6 +94,7 @@ typedef struct Task {
   bool free_taskdata;
   TaskFreeFunction freedata;
   TaskPool *pool;
+  TaskGroup *group;
 } Task;
 
 /* This is a per-thread storage of pre-allocated tasks.
@@ -138,29 +147,60 @@ typedef struct TaskThreadLocalStorage {
    */
   TaskMemPool task_mempool;
 
-  /* Local queue keeps thread alive by keeping small amount of tasks ready
-   * to be picked up without causing global thread locks for synchronization.
-   */
-  int num_local_queue;
-  Task *local_queue[LOCAL_QUEUE_SIZE];
-
   /* Thread can be marked for delayed tasks push. This is helpful when it's
    * know that lots of subsequent task pushed will happen from the same thread
    * without "interrupting" for task execution.
    *
-   * We try to accumulate as much tasks as possible in a local queue without
-   * any locks first, and then we push all of them into a scheduler's queue
-   * from within a single mutex lock.
+   * Tasks still go to the thread deque right away, but sleeping threads are
+   * only woken up once all of them are pushed.
    */
   bool do_delayed_push;
-  int num_delayed_queue;
-  Task *delayed_queue[DELAYED_QUEUE_SIZE];
+  int num_delayed_push;
 } TaskThreadLocalStorage;
 
+/* One slot of a deque array. The pool and group are stored next to the task, so thieves can
+ * check which pool a task belongs to without reading the task, which may be taken, run and
+ * freed by another thread at any moment. */
+typedef struct TaskDequeSlot {
+  std::atomic<Task *> task;
+  std::atomic<TaskPool *> pool;
+  std::atomic<TaskGroup *> group;
+} TaskDequeSlot;
+
+typedef struct TaskDequeArray {
+  /* Smaller array this one replaced. Thieves may still be reading from it,
+   * so it is only freed together with the deque. */
+  struct TaskDequeArray *prev;
+  /* Number of slots minus one, the number of slots is a power of two. */
+  int64_t mask;
+  TaskDequeSlot *slots;
+} TaskDequeArray;
+
+/* Work-stealing deque of a scheduler thread.
+ *
+ * This is a Chase-Lev deque, using the memory ordering from "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" (Lê et al., 2013). Only the owner thread pushes
+ * and takes tasks at the bottom, any thread can steal tasks from the top.
+ */
+typedef struct TaskDeque {
+  std::atomic<int64_t> top;
+  char _pad_top[TASK_CACHE_LINE_SIZE - sizeof(std::atomic<int64_t>)];
+  std::atomic<int64_t> bottom;
+  std::atomic<TaskDequeArray *> array;
+  char _pad_bottom[TASK_CACHE_LINE_SIZE - sizeof(std::atomic<int64_t>) -
+                   sizeof(std::atomic<TaskDequeArray *>)];
+} TaskDeque;
+
 struct TaskPool {
   TaskScheduler *scheduler;
 
+  /* Number of tasks which are pushed and not finished yet. */
   volatile size_t num;
+  /* Incremented after every push, so waiting threads can tell whether there might be new
+   * tasks to help with since they last looked for them. */
+  volatile uint32_t num_pushed;
+  /* Number of threads waiting on num_cond, pushing only locks num_mutex when there are any. */
+  volatile uint32_t num_waiters;
   ThreadMutex num_mutex;
   ThreadCondition num_cond;
 
@@ -172,6 +212,10 @@ struct TaskPool {
 
   volatile bool is_suspended;
   bool start_suspended;
+
+  /* Threads waiting inside a task of this pool may run other tasks of the pool meanwhile,
+   * see BLI_task_pool_set_reentrant(). */
+  bool is_reentrant;
   ListBase suspended_queue;
   size_t num_suspended;
 
@@ -203,15 +247,32 @@ struct TaskPool {
 #endif
 };
 
+/* Scheduler threads of a NUMA node, and the tasks which should only run on them. */
+typedef struct TaskNumaNode {
+  /* Protected by the scheduler's queue_mutex. */
+  ListBase queue;
+  std::atomic<int> num_queued;
+  int *thread_ids;
+  int num_threads;
+} TaskNumaNode;
+
 struct TaskScheduler {
   pthread_t *threads;
   struct TaskThread *task_threads;
   int num_threads;
   bool background_thread_only;
 
+  /* Only allocated with more than one node, worker threads are pinned to their node then. */
+  TaskNumaNode *numa_nodes;
+  int num_numa_nodes;
+
+  /* Global queue, for tasks which can not go to a thread deque. */
   ListBase queue;
+  std::atomic<int> num_queued;
   ThreadMutex queue_mutex;
+  /* Idle worker threads wait on this condition, together with queue_mutex. */
   ThreadCondition queue_cond;
+  std::atomic<int> num_sleeping;
 
   ThreadMutex startup_mutex;
   ThreadCondition startup_cond;
@@ -223,12 +284,32 @@ struct TaskScheduler {
   pthread_key_t tls_id_key;
 };
 
+struct TaskGroup {
+  TaskPool *pool;
+  /* Number of tasks of the group which are pushed and not finished yet. */
+  volatile size_t num;
+  /* Thread the group was created from, its tasks are pushed to the deque of that thread. */
+  int thread_id;
+};
+
 typedef struct TaskThread {
+  TaskDeque deque;
   TaskScheduler *scheduler;
   int id;
+  /* NUMA node the thread is pinned to, -1 for the main thread or without NUMA. */
+  int numa_node;
+  /* Pool of the task the thread is running, NULL when not running a task. */
+  TaskPool *current_pool;
+  /* Number of tasks the thread is running on top of each other. */
+  int current_depth;
+  /* State of the random generator used to pick threads to steal from. */
+  uint32_t steal_seed;
   TaskThreadLocalStorage tls;
 } TaskThread;
 
+/* Number of #BLI_task_isolate calls the thread is in. */
+static thread_local int task_isolation_depth = 0;
+
 /* Helper */
 BLI_INLINE void task_data_free(Task *task, const int thread_id)
 {
@@ -328,113 +409,526 @@ static void task_free(TaskPool *pool, Task *task, const int thread_id)
   }
 }
 
+/* Selects the tasks a waiting thread is allowed to run. */
+typedef struct TaskFilter {
+  /* Tasks of this pool, or only of this group when set. */
+  const TaskPool *pool;
+  const TaskGroup *group;
+  /* Any task of this pool, see BLI_task_pool_set_reentrant(). */
+  const TaskPool *reentrant_pool;
+} TaskFilter;
+
+BLI_INLINE bool task_filter_match(const TaskFilter *filter,
+                                  const TaskPool *pool,
+                                  const TaskGroup *group)
+{
+  if (filter == NULL) {
+    return true;
+  }
+  if (filter->group != NULL ? (group == filter->group) : (pool == filter->pool)) {
+    return true;
+  }
+  return pool == filter->reentrant_pool;
+}
+
+/* Task Deque */
+
+static TaskDequeArray *task_deque_array_create(int64_t size)
+{
+  TaskDequeArray *array = (TaskDequeArray *)MEM_mallocN(sizeof(*array), "TaskDequeArray");
+  array->prev = NULL;
+  array->mask = size - 1;
+  array->slots = (TaskDequeSlot *)MEM_mallocN(sizeof(*array->slots) * (size_t)size,
+                                              "TaskDequeArray slots");
+  return array;
+}
+
+static void task_deque_init(TaskDeque *deque)
+{
+  deque->top.store(0, std::memory_order_relaxed);
+  deque->bottom.store(0, std::memory_order_relaxed);
+  deque->array.store(task_deque_array_create(TASK_DEQUE_INITIAL_SIZE),
+                     std::memory_order_relaxed);
+}
+
+/* Free the deque, tasks which are still in it are discarded. */
+static void task_deque_free(TaskDeque *deque)
+{
+  TaskDequeArray *array = deque->array.load(std::memory_order_relaxed);
+  const int64_t top = deque->top.load(std::memory_order_relaxed);
+  const int64_t bottom = deque->bottom.load(std::memory_order_relaxed);
+  for (int64_t i = top; i < bottom; i++) {
+    Task *task = array->slots[i & array->mask].task.load(std::memory_order_relaxed);
+    task_data_free(task, 0);
+    MEM_freeN(task);
+  }
+  while (array != NULL) {
+    TaskDequeArray *prev = array->prev;
+    MEM_freeN(array->slots);
+    MEM_freeN(array);
+    array = prev;
+  }
+}
+
+static TaskDequeArray *task_deque_grow(TaskDeque *deque,
+                                       TaskDequeArray *array,
+                                       const int64_t top,
+                                       const int64_t bottom)
+{
+  TaskDequeArray *new_array = task_deque_array_create((array->mask + 1) * 2);
+  for (int64_t i = top; i < bottom; i++) {
+    const TaskDequeSlot *slot = &array->slots[i & array->mask];
+    TaskDequeSlot *new_slot = &new_array->slots[i & new_array->mask];
+    new_slot->task.store(slot->task.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    new_slot->pool.store(slot->pool.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    new_slot->group.store(slot->group.load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+  }
+  new_array->prev = array;
+  deque->array.store(new_array, std::memory_order_release);
+  return new_array;
+}
+
+/* Push a task to the bottom, must only be called from the owner thread. */
+static void task_deque_push(TaskDeque *deque, Task *task)
+{
+  const int64_t bottom = deque->bottom.load(std::memory_order_relaxed);
+  const int64_t top = deque->top.load(std::memory_order_acquire);
+  TaskDequeArray *array = deque->array.load(std::memory_order_relaxed);
+  if (bottom - top > array->mask) {
+    array = task_deque_grow(deque, array, top, bottom);
+  }
+  TaskDequeSlot *slot = &array->slots[bottom & array->mask];
+  slot->task.store(task, std::memory_order_relaxed);
+  slot->pool.store(task->pool, std::memory_order_relaxed);
+  slot->group.store(task->group, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+}
+
+/* Take the most recently pushed task, must only be called from the owner thread. */
+static Task *task_deque_take(TaskDeque *deque)
+{
+  const int64_t bottom = deque->bottom.load(std::memory_order_relaxed) - 1;
+  TaskDequeArray *array = deque->array.load(std::memory_order_relaxed);
+  deque->bottom.store(bottom, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t top = deque->top.load(std::memory_order_relaxed);
+
+  if (top > bottom) {
+    /* Empty. */
+    deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+    return NULL;
+  }
+
+  Task *task = array->slots[bottom & array->mask].task.load(std::memory_order_relaxed);
+  if (top == bottom) {
+    /* Last task, race against thieves for it. */
+    if (!deque->top.compare_exchange_strong(
+            top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      task = NULL;
+    }
+    deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+  }
+  return task;
+}
+
+/**
+ * Steal the oldest task, can be called from any thread.
+ *
+ * \param filter: When not NULL, only steal the task if it matches the filter.
+ * \return NULL when the deque is empty, the oldest task does not match or another
+ * thread took it first.
+ */
+static Task *task_deque_steal(TaskDeque *deque, const TaskFilter *filter)
+{
+  int64_t top = deque->top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  const int64_t bottom = deque->bottom.load(std::memory_order_acquire);
+
+  if (top >= bottom) {
+    return NULL;
+  }
+
+  TaskDequeArray *array = deque->array.load(std::memory_order_acquire);
+  const TaskDequeSlot *slot = &array->slots[top & array->mask];
+  if (filter != NULL && !task_filter_match(filter,
+                                           slot->pool.load(std::memory_order_relaxed),
+                                           slot->group.load(std::memory_order_relaxed))) {
+    return NULL;
+  }
+  Task *task = slot->task.load(std::memory_order_relaxed);
+  if (!deque->top.compare_exchange_strong(
+          top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+    return NULL;
+  }
+  return task;
+}
+
+BLI_INLINE bool task_deque_is_empty(TaskDeque *deque)
+{
+  const int64_t top = deque->top.load(std::memory_order_relaxed);
+  const int64_t bottom = deque->bottom.load(std::memory_order_relaxed);
+  return top >= bottom;
+}
+
 /* Task Scheduler */
 
-static void task_pool_num_decrease(TaskPool *pool, size_t done)
+/* Scheduler thread the caller runs on, NULL for threads not managed by the scheduler. */
+BLI_INLINE TaskThread *task_scheduler_current_thread(TaskScheduler *scheduler)
 {
-  BLI_mutex_lock(&pool->num_mutex);
+  if (BLI_thread_is_main()) {
+    return &scheduler->task_threads[0];
+  }
+  return (TaskThread *)pthread_getspecific(scheduler->tls_id_key);
+}
+
+/* Wake up sleeping worker threads after tasks were pushed to a thread deque. */
+static void task_scheduler_wake(TaskScheduler *scheduler, const bool wake_all)
+{
+  /* The background thread never steals from deques. */
+  if (scheduler->background_thread_only) {
+    return;
+  }
+  /* Pairs with the fence in task_scheduler_thread_wait(): either the sleeping thread sees the
+   * new task, or we see the sleeping thread. */
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (scheduler->num_sleeping.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  BLI_mutex_lock(&scheduler->queue_mutex);
+  if (wake_all) {
+    BLI_condition_notify_all(&scheduler->queue_cond);
+  }
+  else {
+    BLI_condition_notify_one(&scheduler->queue_cond);
+  }
+  BLI_mutex_unlock(&scheduler->queue_mutex);
+}
+
+/* Decrease a number of unfinished tasks of the pool or one of its groups, waking up threads
+ * waiting for the pool when it reaches zero. */
+static void task_pool_counter_decrease(TaskPool *pool, volatile size_t *counter, size_t done)
+{
+  /* Only the last tasks take the lock: once the counter is zero the pool or group may be
+   * freed by the thread waiting for it, which will only happen after we released the mutex. */
+  size_t num = *counter;
+  while (num > done) {
+    const size_t prev_num = atomic_cas_z((size_t *)counter, num, num - done);
+    if (prev_num == num) {
+      return;
+    }
+    num = prev_num;
+  }
 
-  BLI_assert(pool->num >= done);
+  BLI_mutex_lock(&pool->num_mutex);
 
-  pool->num -= done;
+  BLI_assert(*counter >= done);
 
-  if (pool->num == 0) {
+  if (atomic_sub_and_fetch_z((size_t *)counter, done) == 0) {
     BLI_condition_notify_all(&pool->num_cond);
   }
 
   BLI_mutex_unlock(&pool->num_mutex);
 }
 
+static void task_pool_num_decrease(TaskPool *pool, size_t done)
+{
+  task_pool_counter_decrease(pool, &pool->num, done);
+}
+
 static void task_pool_num_increase(TaskPool *pool, size_t new_num)
 {
-  BLI_mutex_lock(&pool->num_mutex);
+  atomic_add_and_fetch_z((size_t *)&pool->num, new_num);
+}
 
-  pool->num += new_num;
-  BLI_condition_notify_all(&pool->num_cond);
+/* Let threads waiting for the pool know that new tasks were pushed to it. */
+static void task_pool_notify_pushed(TaskPool *pool)
+{
+  /* The atomic increment is a full barrier, pairs with the one in
+   * task_pool_work_and_wait_ex(). */
+  atomic_add_and_fetch_uint32((uint32_t *)&pool->num_pushed, 1);
+  if (pool->num_waiters != 0) {
+    BLI_mutex_lock(&pool->num_mutex);
+    BLI_condition_notify_all(&pool->num_cond);
+    BLI_mutex_unlock(&pool->num_mutex);
+  }
+}
 
-  BLI_mutex_unlock(&pool->num_mutex);
+BLI_INLINE bool task_scheduler_thread_can_run(TaskScheduler *scheduler, const TaskPool *pool)
+{
+  return !scheduler->background_thread_only || pool->run_in_background;
 }
 
-static bool task_scheduler_thread_wait_pop(TaskScheduler *scheduler, Task **task)
+static void task_scheduler_push(TaskScheduler *scheduler, Task *task, TaskPriority priority)
 {
-  bool found_task = false;
+  task_pool_num_increase(task->pool, 1);
+
+  /* add task to queue */
   BLI_mutex_lock(&scheduler->queue_mutex);
 
-  while (!scheduler->queue.first && !scheduler->do_exit) {
-    BLI_condition_wait(&scheduler->queue_cond, &scheduler->queue_mutex);
+  if (priority == TASK_PRIORITY_HIGH) {
+    BLI_addhead(&scheduler->queue, task);
+  }
+  else {
+    BLI_addtail(&scheduler->queue, task);
   }
+  scheduler->num_queued.fetch_add(1, std::memory_order_relaxed);
+  /* While the queue is locked the task can't run yet, so the pool can't be freed. */
+  task_pool_notify_pushed(task->pool);
 
-  do {
-    Task *current_task;
+  BLI_condition_notify_one(&scheduler->queue_cond);
+  BLI_mutex_unlock(&scheduler->queue_mutex);
+}
 
-    /* Assuming we can only have a void queue in 'exit' case here seems logical
-     * (we should only be here after our worker thread has been woken up from a
-     * condition_wait(), which only happens after a new task was added to the queue),
-     * but it is wrong.
-     * Waiting on condition may wake up the thread even if condition is not signaled
-     * (spurious wake-ups), and some race condition may also empty the queue **after**
-     * condition has been signaled, but **before** awoken thread reaches this point...
-     * See http://stackoverflow.com/questions/8594591
-     *
-     * So we only abort here if do_exit is set.
-     */
-    if (scheduler->do_exit) {
-      BLI_mutex_unlock(&scheduler->queue_mutex);
-      return false;
+/* Move all tasks from the deque of the calling thread to the global queue,
+ * so other threads can run them while this one is blocked. */
+static void task_scheduler_thread_hand_over(TaskScheduler *scheduler, TaskThread *thread)
+{
+  ListBase tasks = {NULL, NULL};
+  Task *task;
+  while ((task = task_deque_take(&thread->deque)) != NULL) {
+    BLI_addhead(&tasks, task);
+  }
+  if (tasks.first == NULL) {
+    return;
+  }
+
+  const int num_tasks = BLI_listbase_count(&tasks);
+  BLI_mutex_lock(&scheduler->queue_mutex);
+  /* Threads waiting for these pools could not see the tasks in the middle of our deque.
+   * Notify them while the queue is locked, so the pools can't be freed meanwhile. */
+  TaskPool *notified_pool = NULL;
+  LISTBASE_FOREACH (Task *, task_iter, &tasks) {
+    if (task_iter->pool != notified_pool) {
+      notified_pool = task_iter->pool;
+      task_pool_notify_pushed(notified_pool);
+    }
+  }
+  BLI_movelisttolist_reverse(&scheduler->queue, &tasks);
+  scheduler->num_queued.fetch_add(num_tasks, std::memory_order_relaxed);
+  BLI_condition_notify_all(&scheduler->queue_cond);
+  BLI_mutex_unlock(&scheduler->queue_mutex);
+}
+
+/* Pop a task from a queue protected by the scheduler's queue_mutex, optionally only a task
+ * matching the filter. */
+static Task *task_scheduler_queue_pop_ex(TaskScheduler *scheduler,
+                                         ListBase *queue,
+                                         std::atomic<int> *num_queued,
+                                         const TaskFilter *filter,
+                                         const bool background_only)
+{
+  if (num_queued->load(std::memory_order_relaxed) == 0) {
+    return NULL;
+  }
+
+  Task *found_task = NULL;
+  BLI_mutex_lock(&scheduler->queue_mutex);
+  LISTBASE_FOREACH (Task *, task, queue) {
+    if (!task_filter_match(filter, task->pool, task->group)) {
+      continue;
     }
+    if (background_only && !task->pool->run_in_background) {
+      continue;
+    }
+    found_task = task;
+    BLI_remlink(queue, task);
+    num_queued->fetch_sub(1, std::memory_order_relaxed);
+    break;
+  }
+  BLI_mutex_unlock(&scheduler->queue_mutex);
+
+  return found_task;
+}
+
+/* Pop a task from the global queue. */
+static Task *task_scheduler_queue_pop(TaskScheduler *scheduler,
+                                      const TaskFilter *filter,
+                                      const bool background_only)
+{
+  return task_scheduler_queue_pop_ex(
+      scheduler, &scheduler->queue, &scheduler->num_queued, filter, background_only);
+}
+
+/* Pop a task from the queue of a NUMA node. */
+static Task *task_scheduler_numa_pop(TaskScheduler *scheduler,
+                                     const int node_index,
+                                     const TaskFilter *filter)
+{
+  TaskNumaNode *node = &scheduler->numa_nodes[node_index];
+  return task_scheduler_queue_pop_ex(scheduler, &node->queue, &node->num_queued, filter, false);
+}
 
-    for (current_task = (Task *)scheduler->queue.first; current_task != NULL;
-         current_task = current_task->next) {
-      TaskPool *pool = current_task->pool;
+/* Xorshift, quality is not important here. */
+BLI_INLINE uint32_t task_thread_random(TaskThread *thread)
+{
+  uint32_t seed = thread->steal_seed;
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  thread->steal_seed = seed;
+  return seed;
+}
 
-      if (scheduler->background_thread_only && !pool->run_in_background) {
-        continue;
+/* Steal a task from any of the scheduler thread deques, starting at a random one.
+ * Threads pinned to a NUMA node try the threads of their node first, their tasks are more
+ * likely to work on memory of that node. */
+static Task *task_scheduler_steal(TaskScheduler *scheduler,
+                                  TaskThread *thread,
+                                  const TaskFilter *filter)
+{
+  if (thread != NULL && thread->numa_node != -1) {
+    const TaskNumaNode *node = &scheduler->numa_nodes[thread->numa_node];
+    int victim = (int)(task_thread_random(thread) % (uint32_t)node->num_threads);
+    for (int i = 0; i < node->num_threads; i++, victim = (victim + 1) % node->num_threads) {
+      Task *task = task_deque_steal(
+          &scheduler->task_threads[node->thread_ids[victim]].deque, filter);
+      if (task != NULL) {
+        return task;
       }
+    }
+  }
 
-      *task = current_task;
-      found_task = true;
-      BLI_remlink(&scheduler->queue, *task);
-      break;
+  const int num_deques = scheduler->num_threads + 1;
+  int victim = 0;
+  if (thread != NULL) {
+    victim = (int)(task_thread_random(thread) % (uint32_t)num_deques);
+  }
+
+  for (int i = 0; i < num_deques; i++, victim = (victim + 1) % num_deques) {
+    Task *task = task_deque_steal(&scheduler->task_threads[victim].deque, filter);
+    if (task != NULL) {
+      return task;
     }
-    if (!found_task) {
-      BLI_condition_wait(&scheduler->queue_cond, &scheduler->queue_mutex);
+  }
+  return NULL;
+}
+
+/* Run the task, \a thread is NULL for threads not managed by the scheduler. */
+BLI_INLINE void task_run(Task *task, const int thread_id, TaskThread *thread)
+{
+  TaskPool *pool = task->pool;
+  TaskGroup *group = task->group;
+
+  /* Tasks of a canceled pool may still be in thread deques, they are discarded here. */
+  if (!pool->do_cancel) {
+    if (thread != NULL) {
+      TaskPool *prev_pool = thread->current_pool;
+      thread->current_pool = pool;
+      thread->current_depth++;
+      task->run(pool, task->taskdata, thread_id);
+      thread->current_depth--;
+      thread->current_pool = prev_pool;
     }
-  } while (!found_task);
+    else {
+      task->run(pool, task->taskdata, thread_id);
+    }
+  }
 
-  BLI_mutex_unlock(&scheduler->queue_mutex);
+  /* delete task */
+  task_free(pool, task, thread_id);
 
-  return true;
+  /* notify group and pool task was done */
+  if (group != NULL) {
+    task_pool_counter_decrease(pool, &group->num, 1);
+  }
+  task_pool_num_decrease(pool, 1);
 }
 
-BLI_INLINE void handle_local_queue(TaskThreadLocalStorage *tls, const int thread_id)
+static Task *task_scheduler_thread_find_task(TaskScheduler *scheduler, TaskThread *thread)
 {
-  BLI_assert(!tls->do_delayed_push);
-  while (tls->num_local_queue > 0) {
-    /* We pop task from queue before handling it so handler of the task can
-     * push next job to the local queue.
-     */
-    tls->num_local_queue--;
-    Task *local_task = tls->local_queue[tls->num_local_queue];
-    /* TODO(sergey): Double-check work_and_wait() doesn't handle other's
-     * pool tasks.
-     */
-    TaskPool *local_pool = local_task->pool;
-    local_task->run(local_pool, local_task->taskdata, thread_id);
-    task_free(local_pool, local_task, thread_id);
+  Task *task;
+
+  /* Own tasks first, most recently pushed ones have the best chance to be in cache. */
+  task = task_deque_take(&thread->deque);
+  if (task != NULL) {
+    if (task_scheduler_thread_can_run(scheduler, task->pool)) {
+      return task;
+    }
+    /* Only the background thread runs, this task has to be run by the thread waiting
+     * for its pool. */
+    task_deque_push(&thread->deque, task);
+    task_scheduler_thread_hand_over(scheduler, thread);
+  }
+
+  if (thread->numa_node != -1) {
+    task = task_scheduler_numa_pop(scheduler, thread->numa_node, NULL);
+    if (task != NULL) {
+      return task;
+    }
+  }
+
+  task = task_scheduler_queue_pop(scheduler, NULL, scheduler->background_thread_only);
+  if (task != NULL) {
+    return task;
+  }
+
+  /* Background pools never use thread deques, nothing to steal for the background thread. */
+  if (scheduler->background_thread_only) {
+    return NULL;
+  }
+  return task_scheduler_steal(scheduler, thread, NULL);
+}
+
+static bool task_scheduler_has_work(TaskScheduler *scheduler, TaskThread *thread)
+{
+  if (thread->numa_node != -1 &&
+      !BLI_listbase_is_empty(&scheduler->numa_nodes[thread->numa_node].queue)) {
+    return true;
+  }
+  LISTBASE_FOREACH (Task *, task, &scheduler->queue) {
+    if (task_scheduler_thread_can_run(scheduler, task->pool)) {
+      return true;
+    }
+  }
+  if (scheduler->background_thread_only) {
+    return false;
+  }
+  for (int i = 0; i < scheduler->num_threads + 1; i++) {
+    if (!task_deque_is_empty(&scheduler->task_threads[i].deque)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Sleep until there might be new work, return false when the thread is to exit. */
+static bool task_scheduler_thread_wait(TaskScheduler *scheduler, TaskThread *thread)
+{
+  BLI_mutex_lock(&scheduler->queue_mutex);
+
+  if (!scheduler->do_exit) {
+    scheduler->num_sleeping.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    /* Check again now that pushing threads know about us, waking up may also be spurious
+     * which is handled by the caller looking for tasks again. */
+    if (!task_scheduler_has_work(scheduler, thread)) {
+      BLI_condition_wait(&scheduler->queue_cond, &scheduler->queue_mutex);
+    }
+
+    scheduler->num_sleeping.fetch_sub(1, std::memory_order_relaxed);
   }
-  BLI_assert(!tls->do_delayed_push);
+
+  const bool do_exit = scheduler->do_exit;
+  BLI_mutex_unlock(&scheduler->queue_mutex);
+
+  return !do_exit;
 }
 
 static void *task_scheduler_thread_run(void *thread_p)
 {
   TaskThread *thread = (TaskThread *)thread_p;
-  TaskThreadLocalStorage *tls = &thread->tls;
   TaskScheduler *scheduler = thread->scheduler;
   int thread_id = thread->id;
-  Task *task;
 
   pthread_setspecific(scheduler->tls_id_key, thread);
 
+  if (thread->numa_node != -1) {
+    BLI_thread_run_on_numa_node(thread->numa_node);
+  }
+
   /* signal the main thread when all threads have started */
   BLI_mutex_lock(&scheduler->startup_mutex);
   scheduler->num_thread_started++;
@@ -444,25 +938,82 @@ static void *task_scheduler_thread_run(void *thread_p)
   BLI_mutex_unlock(&scheduler->startup_mutex);
 
   /* keep popping off tasks */
-  while (task_scheduler_thread_wait_pop(scheduler, &task)) {
-    TaskPool *pool = task->pool;
+  while (!scheduler->do_exit) {
+    Task *task = task_scheduler_thread_find_task(scheduler, thread);
+    if (task != NULL) {
+      BLI_assert(!thread->tls.do_delayed_push);
+      task_run(task, thread_id, thread);
+      BLI_assert(!thread->tls.do_delayed_push);
+    }
+    else if (!task_scheduler_thread_wait(scheduler, thread)) {
+      break;
+    }
+  }
 
-    /* run task */
-    BLI_assert(!tls->do_delayed_push);
-    task->run(pool, task->taskdata, thread_id);
-    BLI_assert(!tls->do_delayed_push);
+  return NULL;
+}
+
+static void task_thread_init(TaskScheduler *scheduler, TaskThread *thread, const int id)
+{
+  thread->scheduler = scheduler;
+  thread->id = id;
+  thread->numa_node = -1;
+  thread->current_pool = NULL;
+  thread->current_depth = 0;
+  thread->steal_seed = 0x9E3779B9u * (uint32_t)(id + 1);
+  initialize_task_tls(&thread->tls);
+  task_deque_init(&thread->deque);
+}
 
-    /* delete task */
-    task_free(pool, task, thread_id);
+/* Distribute the worker threads over the NUMA nodes, proportionally to the number of
+ * processors of each node. */
+static void task_scheduler_numa_init(TaskScheduler *scheduler)
+{
+  scheduler->numa_nodes = NULL;
+  scheduler->num_numa_nodes = 1;
 
-    /* Handle all tasks from local queue. */
-    handle_local_queue(tls, thread_id);
+  /* The background thread only runs background pools, no need to place it. */
+  const int num_nodes = BLI_system_numa_num_nodes();
+  if (num_nodes <= 1 || scheduler->background_thread_only) {
+    return;
+  }
 
-    /* notify pool task was done */
-    task_pool_num_decrease(pool, 1);
+  int *node_processors_end = (int *)MEM_mallocN(sizeof(int) * (size_t)num_nodes, __func__);
+  int num_processors = 0;
+  for (int node = 0; node < num_nodes; node++) {
+    num_processors += BLI_system_numa_node_num_processors(node);
+    node_processors_end[node] = num_processors;
+  }
+  if (num_processors == 0) {
+    MEM_freeN(node_processors_end);
+    return;
   }
 
-  return NULL;
+  scheduler->num_numa_nodes = num_nodes;
+  scheduler->numa_nodes = (TaskNumaNode *)MEM_callocN(sizeof(TaskNumaNode) * (size_t)num_nodes,
+                                                      "TaskScheduler NUMA nodes");
+  for (int node = 0; node < num_nodes; node++) {
+    TaskNumaNode *numa_node = &scheduler->numa_nodes[node];
+    BLI_listbase_clear(&numa_node->queue);
+    numa_node->num_queued.store(0);
+    numa_node->thread_ids = (int *)MEM_mallocN(sizeof(int) * (size_t)scheduler->num_threads,
+                                               "TaskNumaNode thread ids");
+  }
+
+  /* The main thread is left to the operating system. */
+  for (int i = 0; i < scheduler->num_threads; i++) {
+    const int processor = (int)((int64_t)i * num_processors / scheduler->num_threads);
+    int node = 0;
+    while (processor >= node_processors_end[node]) {
+      node++;
+    }
+    TaskThread *thread = &scheduler->task_threads[i + 1];
+    TaskNumaNode *numa_node = &scheduler->numa_nodes[node];
+    thread->numa_node = node;
+    numa_node->thread_ids[numa_node->num_threads++] = thread->id;
+  }
+
+  MEM_freeN(node_processors_end);
 }
 
 TaskScheduler *BLI_task_scheduler_create(int num_threads)
@@ -474,6 +1025,8 @@ TaskScheduler *BLI_task_scheduler_create(int num_threads)
   scheduler->do_exit = false;
 
   BLI_listbase_clear(&scheduler->queue);
+  scheduler->num_queued.store(0);
+  scheduler->num_sleeping.store(0);
   BLI_mutex_init(&scheduler->queue_mutex);
   BLI_condition_init(&scheduler->queue_cond);
 
@@ -495,11 +1048,16 @@ TaskScheduler *BLI_task_scheduler_create(int num_threads)
     num_threads = 1;
   }
 
+  scheduler->num_threads = num_threads;
   scheduler->task_threads = (TaskThread *)MEM_mallocN(sizeof(TaskThread) * (num_threads + 1),
                                                       "TaskScheduler task threads");
 
-  /* Initialize TLS for main thread. */
-  initialize_task_tls(&scheduler->task_threads[0].tls);
+  /* Initialize deque and TLS for all threads, including the main thread. Threads steal from
+   * each other, so this has to be done before any of them is launched. */
+  for (int i = 0; i < num_threads + 1; i++) {
+    task_thread_init(scheduler, &scheduler->task_threads[i], i);
+  }
+  task_scheduler_numa_init(scheduler);
 
   pthread_key_create(&scheduler->tls_id_key, NULL);
 
@@ -507,15 +1065,11 @@ TaskScheduler *BLI_task_scheduler_create(int num_threads)
   if (num_threads > 0) {
     int i;
 
-    scheduler->num_threads = num_threads;
     scheduler->threads = (pthread_t *)MEM_callocN(sizeof(pthread_t) * num_threads,
                                                   "TaskScheduler threads");
 
     for (i = 0; i < num_threads; i++) {
       TaskThread *thread = &scheduler->task_threads[i + 1];
-      thread->scheduler = scheduler;
-      thread->id = i + 1;
-      initialize_task_tls(&thread->tls);
 
       if (pthread_create(&scheduler->threads[i], NULL, task_scheduler_thread_run, thread) != 0) {
         fprintf(stderr, "TaskScheduler failed to launch thread %d/%d\n", i, num_threads);
@@ -565,8 +1119,9 @@ void BLI_task_scheduler_free(TaskScheduler *scheduler)
   /* Delete task thread data */
   if (scheduler->task_threads) {
     for (int i = 0; i < scheduler->num_threads + 1; i++) {
-      TaskThreadLocalStorage *tls = &scheduler->task_threads[i].tls;
-      free_task_tls(tls);
+      TaskThread *thread = &scheduler->task_threads[i];
+      task_deque_free(&thread->deque);
+      free_task_tls(&thread->tls);
     }
 
     MEM_freeN(scheduler->task_threads);
@@ -578,6 +1133,18 @@ void BLI_task_scheduler_free(TaskScheduler *scheduler)
   }
   BLI_freelistN(&scheduler->queue);
 
+  if (scheduler->numa_nodes) {
+    for (int i = 0; i < scheduler->num_numa_nodes; i++) {
+      TaskNumaNode *numa_node = &scheduler->numa_nodes[i];
+      for (task = (Task *)numa_node->queue.first; task; task = task->next) {
+        task_data_free(task, 0);
+      }
+      BLI_freelistN(&numa_node->queue);
+      MEM_freeN(numa_node->thread_ids);
+    }
+    MEM_freeN(scheduler->numa_nodes);
+  }
+
   /* delete mutex/condition */
   BLI_mutex_end(&scheduler->queue_mutex);
   BLI_condition_end(&scheduler->queue_cond);
@@ -592,68 +1159,64 @@ int BLI_task_scheduler_num_threads(TaskScheduler *scheduler)
   return scheduler->num_threads + 1;
 }
 
-static void task_scheduler_push(TaskScheduler *scheduler, Task *task, TaskPriority priority)
+int BLI_task_scheduler_num_numa_nodes(TaskScheduler *scheduler)
 {
-  task_pool_num_increase(task->pool, 1);
-
-  /* add task to queue */
-  BLI_mutex_lock(&scheduler->queue_mutex);
+  return scheduler->num_numa_nodes;
+}
 
-  if (priority == TASK_PRIORITY_HIGH) {
-    BLI_addhead(&scheduler->queue, task);
-  }
-  else {
-    BLI_addtail(&scheduler->queue, task);
+int BLI_task_scheduler_numa_node_num_threads(TaskScheduler *scheduler, int node)
+{
+  BLI_assert(node >= 0 && node < scheduler->num_numa_nodes);
+  if (scheduler->numa_nodes == NULL) {
+    return scheduler->num_threads + 1;
   }
-
-  BLI_condition_notify_one(&scheduler->queue_cond);
-  BLI_mutex_unlock(&scheduler->queue_mutex);
+  return scheduler->numa_nodes[node].num_threads;
 }
 
-static void task_scheduler_push_all(TaskScheduler *scheduler,
-                                    TaskPool *pool,
-                                    Task **tasks,
-                                    int num_tasks)
+/* Free the tasks of the pool from a queue protected by queue_mutex, returns their number. */
+static size_t task_scheduler_queue_clear(ListBase *queue,
+                                         std::atomic<int> *num_queued,
+                                         TaskPool *pool)
 {
-  if (num_tasks == 0) {
-    return;
-  }
+  Task *task, *nexttask;
+  size_t done = 0;
 
-  task_pool_num_increase(pool, num_tasks);
+  for (task = (Task *)queue->first; task; task = nexttask) {
+    nexttask = task->next;
 
-  BLI_mutex_lock(&scheduler->queue_mutex);
+    if (task->pool == pool) {
+      task_data_free(task, pool->thread_id);
+      BLI_freelinkN(queue, task);
+      num_queued->fetch_sub(1, std::memory_order_relaxed);
 
-  for (int i = 0; i < num_tasks; i++) {
-    BLI_addhead(&scheduler->queue, tasks[i]);
+      done++;
+    }
   }
 
-  BLI_condition_notify_all(&scheduler->queue_cond);
-  BLI_mutex_unlock(&scheduler->queue_mutex);
+  return done;
 }
 
 static void task_scheduler_clear(TaskScheduler *scheduler, TaskPool *pool)
 {
-  Task *task, *nexttask;
   size_t done = 0;
 
   BLI_mutex_lock(&scheduler->queue_mutex);
 
-  /* free all tasks from this pool from the queue */
-  for (task = (Task *)scheduler->queue.first; task; task = nexttask) {
-    nexttask = task->next;
-
-    if (task->pool == pool) {
-      task_data_free(task, pool->thread_id);
-      BLI_freelinkN(&scheduler->queue, task);
-
-      done++;
+  /* free all tasks from this pool from the queues */
+  done += task_scheduler_queue_clear(&scheduler->queue, &scheduler->num_queued, pool);
+  if (scheduler->numa_nodes) {
+    for (int i = 0; i < scheduler->num_numa_nodes; i++) {
+      TaskNumaNode *numa_node = &scheduler->numa_nodes[i];
+      done += task_scheduler_queue_clear(&numa_node->queue, &numa_node->num_queued, pool);
     }
   }
 
   BLI_mutex_unlock(&scheduler->queue_mutex);
 
   /* notify done */
-  task_pool_num_decrease(pool, done);
+  if (done != 0) {
+    task_pool_num_decrease(pool, done);
+  }
 }
 
 /* Task Pool */
@@ -681,10 +1244,13 @@ static TaskPool *task_pool_create_ex(TaskScheduler *scheduler,
 
   pool->scheduler = scheduler;
   pool->num = 0;
+  pool->num_pushed = 0;
+  pool->num_waiters = 0;
   pool->do_cancel = false;
   pool->do_work = false;
   pool->is_suspended = is_suspended;
   pool->start_suspended = is_suspended;
+  pool->is_reentrant = false;
   pool->num_suspended = 0;
   pool->suspended_queue.first = pool->suspended_queue.last = NULL;
   pool->priority = priority;
@@ -805,9 +1371,19 @@ void BLI_task_pool_free(TaskPool *pool)
   BLI_threaded_malloc_end();
 }
 
-BLI_INLINE bool task_can_use_local_queues(TaskPool *pool, int thread_id)
+/* Tasks can be pushed to the deque of the pushing thread when it is a scheduler thread.
+ * Background pools always use the global queue, the background thread is the only one allowed
+ * to run them in the single-threaded case, and it does not steal.
+ *
+ * Only the thread owning a deque may push to it, so the given ID is checked against the calling
+ * thread. Threads not managed by the scheduler also identify themselves as thread 0. */
+BLI_INLINE bool task_can_use_thread_deque(TaskPool *pool, int thread_id)
 {
-  return (thread_id != -1 && (thread_id != pool->thread_id || pool->do_work));
+  if (thread_id == -1 || pool->run_in_background || (pool->use_local_tls && thread_id == 0)) {
+    return false;
+  }
+  const TaskThread *thread = task_scheduler_current_thread(pool->scheduler);
+  return (thread != NULL && thread->id == thread_id);
 }
 
 static void task_pool_push(TaskPool *pool,
@@ -815,8 +1391,11 @@ static void task_pool_push(TaskPool *pool,
                            void *taskdata,
                            bool free_taskdata,
                            TaskFreeFunction freedata,
-                           int thread_id)
+                           int thread_id,
+                           TaskGroup *group)
 {
+  TaskScheduler *scheduler = pool->scheduler;
+
   /* Allocate task and fill it's properties. */
   Task *task = task_alloc(pool, thread_id);
   task->run = run;
@@ -824,6 +1403,10 @@ static void task_pool_push(TaskPool *pool,
   task->free_taskdata = free_taskdata;
   task->freedata = freedata;
   task->pool = pool;
+  task->group = group;
+  if (group != NULL) {
+    atomic_add_and_fetch_z((size_t *)&group->num, 1);
+  }
   /* For suspended pools we put everything yo a global queue first
    * and exit as soon as possible.
    *
@@ -835,32 +1418,26 @@ static void task_pool_push(TaskPool *pool,
     atomic_fetch_and_add_z(&pool->num_suspended, 1);
     return;
   }
-  /* Populate to any local queue first, this is cheapest push ever. */
-  if (task_can_use_local_queues(pool, thread_id)) {
-    ASSERT_THREAD_ID(pool->scheduler, thread_id);
-    TaskThreadLocalStorage *tls = get_task_tls(pool, thread_id);
-    /* Try to push to a local execution queue.
-     * These tasks will be picked up next.
-     */
-    if (tls->num_local_queue < LOCAL_QUEUE_SIZE) {
-      tls->local_queue[tls->num_local_queue] = task;
-      tls->num_local_queue++;
-      return;
+  /* Push to the deque of this thread, this is cheapest push ever, no locks are involved. */
+  if (task_can_use_thread_deque(pool, thread_id)) {
+    ASSERT_THREAD_ID(scheduler, thread_id);
+    TaskThread *thread = &scheduler->task_threads[thread_id];
+    task_pool_num_increase(pool, 1);
+    task_deque_push(&thread->deque, task);
+    task_pool_notify_pushed(pool);
+
+    if (thread->tls.do_delayed_push) {
+      thread->tls.num_delayed_push++;
     }
-    /* If we are in the delayed tasks push mode, we push tasks to a
-     * temporary local queue first without any locks, and then move them
-     * to global execution queue with a single lock.
-     */
-    if (tls->do_delayed_push && tls->num_delayed_queue < DELAYED_QUEUE_SIZE) {
-      tls->delayed_queue[tls->num_delayed_queue] = task;
-      tls->num_delayed_queue++;
-      return;
+    else {
+      task_scheduler_wake(scheduler, false);
     }
+    return;
   }
   /* Do push to a global execution pool, slowest possible method,
    * causes quite reasonable amount of threading overhead.
    */
-  task_scheduler_push(pool->scheduler, task, pool->priority);
+  task_scheduler_push(scheduler, task, pool->priority);
 }
 
 void BLI_task_pool_push(TaskPool *pool,
@@ -869,7 +1446,7 @@ void BLI_task_pool_push(TaskPool *pool,
                         bool free_taskdata,
                         TaskFreeFunction freedata)
 {
-  task_pool_push(pool, run, taskdata, free_taskdata, freedata, -1);
+  task_pool_push(pool, run, taskdata, free_taskdata, freedata, -1, NULL);
 }
 
 void BLI_task_pool_push_from_thread(TaskPool *pool,
@@ -879,88 +1456,202 @@ void BLI_task_pool_push_from_thread(TaskPool *pool,
                                     TaskFreeFunction freedata,
                                     int thread_id)
 {
-  task_pool_push(pool, run, taskdata, free_taskdata, freedata, thread_id);
+  task_pool_push(pool, run, taskdata, free_taskdata, freedata, thread_id, NULL);
 }
 
-void BLI_task_pool_work_and_wait(TaskPool *pool)
+void BLI_task_pool_push_on_numa_node(TaskPool *pool,
+                                     TaskRunFunction run,
+                                     void *taskdata,
+                                     bool free_taskdata,
+                                     TaskFreeFunction freedata,
+                                     int numa_node)
 {
-  TaskThreadLocalStorage *tls = get_task_tls(pool, pool->thread_id);
   TaskScheduler *scheduler = pool->scheduler;
+  BLI_assert(numa_node >= 0 && numa_node < scheduler->num_numa_nodes);
+  BLI_assert(!pool->is_suspended);
 
-  if (atomic_fetch_and_and_uint8((uint8_t *)&pool->is_suspended, 0)) {
-    if (pool->num_suspended) {
-      task_pool_num_increase(pool, pool->num_suspended);
-      BLI_mutex_lock(&scheduler->queue_mutex);
-
-      BLI_movelisttolist(&scheduler->queue, &pool->suspended_queue);
-
-      BLI_condition_notify_all(&scheduler->queue_cond);
-      BLI_mutex_unlock(&scheduler->queue_mutex);
-
-      pool->num_suspended = 0;
-    }
+  if (scheduler->numa_nodes == NULL || pool->is_suspended ||
+      scheduler->numa_nodes[numa_node].num_threads == 0) {
+    task_pool_push(pool, run, taskdata, free_taskdata, freedata, -1, NULL);
+    return;
   }
 
-  pool->do_work = true;
+  Task *task = task_alloc(pool, -1);
+  task->run = run;
+  task->taskdata = taskdata;
+  task->free_taskdata = free_taskdata;
+  task->freedata = freedata;
+  task->pool = pool;
+  task->group = NULL;
 
-  ASSERT_THREAD_ID(pool->scheduler, pool->thread_id);
+  task_pool_num_increase(pool, 1);
 
-  handle_local_queue(tls, pool->thread_id);
+  TaskNumaNode *node = &scheduler->numa_nodes[numa_node];
+  BLI_mutex_lock(&scheduler->queue_mutex);
+  BLI_addtail(&node->queue, task);
+  node->num_queued.fetch_add(1, std::memory_order_relaxed);
+  task_pool_notify_pushed(pool);
+  /* Only threads of the node can run the task, which one of the sleeping threads that is
+   * is unknown. */
+  BLI_condition_notify_all(&scheduler->queue_cond);
+  BLI_mutex_unlock(&scheduler->queue_mutex);
+}
 
-  BLI_mutex_lock(&pool->num_mutex);
+/* Find a task the waiting thread can help with. */
+static Task *task_pool_find_task(TaskScheduler *scheduler,
+                                 TaskThread *thread,
+                                 const TaskFilter *filter)
+{
+  Task *task;
 
-  while (pool->num != 0) {
-    Task *task, *work_task = NULL;
-    bool found_task = false;
+  if (thread != NULL) {
+    task = task_deque_take(&thread->deque);
+    if (task != NULL) {
+      if (task_filter_match(filter, task->pool, task->group)) {
+        return task;
+      }
+      /* Running tasks of other pools here could deadlock, when they wait for something this
+       * thread is going to do after the pool is done. Leave it for other threads. */
+      task_deque_push(&thread->deque, task);
+    }
+  }
 
-    BLI_mutex_unlock(&pool->num_mutex);
+  if (thread != NULL && thread->numa_node != -1) {
+    task = task_scheduler_numa_pop(scheduler, thread->numa_node, filter);
+    if (task != NULL) {
+      return task;
+    }
+  }
 
-    BLI_mutex_lock(&scheduler->queue_mutex);
+  task = task_scheduler_queue_pop(scheduler, filter, false);
+  if (task != NULL) {
+    return task;
+  }
 
-    /* find task from this pool. if we get a task from another pool,
-     * we can get into deadlock */
+  task = task_scheduler_steal(scheduler, thread, filter);
+  if (task != NULL) {
+    return task;
+  }
 
-    for (task = (Task *)scheduler->queue.first; task; task = task->next) {
-      if (task->pool == pool) {
-        work_task = task;
-        found_task = true;
-        BLI_remlink(&scheduler->queue, task);
-        break;
+  /* Tasks for other NUMA nodes last, their threads may all be busy with something which
+   * can't finish before this pool does. */
+  if (scheduler->numa_nodes) {
+    for (int i = 0; i < scheduler->num_numa_nodes; i++) {
+      task = task_scheduler_numa_pop(scheduler, i, filter);
+      if (task != NULL) {
+        return task;
       }
     }
+  }
+  return NULL;
+}
 
-    BLI_mutex_unlock(&scheduler->queue_mutex);
-
-    /* if found task, do it, otherwise wait until other tasks are done */
-    if (found_task) {
-      /* run task */
-      BLI_assert(!tls->do_delayed_push);
-      work_task->run(pool, work_task->taskdata, pool->thread_id);
-      BLI_assert(!tls->do_delayed_push);
+/**
+ * Run tasks of the pool (or only of the group when given) and wait until they are all done.
+ * Tasks of a canceled pool are discarded instead of being run.
+ *
+ * \param use_reentrant: When waiting inside a task of a reentrant pool, run other tasks of
+ * that pool as well while our own tasks are running on other threads.
+ */
+static void task_pool_work_and_wait_ex(TaskPool *pool,
+                                       TaskGroup *group,
+                                       const int thread_id,
+                                       const bool use_reentrant)
+{
+  TaskScheduler *scheduler = pool->scheduler;
+  TaskThread *thread = task_scheduler_current_thread(scheduler);
+  volatile size_t *num = (group != NULL) ? &group->num : &pool->num;
+
+  TaskFilter filter = {pool, group, NULL};
+  if (use_reentrant && thread != NULL && thread->current_pool != NULL &&
+      thread->current_pool->is_reentrant && thread->current_depth < TASK_REENTRANT_MAX_DEPTH &&
+      task_isolation_depth == 0) {
+    filter.reentrant_pool = thread->current_pool;
+  }
 
-      /* delete task */
-      task_free(pool, task, pool->thread_id);
+  while (true) {
+    const uint32_t num_pushed = pool->num_pushed;
 
-      /* Handle all tasks from local queue. */
-      handle_local_queue(tls, pool->thread_id);
+    Task *task = task_pool_find_task(scheduler, thread, &filter);
+    if (task != NULL) {
+      task_run(task, thread_id, thread);
+      continue;
+    }
 
-      /* notify pool task was done */
-      task_pool_num_decrease(pool, 1);
+    /* Other tasks of this thread's deque may be needed by other threads before this pool can
+     * finish, don't keep them blocked while waiting. */
+    if (thread != NULL) {
+      task_scheduler_thread_hand_over(scheduler, thread);
     }
 
     BLI_mutex_lock(&pool->num_mutex);
-    if (pool->num == 0) {
+    if (*num == 0) {
+      BLI_mutex_unlock(&pool->num_mutex);
       break;
     }
-
-    if (!found_task) {
+    atomic_add_and_fetch_uint32((uint32_t *)&pool->num_waiters, 1);
+    /* Only sleep when nothing was pushed since we looked for tasks, otherwise there might be
+     * a task we can run. Pushes after this point will notify us. */
+    if (pool->num_pushed == num_pushed) {
       BLI_condition_wait(&pool->num_cond, &pool->num_mutex);
     }
+    atomic_sub_and_fetch_uint32((uint32_t *)&pool->num_waiters, 1);
+    BLI_mutex_unlock(&pool->num_mutex);
   }
+}
 
-  BLI_mutex_unlock(&pool->num_mutex);
+static void task_pool_work_and_wait(TaskPool *pool, const bool use_reentrant)
+{
+  TaskScheduler *scheduler = pool->scheduler;
+
+  if (atomic_fetch_and_and_uint8((uint8_t *)&pool->is_suspended, 0)) {
+    if (pool->num_suspended) {
+      task_pool_num_increase(pool, pool->num_suspended);
+
+      TaskThread *thread = task_scheduler_current_thread(scheduler);
+      if (thread != NULL && task_can_use_thread_deque(pool, thread->id)) {
+        /* Other threads steal the tasks from our deque, without any locks. */
+        Task *task;
+        while ((task = (Task *)BLI_pophead(&pool->suspended_queue)) != NULL) {
+          task_deque_push(&thread->deque, task);
+        }
+        task_scheduler_wake(scheduler, true);
+      }
+      else {
+        BLI_mutex_lock(&scheduler->queue_mutex);
+
+        BLI_movelisttolist(&scheduler->queue, &pool->suspended_queue);
+        scheduler->num_queued.fetch_add((int)pool->num_suspended, std::memory_order_relaxed);
+
+        BLI_condition_notify_all(&scheduler->queue_cond);
+        BLI_mutex_unlock(&scheduler->queue_mutex);
+      }
+
+      pool->num_suspended = 0;
+    }
+  }
+
+  pool->do_work = true;
+
+  ASSERT_THREAD_ID(pool->scheduler, pool->thread_id);
 
-  BLI_assert(tls->num_local_queue == 0);
+  task_pool_work_and_wait_ex(pool, NULL, pool->thread_id, use_reentrant);
+}
+
+void BLI_task_pool_work_and_wait(TaskPool *pool)
+{
+  task_pool_work_and_wait(pool, false);
+}
+
+/**
+ * Same as #BLI_task_pool_work_and_wait, but when called from a task of a reentrant pool, other
+ * tasks of that pool are run while waiting.
+ *
+ * Only use this when the caller holds no lock which the tasks of that pool may need.
+ */
+void BLI_task_pool_work_and_wait_reentrant(TaskPool *pool)
+{
+  task_pool_work_and_wait(pool, true);
 }
 
 void BLI_task_pool_work_wait_and_reset(TaskPool *pool)
@@ -977,16 +1668,25 @@ void BLI_task_pool_cancel(TaskPool *pool)
 
   task_scheduler_clear(pool->scheduler, pool);
 
-  /* wait until all entries are cleared */
-  BLI_mutex_lock(&pool->num_mutex);
-  while (pool->num) {
-    BLI_condition_wait(&pool->num_cond, &pool->num_mutex);
-  }
-  BLI_mutex_unlock(&pool->num_mutex);
+  /* Wait until all running tasks are done, and discard the ones still in thread deques. */
+  task_pool_work_and_wait_ex(pool, NULL, pool->thread_id, false);
 
   pool->do_cancel = false;
 }
 
+/**
+ * Allow threads waiting inside a task of this pool, on a nested pool or a #TaskGroup, to run
+ * other tasks of the pool meanwhile instead of sleeping.
+ *
+ * This only applies to waits which opt in, see #BLI_task_pool_work_and_wait_reentrant,
+ * #BLI_task_group_work_and_wait_reentrant and #TaskParallelSettings.use_reentrant. Other waits
+ * only run the tasks they wait for, so code waiting while holding a lock stays safe.
+ */
+void BLI_task_pool_set_reentrant(TaskPool *pool, bool is_reentrant)
+{
+  pool->is_reentrant = is_reentrant;
+}
+
 bool BLI_task_pool_canceled(TaskPool *pool)
 {
   return pool->do_cancel;
@@ -1009,21 +1709,91 @@ int BLI_task_pool_creator_thread_id(TaskPool *pool)
 
 void BLI_task_pool_delayed_push_begin(TaskPool *pool, int thread_id)
 {
-  if (task_can_use_local_queues(pool, thread_id)) {
+  if (task_can_use_thread_deque(pool, thread_id)) {
     ASSERT_THREAD_ID(pool->scheduler, thread_id);
-    TaskThreadLocalStorage *tls = get_task_tls(pool, thread_id);
+    TaskThreadLocalStorage *tls = &pool->scheduler->task_threads[thread_id].tls;
     tls->do_delayed_push = true;
   }
 }
 
 void BLI_task_pool_delayed_push_end(TaskPool *pool, int thread_id)
 {
-  if (task_can_use_local_queues(pool, thread_id)) {
+  if (task_can_use_thread_deque(pool, thread_id)) {
     ASSERT_THREAD_ID(pool->scheduler, thread_id);
-    TaskThreadLocalStorage *tls = get_task_tls(pool, thread_id);
+    TaskThreadLocalStorage *tls = &pool->scheduler->task_threads[thread_id].tls;
     BLI_assert(tls->do_delayed_push);
-    task_scheduler_push_all(pool->scheduler, pool, tls->delayed_queue, tls->num_delayed_queue);
+    if (tls->num_delayed_push != 0) {
+      task_scheduler_wake(pool->scheduler, tls->num_delayed_push > 1);
+    }
     tls->do_delayed_push = false;
-    tls->num_delayed_queue = 0;
+    tls->num_delayed_push = 0;
   }
 }
+
+/* Task Group */
+
+/**
+ * Create a group of tasks in the pool, to wait for them only.
+ *
+ * Typically used from a running task to fork sub-tasks and join them, \a thread_id being the
+ * one the task runs on: the sub-tasks go to the deque of that thread and idle threads steal
+ * them. While waiting, the thread runs tasks of the group itself, see
+ * #BLI_task_group_work_and_wait_reentrant to also run other tasks.
+ */
+TaskGroup *BLI_task_group_create(TaskPool *pool, int thread_id)
+{
+  TaskGroup *group = (TaskGroup *)MEM_mallocN(sizeof(TaskGroup), "TaskGroup");
+  group->pool = pool;
+  group->num = 0;
+  group->thread_id = thread_id;
+  return group;
+}
+
+void BLI_task_group_push(TaskGroup *group,
+                         TaskRunFunction run,
+                         void *taskdata,
+                         bool free_taskdata,
+                         TaskFreeFunction freedata)
+{
+  task_pool_push(group->pool, run, taskdata, free_taskdata, freedata, group->thread_id, group);
+}
+
+/* Work and wait until all tasks of the group are done, the group can be used again after. */
+void BLI_task_group_work_and_wait(TaskGroup *group)
+{
+  ASSERT_THREAD_ID(group->pool->scheduler, group->thread_id);
+  BLI_assert(!group->pool->is_suspended);
+
+  task_pool_work_and_wait_ex(group->pool, group, group->thread_id, false);
+}
+
+/* Same as #BLI_task_group_work_and_wait, also running other tasks of a reentrant pool the
+ * calling task belongs to, see #BLI_task_pool_work_and_wait_reentrant. */
+void BLI_task_group_work_and_wait_reentrant(TaskGroup *group)
+{
+  ASSERT_THREAD_ID(group->pool->scheduler, group->thread_id);
+  BLI_assert(!group->pool->is_suspended);
+
+  task_pool_work_and_wait_ex(group->pool, group, group->thread_id, true);
+}
+
+void BLI_task_group_free(TaskGroup *group)
+{
+  BLI_assert(group->num == 0);
+  MEM_freeN(group);
+}
+
+/**
+ * Run \a func without letting the waits inside it run other tasks of reentrant pools, even
+ * the waits which opt in to it.
+ *
+ * Needed when calling code which uses reentrant waits while holding a lock that other tasks of
+ * the pool the calling task belongs to may need: running one of them on top of the waiting task
+ * would deadlock.
+ */
+void BLI_task_isolate(void (*func)(void *userdata), void *userdata)
+{
+  task_isolation_depth++;
+  func(userdata);
+  task_isolation_depth--;
+}
@@ -964,3 +964,31 @@ void BLI_thread_put_thread_on_fast_node(void)
   }
 #endif
 }
+
+int BLI_system_numa_num_nodes(void)
+{
+  if (!is_numa_available) {
+    return 1;
+  }
+  const int num_nodes = numaAPI_GetNumNodes();
+  return (num_nodes > 0) ? num_nodes : 1;
+}
+
+int BLI_system_numa_node_num_processors(int node)
+{
+  if (!is_numa_available) {
+    return (node == 0) ? BLI_system_thread_count() : 0;
+  }
+  if (!numaAPI_IsNodeAvailable(node)) {
+    return 0;
+  }
+  return numaAPI_GetNumNodeProcessors(node);
+}
+
+bool BLI_thread_run_on_numa_node(int node)
+{
+  if (!is_numa_available) {
+    return false;
+  }
+  return numaAPI_RunThreadOnNode(node);
+}
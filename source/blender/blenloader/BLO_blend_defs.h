@@ -69,6 +69,11 @@ enum {
    * Terminate reading (no data).
    */
   ENDB = BLEND_MAKE_ID('E', 'N', 'D', 'B'),
+  /**
+   * Index of the ID blocks, written after #ENDB (see #BlendIDIndexFooter),
+   * (ignored for regular file reading).
+   */
+  INDX = BLEND_MAKE_ID('I', 'N', 'D', 'X'),
 };
 
 #define BLEN_THUMB_MEMSIZE_FILE(_x, _y) (sizeof(int) * (2 + (size_t)(_x) * (size_t)(_y)))
@@ -27,22 +27,36 @@
 
 struct Scene;
 
-typedef struct {
+typedef struct MemFileChunk {
   void *next, *prev;
   const char *buf;
   /** Size in bytes. */
   unsigned int size;
-  /** When true, this chunk doesn't own the memory, it's shared with a previous #MemFileChunk */
+  /** When true, the memory is shared with the previous #MemFileChunk.
+   * Buffers are reference counted, see #BLO_memfile_write_file_async. */
   bool is_identical;
   /** When true, this chunk is also identical to the one in the next step (used by undo code to
    * detect unchanged IDs).
    * Defined when writing the next step (i.e. last undo step has those always false). */
   bool is_identical_future;
+  /** Hash of the contents, used to share buffers of chunks which moved between steps. */
+  unsigned int hash;
+  /** Session UUID of the ID this chunk belongs to, zero for data written outside of IDs. */
+  unsigned int id_session_uuid;
 } MemFileChunk;
 
 typedef struct MemFile {
   ListBase chunks;
+  /** Size in bytes of the chunks which are not shared with the previous step. */
   size_t size;
+  /** Size in bytes of all chunks. */
+  size_t size_total;
+  /** Size in bytes of the chunks shared with the previous step at a different position. */
+  size_t size_shared_moved;
+  /** Chunks by contents, to share buffers with the next step regardless of position. */
+  struct GSet *chunks_by_content;
+  /** First chunk of each ID by session UUID, to compare with the same ID in the next step. */
+  struct GHash *id_first_chunk;
 } MemFile;
 
 typedef struct MemFileUndoData {
@@ -53,8 +67,10 @@ typedef struct MemFileUndoData {
 
 /* actually only used writefile.c */
 extern void memfile_chunk_add(MemFile *memfile,
+                              const MemFile *compare,
                               const char *buf,
                               unsigned int size,
+                              unsigned int id_session_uuid,
                               MemFileChunk **compchunk_step);
 
 /* exports */
@@ -68,4 +84,11 @@ extern struct Main *BLO_memfile_main_get(struct MemFile *memfile,
                                          struct Scene **r_scene);
 extern bool BLO_memfile_write_file(struct MemFile *memfile, const char *filename);
 
+struct MemFileWriteAsync;
+extern struct MemFileWriteAsync *BLO_memfile_write_file_async(struct MemFile *memfile,
+                                                              const char *filename);
+extern bool BLO_memfile_write_async_is_done(struct MemFileWriteAsync *write_async);
+extern bool BLO_memfile_write_async_finish(struct MemFileWriteAsync *write_async,
+                                           const bool cancel);
+
 #endif /* __BLO_UNDOFILE_H__ */
@@ -98,14 +98,19 @@
 
 #include "MEM_guardedalloc.h"
 
+#include "BLI_bitmap.h"
 #include "BLI_blenlib.h"
 #include "BLI_endian_switch.h"
 #include "BLI_ghash.h"
 #include "BLI_linklist.h"
 #include "BLI_math.h"
 #include "BLI_mempool.h"
+#include "BLI_mmap.h"
+#include "BLI_task.h"
 #include "BLI_threads.h"
 
+#include "PIL_time.h"
+
 #include "BLT_translation.h"
 
 #include "BKE_action.h"
@@ -249,6 +254,8 @@
 /* local prototypes */
 static void read_libraries(FileData *basefd, ListBase *mainlist);
 static void *read_struct(FileData *fd, BHead *bh, const char *blockname);
+static int fd_memfile_chunk_find(const FileData *fd, const size_t offset, const int index_hint);
+static bool fd_memfile_range_is_identical(const FileData *fd, size_t offset, const size_t len);
 static void direct_link_modifiers(FileData *fd, ListBase *lb, Object *ob);
 static BHead *find_bhead_from_code_name(FileData *fd, const short idcode, const char *name);
 static BHead *find_bhead_from_idname(FileData *fd, const char *idname);
@@ -268,6 +275,8 @@ typedef struct BHeadN {
   bool has_data;
 #endif
   bool is_memchunk_identical;
+  /** Read for an entry of #FileData.id_index, not part of #FileData.bhead_list. */
+  bool is_id_index_entry;
   struct BHead bhead;
 } BHeadN;
 
@@ -320,38 +329,60 @@ typedef struct OldNew {
   int nr;
 } OldNew;
 
+/**
+ * Open addressing hash table with linear probing.
+ *
+ * Keys are stored inline in #OldNewMap.map_keys so probing a cluster only reads consecutive
+ * memory (a single cache line in the common case), the index into the entries array is only
+ * read once the key matched. Empty slots have a NULL key, NULL pointers are never inserted.
+ */
 typedef struct OldNewMap {
   /* Array that stores the actual entries. */
   OldNew *entries;
   int nentries;
-  /* Hashmap that stores indices into the `entries` array. */
-  int32_t *map;
+  /* Hash table slots, the key and the index into the `entries` array. */
+  const void **map_keys;
+  int32_t *map_indices;
 
   int capacity_exp;
+  /* Allocated capacity, kept when the map is cleared to avoid re-allocating for every ID. */
+  int capacity_exp_alloc;
 } OldNewMap;
 
 #define ENTRIES_CAPACITY(onm) (1ll << (onm)->capacity_exp)
 #define MAP_CAPACITY(onm) (1ll << ((onm)->capacity_exp + 1))
 #define SLOT_MASK(onm) (MAP_CAPACITY(onm) - 1)
 #define DEFAULT_SIZE_EXP 6
-#define PERTURB_SHIFT 5
-
-/* based on the probing algorithm used in Python dicts. */
-#define ITER_SLOTS(onm, KEY, SLOT_NAME, INDEX_NAME) \
-  uint32_t hash = BLI_ghashutil_ptrhash(KEY); \
-  uint32_t mask = SLOT_MASK(onm); \
-  uint perturb = hash; \
-  int SLOT_NAME = mask & hash; \
-  int INDEX_NAME = onm->map[SLOT_NAME]; \
-  for (;; SLOT_NAME = mask & ((5 * SLOT_NAME) + 1 + perturb), \
-          perturb >>= PERTURB_SHIFT, \
-          INDEX_NAME = onm->map[SLOT_NAME])
+/* Number of keys to look ahead when prefetching slots for batched operations. */
+#define PREFETCH_DISTANCE 8
+
+#if defined(__GNUC__) || defined(__clang__)
+#  define OLDNEWMAP_PREFETCH(ptr) __builtin_prefetch(ptr)
+#else
+#  define OLDNEWMAP_PREFETCH(ptr) ((void)0)
+#endif
+
+/**
+ * Fibonacci hashing of the pointer: old addresses are typically allocated in sequence,
+ * the multiplication spreads them over the whole table.
+ */
+BLI_INLINE uint oldnewmap_slot_home(const OldNewMap *onm, const void *ptr)
+{
+  const uint64_t hash = ((uint64_t)(uintptr_t)ptr >> 3) * 0x9E3779B97F4A7C15ull;
+  return (uint)(hash >> (64 - (onm->capacity_exp + 1)));
+}
+
+#define ITER_SLOTS(onm, KEY, SLOT_NAME) \
+  const uint64_t mask = SLOT_MASK(onm); \
+  for (uint64_t SLOT_NAME = oldnewmap_slot_home(onm, KEY);; \
+       SLOT_NAME = (SLOT_NAME + 1) & mask)
 
 static void oldnewmap_insert_index_in_map(OldNewMap *onm, const void *ptr, int index)
 {
-  ITER_SLOTS (onm, ptr, slot, stored_index) {
-    if (stored_index == -1) {
-      onm->map[slot] = index;
+  ITER_SLOTS (onm, ptr, slot) {
+    if (onm->map_keys[slot] == NULL) {
+      onm->map_keys[slot] = ptr;
+      onm->map_indices[slot] = index;
       break;
     }
   }
@@ -359,15 +390,17 @@ static void oldnewmap_insert_index_in_map(OldNewMap *onm, const void *ptr, int i
 
 static void oldnewmap_insert_or_replace(OldNewMap *onm, OldNew entry)
 {
-  ITER_SLOTS (onm, entry.oldp, slot, index) {
-    if (index == -1) {
+  ITER_SLOTS (onm, entry.oldp, slot) {
+    const void *key = onm->map_keys[slot];
+    if (key == NULL) {
       onm->entries[onm->nentries] = entry;
-      onm->map[slot] = onm->nentries;
+      onm->map_keys[slot] = entry.oldp;
+      onm->map_indices[slot] = onm->nentries;
       onm->nentries++;
       break;
     }
-    else if (onm->entries[index].oldp == entry.oldp) {
-      onm->entries[index] = entry;
+    else if (key == entry.oldp) {
+      onm->entries[onm->map_indices[slot]] = entry;
       break;
     }
   }
@@ -375,14 +408,15 @@ static void oldnewmap_insert_or_replace(OldNewMap *onm, OldNew entry)
 
 static OldNew *oldnewmap_lookup_entry(const OldNewMap *onm, const void *addr)
 {
-  ITER_SLOTS (onm, addr, slot, index) {
-    if (index >= 0) {
-      OldNew *entry = &onm->entries[index];
-      if (entry->oldp == addr) {
-        return entry;
-      }
+  if (addr == NULL) {
+    return NULL;
+  }
+  ITER_SLOTS (onm, addr, slot) {
+    const void *key = onm->map_keys[slot];
+    if (key == addr) {
+      return &onm->entries[onm->map_indices[slot]];
     }
-    else {
+    else if (key == NULL) {
       return NULL;
     }
   }
@@ -390,35 +424,63 @@ static OldNew *oldnewmap_lookup_entry(const OldNewMap *onm, const void *addr)
 
 static void oldnewmap_clear_map(OldNewMap *onm)
 {
-  memset(onm->map, 0xFF, MAP_CAPACITY(onm) * sizeof(*onm->map));
+  memset(onm->map_keys, 0, MAP_CAPACITY(onm) * sizeof(*onm->map_keys));
 }
 
-static void oldnewmap_increase_size(OldNewMap *onm)
+static void oldnewmap_resize(OldNewMap *onm, int capacity_exp)
 {
-  onm->capacity_exp++;
-  onm->entries = MEM_reallocN(onm->entries, sizeof(*onm->entries) * ENTRIES_CAPACITY(onm));
-  onm->map = MEM_reallocN(onm->map, sizeof(*onm->map) * MAP_CAPACITY(onm));
+  onm->capacity_exp = capacity_exp;
+  if (capacity_exp > onm->capacity_exp_alloc) {
+    onm->capacity_exp_alloc = capacity_exp;
+    onm->entries = MEM_reallocN(onm->entries, sizeof(*onm->entries) * ENTRIES_CAPACITY(onm));
+    MEM_freeN(onm->map_keys);
+    MEM_freeN(onm->map_indices);
+    onm->map_keys = MEM_malloc_arrayN(MAP_CAPACITY(onm), sizeof(*onm->map_keys), __func__);
+    onm->map_indices = MEM_malloc_arrayN(MAP_CAPACITY(onm), sizeof(*onm->map_indices), __func__);
+  }
   oldnewmap_clear_map(onm);
   for (int i = 0; i < onm->nentries; i++) {
     oldnewmap_insert_index_in_map(onm, onm->entries[i].oldp, i);
   }
 }
 
+/**
+ * Ensure \a entries_num more entries can be inserted without growing the map.
+ */
+static void oldnewmap_reserve(OldNewMap *onm, int entries_num)
+{
+  int capacity_exp = onm->capacity_exp;
+  while ((1ll << capacity_exp) < (int64_t)onm->nentries + entries_num) {
+    capacity_exp++;
+  }
+  if (capacity_exp != onm->capacity_exp) {
+    oldnewmap_resize(onm, capacity_exp);
+  }
+}
+
 /* Public OldNewMap API */
 
-static OldNewMap *oldnewmap_new(void)
+static OldNewMap *oldnewmap_new_ex(const int capacity_exp)
 {
   OldNewMap *onm = MEM_callocN(sizeof(*onm), "OldNewMap");
 
-  onm->capacity_exp = DEFAULT_SIZE_EXP;
+  onm->capacity_exp = capacity_exp;
+  onm->capacity_exp_alloc = capacity_exp;
   onm->entries = MEM_malloc_arrayN(
       ENTRIES_CAPACITY(onm), sizeof(*onm->entries), "OldNewMap.entries");
-  onm->map = MEM_malloc_arrayN(MAP_CAPACITY(onm), sizeof(*onm->map), "OldNewMap.map");
+  onm->map_keys = MEM_malloc_arrayN(MAP_CAPACITY(onm), sizeof(*onm->map_keys), "OldNewMap.keys");
+  onm->map_indices = MEM_malloc_arrayN(
+      MAP_CAPACITY(onm), sizeof(*onm->map_indices), "OldNewMap.indices");
   oldnewmap_clear_map(onm);
 
   return onm;
 }
 
+static OldNewMap *oldnewmap_new(void)
+{
+  return oldnewmap_new_ex(DEFAULT_SIZE_EXP);
+}
+
 static void oldnewmap_insert(OldNewMap *onm, const void *oldaddr, void *newaddr, int nr)
 {
   if (oldaddr == NULL || newaddr == NULL) {
@@ -426,7 +488,7 @@ static void oldnewmap_insert(OldNewMap *onm, const void *oldaddr, void *newaddr,
   }
 
   if (UNLIKELY(onm->nentries == ENTRIES_CAPACITY(onm))) {
-    oldnewmap_increase_size(onm);
+    oldnewmap_resize(onm, onm->capacity_exp + 1);
   }
 
   OldNew entry;
@@ -436,6 +498,34 @@ static void oldnewmap_insert(OldNewMap *onm, const void *oldaddr, void *newaddr,
   oldnewmap_insert_or_replace(onm, entry);
 }
 
+/**
+ * Insert many entries at once (all the data of an ID for e.g.),
+ * the map is grown only once and slots are prefetched ahead of insertion.
+ */
+static void oldnewmap_insert_batch(OldNewMap *onm,
+                                   const void **oldaddrs,
+                                   void **newaddrs,
+                                   const int entries_num,
+                                   const int nr)
+{
+  oldnewmap_reserve(onm, entries_num);
+
+  for (int i = 0; i < entries_num; i++) {
+    if (i + PREFETCH_DISTANCE < entries_num && oldaddrs[i + PREFETCH_DISTANCE] != NULL) {
+      OLDNEWMAP_PREFETCH(
+          &onm->map_keys[oldnewmap_slot_home(onm, oldaddrs[i + PREFETCH_DISTANCE])]);
+    }
+    if (oldaddrs[i] == NULL || newaddrs[i] == NULL) {
+      continue;
+    }
+    OldNew entry;
+    entry.oldp = oldaddrs[i];
+    entry.newp = newaddrs[i];
+    entry.nr = nr;
+    oldnewmap_insert_or_replace(onm, entry);
+  }
+}
+
 void blo_do_versions_oldnewmap_insert(OldNewMap *onm, const void *oldaddr, void *newaddr, int nr)
 {
   oldnewmap_insert(onm, oldaddr, newaddr, nr);
@@ -453,6 +543,24 @@ static void *oldnewmap_lookup_and_inc(OldNewMap *onm, const void *addr, bool inc
   return entry->newp;
 }
 
+/**
+ * Look up many addresses at once (arrays of pointers for e.g.),
+ * prefetching the slots of the following keys while probing the current one.
+ */
+static void oldnewmap_lookup_batch(OldNewMap *onm,
+                                   const void **addrs,
+                                   void **r_newaddrs,
+                                   const int addrs_num,
+                                   bool increase_users)
+{
+  for (int i = 0; i < addrs_num; i++) {
+    if (i + PREFETCH_DISTANCE < addrs_num && addrs[i + PREFETCH_DISTANCE] != NULL) {
+      OLDNEWMAP_PREFETCH(&onm->map_keys[oldnewmap_slot_home(onm, addrs[i + PREFETCH_DISTANCE])]);
+    }
+    r_newaddrs[i] = oldnewmap_lookup_and_inc(onm, addrs[i], increase_users);
+  }
+}
+
 /* for libdata, OldNew.nr has ID code, no increment */
 static void *oldnewmap_liblookup(OldNewMap *onm, const void *addr, const void *lib)
 {
@@ -470,9 +578,8 @@ static void *oldnewmap_liblookup(OldNewMap *onm, const void *addr, const void *l
   return NULL;
 }
 
-static void oldnewmap_clear(OldNewMap *onm)
+static void oldnewmap_free_unused_data(OldNewMap *onm)
 {
-  /* Free unused data. */
   for (int i = 0; i < onm->nentries; i++) {
     OldNew *entry = &onm->entries[i];
     if (entry->nr == 0) {
@@ -480,7 +587,13 @@ static void oldnewmap_clear(OldNewMap *onm)
       entry->newp = NULL;
     }
   }
+}
 
+static void oldnewmap_clear(OldNewMap *onm)
+{
+  oldnewmap_free_unused_data(onm);
+
+  /* Slots beyond the default capacity are cleared again when growing. */
   onm->capacity_exp = DEFAULT_SIZE_EXP;
   oldnewmap_clear_map(onm);
   onm->nentries = 0;
@@ -489,7 +602,8 @@ static void oldnewmap_clear(OldNewMap *onm)
 static void oldnewmap_free(OldNewMap *onm)
 {
   MEM_freeN(onm->entries);
-  MEM_freeN(onm->map);
+  MEM_freeN(onm->map_keys);
+  MEM_freeN(onm->map_indices);
   MEM_freeN(onm);
 }
 
@@ -497,7 +611,7 @@ static void oldnewmap_free(OldNewMap *onm)
 #undef MAP_CAPACITY
 #undef SLOT_MASK
 #undef DEFAULT_SIZE_EXP
-#undef PERTURB_SHIFT
+#undef PREFETCH_DISTANCE
 #undef ITER_SLOTS
 
 /** \} */
@@ -603,9 +717,11 @@ static void read_file_version(FileData *fd, Main *main)
         main->minsubversionfile = fg->minsubversion;
         MEM_freeN(fg);
       }
-      else if (bhead->code == ENDB) {
-        break;
-      }
+      /* Avoid reading all blocks of the file, there is only one. */
+      break;
+    }
+    else if (bhead->code == ENDB) {
+      break;
     }
   }
   if (main->curlib) {
@@ -779,7 +895,8 @@ static void bh8_from_bh4(BHead *bhead, BHead4 *bhead4)
   }
 }
 
-static BHeadN *get_bhead(FileData *fd)
+/** Read the block at the current offset. */
+static BHeadN *read_bhead(FileData *fd)
 {
   BHeadN *new_bhead = NULL;
   int readsize;
@@ -865,7 +982,11 @@ static BHeadN *get_bhead(FileData *fd)
           new_bhead->next = new_bhead->prev = NULL;
           new_bhead->file_offset = fd->file_offset;
           new_bhead->has_data = false;
-          new_bhead->is_memchunk_identical = false;
+          new_bhead->is_id_index_entry = false;
+          new_bhead->is_memchunk_identical = (fd->memfile != NULL) ?
+                                                 fd_memfile_range_is_identical(
+                                                     fd, (size_t)fd->file_offset, bhead.len) :
+                                                 false;
           new_bhead->bhead = bhead;
           off64_t seek_new = fd->seek(fd, bhead.len, SEEK_CUR);
           if (seek_new == -1) {
@@ -889,6 +1010,7 @@ static BHeadN *get_bhead(FileData *fd)
           new_bhead->has_data = true;
 #endif
           new_bhead->is_memchunk_identical = false;
+          new_bhead->is_id_index_entry = false;
           new_bhead->bhead = bhead;
 
           readsize = fd->read(fd, new_bhead + 1, bhead.len, &new_bhead->is_memchunk_identical);
@@ -903,9 +1025,21 @@ static BHeadN *get_bhead(FileData *fd)
           fd->is_eof = true;
         }
       }
+
+      /* Only the #INDX block follows, which isn't part of the regular blocks. */
+      if (bhead.code == ENDB) {
+        fd->is_eof = true;
+      }
     }
   }
 
+  return new_bhead;
+}
+
+static BHeadN *get_bhead(FileData *fd)
+{
+  BHeadN *new_bhead = read_bhead(fd);
+
   /* We've read a new block. Now add it to the list
    * of blocks.
    */
@@ -954,9 +1088,11 @@ BHead *blo_bhead_next(FileData *fd, BHead *thisblock)
      * We calculate the BHeadN pointer from the BHead pointer below */
     new_bhead = BHEADN_FROM_BHEAD(thisblock);
 
-    /* get the next BHeadN. If it doesn't exist we read in the next one */
+    /* get the next BHeadN. If it doesn't exist we read in the next one,
+     * unless this block was read for the ID index (which only reads the blocks of an ID). */
+    const bool is_id_index_entry = new_bhead->is_id_index_entry;
     new_bhead = new_bhead->next;
-    if (new_bhead == NULL) {
+    if (new_bhead == NULL && !is_id_index_entry) {
       new_bhead = get_bhead(fd);
     }
   }
@@ -1000,12 +1136,48 @@ static BHead *blo_bhead_read_full(FileData *fd, BHead *thisblock)
   new_bhead_data->file_offset = new_bhead->file_offset;
   new_bhead_data->has_data = true;
   new_bhead_data->is_memchunk_identical = false;
+  new_bhead_data->is_id_index_entry = false;
   if (!blo_bhead_read_data(fd, thisblock, new_bhead_data + 1)) {
     MEM_freeN(new_bhead_data);
     return NULL;
   }
   return &new_bhead_data->bhead;
 }
+
+/**
+ * \return The data of a block which has not been read yet, accessed in-place from the
+ * memory-mapped file or undo memfile, or NULL when that isn't possible.
+ */
+static const void *blo_bhead_data_mapped(FileData *fd, BHead *thisblock)
+{
+  BHeadN *new_bhead = BHEADN_FROM_BHEAD(thisblock);
+  BLI_assert(new_bhead->has_data == false && new_bhead->file_offset != 0);
+  if (fd->memfile != NULL) {
+    /* Undo data within a single chunk can be used in-place. */
+    const size_t offset = (size_t)new_bhead->file_offset;
+    const int chunk_index = fd_memfile_chunk_find(fd, offset, fd->memfile_chunk_index);
+    if (chunk_index == -1 ||
+        offset + (size_t)new_bhead->bhead.len > fd->memfile_chunk_offsets[chunk_index + 1]) {
+      return NULL;
+    }
+    return fd->memfile_chunks[chunk_index]->buf +
+           (offset - fd->memfile_chunk_offsets[chunk_index]);
+  }
+  if (fd->mmap_file == NULL) {
+    return NULL;
+  }
+  return BLI_mmap_get_pointer(
+      fd->mmap_file, (size_t)new_bhead->file_offset, (size_t)new_bhead->bhead.len);
+}
+
+/**
+ * Mapped pages which failed to load read as zeros,
+ * data decoded from #blo_bhead_data_mapped can't be used then.
+ */
+static bool blo_mmap_has_io_error(const FileData *fd)
+{
+  return (fd->mmap_file != NULL) && BLI_mmap_any_io_error(fd->mmap_file);
+}
 #endif /* USE_BHEAD_READ_ON_DEMAND */
 
 /* Warning! Caller's responsibility to ensure given bhead **is** and ID one! */
@@ -1014,6 +1186,282 @@ const char *blo_bhead_id_name(const FileData *fd, const BHead *bhead)
   return (const char *)POINTER_OFFSET(bhead, sizeof(*bhead) + fd->id_name_offs);
 }
 
+/* -------------------------------------------------------------------- */
+/** \name ID Index
+ *
+ * Files may store the offsets of their ID blocks and the IDs they depend on,
+ * see #BlendIDIndexFooter. When linking, this is used to read only the blocks
+ * of the requested IDs and their dependencies, instead of scanning the whole file.
+ * \{ */
+
+typedef struct FileDataIDIndex {
+  /** The `INDX` block, holding the header, entries and dependencies. */
+  BHeadN *bhead_index;
+  BlendIDIndexHeader header;
+  const BlendIDIndexEntry *entries;
+  const int *deps;
+  /** Blocks of each entry, read as needed. */
+  ListBase *entry_bheads;
+  /** Lookup tables, only created when linking, see #read_file_id_index_lookup_create. */
+  GHash *entry_from_name;
+  GHash *entry_from_old;
+} FileDataIDIndex;
+
+/**
+ * Read the blocks from \a offset_begin up to \a offset_end into \a r_bheads,
+ * without changing the offset of sequential reading.
+ *
+ * \return false when the blocks could not be read.
+ */
+static bool read_bheads_in_range(FileData *fd,
+                                 const off64_t offset_begin,
+                                 const off64_t offset_end,
+                                 ListBase *r_bheads)
+{
+  const off64_t file_offset_backup = fd->file_offset;
+  const bool is_eof_backup = fd->is_eof;
+  bool success = true;
+
+  fd->is_eof = false;
+  if (fd->seek(fd, offset_begin, SEEK_SET) == -1) {
+    success = false;
+  }
+  while (success && fd->file_offset < offset_end) {
+    BHeadN *new_bhead = read_bhead(fd);
+    if (new_bhead == NULL) {
+      success = false;
+      break;
+    }
+    new_bhead->is_id_index_entry = true;
+    BLI_addtail(r_bheads, new_bhead);
+  }
+
+  fd->is_eof = is_eof_backup;
+  if (fd->seek(fd, file_offset_backup, SEEK_SET) == -1) {
+    success = false;
+  }
+  return success;
+}
+
+static bool read_file_id_index_validate(const FileDataIDIndex *id_index, const off64_t file_len)
+{
+  const int entries_len = id_index->header.entries_len;
+  const int deps_len = id_index->header.deps_len;
+
+  if (id_index->header.dna_offset >= (uint64_t)file_len) {
+    return false;
+  }
+  for (int i = 0; i < entries_len; i++) {
+    const BlendIDIndexEntry *entry = &id_index->entries[i];
+    if ((entry->offset_begin >= entry->offset_end) || (entry->offset_end > (uint64_t)file_len) ||
+        (entry->lib_index < -1) || (entry->lib_index >= entries_len) ||
+        (entry->deps_start < 0) || (entry->deps_len < 0) ||
+        (entry->deps_start > deps_len - entry->deps_len) ||
+        (entry->name[sizeof(entry->name) - 1] != '\0')) {
+      return false;
+    }
+  }
+  for (int i = 0; i < deps_len; i++) {
+    if ((id_index->deps[i] < 0) || (id_index->deps[i] >= entries_len)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Read the ID index from the end of the file, when it has one.
+ * Blocks need to be read at arbitrary offsets without conversion for the index to be used.
+ */
+static void read_file_id_index(FileData *fd)
+{
+  if ((fd->seek == NULL) || (fd->memfile != NULL) ||
+      (fd->flags & (FD_FLAGS_SWITCH_ENDIAN | FD_FLAGS_POINTSIZE_DIFFERS))) {
+    return;
+  }
+
+  const off64_t file_offset_backup = fd->file_offset;
+  BlendIDIndexFooter footer;
+  ListBase bheads = {NULL, NULL};
+  const off64_t footer_offset = fd->seek(fd, -(off64_t)sizeof(footer), SEEK_END);
+  if ((footer_offset != -1) && (fd->read(fd, &footer, sizeof(footer), NULL) == sizeof(footer)) &&
+      (memcmp(footer.magic, BLEND_ID_INDEX_MAGIC, sizeof(footer.magic)) == 0) &&
+      (footer.index_offset < (uint64_t)footer_offset)) {
+    const off64_t index_offset = (off64_t)footer.index_offset;
+    read_bheads_in_range(fd, index_offset, index_offset + 1, &bheads);
+  }
+  fd->seek(fd, file_offset_backup, SEEK_SET);
+
+  BHeadN *bhead_index = bheads.first;
+  if ((bhead_index == NULL) || (bhead_index->bhead.code != INDX) ||
+      (bhead_index->bhead.len < (int)sizeof(BlendIDIndexHeader))) {
+    BLI_freelistN(&bheads);
+    return;
+  }
+  BLI_remlink(&bheads, bhead_index);
+  BLI_freelistN(&bheads);
+
+  FileDataIDIndex *id_index = MEM_callocN(sizeof(*id_index), __func__);
+  id_index->bhead_index = bhead_index;
+  /* Data follows the #BHead, as read_struct expects for all blocks. */
+  const char *index_data = (const char *)(&bhead_index->bhead + 1);
+  memcpy(&id_index->header, index_data, sizeof(id_index->header));
+  id_index->entries = (const BlendIDIndexEntry *)(index_data + sizeof(id_index->header));
+  id_index->deps = (const int *)(id_index->entries + MAX2(id_index->header.entries_len, 0));
+
+  const int entries_len = id_index->header.entries_len;
+  const int deps_len = id_index->header.deps_len;
+  if ((entries_len < 0) || (deps_len < 0) ||
+      ((size_t)bhead_index->bhead.len != sizeof(BlendIDIndexHeader) +
+                                             sizeof(BlendIDIndexEntry) * (size_t)entries_len +
+                                             sizeof(int) * (size_t)deps_len) ||
+      !read_file_id_index_validate(id_index, footer_offset)) {
+    MEM_freeN(bhead_index);
+    MEM_freeN(id_index);
+    return;
+  }
+
+  id_index->entry_bheads = MEM_calloc_arrayN(
+      MAX2(entries_len, 1), sizeof(*id_index->entry_bheads), __func__);
+  fd->id_index = id_index;
+}
+
+static void read_file_id_index_free(FileDataIDIndex *id_index)
+{
+  for (int i = 0; i < id_index->header.entries_len; i++) {
+    BLI_freelistN(&id_index->entry_bheads[i]);
+  }
+  MEM_freeN(id_index->entry_bheads);
+  if (id_index->entry_from_name) {
+    BLI_ghash_free(id_index->entry_from_name, NULL, NULL);
+  }
+  if (id_index->entry_from_old) {
+    BLI_ghash_free(id_index->entry_from_old, NULL, NULL);
+  }
+  MEM_freeN(id_index->bhead_index);
+  MEM_freeN(id_index);
+}
+
+/** Use the index instead of the blocks read sequentially to find IDs. */
+static void read_file_id_index_lookup_create(FileData *fd)
+{
+  FileDataIDIndex *id_index = fd->id_index;
+  if (id_index->entry_from_old != NULL) {
+    return;
+  }
+
+  const int entries_len = id_index->header.entries_len;
+  id_index->entry_from_name = BLI_ghash_str_new_ex(__func__, (uint)entries_len);
+  id_index->entry_from_old = BLI_ghash_ptr_new_ex(__func__, (uint)entries_len);
+
+  for (int i = 0; i < entries_len; i++) {
+    const BlendIDIndexEntry *entry = &id_index->entries[i];
+    void **val_p;
+    if (!BLI_ghash_ensure_p(id_index->entry_from_old, (void *)(uintptr_t)entry->old, &val_p)) {
+      *val_p = (void *)entry;
+    }
+    if (BKE_idtype_idcode_is_valid(entry->code) && BKE_idtype_idcode_is_linkable(entry->code)) {
+      if (!BLI_ghash_ensure_p(id_index->entry_from_name, (void *)entry->name, &val_p)) {
+        *val_p = (void *)entry;
+      }
+    }
+  }
+}
+
+static bool read_file_id_index_use_lookup(const FileData *fd)
+{
+  return (fd->id_index != NULL) && (fd->id_index->entry_from_old != NULL);
+}
+
+/** \return The ID block of the entry, reading the blocks of the entry when needed. */
+static BHead *read_file_id_index_entry_bhead(FileData *fd, const BlendIDIndexEntry *entry)
+{
+  FileDataIDIndex *id_index = fd->id_index;
+  ListBase *bheads = &id_index->entry_bheads[entry - id_index->entries];
+
+  if (BLI_listbase_is_empty(bheads)) {
+    if (!read_bheads_in_range(
+            fd, (off64_t)entry->offset_begin, (off64_t)entry->offset_end, bheads)) {
+      BLI_freelistN(bheads);
+      return NULL;
+    }
+  }
+
+  BHead *bhead = &((BHeadN *)bheads->first)->bhead;
+  /* Sanity check, in case the file was changed without updating the index. */
+  if ((uint64_t)(uintptr_t)bhead->old != entry->old) {
+    return NULL;
+  }
+  return bhead;
+}
+
+static const BlendIDIndexEntry *read_file_id_index_entry_from_old(FileData *fd, const void *old)
+{
+  return BLI_ghash_lookup(fd->id_index->entry_from_old, old);
+}
+
+/**
+ * Read the blocks of all IDs \a bhead depends on (directly or indirectly) in file order,
+ * so expanding the ID doesn't seek back and forth through the file.
+ */
+static void read_file_id_index_prefetch_deps(FileData *fd, const BHead *bhead)
+{
+  FileDataIDIndex *id_index = fd->id_index;
+  const BlendIDIndexEntry *entry_root = read_file_id_index_entry_from_old(fd, bhead->old);
+  if (entry_root == NULL) {
+    return;
+  }
+
+  const int entries_len = id_index->header.entries_len;
+  BLI_bitmap *entries_used = BLI_BITMAP_NEW(entries_len, __func__);
+  int *stack = MEM_malloc_arrayN(entries_len, sizeof(*stack), __func__);
+  int stack_len = 0;
+
+  stack[stack_len++] = (int)(entry_root - id_index->entries);
+  BLI_BITMAP_ENABLE(entries_used, stack[0]);
+  while (stack_len != 0) {
+    const BlendIDIndexEntry *entry = &id_index->entries[stack[--stack_len]];
+    for (int i = 0; i < entry->deps_len; i++) {
+      const int index_dep = id_index->deps[entry->deps_start + i];
+      if (!BLI_BITMAP_TEST(entries_used, index_dep)) {
+        BLI_BITMAP_ENABLE(entries_used, index_dep);
+        stack[stack_len++] = index_dep;
+      }
+    }
+    if ((entry->lib_index != -1) && !BLI_BITMAP_TEST(entries_used, entry->lib_index)) {
+      BLI_BITMAP_ENABLE(entries_used, entry->lib_index);
+      stack[stack_len++] = entry->lib_index;
+    }
+  }
+
+  /* Entries are stored in file order. */
+  for (int i = 0; i < entries_len; i++) {
+    if (BLI_BITMAP_TEST(entries_used, i)) {
+      read_file_id_index_entry_bhead(fd, &id_index->entries[i]);
+    }
+  }
+
+  MEM_freeN(stack);
+  MEM_freeN(entries_used);
+}
+
+/**
+ * Create the lookup tables to find ID blocks for linking,
+ * the ID index is used when the file has one, so only the needed blocks are read.
+ */
+static void read_file_link_lookup_create(FileData *fd)
+{
+  if (fd->id_index != NULL) {
+    read_file_id_index_lookup_create(fd);
+    return;
+  }
+#ifdef USE_GHASH_BHEAD
+  read_file_bhead_idname_map_create(fd);
+#endif
+}
+
+/** \} */
+
 static void decode_blender_header(FileData *fd)
 {
   char header[SIZEOFBLENDERHEADER], num[4];
@@ -1057,6 +1505,26 @@ static void decode_blender_header(FileData *fd)
 /**
  * \return Success if the file is read correctly, else set \a r_error_message.
  */
+static bool read_file_dna_decode(FileData *fd,
+                                 BHead *bhead,
+                                 const int subversion,
+                                 const char **r_error_message)
+{
+  const bool do_endian_swap = (fd->flags & FD_FLAGS_SWITCH_ENDIAN) != 0;
+
+  fd->filesdna = DNA_sdna_from_data(&bhead[1], bhead->len, do_endian_swap, true, r_error_message);
+  if (fd->filesdna) {
+    blo_do_versions_dna(fd->filesdna, fd->fileversion, subversion);
+    fd->compflags = DNA_struct_get_compareflags(fd->filesdna, fd->memsdna);
+    fd->reconstruct_info = DNA_reconstruct_info_create(fd->filesdna, fd->memsdna, fd->compflags);
+    /* used to retrieve ID names from (bhead+1) */
+    fd->id_name_offs = DNA_elem_offset(fd->filesdna, "ID", "char", "name[]");
+
+    return true;
+  }
+  return false;
+}
+
 static bool read_file_dna(FileData *fd, const char **r_error_message)
 {
   BHead *bhead;
@@ -1077,24 +1545,24 @@ static bool read_file_dna(FileData *fd, const char **r_error_message)
       memcpy(num, fg->subvstr, 4);
       num[4] = 0;
       subversion = atoi(num);
-    }
-    else if (bhead->code == DNA1) {
-      const bool do_endian_swap = (fd->flags & FD_FLAGS_SWITCH_ENDIAN) != 0;
 
-      fd->filesdna = DNA_sdna_from_data(
-          &bhead[1], bhead->len, do_endian_swap, true, r_error_message);
-      if (fd->filesdna) {
-        blo_do_versions_dna(fd->filesdna, fd->fileversion, subversion);
-        fd->compflags = DNA_struct_get_compareflags(fd->filesdna, fd->memsdna);
-        /* used to retrieve ID names from (bhead+1) */
-        fd->id_name_offs = DNA_elem_offset(fd->filesdna, "ID", "char", "name[]");
-
-        return true;
-      }
-      else {
-        return false;
+      if (fd->id_index != NULL) {
+        /* Read the DNA directly, instead of all blocks in between. */
+        const off64_t dna_offset = (off64_t)fd->id_index->header.dna_offset;
+        ListBase bheads = {NULL, NULL};
+        if (read_bheads_in_range(fd, dna_offset, dna_offset + 1, &bheads) &&
+            (((BHeadN *)bheads.first)->bhead.code == DNA1)) {
+          const bool success = read_file_dna_decode(
+              fd, &((BHeadN *)bheads.first)->bhead, subversion, r_error_message);
+          BLI_freelistN(&bheads);
+          return success;
+        }
+        BLI_freelistN(&bheads);
       }
     }
+    else if (bhead->code == DNA1) {
+      return read_file_dna_decode(fd, bhead, subversion, r_error_message);
+    }
     else if (bhead->code == ENDB) {
       break;
     }
@@ -1123,75 +1591,368 @@ static int *read_file_thumbnail(FileData *fd)
         BLI_endian_switch_int32(&data[1]);
       }
 
-      const int width = data[0];
-      const int height = data[1];
-      if (!BLEN_THUMB_MEMSIZE_IS_VALID(width, height)) {
-        break;
-      }
-      if (bhead->len < BLEN_THUMB_MEMSIZE_FILE(width, height)) {
-        break;
-      }
+      const int width = data[0];
+      const int height = data[1];
+      if (!BLEN_THUMB_MEMSIZE_IS_VALID(width, height)) {
+        break;
+      }
+      if (bhead->len < BLEN_THUMB_MEMSIZE_FILE(width, height)) {
+        break;
+      }
+
+      blend_thumb = data;
+      break;
+    }
+    else if (bhead->code != REND) {
+      /* Thumbnail is stored in TEST immediately after first REND... */
+      break;
+    }
+  }
+
+  return blend_thumb;
+}
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name File Data API
+ * \{ */
+
+/* Regular file reading. */
+
+static int fd_read_data_from_file(FileData *filedata,
+                                  void *buffer,
+                                  uint size,
+                                  bool *UNUSED(r_is_memchunck_identical))
+{
+  int readsize = read(filedata->filedes, buffer, size);
+
+  if (readsize < 0) {
+    readsize = EOF;
+  }
+  else {
+    filedata->file_offset += readsize;
+  }
+
+  return (readsize);
+}
+
+static off64_t fd_seek_data_from_file(FileData *filedata, off64_t offset, int whence)
+{
+  filedata->file_offset = BLI_lseek(filedata->filedes, offset, whence);
+  return filedata->file_offset;
+}
+
+/* Memory-mapped file reading.
+ * Pages are only loaded from disk when touched, so data-blocks which are never read
+ * (see #BHEAD_USE_READ_ON_DEMAND) don't cost any IO or resident memory. */
+
+static int fd_read_from_mmap(FileData *filedata,
+                             void *buffer,
+                             uint size,
+                             bool *UNUSED(r_is_memchunck_identical))
+{
+  /* don't read more bytes then there are available in the file */
+  const size_t length = BLI_mmap_get_length(filedata->mmap_file);
+  const size_t readsize = MIN2((size_t)size, length - (size_t)filedata->file_offset);
+
+  if (!BLI_mmap_read(filedata->mmap_file, buffer, (size_t)filedata->file_offset, readsize)) {
+    return 0;
+  }
+
+  filedata->file_offset += readsize;
+
+  return (int)readsize;
+}
+
+static off64_t fd_seek_from_mmap(FileData *filedata, off64_t offset, int whence)
+{
+  const off64_t length = (off64_t)BLI_mmap_get_length(filedata->mmap_file);
+  off64_t new_pos;
+
+  if (whence == SEEK_CUR) {
+    new_pos = filedata->file_offset + offset;
+  }
+  else if (whence == SEEK_SET) {
+    new_pos = offset;
+  }
+  else if (whence == SEEK_END) {
+    new_pos = length + offset;
+  }
+  else {
+    return -1;
+  }
+
+  if (new_pos < 0 || new_pos > length) {
+    return -1;
+  }
+
+  filedata->file_offset = new_pos;
+  return filedata->file_offset;
+}
+
+/* GZip file reading. */
+
+static int fd_read_gzip_from_file(FileData *filedata,
+                                  void *buffer,
+                                  uint size,
+                                  bool *UNUSED(r_is_memchunck_identical))
+{
+  int readsize = gzread(filedata->gzfiledes, buffer, size);
+
+  if (readsize < 0) {
+    readsize = EOF;
+  }
+  else {
+    filedata->file_offset += readsize;
+  }
+
+  return (readsize);
+}
+
+/* Block compressed file reading.
+ *
+ * Reads gzip members written as independent blocks (see #BLEND_ZLIB_BLOCK_SIZE) and inflates
+ * them in parallel. Blocks are handled in two batches: while one batch is consumed by the
+ * reader, the following blocks are already being decompressed in the other one. */
+
+typedef struct ZlibReadBlock {
+  /** Raw deflate data, freed once inflated. */
+  uchar *data_in;
+  uint data_in_len;
+  uchar *data_out;
+  uint data_out_len;
+  uint crc;
+  bool error;
+} ZlibReadBlock;
+
+typedef struct ZlibReadBatch {
+  TaskPool *task_pool;
+  ZlibReadBlock *blocks;
+  int blocks_len;
+  /** All blocks of the batch have been inflated. */
+  bool is_ready;
+} ZlibReadBatch;
+
+typedef struct FileDataZlibBlocks {
+  ZlibReadBatch batches[2];
+  /** The batch being read from. */
+  int batch_active;
+  /** Block of the active batch being read from, and the read position within it. */
+  int block_active;
+  uint block_offset;
+  /** Number of blocks in each batch. */
+  int blocks_max;
+  /** All blocks of the file have been read (but not necessarily consumed). */
+  bool is_file_eof;
+  bool error;
+} FileDataZlibBlocks;
+
+static uint fd_zlib_block_read_uint32(const uchar *buf)
+{
+  return ((uint)buf[0]) | ((uint)buf[1] << 8) | ((uint)buf[2] << 16) | ((uint)buf[3] << 24);
+}
+
+/**
+ * \return The total size of the gzip member when \a header starts a block written by
+ * #ww_write_zlib_blocks, otherwise zero.
+ */
+static uint fd_zlib_block_header_member_len(const uchar header[BLEND_ZLIB_BLOCK_HEADER_SIZE])
+{
+  if ((header[0] == 0x1f) && (header[1] == 0x8b) && (header[2] == Z_DEFLATED) &&
+      (header[3] == (1 << 2)) && (header[10] == 8) && (header[11] == 0) &&
+      (header[12] == 'B') && (header[13] == 'L') && (header[14] == 4) && (header[15] == 0)) {
+    const uint member_len = fd_zlib_block_read_uint32(&header[16]);
+    if (member_len > BLEND_ZLIB_BLOCK_HEADER_SIZE + BLEND_ZLIB_BLOCK_TRAILER_SIZE) {
+      return member_len;
+    }
+  }
+  return 0;
+}
+
+static void fd_zlib_block_inflate_task(TaskPool *__restrict UNUSED(pool),
+                                       void *taskdata,
+                                       int UNUSED(threadid))
+{
+  ZlibReadBlock *block = taskdata;
+  z_stream strm = {NULL};
+
+  if (inflateInit2(&strm, -MAX_WBITS) != Z_OK) {
+    block->error = true;
+    return;
+  }
+
+  strm.next_in = block->data_in;
+  strm.avail_in = block->data_in_len;
+  strm.next_out = block->data_out;
+  strm.avail_out = block->data_out_len;
+
+  const int err = inflate(&strm, Z_FINISH);
+  inflateEnd(&strm);
+
+  if ((err != Z_STREAM_END) || (strm.total_out != block->data_out_len) ||
+      (crc32(0, block->data_out, block->data_out_len) != block->crc)) {
+    block->error = true;
+  }
+
+  MEM_SAFE_FREE(block->data_in);
+}
+
+static bool fd_zlib_block_read_exact(int filedes, void *buf, uint len)
+{
+  return (read(filedes, buf, len) == (int)len);
+}
+
+/**
+ * Read the next blocks from the file and start inflating them in the background.
+ */
+static void fd_zlib_blocks_batch_fill(FileData *filedata, ZlibReadBatch *batch)
+{
+  FileDataZlibBlocks *zb = filedata->zlib_blocks;
+
+  batch->blocks_len = 0;
+  batch->is_ready = false;
+
+  while (!zb->is_file_eof && !zb->error && (batch->blocks_len < zb->blocks_max)) {
+    uchar header[BLEND_ZLIB_BLOCK_HEADER_SIZE];
+    const int header_len = read(filedata->filedes, header, sizeof(header));
+    if (header_len == 0) {
+      zb->is_file_eof = true;
+      break;
+    }
+
+    const uint member_len = (header_len == sizeof(header)) ?
+                                fd_zlib_block_header_member_len(header) :
+                                0;
+    if (member_len == 0) {
+      zb->error = true;
+      break;
+    }
 
-      blend_thumb = data;
+    ZlibReadBlock *block = &batch->blocks[batch->blocks_len];
+    uchar trailer[BLEND_ZLIB_BLOCK_TRAILER_SIZE];
+
+    block->data_in_len = member_len - BLEND_ZLIB_BLOCK_HEADER_SIZE -
+                         BLEND_ZLIB_BLOCK_TRAILER_SIZE;
+    block->data_in = MEM_mallocN(block->data_in_len, __func__);
+    if (!fd_zlib_block_read_exact(filedata->filedes, block->data_in, block->data_in_len) ||
+        !fd_zlib_block_read_exact(filedata->filedes, trailer, sizeof(trailer))) {
+      MEM_freeN(block->data_in);
+      block->data_in = NULL;
+      zb->error = true;
       break;
     }
-    else if (bhead->code != REND) {
-      /* Thumbnail is stored in TEST immediately after first REND... */
+
+    block->crc = fd_zlib_block_read_uint32(&trailer[0]);
+    block->data_out_len = fd_zlib_block_read_uint32(&trailer[4]);
+    if (block->data_out_len > BLEND_ZLIB_BLOCK_SIZE) {
+      MEM_freeN(block->data_in);
+      block->data_in = NULL;
+      zb->error = true;
       break;
     }
+    block->data_out = MEM_mallocN(MAX2(block->data_out_len, 1), __func__);
+    block->error = false;
+
+    BLI_task_pool_push(batch->task_pool, fd_zlib_block_inflate_task, block, false, NULL);
+    batch->blocks_len++;
   }
+}
 
-  return blend_thumb;
+static void fd_zlib_blocks_batch_clear(ZlibReadBatch *batch)
+{
+  BLI_task_pool_work_and_wait(batch->task_pool);
+  for (int i = 0; i < batch->blocks_len; i++) {
+    MEM_SAFE_FREE(batch->blocks[i].data_in);
+    MEM_SAFE_FREE(batch->blocks[i].data_out);
+  }
+  batch->blocks_len = 0;
+  batch->is_ready = false;
 }
 
-/** \} */
+static void fd_zlib_blocks_init(FileData *filedata)
+{
+  TaskScheduler *scheduler = BLI_task_scheduler_get();
+  FileDataZlibBlocks *zb = MEM_callocN(sizeof(*zb), __func__);
 
-/* -------------------------------------------------------------------- */
-/** \name File Data API
- * \{ */
+  zb->blocks_max = max_ii(BLI_task_scheduler_num_threads(scheduler), 1);
+  for (int i = 0; i < ARRAY_SIZE(zb->batches); i++) {
+    zb->batches[i].task_pool = BLI_task_pool_create(scheduler, NULL, TASK_PRIORITY_HIGH);
+    zb->batches[i].blocks = MEM_calloc_arrayN(
+        zb->blocks_max, sizeof(*zb->batches[i].blocks), __func__);
+  }
+  filedata->zlib_blocks = zb;
 
-/* Regular file reading. */
+  fd_zlib_blocks_batch_fill(filedata, &zb->batches[0]);
+  fd_zlib_blocks_batch_fill(filedata, &zb->batches[1]);
+}
 
-static int fd_read_data_from_file(FileData *filedata,
-                                  void *buffer,
-                                  uint size,
-                                  bool *UNUSED(r_is_memchunck_identical))
+static void fd_zlib_blocks_free(FileData *filedata)
 {
-  int readsize = read(filedata->filedes, buffer, size);
+  FileDataZlibBlocks *zb = filedata->zlib_blocks;
 
-  if (readsize < 0) {
-    readsize = EOF;
-  }
-  else {
-    filedata->file_offset += readsize;
+  for (int i = 0; i < ARRAY_SIZE(zb->batches); i++) {
+    fd_zlib_blocks_batch_clear(&zb->batches[i]);
+    BLI_task_pool_free(zb->batches[i].task_pool);
+    MEM_freeN(zb->batches[i].blocks);
   }
-
-  return (readsize);
+  MEM_freeN(zb);
+  filedata->zlib_blocks = NULL;
 }
 
-static off64_t fd_seek_data_from_file(FileData *filedata, off64_t offset, int whence)
+static int fd_read_zlib_blocks_from_file(FileData *filedata,
+                                         void *buffer,
+                                         uint size,
+                                         bool *UNUSED(r_is_memchunck_identical))
 {
-  filedata->file_offset = BLI_lseek(filedata->filedes, offset, whence);
-  return filedata->file_offset;
-}
+  FileDataZlibBlocks *zb = filedata->zlib_blocks;
+  uint readsize = 0;
 
-/* GZip file reading. */
+  while (readsize < size) {
+    ZlibReadBatch *batch = &zb->batches[zb->batch_active];
 
-static int fd_read_gzip_from_file(FileData *filedata,
-                                  void *buffer,
-                                  uint size,
-                                  bool *UNUSED(r_is_memchunck_identical))
-{
-  int readsize = gzread(filedata->gzfiledes, buffer, size);
+    if (!batch->is_ready) {
+      BLI_task_pool_work_and_wait(batch->task_pool);
+      batch->is_ready = true;
+    }
 
-  if (readsize < 0) {
-    readsize = EOF;
-  }
-  else {
-    filedata->file_offset += readsize;
+    if (zb->block_active == batch->blocks_len) {
+      if (batch->blocks_len < zb->blocks_max) {
+        /* Partially filled batch, end of file (or a truncated/corrupt one). */
+        if (zb->error) {
+          return EOF;
+        }
+        break;
+      }
+      /* Re-use this batch for the blocks following the other batch. */
+      fd_zlib_blocks_batch_clear(batch);
+      fd_zlib_blocks_batch_fill(filedata, batch);
+      zb->batch_active = !zb->batch_active;
+      zb->block_active = 0;
+      zb->block_offset = 0;
+      continue;
+    }
+
+    const ZlibReadBlock *block = &batch->blocks[zb->block_active];
+    if (block->error) {
+      return EOF;
+    }
+
+    const uint len = MIN2(size - readsize, block->data_out_len - zb->block_offset);
+
+    memcpy((char *)buffer + readsize, block->data_out + zb->block_offset, len);
+    readsize += len;
+    zb->block_offset += len;
+
+    if (zb->block_offset == block->data_out_len) {
+      zb->block_active++;
+      zb->block_offset = 0;
+    }
   }
 
-  return (readsize);
+  filedata->file_offset += readsize;
+
+  return (int)readsize;
 }
 
 /* Memory reading. */
@@ -1212,80 +1973,165 @@ static int fd_read_from_memory(FileData *filedata,
 
 /* MemFile reading. */
 
+static void fd_memfile_chunks_init(FileData *fd)
+{
+  const int chunks_len = BLI_listbase_count(&fd->memfile->chunks);
+  size_t offset = 0;
+  int i = 0;
+
+  fd->memfile_chunks = MEM_mallocN(sizeof(*fd->memfile_chunks) * (size_t)MAX2(chunks_len, 1),
+                                   __func__);
+  fd->memfile_chunk_offsets = MEM_mallocN(
+      sizeof(*fd->memfile_chunk_offsets) * (size_t)(chunks_len + 1), __func__);
+  LISTBASE_FOREACH (const MemFileChunk *, chunk, &fd->memfile->chunks) {
+    fd->memfile_chunks[i] = chunk;
+    fd->memfile_chunk_offsets[i] = offset;
+    offset += chunk->size;
+    i++;
+  }
+  fd->memfile_chunk_offsets[chunks_len] = offset;
+  fd->memfile_chunks_len = chunks_len;
+  fd->memfile_chunk_index = 0;
+}
+
+/**
+ * \return The index of the chunk containing \a offset, or -1 when out of range.
+ * Starts looking from \a index_hint since reading is mostly sequential.
+ */
+static int fd_memfile_chunk_find(const FileData *fd, const size_t offset, const int index_hint)
+{
+  const size_t *offsets = fd->memfile_chunk_offsets;
+
+  if (offset >= offsets[fd->memfile_chunks_len]) {
+    return -1;
+  }
+  for (int i = index_hint; i < MIN2(index_hint + 2, fd->memfile_chunks_len); i++) {
+    if (offsets[i] <= offset && offset < offsets[i + 1]) {
+      return i;
+    }
+  }
+
+  /* Binary search for the last chunk starting at or before the offset. */
+  int low = 0, high = fd->memfile_chunks_len - 1;
+  while (low < high) {
+    const int mid = (low + high + 1) / 2;
+    if (offsets[mid] <= offset) {
+      low = mid;
+    }
+    else {
+      high = mid - 1;
+    }
+  }
+  return low;
+}
+
+static bool fd_memfile_chunk_is_identical(const FileData *fd, const MemFileChunk *chunk)
+{
+  /* `is_identical` of current chunk represent whether it changed compared to previous undo
+   * step. this is fine in redo case (filedata->undo_direction > 0), but not in undo case,
+   * where we need an extra flag defined when saving the next (future) step after the one we
+   * want to restore, as we are supposed to 'come from' that future undo step, and not the
+   * one before current one. */
+  return fd->undo_direction > 0 ? chunk->is_identical : chunk->is_identical_future;
+}
+
+/**
+ * \return True when all chunks in the given range are unchanged, without reading them.
+ */
+static bool fd_memfile_range_is_identical(const FileData *fd, size_t offset, const size_t len)
+{
+  const size_t offset_end = offset + len;
+  int chunk_index = fd_memfile_chunk_find(fd, offset, fd->memfile_chunk_index);
+  if (chunk_index == -1) {
+    return false;
+  }
+  for (; chunk_index < fd->memfile_chunks_len; chunk_index++) {
+    if (fd->memfile_chunk_offsets[chunk_index] >= offset_end) {
+      break;
+    }
+    if (!fd_memfile_chunk_is_identical(fd, fd->memfile_chunks[chunk_index])) {
+      return false;
+    }
+  }
+  return true;
+}
+
 static int fd_read_from_memfile(FileData *filedata,
                                 void *buffer,
                                 uint size,
                                 bool *r_is_memchunck_identical)
 {
-  static size_t seek = SIZE_MAX; /* the current position */
-  static size_t offset = 0;      /* size of previous chunks */
-  static MemFileChunk *chunk = NULL;
-  size_t chunkoffset, readsize, totread;
+  size_t readsize, totread = 0;
+  bool is_identical = true;
 
   if (size == 0) {
     return 0;
   }
 
-  if (seek != (size_t)filedata->file_offset) {
-    chunk = filedata->memfile->chunks.first;
-    seek = 0;
+  int chunk_index = fd_memfile_chunk_find(
+      filedata, (size_t)filedata->file_offset, filedata->memfile_chunk_index);
+  if (chunk_index == -1) {
+    return 0;
+  }
 
-    while (chunk) {
-      if (seek + chunk->size > (size_t)filedata->file_offset) {
-        break;
-      }
-      seek += chunk->size;
-      chunk = chunk->next;
+  do {
+    /* debug, should never happen */
+    if (chunk_index == filedata->memfile_chunks_len) {
+      printf("illegal read, chunk zero\n");
+      return 0;
     }
-    offset = seek;
-    seek = filedata->file_offset;
-  }
 
-  if (chunk) {
-    totread = 0;
+    const MemFileChunk *chunk = filedata->memfile_chunks[chunk_index];
+    const size_t chunkoffset = (size_t)filedata->file_offset -
+                               filedata->memfile_chunk_offsets[chunk_index];
 
-    do {
-      /* first check if it's on the end if current chunk */
-      if (seek - offset == chunk->size) {
-        offset += chunk->size;
-        chunk = chunk->next;
-      }
+    /* data can be spread over multiple chunks, so clamp size
+     * to within this chunk, and then it will read further in
+     * the next chunk */
+    readsize = MIN2(size - totread, chunk->size - chunkoffset);
 
-      /* debug, should never happen */
-      if (chunk == NULL) {
-        printf("illegal read, chunk zero\n");
-        return 0;
-      }
+    memcpy(POINTER_OFFSET(buffer, totread), chunk->buf + chunkoffset, readsize);
+    totread += readsize;
+    filedata->file_offset += readsize;
+    is_identical &= fd_memfile_chunk_is_identical(filedata, chunk);
 
-      chunkoffset = seek - offset;
-      readsize = size - totread;
+    filedata->memfile_chunk_index = chunk_index;
+    if (chunkoffset + readsize == chunk->size) {
+      chunk_index++;
+    }
+  } while (totread < size);
 
-      /* data can be spread over multiple chunks, so clamp size
-       * to within this chunk, and then it will read further in
-       * the next chunk */
-      if (chunkoffset + readsize > chunk->size) {
-        readsize = chunk->size - chunkoffset;
-      }
+  if (r_is_memchunck_identical != NULL) {
+    *r_is_memchunck_identical = is_identical;
+  }
 
-      memcpy(POINTER_OFFSET(buffer, totread), chunk->buf + chunkoffset, readsize);
-      totread += readsize;
-      filedata->file_offset += readsize;
-      seek += readsize;
-      if (r_is_memchunck_identical != NULL) {
-        /* `is_identical` of current chunk represent whether it changed compared to previous undo
-         * step. this is fine in redo case (filedata->undo_direction > 0), but not in undo case,
-         * where we need an extra flag defined when saving the next (future) step after the one we
-         * want to restore, as we are supposed to 'come from' that future undo step, and not the
-         * one before current one. */
-        *r_is_memchunck_identical = filedata->undo_direction > 0 ? chunk->is_identical :
-                                                                   chunk->is_identical_future;
-      }
-    } while (totread < size);
+  return (int)totread;
+}
+
+static off64_t fd_seek_from_memfile(FileData *filedata, off64_t offset, int whence)
+{
+  const off64_t length = (off64_t)filedata->memfile_chunk_offsets[filedata->memfile_chunks_len];
+  off64_t new_pos;
+
+  if (whence == SEEK_CUR) {
+    new_pos = filedata->file_offset + offset;
+  }
+  else if (whence == SEEK_SET) {
+    new_pos = offset;
+  }
+  else if (whence == SEEK_END) {
+    new_pos = length + offset;
+  }
+  else {
+    return -1;
+  }
 
-    return totread;
+  if (new_pos < 0 || new_pos > length) {
+    return -1;
   }
 
-  return 0;
+  filedata->file_offset = new_pos;
+  return filedata->file_offset;
 }
 
 static FileData *filedata_new(void)
@@ -1309,6 +2155,7 @@ static FileData *blo_decode_and_check(FileData *fd, ReportList *reports)
   decode_blender_header(fd);
 
   if (fd->flags & FD_FLAGS_FILE_OK) {
+    read_file_id_index(fd);
     const char *error_message = NULL;
     if (read_file_dna(fd, &error_message) == false) {
       BKE_reportf(
@@ -1336,7 +2183,7 @@ static FileData *blo_filedata_from_file_descriptor(const char *filepath,
 
   gzFile gzfile = (gzFile)Z_NULL;
 
-  char header[7];
+  uchar header[7];
 
   /* Regular file. */
   errno = 0;
@@ -1353,9 +2200,34 @@ static FileData *blo_filedata_from_file_descriptor(const char *filepath,
   }
 
   /* Regular file. */
+  BLI_mmap_file *mmap_file = NULL;
   if (memcmp(header, "BLENDER", sizeof(header)) == 0) {
-    read_fn = fd_read_data_from_file;
-    seek_fn = fd_seek_data_from_file;
+    /* Prefer memory-mapped reading, fall back to regular reading when mapping fails
+     * (network file-systems for e.g.). */
+    mmap_file = BLI_mmap_open(file);
+    BLI_lseek(file, 0, SEEK_SET);
+    if (mmap_file != NULL) {
+      read_fn = fd_read_from_mmap;
+      seek_fn = fd_seek_from_mmap;
+    }
+    else {
+      read_fn = fd_read_data_from_file;
+      seek_fn = fd_seek_data_from_file;
+    }
+  }
+
+  /* Block compressed gzip file, inflated in parallel. */
+  bool use_zlib_blocks = false;
+  if ((read_fn == NULL) &&
+      /* Check header magic. */
+      (header[0] == 0x1f && header[1] == 0x8b)) {
+    uchar block_header[BLEND_ZLIB_BLOCK_HEADER_SIZE];
+    if ((read(file, block_header, sizeof(block_header)) == sizeof(block_header)) &&
+        (fd_zlib_block_header_member_len(block_header) != 0)) {
+      read_fn = fd_read_zlib_blocks_from_file;
+      use_zlib_blocks = true;
+    }
+    BLI_lseek(file, 0, SEEK_SET);
   }
 
   /* Gzip file. */
@@ -1389,10 +2261,15 @@ static FileData *blo_filedata_from_file_descriptor(const char *filepath,
 
   fd->filedes = file;
   fd->gzfiledes = gzfile;
+  fd->mmap_file = mmap_file;
 
   fd->read = read_fn;
   fd->seek = seek_fn;
 
+  if (use_zlib_blocks) {
+    fd_zlib_blocks_init(fd);
+  }
+
   return fd;
 }
 
@@ -1459,8 +2336,19 @@ static int fd_read_gzip_from_memory(FileData *filedata,
   // Inflate another chunk.
   err = inflate(&filedata->strm, Z_SYNC_FLUSH);
 
+  /* Compressed files may consist of multiple gzip members, see #BLEND_ZLIB_BLOCK_SIZE. */
+  while ((err == Z_STREAM_END) && (filedata->strm.avail_out != 0) &&
+         (filedata->strm.avail_in != 0)) {
+    if (inflateReset(&filedata->strm) != Z_OK) {
+      break;
+    }
+    err = inflate(&filedata->strm, Z_SYNC_FLUSH);
+  }
+
   if (err == Z_STREAM_END) {
-    return 0;
+    if (filedata->strm.avail_out != 0) {
+      return 0;
+    }
   }
   else if (err != Z_OK) {
     printf("fd_read_gzip_from_memory: zlib error\n");
@@ -1498,7 +2386,7 @@ FileData *blo_filedata_from_memory(const void *mem, int memsize, ReportList *rep
   }
   else {
     FileData *fd = filedata_new();
-    const char *cp = mem;
+    const uchar *cp = mem;
 
     fd->buffer = mem;
     fd->buffersize = memsize;
@@ -1533,7 +2421,10 @@ FileData *blo_filedata_from_memfile(MemFile *memfile,
     fd->memfile = memfile;
     fd->undo_direction = params->undo_direction;
 
+    /* Only the data of changed data-blocks is read, see #read_libblock_is_identical. */
+    fd_memfile_chunks_init(fd);
     fd->read = fd_read_from_memfile;
+    fd->seek = fd_seek_from_memfile;
     fd->flags |= FD_FLAGS_NOT_MY_BUFFER;
 
     return blo_decode_and_check(fd, reports);
@@ -1543,6 +2434,19 @@ FileData *blo_filedata_from_memfile(MemFile *memfile,
 void blo_filedata_free(FileData *fd)
 {
   if (fd) {
+    if (fd->zlib_blocks != NULL) {
+      fd_zlib_blocks_free(fd);
+    }
+
+    if (fd->mmap_file != NULL) {
+      BLI_mmap_free(fd->mmap_file);
+    }
+
+    if (fd->memfile_chunks != NULL) {
+      MEM_freeN(fd->memfile_chunks);
+      MEM_freeN(fd->memfile_chunk_offsets);
+    }
+
     if (fd->filedes != -1) {
       close(fd->filedes);
     }
@@ -1575,6 +2479,10 @@ void blo_filedata_free(FileData *fd)
     }
 #endif
 
+    /* Before the file SDNA and compare flags it references. */
+    if (fd->reconstruct_info) {
+      DNA_reconstruct_info_free(fd->reconstruct_info);
+    }
     if (fd->filesdna) {
       DNA_sdna_free(fd->filesdna);
     }
@@ -1622,6 +2530,10 @@ void blo_filedata_free(FileData *fd)
     }
 #endif
 
+    if (fd->id_index) {
+      read_file_id_index_free(fd->id_index);
+    }
+
     MEM_freeN(fd);
   }
 }
@@ -1772,6 +2684,12 @@ static void *newdataadr_no_us(FileData *fd, const void *adr)
   return oldnewmap_lookup_and_inc(fd->datamap, adr, false);
 }
 
+/* only direct databocks, remaps an array of pointers in-place */
+static void newdataadr_array(FileData *fd, void **array, const int len)
+{
+  oldnewmap_lookup_batch(fd->datamap, (const void **)array, array, len, true);
+}
+
 /* direct datablocks with global linking */
 static void *newglobadr(FileData *fd, const void *adr)
 {
@@ -2315,6 +3233,76 @@ static void switch_endian_structs(const struct SDNA *filesdna, BHead *bhead)
   }
 }
 
+/* Reconstruct arrays of structs larger than this (in bytes) using multiple threads. */
+#define READ_STRUCT_RECONSTRUCT_PARALLEL_MIN_SIZE (1 << 18)
+/* Number of structs reconstructed by each task. */
+#define READ_STRUCT_RECONSTRUCT_PARALLEL_CHUNK 1024
+
+typedef struct ReadStructReconstructData {
+  const struct DNA_ReconstructInfo *reconstruct_info;
+  int old_struct_nr;
+  int blocks;
+  int old_size;
+  int new_size;
+  const char *old_data;
+  char *new_data;
+} ReadStructReconstructData;
+
+static void read_struct_reconstruct_fn(void *__restrict userdata,
+                                       const int chunk,
+                                       const TaskParallelTLS *__restrict UNUSED(tls))
+{
+  const ReadStructReconstructData *data = userdata;
+  const int first = chunk * READ_STRUCT_RECONSTRUCT_PARALLEL_CHUNK;
+  const int blocks = MIN2(READ_STRUCT_RECONSTRUCT_PARALLEL_CHUNK, data->blocks - first);
+
+  DNA_struct_reconstruct_blocks(data->reconstruct_info,
+                                data->old_struct_nr,
+                                blocks,
+                                data->old_data + (size_t)first * data->old_size,
+                                data->new_data + (size_t)first * data->new_size);
+}
+
+/**
+ * Convert the data of \a bh to the current SDNA, large arrays are split up between threads.
+ */
+static void *read_struct_reconstruct(FileData *fd, BHead *bh, const void *data)
+{
+  if (bh->len < READ_STRUCT_RECONSTRUCT_PARALLEL_MIN_SIZE ||
+      bh->nr < 2 * READ_STRUCT_RECONSTRUCT_PARALLEL_CHUNK) {
+    return DNA_struct_reconstruct(fd->reconstruct_info, bh->SDNAnr, bh->nr, data);
+  }
+
+  const int new_size = DNA_struct_reconstruct_size(fd->reconstruct_info, bh->SDNAnr);
+  if (new_size == 0) {
+    return NULL;
+  }
+
+  ReadStructReconstructData reconstruct_data = {
+      .reconstruct_info = fd->reconstruct_info,
+      .old_struct_nr = bh->SDNAnr,
+      .blocks = bh->nr,
+      .old_size = bh->len / bh->nr,
+      .new_size = new_size,
+      .old_data = data,
+      .new_data = MEM_callocN((size_t)bh->nr * new_size, "reconstruct"),
+  };
+
+  TaskParallelSettings settings;
+  BLI_parallel_range_settings_defaults(&settings);
+  BLI_task_parallel_range(0,
+                          (bh->nr + READ_STRUCT_RECONSTRUCT_PARALLEL_CHUNK - 1) /
+                              READ_STRUCT_RECONSTRUCT_PARALLEL_CHUNK,
+                          &reconstruct_data,
+                          read_struct_reconstruct_fn,
+                          &settings);
+
+  return reconstruct_data.new_data;
+}
+
+#undef READ_STRUCT_RECONSTRUCT_PARALLEL_MIN_SIZE
+#undef READ_STRUCT_RECONSTRUCT_PARALLEL_CHUNK
+
 static void *read_struct(FileData *fd, BHead *bh, const char *blockname)
 {
   void *temp = NULL;
@@ -2340,20 +3328,35 @@ static void *read_struct(FileData *fd, BHead *bh, const char *blockname)
 
     if (fd->compflags[bh->SDNAnr] != SDNA_CMP_REMOVED) {
       if (fd->compflags[bh->SDNAnr] == SDNA_CMP_NOT_EQUAL) {
+        const void *data = (bh + 1);
 #ifdef USE_BHEAD_READ_ON_DEMAND
         if (BHEADN_FROM_BHEAD(bh)->has_data == false) {
-          bh = blo_bhead_read_full(fd, bh);
-          if (UNLIKELY(bh == NULL)) {
-            fd->flags &= ~FD_FLAGS_FILE_OK;
-            return NULL;
+          /* Reconstruct straight from the mapped file when possible,
+           * avoids reading the data into a temporary copy first. */
+          data = blo_bhead_data_mapped(fd, bh);
+          if (data == NULL) {
+            bh = blo_bhead_read_full(fd, bh);
+            if (UNLIKELY(bh == NULL)) {
+              fd->flags &= ~FD_FLAGS_FILE_OK;
+              return NULL;
+            }
+            data = (bh + 1);
           }
         }
 #endif
-        temp = DNA_struct_reconstruct(
-            fd->memsdna, fd->filesdna, fd->compflags, bh->SDNAnr, bh->nr, (bh + 1));
+        temp = read_struct_reconstruct(fd, bh, data);
+#ifdef USE_BHEAD_READ_ON_DEMAND
+        if (UNLIKELY(data != (bh + 1) && blo_mmap_has_io_error(fd))) {
+          fd->flags &= ~FD_FLAGS_FILE_OK;
+          MEM_SAFE_FREE(temp);
+        }
+#endif
       }
       else {
-        /* SDNA_CMP_EQUAL */
+        /* SDNA_CMP_EQUAL
+         * Copied even when the file is memory-mapped: read data is owned by the guarded
+         * allocator, unused blocks are freed by #oldnewmap_clear and direct linking frees or
+         * re-allocates arrays, so mapped memory can't be used in place. */
         temp = MEM_mallocN(bh->len, blockname);
 #ifdef USE_BHEAD_READ_ON_DEMAND
         if (BHEADN_FROM_BHEAD(bh)->has_data) {
@@ -4991,7 +5994,7 @@ static void direct_link_customdata(FileData *fd, CustomData *data, int count)
       layer->flag &= ~CD_FLAG_IN_MEMORY;
     }
 
-    layer->flag &= ~CD_FLAG_NOFREE;
+    layer->flag &= ~(CD_FLAG_NOFREE | CD_FLAG_SHARED);
 
     if (CustomData_verify_versions(data, i)) {
       layer->data = newdataadr(fd, layer->data);
@@ -6129,10 +7132,7 @@ static void direct_link_object(FileData *fd, Object *ob)
     sb->keys = newdataadr(fd, sb->keys);
     test_pointer_array(fd, (void **)&sb->keys);
     if (sb->keys) {
-      int a;
-      for (a = 0; a < sb->totkey; a++) {
-        sb->keys[a] = newdataadr(fd, sb->keys[a]);
-      }
+      newdataadr_array(fd, (void **)sb->keys, sb->totkey);
     }
 
     sb->effector_weights = newdataadr(fd, sb->effector_weights);
@@ -8638,12 +9638,10 @@ static void direct_link_moviePlaneTracks(FileData *fd, ListBase *plane_tracks_ba
   link_list(fd, plane_tracks_base);
 
   for (plane_track = plane_tracks_base->first; plane_track; plane_track = plane_track->next) {
-    int i;
-
     plane_track->point_tracks = newdataadr(fd, plane_track->point_tracks);
     test_pointer_array(fd, (void **)&plane_track->point_tracks);
-    for (i = 0; i < plane_track->point_tracksnr; i++) {
-      plane_track->point_tracks[i] = newdataadr(fd, plane_track->point_tracks[i]);
+    if (plane_track->point_tracks) {
+      newdataadr_array(fd, (void **)plane_track->point_tracks, plane_track->point_tracksnr);
     }
 
     plane_track->markers = newdataadr(fd, plane_track->markers);
@@ -9268,7 +10266,8 @@ static const char *dataname(short id_code)
   return "Data from Lib Block";
 }
 
-static bool direct_link_id(FileData *fd, Main *main, const int tag, ID *id, ID *id_old)
+/* Runtime members of a newly read ID, these depend on the order IDs are read in. */
+static void direct_link_id_init(FileData *fd, Main *main, ID *id)
 {
   if (fd->memfile == NULL) {
     /* When actually reading a file , we do want to reset/re-generate session uuids.
@@ -9283,13 +10282,10 @@ static bool direct_link_id(FileData *fd, Main *main, const int tag, ID *id, ID *
   id->icon_id = 0;
   id->newid = NULL; /* Needed because .blend may have been saved with crap value here... */
   id->orig_id = NULL;
+}
 
-  if (tag & LIB_TAG_ID_LINK_PLACEHOLDER) {
-    /* For placeholder we only need to set the tag, no further data to read. */
-    id->tag = tag;
-    return true;
-  }
-
+static bool direct_link_id_data(FileData *fd, Main *main, const int tag, ID *id, ID *id_old)
+{
   /* Read part of datablock that is common between real and embedded datablocks. */
   direct_link_id_common(fd, id, id_old, tag);
 
@@ -9420,11 +10416,149 @@ static bool direct_link_id(FileData *fd, Main *main, const int tag, ID *id, ID *
   return success;
 }
 
-/* Read all data associated with a datablock into datamap. */
+static bool direct_link_id(FileData *fd, Main *main, const int tag, ID *id, ID *id_old)
+{
+  direct_link_id_init(fd, main, id);
+
+  if (tag & LIB_TAG_ID_LINK_PLACEHOLDER) {
+    /* For placeholder we only need to set the tag, no further data to read. */
+    id->tag = tag;
+    return true;
+  }
+
+  return direct_link_id_data(fd, main, tag, id, id_old);
+}
+
+#ifdef USE_BHEAD_READ_ON_DEMAND
+/* Minimum number of data blocks following an ID to decode them in parallel. */
+#  define READ_DATA_PARALLEL_MIN 32
+
+typedef struct ReadDataParallelData {
+  FileData *fd;
+  BHead **bheads;
+  void **data;
+  const char *allocname;
+} ReadDataParallelData;
+
+/**
+ * Thread-safe version of #read_struct, only valid for memory-mapped files which don't need
+ * endian switching, since it never uses the file read/seek callbacks.
+ */
+static void *read_struct_mapped(FileData *fd, BHead *bh, const char *blockname)
+{
+  if (bh->len == 0 || fd->compflags[bh->SDNAnr] == SDNA_CMP_REMOVED) {
+    return NULL;
+  }
+
+  const bool is_equal = fd->compflags[bh->SDNAnr] == SDNA_CMP_EQUAL;
+  const void *data = (bh + 1);
+  void *data_copy = NULL;
+  if (BHEADN_FROM_BHEAD(bh)->has_data == false) {
+    data = blo_bhead_data_mapped(fd, bh);
+    if (data == NULL) {
+      /* Mapped memory can't be accessed directly, or had an IO error. */
+      data_copy = MEM_mallocN(bh->len, blockname);
+      if (!BLI_mmap_read(
+              fd->mmap_file, data_copy, (size_t)BHEADN_FROM_BHEAD(bh)->file_offset, bh->len)) {
+        MEM_freeN(data_copy);
+        return NULL;
+      }
+      if (is_equal) {
+        return data_copy;
+      }
+      data = data_copy;
+    }
+  }
+
+  void *temp;
+  if (!is_equal) {
+    temp = DNA_struct_reconstruct(fd->reconstruct_info, bh->SDNAnr, bh->nr, data);
+  }
+  else {
+    temp = MEM_mallocN(bh->len, blockname);
+    memcpy(temp, data, bh->len);
+  }
+  if (data_copy != NULL) {
+    MEM_freeN(data_copy);
+  }
+  else if (UNLIKELY(data != (bh + 1) && blo_mmap_has_io_error(fd))) {
+    MEM_freeN(temp);
+    return NULL;
+  }
+  return temp;
+}
+
+static void read_data_into_datamap_parallel_fn(void *__restrict userdata,
+                                               const int i,
+                                               const TaskParallelTLS *__restrict UNUSED(tls))
+{
+  ReadDataParallelData *data = userdata;
+  data->data[i] = read_struct_mapped(data->fd, data->bheads[i], data->allocname);
+}
+
+/**
+ * Decode the data of IDs with many data blocks (meshes, node trees, ...) in parallel.
+ * Inserting into the datamap is still done from a single thread, in file order.
+ */
+static BHead *read_data_into_datamap_parallel(FileData *fd,
+                                              BHead *bhead_first,
+                                              const int bheads_len,
+                                              const char *allocname)
+{
+  ReadDataParallelData data = {
+      .fd = fd,
+      .bheads = MEM_malloc_arrayN(bheads_len, sizeof(*data.bheads), __func__),
+      .data = MEM_malloc_arrayN(bheads_len, sizeof(*data.data), __func__),
+      .allocname = allocname,
+  };
+
+  BHead *bhead = bhead_first;
+  for (int i = 0; i < bheads_len; i++, bhead = blo_bhead_next(fd, bhead)) {
+    data.bheads[i] = bhead;
+  }
+
+  TaskParallelSettings settings;
+  BLI_parallel_range_settings_defaults(&settings);
+  settings.scheduling_mode = TASK_SCHEDULING_DYNAMIC;
+  BLI_task_parallel_range(0, bheads_len, &data, read_data_into_datamap_parallel_fn, &settings);
+
+  const void **oldaddrs = MEM_malloc_arrayN(bheads_len, sizeof(*oldaddrs), __func__);
+  for (int i = 0; i < bheads_len; i++) {
+    BHead *bh = data.bheads[i];
+    oldaddrs[i] = bh->old;
+    if ((data.data[i] == NULL) && bh->len && fd->compflags[bh->SDNAnr] != SDNA_CMP_REMOVED) {
+      fd->flags &= ~FD_FLAGS_FILE_OK;
+    }
+  }
+  oldnewmap_insert_batch(fd->datamap, oldaddrs, data.data, bheads_len, 0);
+
+  MEM_freeN(oldaddrs);
+  MEM_freeN(data.bheads);
+  MEM_freeN(data.data);
+
+  return bhead;
+}
+#endif /* USE_BHEAD_READ_ON_DEMAND */
+
+/* Read all data associated with a datablock into datamap.
+ * Blocks are decoded right away, direct linking the ID accesses all of them anyway. */
 static BHead *read_data_into_datamap(FileData *fd, BHead *bhead, const char *allocname)
 {
   bhead = blo_bhead_next(fd, bhead);
 
+#ifdef USE_BHEAD_READ_ON_DEMAND
+  /* Memory-mapped files can be read from multiple threads. */
+  if ((fd->mmap_file != NULL) && !(fd->flags & FD_FLAGS_SWITCH_ENDIAN)) {
+    int bheads_len = 0;
+    for (BHead *bh = bhead; bh && bh->code == DATA; bh = blo_bhead_next(fd, bh)) {
+      bheads_len++;
+    }
+    if (bheads_len >= READ_DATA_PARALLEL_MIN) {
+      return read_data_into_datamap_parallel(fd, bhead, bheads_len, allocname);
+    }
+  }
+#endif
+
   while (bhead && bhead->code == DATA) {
     void *data;
 #if 0
@@ -9685,6 +10819,147 @@ static bool read_libblock_undo_restore(
   }
 }
 
+/* Initial capacity of the maps of IDs which direct linking is deferred, grown as needed. */
+#define DEFERRED_DATAMAP_SIZE_EXP 2
+
+/* An ID which data has been read, but not linked yet, see #read_libblock_direct_link_deferred. */
+typedef struct DeferredDirectLink {
+  struct DeferredDirectLink *next, *prev;
+  Main *bmain;
+  ID *id;
+  int tag;
+  /* Data of this ID only, so different IDs can be linked from different threads. */
+  OldNewMap *datamap;
+  /* Result of #direct_link_id_data, failed IDs are freed after linking. */
+  bool success;
+} DeferredDirectLink;
+
+typedef struct DeferredDirectLinkData {
+  FileData *fd;
+  DeferredDirectLink **deferred_array;
+} DeferredDirectLinkData;
+
+/* Types which direct linking only accesses the ID and its own data (embedded IDs included),
+ * these don't depend on other IDs being read already. */
+static bool read_libblock_direct_link_can_defer(const FileData *fd, const short idcode)
+{
+  if (fd->deferred_direct_link == NULL) {
+    return false;
+  }
+  return ELEM(idcode,
+              ID_ME,
+              ID_CU,
+              ID_MB,
+              ID_LT,
+              ID_KE,
+              ID_AR,
+              ID_AC,
+              ID_NT,
+              ID_TXT,
+              ID_MA,
+              ID_TE,
+              ID_LA,
+              ID_CA,
+              ID_WO);
+}
+
+static BHead *read_libblock_defer_direct_link(
+    FileData *fd, Main *main, BHead *bhead, const int tag, ID *id, const char *allocname)
+{
+  DeferredDirectLink *deferred = MEM_mallocN(sizeof(*deferred), __func__);
+  deferred->bmain = main;
+  deferred->id = id;
+  deferred->tag = tag;
+  deferred->datamap = oldnewmap_new_ex(DEFERRED_DATAMAP_SIZE_EXP);
+
+  OldNewMap *datamap = fd->datamap;
+  fd->datamap = deferred->datamap;
+  bhead = read_data_into_datamap(fd, bhead, allocname);
+  fd->datamap = datamap;
+
+  direct_link_id_init(fd, main, id);
+  BLI_addtail(fd->deferred_direct_link, deferred);
+
+  return bhead;
+}
+
+static void read_libblock_direct_link_deferred_fn(void *__restrict userdata,
+                                                  const int i,
+                                                  const TaskParallelTLS *__restrict tls)
+{
+  DeferredDirectLinkData *data = userdata;
+  DeferredDirectLink *deferred = data->deferred_array[i];
+
+  /* Copy of the file data for this thread, only the data map differs between IDs. */
+  FileData *fd = tls->userdata_chunk;
+  fd->datamap = deferred->datamap;
+
+  deferred->success = direct_link_id_data(fd, deferred->bmain, deferred->tag, deferred->id, NULL);
+
+  oldnewmap_free_unused_data(deferred->datamap);
+  oldnewmap_free(deferred->datamap);
+  fd->datamap = NULL;
+}
+
+static void read_libblock_direct_link_deferred_finalize(void *__restrict userdata,
+                                                        void *__restrict userdata_chunk)
+{
+  DeferredDirectLinkData *data = userdata;
+  const FileData *fd_thread = userdata_chunk;
+
+  /* Errors reported through the flags of the copies must not get lost. */
+  if ((fd_thread->flags & FD_FLAGS_FILE_OK) == 0) {
+    data->fd->flags &= ~FD_FLAGS_FILE_OK;
+  }
+}
+
+/**
+ * Direct link the IDs deferred while reading, in parallel. Besides their own data map,
+ * linking only reads members of \a fd which don't change after the file header is read.
+ * Each thread links using a copy of \a fd, errors flagged on the copies are merged back
+ * and IDs which failed to link are freed afterwards, from this thread.
+ */
+static void read_libblock_direct_link_deferred(FileData *fd)
+{
+  ListBase *deferred_list = fd->deferred_direct_link;
+  const int deferred_len = BLI_listbase_count(deferred_list);
+  if (deferred_len == 0) {
+    return;
+  }
+
+  DeferredDirectLink **deferred_array = MEM_malloc_arrayN(
+      deferred_len, sizeof(*deferred_array), __func__);
+  int i = 0;
+  LISTBASE_FOREACH (DeferredDirectLink *, deferred, deferred_list) {
+    deferred_array[i++] = deferred;
+  }
+
+  DeferredDirectLinkData data = {
+      .fd = fd,
+      .deferred_array = deferred_array,
+  };
+
+  TaskParallelSettings settings;
+  BLI_parallel_range_settings_defaults(&settings);
+  settings.scheduling_mode = TASK_SCHEDULING_DYNAMIC;
+  settings.userdata_chunk = fd;
+  settings.userdata_chunk_size = sizeof(*fd);
+  settings.func_finalize = read_libblock_direct_link_deferred_finalize;
+  BLI_task_parallel_range(
+      0, deferred_len, &data, read_libblock_direct_link_deferred_fn, &settings);
+
+  for (i = 0; i < deferred_len; i++) {
+    DeferredDirectLink *deferred = deferred_array[i];
+    if (!deferred->success) {
+      /* Same as for IDs linked while reading, see #read_libblock. */
+      BKE_id_free(deferred->bmain, deferred->id);
+    }
+  }
+
+  MEM_freeN(deferred_array);
+  BLI_freelistN(deferred_list);
+}
+
 /* This routine reads a datablock and its direct data, and advances bhead to
  * the next datablock. For library linked datablocks, only a placeholder will
  * be generated, to be replaced in read_library_linked_ids.
@@ -9772,6 +11047,11 @@ static BHead *read_libblock(FileData *fd,
   /* Read datablock contents.
    * Use convenient malloc name for debugging and better memory link prints. */
   const char *allocname = dataname(idcode);
+  if (read_libblock_direct_link_can_defer(fd, idcode)) {
+    BLI_assert(id_old == NULL);
+    return read_libblock_defer_direct_link(fd, main, bhead, id_tag, id, allocname);
+  }
+
   bhead = read_data_into_datamap(fd, bhead, allocname);
   const bool success = direct_link_id(fd, main, id_tag, id, id_old);
   oldnewmap_clear(fd->datamap);
@@ -9959,160 +11239,258 @@ static void do_versions_after_linking(Main *main, ReportList *reports)
 /** \name Read Library Data Block (all)
  * \{ */
 
-static void lib_link_all(FileData *fd, Main *bmain)
+/* Minimum number of independent IDs to link them in parallel. */
+#define LIB_LINK_PARALLEL_MIN 64
+
+static void lib_link_id_type(FileData *fd, Main *bmain, ID *id)
 {
-  const bool do_partial_undo = (fd->skip_flags & BLO_READ_SKIP_UNDO_OLD_MAIN) == 0;
+  /* Note: ID types are processed in reverse order as defined by INDEX_ID_XXX enums in DNA_ID.h.
+   * This ensures handling of most dependencies in proper order, as elsewhere in code.
+   * Please keep order of entries in that switch matching that order, it's easier to quickly see
+   * whether something is wrong then. */
+  switch (GS(id->name)) {
+    case ID_MSK:
+      lib_link_mask(fd, bmain, (Mask *)id);
+      break;
+    case ID_WM:
+      lib_link_windowmanager(fd, bmain, (wmWindowManager *)id);
+      break;
+    case ID_WS:
+      /* Could we skip WS in undo case? */
+      lib_link_workspaces(fd, bmain, (WorkSpace *)id);
+      break;
+    case ID_SCE:
+      lib_link_scene(fd, bmain, (Scene *)id);
+      break;
+    case ID_LS:
+      lib_link_linestyle(fd, bmain, (FreestyleLineStyle *)id);
+      break;
+    case ID_OB:
+      lib_link_object(fd, bmain, (Object *)id);
+      break;
+    case ID_SCR:
+      /* DO NOT skip screens here,
+       * 3D viewport may contains pointers to other ID data (like bgpic)! See T41411. */
+      lib_link_screen(fd, bmain, (bScreen *)id);
+      break;
+    case ID_MC:
+      lib_link_movieclip(fd, bmain, (MovieClip *)id);
+      break;
+    case ID_WO:
+      lib_link_world(fd, bmain, (World *)id);
+      break;
+    case ID_LP:
+      lib_link_lightprobe(fd, bmain, (LightProbe *)id);
+      break;
+    case ID_SPK:
+      lib_link_speaker(fd, bmain, (Speaker *)id);
+      break;
+    case ID_PA:
+      lib_link_particlesettings(fd, bmain, (ParticleSettings *)id);
+      break;
+    case ID_PC:
+      lib_link_paint_curve(fd, bmain, (PaintCurve *)id);
+      break;
+    case ID_BR:
+      lib_link_brush(fd, bmain, (Brush *)id);
+      break;
+    case ID_GR:
+      lib_link_collection(fd, bmain, (Collection *)id);
+      break;
+    case ID_SO:
+      lib_link_sound(fd, bmain, (bSound *)id);
+      break;
+    case ID_TXT:
+      lib_link_text(fd, bmain, (Text *)id);
+      break;
+    case ID_CA:
+      lib_link_camera(fd, bmain, (Camera *)id);
+      break;
+    case ID_LA:
+      lib_link_light(fd, bmain, (Light *)id);
+      break;
+    case ID_LT:
+      lib_link_latt(fd, bmain, (Lattice *)id);
+      break;
+    case ID_MB:
+      lib_link_mball(fd, bmain, (MetaBall *)id);
+      break;
+    case ID_CU:
+      lib_link_curve(fd, bmain, (Curve *)id);
+      break;
+    case ID_ME:
+      lib_link_mesh(fd, bmain, (Mesh *)id);
+      break;
+    case ID_CF:
+      lib_link_cachefiles(fd, bmain, (CacheFile *)id);
+      break;
+    case ID_AR:
+      lib_link_armature(fd, bmain, (bArmature *)id);
+      break;
+    case ID_VF:
+      lib_link_vfont(fd, bmain, (VFont *)id);
+      break;
+    case ID_HA:
+      lib_link_hair(fd, bmain, (Hair *)id);
+      break;
+    case ID_PT:
+      lib_link_pointcloud(fd, bmain, (PointCloud *)id);
+      break;
+    case ID_VO:
+      lib_link_volume(fd, bmain, (Volume *)id);
+      break;
+    case ID_MA:
+      lib_link_material(fd, bmain, (Material *)id);
+      break;
+    case ID_TE:
+      lib_link_texture(fd, bmain, (Tex *)id);
+      break;
+    case ID_IM:
+      lib_link_image(fd, bmain, (Image *)id);
+      break;
+    case ID_NT:
+      /* Has to be done after node users (scene/materials/...), this will verify group nodes. */
+      lib_link_nodetree(fd, bmain, (bNodeTree *)id);
+      break;
+    case ID_GD:
+      lib_link_gpencil(fd, bmain, (bGPdata *)id);
+      break;
+    case ID_PAL:
+      lib_link_palette(fd, bmain, (Palette *)id);
+      break;
+    case ID_KE:
+      lib_link_key(fd, bmain, (Key *)id);
+      break;
+    case ID_AC:
+      lib_link_action(fd, bmain, (bAction *)id);
+      break;
+    case ID_IP:
+      /* XXX deprecated... still needs to be maintained for version patches still. */
+      lib_link_ipo(fd, bmain, (Ipo *)id);
+      break;
+    case ID_LI:
+      lib_link_library(fd, bmain, (Library *)id); /* Only init users. */
+      break;
+  }
+}
+
+static bool lib_link_all_id_needs_link(FileData *fd, ID *id, const bool do_partial_undo)
+{
+  if ((id->tag & LIB_TAG_NEED_LINK) == 0) {
+    /* This ID does not need liblink, just skip to next one. */
+    return false;
+  }
+
+  if (fd->memfile != NULL && GS(id->name) == ID_WM) {
+    /* No load UI for undo memfiles.
+     * Only WM currently, SCR needs it still (see below), and so does WS? */
+    return false;
+  }
+
+  if (fd->memfile != NULL && do_partial_undo && (id->tag & LIB_TAG_UNDO_OLD_ID_REUSED) != 0) {
+    /* This ID has been re-used from 'old' bmain. Since it was therefore unchanged across
+     * current undo step, and old IDs re-use their old memory address, we do not need to liblink
+     * it at all. */
+    return false;
+  }
+
+  return true;
+}
 
+/* Types which lib linking only looks up `fd->libmap` and writes to the ID itself. Animation data
+ * (which may patch the actions it uses) and embedded node trees (which verify the sockets of
+ * their nodes) are excluded. */
+static bool lib_link_id_is_independent(ID *id)
+{
+  if (!ELEM(GS(id->name),
+            ID_ME,
+            ID_CU,
+            ID_MB,
+            ID_LT,
+            ID_KE,
+            ID_AR,
+            ID_AC,
+            ID_TXT,
+            ID_MA,
+            ID_TE,
+            ID_LA,
+            ID_CA,
+            ID_WO)) {
+    return false;
+  }
+  return (BKE_animdata_from_id(id) == NULL) && (ntreeFromID(id) == NULL);
+}
+
+typedef struct LibLinkParallelData {
+  FileData *fd;
+  Main *bmain;
+  ID **ids;
+} LibLinkParallelData;
+
+static void lib_link_all_parallel_fn(void *__restrict userdata,
+                                     const int i,
+                                     const TaskParallelTLS *__restrict UNUSED(tls))
+{
+  LibLinkParallelData *data = userdata;
+  ID *id = data->ids[i];
+
+  lib_link_id(data->fd, data->bmain, id);
+  lib_link_id_type(data->fd, data->bmain, id);
+
+  id->tag &= ~LIB_TAG_NEED_LINK;
+}
+
+/* Link the independent IDs in parallel, lookups in `fd->libmap` don't modify it. */
+static void lib_link_all_parallel(FileData *fd, Main *bmain, const bool do_partial_undo)
+{
+  int ids_len = 0;
   ID *id;
   FOREACH_MAIN_ID_BEGIN (bmain, id) {
-    if ((id->tag & LIB_TAG_NEED_LINK) == 0) {
-      /* This ID does not need liblink, just skip to next one. */
-      continue;
+    if (lib_link_all_id_needs_link(fd, id, do_partial_undo) && lib_link_id_is_independent(id)) {
+      ids_len++;
     }
+  }
+  FOREACH_MAIN_ID_END;
 
-    if (fd->memfile != NULL && GS(id->name) == ID_WM) {
-      /* No load UI for undo memfiles.
-       * Only WM currently, SCR needs it still (see below), and so does WS? */
-      continue;
+  if (ids_len < LIB_LINK_PARALLEL_MIN) {
+    return;
+  }
+
+  LibLinkParallelData data = {
+      .fd = fd,
+      .bmain = bmain,
+      .ids = MEM_malloc_arrayN(ids_len, sizeof(*data.ids), __func__),
+  };
+  int i = 0;
+  FOREACH_MAIN_ID_BEGIN (bmain, id) {
+    if (lib_link_all_id_needs_link(fd, id, do_partial_undo) && lib_link_id_is_independent(id)) {
+      data.ids[i++] = id;
     }
+  }
+  FOREACH_MAIN_ID_END;
+
+  TaskParallelSettings settings;
+  BLI_parallel_range_settings_defaults(&settings);
+  settings.scheduling_mode = TASK_SCHEDULING_DYNAMIC;
+  BLI_task_parallel_range(0, ids_len, &data, lib_link_all_parallel_fn, &settings);
 
-    if (fd->memfile != NULL && do_partial_undo && (id->tag & LIB_TAG_UNDO_OLD_ID_REUSED) != 0) {
-      /* This ID has been re-used from 'old' bmain. Since it was therefore unchanged across
-       * current undo step, and old IDs re-use their old memory address, we do not need to liblink
-       * it at all. */
+  MEM_freeN(data.ids);
+}
+
+static void lib_link_all(FileData *fd, Main *bmain)
+{
+  const bool do_partial_undo = (fd->skip_flags & BLO_READ_SKIP_UNDO_OLD_MAIN) == 0;
+
+  lib_link_all_parallel(fd, bmain, do_partial_undo);
+
+  ID *id;
+  FOREACH_MAIN_ID_BEGIN (bmain, id) {
+    if (!lib_link_all_id_needs_link(fd, id, do_partial_undo)) {
       continue;
     }
 
     lib_link_id(fd, bmain, id);
-
-    /* Note: ID types are processed in reverse order as defined by INDEX_ID_XXX enums in DNA_ID.h.
-     * This ensures handling of most dependencies in proper order, as elsewhere in code.
-     * Please keep order of entries in that switch matching that order, it's easier to quickly see
-     * whether something is wrong then. */
-    switch (GS(id->name)) {
-      case ID_MSK:
-        lib_link_mask(fd, bmain, (Mask *)id);
-        break;
-      case ID_WM:
-        lib_link_windowmanager(fd, bmain, (wmWindowManager *)id);
-        break;
-      case ID_WS:
-        /* Could we skip WS in undo case? */
-        lib_link_workspaces(fd, bmain, (WorkSpace *)id);
-        break;
-      case ID_SCE:
-        lib_link_scene(fd, bmain, (Scene *)id);
-        break;
-      case ID_LS:
-        lib_link_linestyle(fd, bmain, (FreestyleLineStyle *)id);
-        break;
-      case ID_OB:
-        lib_link_object(fd, bmain, (Object *)id);
-        break;
-      case ID_SCR:
-        /* DO NOT skip screens here,
-         * 3D viewport may contains pointers to other ID data (like bgpic)! See T41411. */
-        lib_link_screen(fd, bmain, (bScreen *)id);
-        break;
-      case ID_MC:
-        lib_link_movieclip(fd, bmain, (MovieClip *)id);
-        break;
-      case ID_WO:
-        lib_link_world(fd, bmain, (World *)id);
-        break;
-      case ID_LP:
-        lib_link_lightprobe(fd, bmain, (LightProbe *)id);
-        break;
-      case ID_SPK:
-        lib_link_speaker(fd, bmain, (Speaker *)id);
-        break;
-      case ID_PA:
-        lib_link_particlesettings(fd, bmain, (ParticleSettings *)id);
-        break;
-      case ID_PC:
-        lib_link_paint_curve(fd, bmain, (PaintCurve *)id);
-        break;
-      case ID_BR:
-        lib_link_brush(fd, bmain, (Brush *)id);
-        break;
-      case ID_GR:
-        lib_link_collection(fd, bmain, (Collection *)id);
-        break;
-      case ID_SO:
-        lib_link_sound(fd, bmain, (bSound *)id);
-        break;
-      case ID_TXT:
-        lib_link_text(fd, bmain, (Text *)id);
-        break;
-      case ID_CA:
-        lib_link_camera(fd, bmain, (Camera *)id);
-        break;
-      case ID_LA:
-        lib_link_light(fd, bmain, (Light *)id);
-        break;
-      case ID_LT:
-        lib_link_latt(fd, bmain, (Lattice *)id);
-        break;
-      case ID_MB:
-        lib_link_mball(fd, bmain, (MetaBall *)id);
-        break;
-      case ID_CU:
-        lib_link_curve(fd, bmain, (Curve *)id);
-        break;
-      case ID_ME:
-        lib_link_mesh(fd, bmain, (Mesh *)id);
-        break;
-      case ID_CF:
-        lib_link_cachefiles(fd, bmain, (CacheFile *)id);
-        break;
-      case ID_AR:
-        lib_link_armature(fd, bmain, (bArmature *)id);
-        break;
-      case ID_VF:
-        lib_link_vfont(fd, bmain, (VFont *)id);
-        break;
-      case ID_HA:
-        lib_link_hair(fd, bmain, (Hair *)id);
-        break;
-      case ID_PT:
-        lib_link_pointcloud(fd, bmain, (PointCloud *)id);
-        break;
-      case ID_VO:
-        lib_link_volume(fd, bmain, (Volume *)id);
-        break;
-      case ID_MA:
-        lib_link_material(fd, bmain, (Material *)id);
-        break;
-      case ID_TE:
-        lib_link_texture(fd, bmain, (Tex *)id);
-        break;
-      case ID_IM:
-        lib_link_image(fd, bmain, (Image *)id);
-        break;
-      case ID_NT:
-        /* Has to be done after node users (scene/materials/...), this will verify group nodes. */
-        lib_link_nodetree(fd, bmain, (bNodeTree *)id);
-        break;
-      case ID_GD:
-        lib_link_gpencil(fd, bmain, (bGPdata *)id);
-        break;
-      case ID_PAL:
-        lib_link_palette(fd, bmain, (Palette *)id);
-        break;
-      case ID_KE:
-        lib_link_key(fd, bmain, (Key *)id);
-        break;
-      case ID_AC:
-        lib_link_action(fd, bmain, (bAction *)id);
-        break;
-      case ID_IP:
-        /* XXX deprecated... still needs to be maintained for version patches still. */
-        lib_link_ipo(fd, bmain, (Ipo *)id);
-        break;
-      case ID_LI:
-        lib_link_library(fd, bmain, (Library *)id); /* Only init users. */
-        break;
-    }
+    lib_link_id_type(fd, bmain, id);
 
     id->tag &= ~LIB_TAG_NEED_LINK;
   }
@@ -10256,11 +11634,44 @@ static BHead *read_userdef(BlendFileData *bfd, FileData *fd, BHead *bhead)
 /** \name Read File (Internal)
  * \{ */
 
+/* Phases of #blo_read_file_internal, timings are reported with `--debug-io`. */
+enum {
+  READ_FILE_TIMING_READ = 0,
+  READ_FILE_TIMING_DIRECT_LINK,
+  READ_FILE_TIMING_VERSIONING,
+  READ_FILE_TIMING_LIBRARIES,
+  READ_FILE_TIMING_LIB_LINK,
+  READ_FILE_TIMING_AFTER_LINK,
+  READ_FILE_TIMING_TOT,
+};
+
+static void read_file_timing_print(const char *filepath,
+                                   const double time_start,
+                                   const double timings[READ_FILE_TIMING_TOT])
+{
+  const double time_end = timings[READ_FILE_TIMING_TOT - 1];
+  printf("Read blend file '%s': %.4fs\n", filepath, time_end - time_start);
+  printf("  read & direct link: %.4fs\n", timings[READ_FILE_TIMING_READ] - time_start);
+  printf("  parallel link:      %.4fs\n",
+         timings[READ_FILE_TIMING_DIRECT_LINK] - timings[READ_FILE_TIMING_READ]);
+  printf("  versioning:         %.4fs\n",
+         timings[READ_FILE_TIMING_VERSIONING] - timings[READ_FILE_TIMING_DIRECT_LINK]);
+  printf("  read libraries:     %.4fs\n",
+         timings[READ_FILE_TIMING_LIBRARIES] - timings[READ_FILE_TIMING_VERSIONING]);
+  printf("  lib link:           %.4fs\n",
+         timings[READ_FILE_TIMING_LIB_LINK] - timings[READ_FILE_TIMING_LIBRARIES]);
+  printf("  after linking:      %.4fs\n",
+         timings[READ_FILE_TIMING_AFTER_LINK] - timings[READ_FILE_TIMING_LIB_LINK]);
+}
+
 BlendFileData *blo_read_file_internal(FileData *fd, const char *filepath)
 {
   BHead *bhead = blo_bhead_first(fd);
   BlendFileData *bfd;
   ListBase mainlist = {NULL, NULL};
+  ListBase deferred_direct_link = {NULL, NULL};
+  const double time_start = PIL_check_seconds_timer();
+  double timings[READ_FILE_TIMING_TOT] = {0.0};
 
   if (fd->memfile != NULL) {
     DEBUG_PRINTF("\nUNDO: read step\n");
@@ -10277,6 +11688,11 @@ BlendFileData *blo_read_file_internal(FileData *fd, const char *filepath)
     BLI_addtail(&mainlist, bfd->main);
     fd->mainlist = &mainlist;
     BLI_strncpy(bfd->main->name, filepath, sizeof(bfd->main->name));
+
+    /* Undo restores IDs at their old address while reading, so can't defer linking them. */
+    if (fd->memfile == NULL) {
+      fd->deferred_direct_link = &deferred_direct_link;
+    }
   }
 
   if (G.background) {
@@ -10352,6 +11768,27 @@ BlendFileData *blo_read_file_internal(FileData *fd, const char *filepath)
     }
   }
 
+  timings[READ_FILE_TIMING_READ] = PIL_check_seconds_timer();
+
+  if (fd->deferred_direct_link != NULL) {
+    read_libblock_direct_link_deferred(fd);
+    fd->deferred_direct_link = NULL;
+  }
+
+#ifdef USE_BHEAD_READ_ON_DEMAND
+  /* Blocks of the file may be missing, or decoded from zeroed pages. */
+  if (UNLIKELY(blo_mmap_has_io_error(fd))) {
+    BKE_reportf(fd->reports, RPT_ERROR, "Failed to read blend file '%s': I/O error", filepath);
+    if (mainlist.first != NULL) {
+      blo_join_main(&mainlist);
+    }
+    BLO_blendfiledata_free(bfd);
+    return NULL;
+  }
+#endif
+
+  timings[READ_FILE_TIMING_DIRECT_LINK] = PIL_check_seconds_timer();
+
   /* do before read_libraries, but skip undo case */
   if (fd->memfile == NULL) {
     if ((fd->skip_flags & BLO_READ_SKIP_DATA) == 0) {
@@ -10363,13 +11800,19 @@ BlendFileData *blo_read_file_internal(FileData *fd, const char *filepath)
     }
   }
 
+  timings[READ_FILE_TIMING_VERSIONING] = PIL_check_seconds_timer();
+
   if ((fd->skip_flags & BLO_READ_SKIP_DATA) == 0) {
     read_libraries(fd, &mainlist);
 
     blo_join_main(&mainlist);
 
+    timings[READ_FILE_TIMING_LIBRARIES] = PIL_check_seconds_timer();
+
     lib_link_all(fd, bfd->main);
 
+    timings[READ_FILE_TIMING_LIB_LINK] = PIL_check_seconds_timer();
+
     /* Skip in undo case. */
     if (fd->memfile == NULL) {
       /* Note that we can't recompute user-counts at this point in undo case, we play too much with
@@ -10416,9 +11859,18 @@ BlendFileData *blo_read_file_internal(FileData *fd, const char *filepath)
 
     link_global(fd, bfd); /* as last */
   }
+  else {
+    timings[READ_FILE_TIMING_LIBRARIES] = timings[READ_FILE_TIMING_VERSIONING];
+    timings[READ_FILE_TIMING_LIB_LINK] = timings[READ_FILE_TIMING_VERSIONING];
+  }
 
   fd->mainlist = NULL; /* Safety, this is local variable, shall not be used afterward. */
 
+  timings[READ_FILE_TIMING_AFTER_LINK] = PIL_check_seconds_timer();
+  if (G.debug & G_DEBUG_IO) {
+    read_file_timing_print(filepath, time_start, timings);
+  }
+
   return bfd;
 }
 
@@ -10480,6 +11932,14 @@ static BHead *find_previous_lib(FileData *fd, BHead *bhead)
     return NULL;
   }
 
+  if (read_file_id_index_use_lookup(fd)) {
+    const BlendIDIndexEntry *entry = read_file_id_index_entry_from_old(fd, bhead->old);
+    if ((entry == NULL) || (entry->lib_index == -1)) {
+      return NULL;
+    }
+    return read_file_id_index_entry_bhead(fd, &fd->id_index->entries[entry->lib_index]);
+  }
+
   for (; bhead; bhead = blo_bhead_prev(fd, bhead)) {
     if (bhead->code == ID_LI) {
       break;
@@ -10500,6 +11960,11 @@ static BHead *find_bhead(FileData *fd, void *old)
     return NULL;
   }
 
+  if (read_file_id_index_use_lookup(fd)) {
+    const BlendIDIndexEntry *entry = read_file_id_index_entry_from_old(fd, old);
+    return entry ? read_file_id_index_entry_bhead(fd, entry) : NULL;
+  }
+
   if (fd->bheadmap == NULL) {
     sort_bhead_old_map(fd);
   }
@@ -10531,7 +11996,7 @@ static BHead *find_bhead_from_code_name(FileData *fd, const short idcode, const
   *((short *)idname_full) = idcode;
   BLI_strncpy(idname_full + 2, name, sizeof(idname_full) - 2);
 
-  return BLI_ghash_lookup(fd->bhead_idname_hash, idname_full);
+  return find_bhead_from_idname(fd, idname_full);
 
 #else
   BHead *bhead;
@@ -10554,6 +12019,11 @@ static BHead *find_bhead_from_code_name(FileData *fd, const short idcode, const
 
 static BHead *find_bhead_from_idname(FileData *fd, const char *idname)
 {
+  if (read_file_id_index_use_lookup(fd)) {
+    const BlendIDIndexEntry *entry = BLI_ghash_lookup(fd->id_index->entry_from_name, idname);
+    return entry ? read_file_id_index_entry_bhead(fd, entry) : NULL;
+  }
+
 #ifdef USE_GHASH_BHEAD
   return BLI_ghash_lookup(fd->bhead_idname_hash, idname);
 #else
@@ -11888,6 +13358,9 @@ static ID *link_named_part(
     if (id == NULL) {
       /* not read yet */
       const int tag = force_indirect ? LIB_TAG_INDIRECT : LIB_TAG_EXTERN;
+      if (read_file_id_index_use_lookup(fd)) {
+        read_file_id_index_prefetch_deps(fd, bhead);
+      }
       read_libblock(fd, mainl, bhead, tag | LIB_TAG_NEED_EXPAND, false, &id);
 
       if (id) {
@@ -12044,9 +13517,7 @@ static Main *library_link_begin(Main *mainvar, FileData **fd, const char *filepa
   /* needed for do_version */
   mainl->versionfile = (*fd)->fileversion;
   read_file_version(*fd, mainl);
-#ifdef USE_GHASH_BHEAD
-  read_file_bhead_idname_map_create(*fd);
-#endif
+  read_file_link_lookup_create(*fd);
 
   return mainl;
 }
@@ -12427,9 +13898,7 @@ static FileData *read_library_file_data(FileData *basefd,
 
     /* subversion */
     read_file_version(fd, mainptr);
-#ifdef USE_GHASH_BHEAD
-    read_file_bhead_idname_map_create(fd);
-#endif
+    read_file_link_lookup_create(fd);
   }
   else {
     mainptr->curlib->filedata = NULL;
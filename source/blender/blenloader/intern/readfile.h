@@ -80,17 +80,28 @@ typedef struct FileData {
 
   /** Regular file reading. */
   int filedes;
+  /** Memory-mapped file reading, used for uncompressed files when supported. */
+  struct BLI_mmap_file *mmap_file;
 
   /** Variables needed for reading from memory / stream. */
   const char *buffer;
   /** Variables needed for reading from memfile (undo). */
   struct MemFile *memfile;
+  /** Chunks of the memfile, to find the chunk at any offset for reading on demand. */
+  const struct MemFileChunk **memfile_chunks;
+  /** Offset of each chunk, followed by the total size. */
+  size_t *memfile_chunk_offsets;
+  int memfile_chunks_len;
+  /** Index of the chunk read last, reading is mostly sequential. */
+  int memfile_chunk_index;
   /** Whether we are undoing (< 0) or redoing (> 0), used to choose which 'unchanged' flag to use
    * to detect unchanged data from memfile. */
   short undo_direction;
 
   /** Variables needed for reading from file. */
   gzFile gzfiledes;
+  /** Parallel reading of block compressed files, see #BLEND_ZLIB_BLOCK_SIZE. */
+  struct FileDataZlibBlocks *zlib_blocks;
   /** Gzip stream for memory decompression. */
   z_stream strm;
 
@@ -102,6 +113,8 @@ typedef struct FileData {
   const struct SDNA *memsdna;
   /** Array of #eSDNA_StructCompare. */
   const char *compflags;
+  /** Conversion of structs which differ between the file and current SDNA. */
+  struct DNA_ReconstructInfo *reconstruct_info;
 
   int fileversion;
   /** Used to retrieve ID names from (bhead+1). */
@@ -128,7 +141,15 @@ typedef struct FileData {
   /** See: #USE_GHASH_BHEAD. */
   struct GHash *bhead_idname_hash;
 
+  /** Index of ID blocks stored at the end of the file, see #BlendIDIndexFooter. */
+  struct FileDataIDIndex *id_index;
+
   ListBase *mainlist;
+  /**
+   * IDs read but not direct linked yet, these are linked in parallel after reading all blocks.
+   * Only set while reading the blocks of a file (not for undo or linking).
+   */
+  ListBase *deferred_direct_link;
   /** Used for undo. */
   ListBase *old_mainlist;
   struct IDNameLib_Map *old_idmap;
@@ -138,6 +159,61 @@ typedef struct FileData {
 
 #define SIZEOFBLENDERHEADER 12
 
+/**
+ * Compressed files are written as a sequence of independent gzip members ("blocks"),
+ * each holding at most #BLEND_ZLIB_BLOCK_SIZE bytes of uncompressed data.
+ *
+ * Every member stores its total size (header, deflate data and trailer) in a `BL` extra
+ * sub-field, so blocks can be located without inflating them and decoded in parallel.
+ * Concatenated gzip members are still a valid gzip stream, older readers load them as before.
+ */
+#define BLEND_ZLIB_BLOCK_SIZE (1 << 20)
+/** Fixed gzip header (10), `XLEN` (2), `BL` sub-field header (4) and member size (4). */
+#define BLEND_ZLIB_BLOCK_HEADER_SIZE 20
+/** gzip trailer: CRC32 and ISIZE. */
+#define BLEND_ZLIB_BLOCK_TRAILER_SIZE 8
+
+/**
+ * Uncompressed files end with an index of their ID blocks, stored in an `INDX` block after
+ * `ENDB` so older readers ignore it. When linking, it's used to read the requested IDs
+ * and their dependencies directly, instead of scanning all blocks of the file.
+ *
+ * The `INDX` block holds #BlendIDIndexHeader, the #BlendIDIndexEntry array and dependencies
+ * (entry indices, see #BlendIDIndexEntry.deps_start), it's followed by #BlendIDIndexFooter.
+ * Values use the byte order of the file, offsets count from the start of the file.
+ */
+#define BLEND_ID_INDEX_MAGIC "BIDINDEX"
+
+typedef struct BlendIDIndexHeader {
+  int entries_len;
+  int deps_len;
+  /** Offset of the `DNA1` block. */
+  uint64_t dna_offset;
+} BlendIDIndexHeader;
+
+typedef struct BlendIDIndexEntry {
+  /** #BHead.old of the ID block. */
+  uint64_t old;
+  /** Range of the ID block followed by its data blocks. */
+  uint64_t offset_begin;
+  uint64_t offset_end;
+  /** #BHead.code of the ID block, #ID_LI and #ID_LINK_PLACEHOLDER are included too. */
+  int code;
+  /** For #ID_LINK_PLACEHOLDER, the entry of the library it belongs to, otherwise -1. */
+  int lib_index;
+  /** Entries of the IDs used by this one. */
+  int deps_start;
+  int deps_len;
+  char name[MAX_ID_NAME];
+  char _pad[6];
+} BlendIDIndexEntry;
+
+typedef struct BlendIDIndexFooter {
+  /** Offset of the `INDX` block. */
+  uint64_t index_offset;
+  char magic[8];
+} BlendIDIndexFooter;
+
 /***/
 struct Main;
 void blo_join_main(ListBase *mainlist);
@@ -41,29 +41,76 @@
 #include "DNA_listBase.h"
 
 #include "BLI_blenlib.h"
+#include "BLI_ghash.h"
+#include "BLI_hash_mm2a.h"
+#include "BLI_task.h"
+#include "BLI_threads.h"
 
 #include "BLO_readfile.h"
 #include "BLO_undofile.h"
 
 #include "BKE_main.h"
 
+#include "atomic_ops.h"
+
 /* keep last */
 #include "BLI_strict_flags.h"
 
 /* **************** support for memory-write, for undo buffers *************** */
 
+/**
+ * Chunk buffers are shared between the chunks of consecutive undo steps and asynchronous
+ * writers, the number of users is stored in a header in front of the data.
+ * The header size keeps the data aligned the same as regular allocations.
+ */
+typedef struct MemFileChunkBufHeader {
+  int users;
+  int _pad[3];
+} MemFileChunkBufHeader;
+
+#define MEMFILE_CHUNK_BUF_HEADER(buf) (((MemFileChunkBufHeader *)(buf)) - 1)
+
+static char *memfile_chunk_buf_alloc(uint size)
+{
+  MemFileChunkBufHeader *header = MEM_mallocN(sizeof(*header) + size, "Chunk buffer");
+  header->users = 1;
+  return (char *)(header + 1);
+}
+
+static void memfile_chunk_buf_user_add(const char *buf)
+{
+  atomic_add_and_fetch_int32(&MEMFILE_CHUNK_BUF_HEADER(buf)->users, 1);
+}
+
+static void memfile_chunk_buf_user_remove(const char *buf)
+{
+  MemFileChunkBufHeader *header = MEMFILE_CHUNK_BUF_HEADER(buf);
+  if (atomic_sub_and_fetch_int32(&header->users, 1) == 0) {
+    MEM_freeN(header);
+  }
+}
+
 /* not memfile itself */
 void BLO_memfile_free(MemFile *memfile)
 {
   MemFileChunk *chunk;
 
+  if (memfile->chunks_by_content) {
+    BLI_gset_free(memfile->chunks_by_content, NULL);
+    memfile->chunks_by_content = NULL;
+  }
+  if (memfile->id_first_chunk) {
+    BLI_ghash_free(memfile->id_first_chunk, NULL, NULL);
+    memfile->id_first_chunk = NULL;
+  }
+
   while ((chunk = BLI_pophead(&memfile->chunks))) {
-    if (chunk->is_identical == false) {
-      MEM_freeN((void *)chunk->buf);
-    }
+    memfile_chunk_buf_user_remove(chunk->buf);
     MEM_freeN(chunk);
   }
   memfile->size = 0;
+  memfile->size_total = 0;
+  memfile->size_shared_moved = 0;
 }
 
 /* to keep list of memfiles consistent, 'first' is always first in list */
@@ -100,7 +147,38 @@ void BLO_memfile_clear_future(MemFile *memfile)
   }
 }
 
-void memfile_chunk_add(MemFile *memfile, const char *buf, uint size, MemFileChunk **compchunk_step)
+static uint memfile_chunk_content_hash(const void *key)
+{
+  const MemFileChunk *chunk = key;
+  return chunk->hash;
+}
+
+static bool memfile_chunk_content_cmp(const void *a, const void *b)
+{
+  const MemFileChunk *chunk_a = a;
+  const MemFileChunk *chunk_b = b;
+  return (chunk_a->hash != chunk_b->hash) || (chunk_a->size != chunk_b->size) ||
+         (memcmp(chunk_a->buf, chunk_b->buf, chunk_a->size) != 0);
+}
+
+/**
+ * Add a chunk of data to \a memfile, sharing its buffer with \a compare when possible:
+ *
+ * - Chunks are compared with the chunk at the same position of the same ID in \a compare,
+ *   an identical chunk there means this part of the ID didn't change, see
+ *   #MemFileChunk.is_identical.
+ * - Otherwise, the buffer of any chunk of \a compare with the same contents is used,
+ *   so data moved by insertions or removals before it doesn't use extra memory.
+ *
+ * \param id_session_uuid: Session UUID of the ID the data belongs to, zero for other data.
+ * \param compchunk_step: Position in \a compare, advanced for every chunk added.
+ */
+void memfile_chunk_add(MemFile *memfile,
+                       const MemFile *compare,
+                       const char *buf,
+                       uint size,
+                       uint id_session_uuid,
+                       MemFileChunk **compchunk_step)
 {
   MemFileChunk *curchunk = MEM_mallocN(sizeof(MemFileChunk), "MemFileChunk");
   curchunk->size = size;
@@ -110,14 +188,39 @@ void memfile_chunk_add(MemFile *memfile, const char *buf, uint size, MemFileChun
    * perform an undo push may make changes after the last undo push that
    * will then not be undo. Though it's not entirely clear that is wrong behavior. */
   curchunk->is_identical_future = true;
+  curchunk->id_session_uuid = id_session_uuid;
+
+  if (memfile->chunks_by_content == NULL) {
+    memfile->chunks_by_content = BLI_gset_new(
+        memfile_chunk_content_hash, memfile_chunk_content_cmp, __func__);
+    memfile->id_first_chunk = BLI_ghash_int_new(__func__);
+  }
+
+  /* First chunk of an ID, compare with the same ID in the previous step wherever it is. */
+  const MemFileChunk *prevchunk = memfile->chunks.last;
+  if (id_session_uuid != 0 &&
+      (prevchunk == NULL || prevchunk->id_session_uuid != id_session_uuid)) {
+    void **id_first_chunk_p;
+    if (!BLI_ghash_ensure_p(
+            memfile->id_first_chunk, POINTER_FROM_UINT(id_session_uuid), &id_first_chunk_p)) {
+      *id_first_chunk_p = curchunk;
+    }
+    if (compare && compare->id_first_chunk) {
+      *compchunk_step = BLI_ghash_lookup(compare->id_first_chunk,
+                                         POINTER_FROM_UINT(id_session_uuid));
+    }
+  }
+
   BLI_addtail(&memfile->chunks, curchunk);
 
   /* we compare compchunk with buf */
   if (*compchunk_step != NULL) {
     MemFileChunk *compchunk = *compchunk_step;
-    if (compchunk->size == curchunk->size) {
+    if (compchunk->size == curchunk->size && compchunk->id_session_uuid == id_session_uuid) {
       if (memcmp(compchunk->buf, buf, size) == 0) {
+        memfile_chunk_buf_user_add(compchunk->buf);
         curchunk->buf = compchunk->buf;
+        curchunk->hash = compchunk->hash;
         curchunk->is_identical = true;
         compchunk->is_identical_future = true;
       }
@@ -125,13 +228,28 @@ void memfile_chunk_add(MemFile *memfile, const char *buf, uint size, MemFileChun
     *compchunk_step = compchunk->next;
   }
 
-  /* not equal... */
+  /* not equal, look for the same contents anywhere in the previous step... */
   if (curchunk->buf == NULL) {
-    char *buf_new = MEM_mallocN(size, "Chunk buffer");
-    memcpy(buf_new, buf, size);
-    curchunk->buf = buf_new;
-    memfile->size += size;
+    curchunk->buf = buf;
+    curchunk->hash = BLI_hash_mm2((const uchar *)buf, size, 0);
+    const MemFileChunk *compchunk = (compare && compare->chunks_by_content) ?
+                                        BLI_gset_lookup(compare->chunks_by_content, curchunk) :
+                                        NULL;
+    if (compchunk != NULL) {
+      memfile_chunk_buf_user_add(compchunk->buf);
+      curchunk->buf = compchunk->buf;
+      memfile->size_shared_moved += size;
+    }
+    else {
+      char *buf_new = memfile_chunk_buf_alloc(size);
+      memcpy(buf_new, buf, size);
+      curchunk->buf = buf_new;
+      memfile->size += size;
+    }
   }
+
+  memfile->size_total += size;
+  BLI_gset_add(memfile->chunks_by_content, curchunk);
 }
 
 struct Main *BLO_memfile_main_get(struct MemFile *memfile,
@@ -157,14 +275,8 @@ struct Main *BLO_memfile_main_get(struct MemFile *memfile,
   return bmain_undo;
 }
 
-/**
- * Saves .blend using undo buffer.
- *
- * \return success.
- */
-bool BLO_memfile_write_file(struct MemFile *memfile, const char *filename)
+static int memfile_write_file_open(const char *filename)
 {
-  MemFileChunk *chunk;
   int file, oflags;
 
   /* note: This is currently used for autosave and 'quit.blend',
@@ -190,6 +302,29 @@ bool BLO_memfile_write_file(struct MemFile *memfile, const char *filename)
             "Unable to save '%s': %s\n",
             filename,
             errno ? strerror(errno) : "Unknown error opening file");
+  }
+  return file;
+}
+
+static void memfile_write_file_error(const char *filename)
+{
+  fprintf(stderr,
+          "Unable to save '%s': %s\n",
+          filename,
+          errno ? strerror(errno) : "Unknown error writing file");
+}
+
+/**
+ * Saves .blend using undo buffer.
+ *
+ * \return success.
+ */
+bool BLO_memfile_write_file(struct MemFile *memfile, const char *filename)
+{
+  MemFileChunk *chunk;
+  int file = memfile_write_file_open(filename);
+
+  if (file == -1) {
     return false;
   }
 
@@ -202,11 +337,137 @@ bool BLO_memfile_write_file(struct MemFile *memfile, const char *filename)
   close(file);
 
   if (chunk) {
-    fprintf(stderr,
-            "Unable to save '%s': %s\n",
-            filename,
-            errno ? strerror(errno) : "Unknown error writing file");
+    memfile_write_file_error(filename);
     return false;
   }
   return true;
 }
+
+/* -------------------------------------------------------------------- */
+/** \name Asynchronous Memfile Writing
+ *
+ * Writes a snapshot of the undo buffer from a background thread, so auto-save doesn't block
+ * the interface. The snapshot only adds users to the chunk buffers, which are immutable, and
+ * releases each buffer once it's written: memory use is never more than the undo buffer
+ * would have used if the undo steps it belongs to had been kept alive.
+ * \{ */
+
+typedef struct MemFileWriteAsync {
+  TaskPool *pool;
+  char filename[1024]; /* FILE_MAX */
+
+  const char **bufs;
+  uint *sizes;
+  int bufs_len;
+  /** Index of the first buffer still referenced by the snapshot. */
+  int bufs_written;
+
+  bool success;
+  /** Set from the writing thread, once the file is closed. */
+  int done;
+} MemFileWriteAsync;
+
+static void memfile_write_async_release(MemFileWriteAsync *write_async)
+{
+  for (int i = write_async->bufs_written; i < write_async->bufs_len; i++) {
+    memfile_chunk_buf_user_remove(write_async->bufs[i]);
+  }
+  write_async->bufs_written = write_async->bufs_len;
+}
+
+static void memfile_write_async_task(TaskPool *__restrict pool,
+                                     void *UNUSED(taskdata),
+                                     int UNUSED(threadid))
+{
+  MemFileWriteAsync *write_async = BLI_task_pool_userdata(pool);
+  int file = memfile_write_file_open(write_async->filename);
+
+  if (file != -1) {
+    write_async->success = true;
+    for (; write_async->bufs_written < write_async->bufs_len; write_async->bufs_written++) {
+      const int i = write_async->bufs_written;
+      if (BLI_task_pool_canceled(pool)) {
+        write_async->success = false;
+        break;
+      }
+      if ((size_t)write(file, write_async->bufs[i], write_async->sizes[i]) !=
+          write_async->sizes[i]) {
+        memfile_write_file_error(write_async->filename);
+        write_async->success = false;
+        break;
+      }
+      memfile_chunk_buf_user_remove(write_async->bufs[i]);
+    }
+    close(file);
+  }
+
+  memfile_write_async_release(write_async);
+  atomic_fetch_and_or_int32(&write_async->done, 1);
+}
+
+/**
+ * Saves .blend using undo buffer from a background thread.
+ *
+ * The \a memfile may be modified or freed once this returns,
+ * the result must be freed with #BLO_memfile_write_async_finish.
+ */
+MemFileWriteAsync *BLO_memfile_write_file_async(struct MemFile *memfile, const char *filename)
+{
+  MemFileWriteAsync *write_async = MEM_callocN(sizeof(*write_async), __func__);
+  const int bufs_len = BLI_listbase_count(&memfile->chunks);
+
+  BLI_strncpy(write_async->filename, filename, sizeof(write_async->filename));
+  write_async->bufs = MEM_mallocN(sizeof(*write_async->bufs) * (size_t)MAX2(bufs_len, 1),
+                                  __func__);
+  write_async->sizes = MEM_mallocN(sizeof(*write_async->sizes) * (size_t)MAX2(bufs_len, 1),
+                                   __func__);
+  LISTBASE_FOREACH (MemFileChunk *, chunk, &memfile->chunks) {
+    memfile_chunk_buf_user_add(chunk->buf);
+    write_async->bufs[write_async->bufs_len] = chunk->buf;
+    write_async->sizes[write_async->bufs_len] = chunk->size;
+    write_async->bufs_len++;
+  }
+
+  write_async->pool = BLI_task_pool_create_background(
+      BLI_task_scheduler_get(), write_async, TASK_PRIORITY_LOW);
+  BLI_task_pool_push(write_async->pool, memfile_write_async_task, NULL, false, NULL);
+
+  return write_async;
+}
+
+/**
+ * \return True when the background write is done and
+ * #BLO_memfile_write_async_finish won't block.
+ */
+bool BLO_memfile_write_async_is_done(MemFileWriteAsync *write_async)
+{
+  return atomic_add_and_fetch_int32(&write_async->done, 0) != 0;
+}
+
+/**
+ * Waits for the background write to complete and frees \a write_async.
+ *
+ * \param cancel: Stop writing as soon as possible, leaving an incomplete file.
+ * \return success.
+ */
+bool BLO_memfile_write_async_finish(MemFileWriteAsync *write_async, const bool cancel)
+{
+  if (cancel) {
+    BLI_task_pool_cancel(write_async->pool);
+  }
+  else {
+    BLI_task_pool_work_and_wait(write_async->pool);
+  }
+  BLI_task_pool_free(write_async->pool);
+
+  /* In case the task was canceled before it started. */
+  memfile_write_async_release(write_async);
+
+  const bool success = write_async->success && !cancel;
+  MEM_freeN(write_async->bufs);
+  MEM_freeN(write_async->sizes);
+  MEM_freeN(write_async);
+  return success;
+}
+
+/** \} */
@@ -146,7 +146,10 @@
 
 #include "BLI_bitmap.h"
 #include "BLI_blenlib.h"
+#include "BLI_ghash.h"
 #include "BLI_mempool.h"
+#include "BLI_task.h"
+#include "BLI_threads.h"
 #include "MEM_guardedalloc.h"  // MEM_freeN
 
 #include "BKE_action.h"
@@ -161,6 +164,7 @@
 #include "BKE_idtype.h"
 #include "BKE_layer.h"
 #include "BKE_lib_override.h"
+#include "BKE_lib_query.h"
 #include "BKE_main.h"
 #include "BKE_modifier.h"
 #include "BKE_node.h"
@@ -194,16 +198,13 @@
 #define MYWRITE_BUFFER_SIZE (MEM_SIZE_OPTIMAL(1 << 17)) /* 128kb */
 #define MYWRITE_MAX_CHUNK (MEM_SIZE_OPTIMAL(1 << 15))   /* ~32kb */
 
-/** Use if we want to store how many bytes have been written to the file. */
-// #define USE_WRITE_DATA_LEN
-
 /* -------------------------------------------------------------------- */
 /** \name Internal Write Wrapper's (Abstracts Compression)
  * \{ */
 
 typedef enum {
   WW_WRAP_NONE = 1,
-  WW_WRAP_ZLIB,
+  WW_WRAP_ZLIB_BLOCKS,
 } eWriteWrapType;
 
 typedef struct WriteWrap WriteWrap;
@@ -219,7 +220,7 @@ struct WriteWrap {
   /* internal */
   union {
     int file_handle;
-    gzFile gz_handle;
+    struct WriteWrapZlibBlocks *zlib_blocks;
   } _user_data;
 };
 
@@ -250,32 +251,233 @@ static size_t ww_write_none(WriteWrap *ww, const char *buf, size_t buf_len)
 }
 #undef FILE_HANDLE
 
-/* zlib */
-#define FILE_HANDLE(ww) (ww)->_user_data.gz_handle
+/* zlib blocks
+ *
+ * Data is split into blocks of #BLEND_ZLIB_BLOCK_SIZE which are compressed in parallel,
+ * see #BLEND_ZLIB_BLOCK_SIZE for the file layout.
+ *
+ * Blocks are collected into two batches: while one batch is being compressed by the task pool,
+ * the other one is filled by the writer. A batch is written out in order before it is re-used,
+ * which keeps memory use bounded to two batches of blocks. */
+
+typedef struct ZlibBlock {
+  /** Uncompressed data, #BLEND_ZLIB_BLOCK_SIZE bytes allocated. */
+  uchar *data_in;
+  size_t data_in_len;
+  /** Complete gzip member (header, deflate data and trailer). */
+  uchar *data_out;
+  size_t data_out_len;
+  bool error;
+} ZlibBlock;
+
+typedef struct ZlibBlockBatch {
+  TaskPool *task_pool;
+  ZlibBlock *blocks;
+  /** Number of blocks pushed to #ZlibBlockBatch.task_pool. */
+  int blocks_len;
+} ZlibBlockBatch;
+
+typedef struct WriteWrapZlibBlocks {
+  int file_handle;
+  ZlibBlockBatch batches[2];
+  /** The batch currently being filled, the other one may still be compressing. */
+  int batch_active;
+  /** Number of blocks in each batch. */
+  int blocks_max;
+  bool error;
+} WriteWrapZlibBlocks;
+
+#define ZLIB_BLOCKS(ww) (ww)->_user_data.zlib_blocks
 
-static bool ww_open_zlib(WriteWrap *ww, const char *filepath)
+static void ww_zlib_block_write_uint32(uchar *buf, uint value)
 {
-  gzFile file;
+  buf[0] = (uchar)(value);
+  buf[1] = (uchar)(value >> 8);
+  buf[2] = (uchar)(value >> 16);
+  buf[3] = (uchar)(value >> 24);
+}
 
-  file = BLI_gzopen(filepath, "wb1");
+static void ww_zlib_block_compress_task(TaskPool *__restrict UNUSED(pool),
+                                        void *taskdata,
+                                        int UNUSED(threadid))
+{
+  ZlibBlock *block = taskdata;
+  z_stream strm = {NULL};
 
-  if (file != Z_NULL) {
-    FILE_HANDLE(ww) = file;
-    return true;
+  if (deflateInit2(&strm, 1, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    block->error = true;
+    return;
   }
-  else {
+
+  const size_t data_out_len_max = BLEND_ZLIB_BLOCK_HEADER_SIZE +
+                                  deflateBound(&strm, block->data_in_len) +
+                                  BLEND_ZLIB_BLOCK_TRAILER_SIZE;
+  block->data_out = MEM_mallocN(data_out_len_max, __func__);
+
+  strm.next_in = block->data_in;
+  strm.avail_in = block->data_in_len;
+  strm.next_out = block->data_out + BLEND_ZLIB_BLOCK_HEADER_SIZE;
+  strm.avail_out = data_out_len_max - BLEND_ZLIB_BLOCK_HEADER_SIZE -
+                   BLEND_ZLIB_BLOCK_TRAILER_SIZE;
+
+  const int err = deflate(&strm, Z_FINISH);
+  deflateEnd(&strm);
+  if (err != Z_STREAM_END) {
+    block->error = true;
+    return;
+  }
+
+  uchar *header = block->data_out;
+  const size_t member_len = BLEND_ZLIB_BLOCK_HEADER_SIZE + strm.total_out +
+                            BLEND_ZLIB_BLOCK_TRAILER_SIZE;
+
+  /* ID1, ID2, CM (deflate), FLG (FEXTRA). */
+  header[0] = 0x1f;
+  header[1] = 0x8b;
+  header[2] = Z_DEFLATED;
+  header[3] = 1 << 2;
+  /* MTIME, XFL, OS (unknown). */
+  ww_zlib_block_write_uint32(&header[4], 0);
+  header[8] = 0;
+  header[9] = 255;
+  /* XLEN, then the `BL` sub-field holding the member size. */
+  header[10] = 8;
+  header[11] = 0;
+  header[12] = 'B';
+  header[13] = 'L';
+  header[14] = 4;
+  header[15] = 0;
+  ww_zlib_block_write_uint32(&header[16], (uint)member_len);
+
+  uchar *trailer = block->data_out + member_len - BLEND_ZLIB_BLOCK_TRAILER_SIZE;
+  ww_zlib_block_write_uint32(&trailer[0], crc32(0, block->data_in, block->data_in_len));
+  ww_zlib_block_write_uint32(&trailer[4], (uint)block->data_in_len);
+
+  block->data_out_len = member_len;
+}
+
+/**
+ * Wait for all blocks of the batch to be compressed and write them to the file, in order.
+ */
+static void ww_zlib_blocks_batch_finish(WriteWrapZlibBlocks *zb, ZlibBlockBatch *batch)
+{
+  if (batch->blocks_len == 0) {
+    return;
+  }
+
+  BLI_task_pool_work_and_wait(batch->task_pool);
+
+  for (int i = 0; i < batch->blocks_len; i++) {
+    ZlibBlock *block = &batch->blocks[i];
+    if (block->error) {
+      zb->error = true;
+    }
+    else if (!zb->error) {
+      if (write(zb->file_handle, block->data_out, block->data_out_len) !=
+          (ssize_t)block->data_out_len) {
+        zb->error = true;
+      }
+    }
+    MEM_SAFE_FREE(block->data_out);
+    block->data_out_len = 0;
+    block->data_in_len = 0;
+    block->error = false;
+  }
+  batch->blocks_len = 0;
+}
+
+static void ww_zlib_blocks_batch_push(WriteWrapZlibBlocks *zb)
+{
+  ZlibBlockBatch *batch = &zb->batches[zb->batch_active];
+  ZlibBlock *block = &batch->blocks[batch->blocks_len++];
+
+  BLI_task_pool_push(batch->task_pool, ww_zlib_block_compress_task, block, false, NULL);
+
+  if (batch->blocks_len == zb->blocks_max) {
+    /* Swap batches, the previous one has to be written out before it's re-used. */
+    zb->batch_active = !zb->batch_active;
+    ww_zlib_blocks_batch_finish(zb, &zb->batches[zb->batch_active]);
+  }
+}
+
+static bool ww_open_zlib_blocks(WriteWrap *ww, const char *filepath)
+{
+  int file = BLI_open(filepath, O_BINARY + O_WRONLY + O_CREAT + O_TRUNC, 0666);
+  if (file == -1) {
     return false;
   }
+
+  TaskScheduler *scheduler = BLI_task_scheduler_get();
+  WriteWrapZlibBlocks *zb = MEM_callocN(sizeof(*zb), __func__);
+  zb->file_handle = file;
+  zb->blocks_max = MAX2(BLI_task_scheduler_num_threads(scheduler), 1);
+
+  for (int i = 0; i < ARRAY_SIZE(zb->batches); i++) {
+    ZlibBlockBatch *batch = &zb->batches[i];
+    batch->task_pool = BLI_task_pool_create(scheduler, NULL, TASK_PRIORITY_HIGH);
+    batch->blocks = MEM_calloc_arrayN(zb->blocks_max, sizeof(*batch->blocks), __func__);
+    for (int j = 0; j < zb->blocks_max; j++) {
+      batch->blocks[j].data_in = MEM_mallocN(BLEND_ZLIB_BLOCK_SIZE, __func__);
+    }
+  }
+
+  ZLIB_BLOCKS(ww) = zb;
+  return true;
 }
-static bool ww_close_zlib(WriteWrap *ww)
+static bool ww_close_zlib_blocks(WriteWrap *ww)
 {
-  return (gzclose(FILE_HANDLE(ww)) == Z_OK);
+  WriteWrapZlibBlocks *zb = ZLIB_BLOCKS(ww);
+  ZlibBlockBatch *batch = &zb->batches[zb->batch_active];
+
+  /* Compress the last (partially filled) block. */
+  if (batch->blocks[batch->blocks_len].data_in_len != 0) {
+    ww_zlib_blocks_batch_push(zb);
+  }
+
+  /* The inactive batch holds the older blocks. */
+  ww_zlib_blocks_batch_finish(zb, &zb->batches[!zb->batch_active]);
+  ww_zlib_blocks_batch_finish(zb, &zb->batches[zb->batch_active]);
+
+  bool ok = !zb->error;
+  if (close(zb->file_handle) == -1) {
+    ok = false;
+  }
+
+  for (int i = 0; i < ARRAY_SIZE(zb->batches); i++) {
+    ZlibBlockBatch *batch_iter = &zb->batches[i];
+    BLI_task_pool_free(batch_iter->task_pool);
+    for (int j = 0; j < zb->blocks_max; j++) {
+      MEM_freeN(batch_iter->blocks[j].data_in);
+    }
+    MEM_freeN(batch_iter->blocks);
+  }
+  MEM_freeN(zb);
+  ZLIB_BLOCKS(ww) = NULL;
+
+  return ok;
 }
-static size_t ww_write_zlib(WriteWrap *ww, const char *buf, size_t buf_len)
+static size_t ww_write_zlib_blocks(WriteWrap *ww, const char *buf, size_t buf_len)
 {
-  return gzwrite(FILE_HANDLE(ww), buf, buf_len);
+  WriteWrapZlibBlocks *zb = ZLIB_BLOCKS(ww);
+  size_t buf_offset = 0;
+
+  while (buf_offset < buf_len) {
+    ZlibBlockBatch *batch = &zb->batches[zb->batch_active];
+    ZlibBlock *block = &batch->blocks[batch->blocks_len];
+    const size_t len = MIN2(buf_len - buf_offset, BLEND_ZLIB_BLOCK_SIZE - block->data_in_len);
+
+    memcpy(block->data_in + block->data_in_len, buf + buf_offset, len);
+    block->data_in_len += len;
+    buf_offset += len;
+
+    if (block->data_in_len == BLEND_ZLIB_BLOCK_SIZE) {
+      ww_zlib_blocks_batch_push(zb);
+    }
+  }
+
+  return zb->error ? 0 : buf_len;
 }
-#undef FILE_HANDLE
+#undef ZLIB_BLOCKS
 
 /* --- end compression types --- */
 
@@ -284,10 +486,10 @@ static void ww_handle_init(eWriteWrapType ww_type, WriteWrap *r_ww)
   memset(r_ww, 0, sizeof(*r_ww));
 
   switch (ww_type) {
-    case WW_WRAP_ZLIB: {
-      r_ww->open = ww_open_zlib;
-      r_ww->close = ww_close_zlib;
-      r_ww->write = ww_write_zlib;
+    case WW_WRAP_ZLIB_BLOCKS: {
+      r_ww->open = ww_open_zlib_blocks;
+      r_ww->close = ww_close_zlib_blocks;
+      r_ww->write = ww_write_zlib_blocks;
       r_ww->use_buf = false;
       break;
     }
@@ -315,10 +517,8 @@ typedef struct {
   /** Number of bytes used in #WriteData.buf (flushed when exceeded). */
   int buf_used_len;
 
-#ifdef USE_WRITE_DATA_LEN
-  /** Total number of bytes written. */
+  /** Total number of bytes written, the offset of the next write in the file. */
   size_t write_len;
-#endif
 
   /** Set on unlikely case of an error (ignores further file writing).  */
   bool error;
@@ -329,10 +529,15 @@ typedef struct {
     MemFile *compare;
     /** Use to de-duplicate chunks when writing. */
     MemFileChunk *compare_chunk;
+    /** Session UUID of the ID being written, zero outside of IDs. */
+    uint id_session_uuid;
   } mem;
   /** When true, write to #WriteData.current, could also call 'is_undo'. */
   bool use_memfile;
 
+  /** Index of the ID blocks written at the end of the file (NULL for undo). */
+  struct WriteIDIndex *id_index;
+
   /**
    * Wrap writing, so we can use zlib or
    * other compression types later, see: G_FILE_COMPRESS
@@ -368,7 +573,12 @@ static void writedata_do_write(WriteData *wd, const void *mem, int memlen)
 
   /* memory based save */
   if (wd->use_memfile) {
-    memfile_chunk_add(wd->mem.current, mem, memlen, &wd->mem.compare_chunk);
+    memfile_chunk_add(wd->mem.current,
+                      wd->mem.compare,
+                      mem,
+                      (uint)memlen,
+                      wd->mem.id_session_uuid,
+                      &wd->mem.compare_chunk);
   }
   else {
     if (wd->ww->write(wd->ww, mem, memlen) != memlen) {
@@ -377,11 +587,16 @@ static void writedata_do_write(WriteData *wd, const void *mem, int memlen)
   }
 }
 
+static void write_id_index_free(struct WriteIDIndex *id_index);
+
 static void writedata_free(WriteData *wd)
 {
   if (wd->buf) {
     MEM_freeN(wd->buf);
   }
+  if (wd->id_index) {
+    write_id_index_free(wd->id_index);
+  }
   MEM_freeN(wd);
 }
 
@@ -403,6 +618,37 @@ static void mywrite_flush(WriteData *wd)
   }
 }
 
+/**
+ * Start writing the data of \a id, for undo all its data is kept in separate chunks which
+ * are compared with the data of the same ID in the previous step.
+ */
+static void write_id_index_entry_begin(WriteData *wd, const ID *id, const int code);
+static void write_id_index_entry_end(WriteData *wd);
+
+static void mywrite_id_begin(WriteData *wd, const ID *id)
+{
+  if (wd->use_memfile) {
+    mywrite_flush(wd);
+    wd->mem.id_session_uuid = id->session_uuid;
+  }
+  if (wd->id_index) {
+    write_id_index_entry_begin(wd, id, GS(id->name));
+  }
+}
+
+static void mywrite_id_end(WriteData *wd, const ID *UNUSED(id))
+{
+  if (wd->use_memfile) {
+    /* Very important to do it after every ID write now, otherwise we cannot know whether a
+     * specific ID changed or not. */
+    mywrite_flush(wd);
+    wd->mem.id_session_uuid = 0;
+  }
+  if (wd->id_index) {
+    write_id_index_entry_end(wd);
+  }
+}
+
 /**
  * Low level WRITE(2) wrapper that buffers data
  * \param adr: Pointer to new chunk of data
@@ -419,9 +665,7 @@ static void mywrite(WriteData *wd, const void *adr, int len)
     return;
   }
 
-#ifdef USE_WRITE_DATA_LEN
   wd->write_len += len;
-#endif
 
   if (wd->buf == NULL) {
     writedata_do_write(wd, adr, len);
@@ -499,6 +743,178 @@ static bool mywrite_end(WriteData *wd)
 
 /** \} */
 
+/* -------------------------------------------------------------------- */
+/** \name ID Index
+ *
+ * Offsets and dependencies of all ID blocks, written after `ENDB` so linking
+ * can read only the blocks it needs, see #BlendIDIndexFooter.
+ * \{ */
+
+typedef struct WriteIDIndex {
+  BlendIDIndexEntry *entries;
+  int entries_len, entries_len_alloc;
+  /** IDs used by the entries, resolved to entry indices by #write_id_index. */
+  const ID **deps;
+  int deps_len, deps_len_alloc;
+  /** Entry of the last library written, used by link placeholders. */
+  int lib_index;
+  uint64_t dna_offset;
+} WriteIDIndex;
+
+static WriteIDIndex *write_id_index_new(void)
+{
+  WriteIDIndex *id_index = MEM_callocN(sizeof(*id_index), __func__);
+  id_index->lib_index = -1;
+  return id_index;
+}
+
+static void write_id_index_free(WriteIDIndex *id_index)
+{
+  MEM_SAFE_FREE(id_index->entries);
+  MEM_SAFE_FREE(id_index->deps);
+  MEM_freeN(id_index);
+}
+
+static int write_id_index_deps_cb(LibraryIDLinkCallbackData *cb_data)
+{
+  WriteIDIndex *id_index = cb_data->user_data;
+  const ID *id = *cb_data->id_pointer;
+
+  if (id == NULL || (cb_data->cb_flag & IDWALK_CB_LOOPBACK)) {
+    return IDWALK_RET_NOP;
+  }
+
+  if (id_index->deps_len == id_index->deps_len_alloc) {
+    id_index->deps_len_alloc = MAX2(id_index->deps_len_alloc * 2, 256);
+    id_index->deps = MEM_reallocN(id_index->deps,
+                                  sizeof(*id_index->deps) * id_index->deps_len_alloc);
+  }
+  id_index->deps[id_index->deps_len++] = id;
+
+  return IDWALK_RET_NOP;
+}
+
+/**
+ * Start the index entry of an ID block, the blocks written until #write_id_index_entry_end
+ * are read together with it.
+ *
+ * \param code: The ID type, or #ID_LINK_PLACEHOLDER for IDs linked from other files.
+ */
+static void write_id_index_entry_begin(WriteData *wd, const ID *id, const int code)
+{
+  WriteIDIndex *id_index = wd->id_index;
+
+  if (id_index->entries_len == id_index->entries_len_alloc) {
+    id_index->entries_len_alloc = MAX2(id_index->entries_len_alloc * 2, 64);
+    id_index->entries = MEM_reallocN(id_index->entries,
+                                     sizeof(*id_index->entries) * id_index->entries_len_alloc);
+  }
+
+  const int index = id_index->entries_len++;
+  BlendIDIndexEntry *entry = &id_index->entries[index];
+  memset(entry, 0, sizeof(*entry));
+  BLI_strncpy(entry->name, id->name, sizeof(entry->name));
+  entry->code = code;
+  entry->old = (uint64_t)(uintptr_t)id;
+  entry->offset_begin = wd->write_len;
+  entry->lib_index = -1;
+  entry->deps_start = id_index->deps_len;
+
+  if (code == ID_LI) {
+    id_index->lib_index = index;
+  }
+  else if (code == ID_LINK_PLACEHOLDER) {
+    entry->lib_index = id_index->lib_index;
+  }
+  else {
+    BKE_library_foreach_ID_link(
+        NULL, (ID *)id, write_id_index_deps_cb, id_index, IDWALK_READONLY);
+  }
+
+  entry->deps_len = id_index->deps_len - entry->deps_start;
+}
+
+static void write_id_index_entry_end(WriteData *wd)
+{
+  WriteIDIndex *id_index = wd->id_index;
+  BLI_assert(id_index->entries_len != 0);
+  BlendIDIndexEntry *entry = &id_index->entries[id_index->entries_len - 1];
+
+  if (entry->offset_begin == wd->write_len) {
+    /* Nothing written, e.g. IDs without users are skipped. */
+    BLI_assert(entry->code != ID_LI);
+    id_index->deps_len = entry->deps_start;
+    id_index->entries_len--;
+    return;
+  }
+  entry->offset_end = wd->write_len;
+}
+
+/**
+ * Write the `INDX` block after `ENDB`, resolving the dependencies to entries.
+ * Pointers to IDs which aren't written (runtime or embedded IDs) are skipped.
+ */
+static void write_id_index(WriteData *wd)
+{
+  WriteIDIndex *id_index = wd->id_index;
+  const uint64_t index_offset = wd->write_len;
+
+  GHash *entry_from_id = BLI_ghash_ptr_new_ex(__func__, (uint)id_index->entries_len);
+  for (int i = 0; i < id_index->entries_len; i++) {
+    void **val_p;
+    const ID *id = (const ID *)(uintptr_t)id_index->entries[i].old;
+    if (!BLI_ghash_ensure_p(entry_from_id, (void *)id, &val_p)) {
+      *val_p = POINTER_FROM_INT(i);
+    }
+  }
+
+  int *deps = MEM_malloc_arrayN(MAX2(id_index->deps_len, 1), sizeof(*deps), __func__);
+  int deps_len = 0;
+  for (int i = 0; i < id_index->entries_len; i++) {
+    BlendIDIndexEntry *entry = &id_index->entries[i];
+    const int deps_start = deps_len;
+    for (int j = 0; j < entry->deps_len; j++) {
+      void **val_p = BLI_ghash_lookup_p(entry_from_id, id_index->deps[entry->deps_start + j]);
+      if (val_p != NULL && POINTER_AS_INT(*val_p) != i) {
+        deps[deps_len++] = POINTER_AS_INT(*val_p);
+      }
+    }
+    entry->deps_start = deps_start;
+    entry->deps_len = deps_len - deps_start;
+  }
+  BLI_ghash_free(entry_from_id, NULL, NULL);
+
+  BlendIDIndexHeader header = {
+      .entries_len = id_index->entries_len,
+      .deps_len = deps_len,
+      .dna_offset = id_index->dna_offset,
+  };
+  BHead bhead = {
+      .code = INDX,
+      .len = (int)(sizeof(header) + sizeof(*id_index->entries) * id_index->entries_len +
+                   sizeof(*deps) * deps_len),
+      .nr = 1,
+  };
+  mywrite(wd, &bhead, sizeof(bhead));
+  mywrite(wd, &header, sizeof(header));
+  if (id_index->entries_len != 0) {
+    mywrite(wd, id_index->entries, sizeof(*id_index->entries) * id_index->entries_len);
+  }
+  if (deps_len != 0) {
+    mywrite(wd, deps, sizeof(*deps) * deps_len);
+  }
+  MEM_freeN(deps);
+
+  BlendIDIndexFooter footer = {.index_offset = index_offset};
+  memcpy(footer.magic, BLEND_ID_INDEX_MAGIC, sizeof(footer.magic));
+  mywrite(wd, &footer, sizeof(footer));
+
+  write_id_index_free(id_index);
+  wd->id_index = NULL;
+}
+
+/** \} */
+
 /* -------------------------------------------------------------------- */
 /** \name Generic DNA File Writing
  * \{ */
@@ -3890,6 +4306,10 @@ static void write_libraries(WriteData *wd, Main *main)
     if (found_one) {
       /* Not overridable. */
 
+      if (wd->id_index) {
+        write_id_index_entry_begin(wd, &main->curlib->id, ID_LI);
+      }
+
       writestruct(wd, ID_LI, Library, 1, main->curlib);
       write_iddata(wd, &main->curlib->id);
 
@@ -3902,6 +4322,10 @@ static void write_libraries(WriteData *wd, Main *main)
         }
       }
 
+      if (wd->id_index) {
+        write_id_index_entry_end(wd);
+      }
+
       /* Write link placeholders for all direct linked IDs. */
       while (a--) {
         for (id = lbarray[a]->first; id; id = id->next) {
@@ -3916,7 +4340,13 @@ static void write_libraries(WriteData *wd, Main *main)
                   main->curlib->filepath);
               BLI_assert(0);
             }
+            if (wd->id_index) {
+              write_id_index_entry_begin(wd, id, ID_LINK_PLACEHOLDER);
+            }
             writestruct(wd, ID_LINK_PLACEHOLDER, ID, 1, id);
+            if (wd->id_index) {
+              write_id_index_entry_end(wd);
+            }
           }
         }
       }
@@ -4011,6 +4441,11 @@ static bool write_file_handle(Main *mainvar,
 
   wd = mywrite_begin(ww, compare, current);
 
+  /* Compressed files can't be read at arbitrary offsets, the index would be of no use. */
+  if (!wd->use_memfile && (write_flags & G_FILE_COMPRESS) == 0) {
+    wd->id_index = write_id_index_new();
+  }
+
   sprintf(buf,
           "BLENDER%c%c%.3d",
           (sizeof(void *) == 8) ? '-' : '_',
@@ -4087,6 +4522,8 @@ static bool write_file_handle(Main *mainvar,
           }
         }
 
+        mywrite_id_begin(wd, id);
+
         memcpy(id_buffer, id, idtype_struct_size);
 
         ((ID *)id_buffer)->tag = 0;
@@ -4220,11 +4657,7 @@ static bool write_file_handle(Main *mainvar,
           BKE_lib_override_library_operations_store_end(override_storage, id);
         }
 
-        if (wd->use_memfile) {
-          /* Very important to do it after every ID write now, otherwise we cannot know whether a
-           * specific ID changed or not. */
-          mywrite_flush(wd);
-        }
+        mywrite_id_end(wd, id);
       }
 
       if (id_buffer != id_buffer_static) {
@@ -4254,6 +4687,9 @@ static bool write_file_handle(Main *mainvar,
    *
    * Note that we *borrow* the pointer to 'DNAstr',
    * so writing each time uses the same address and doesn't cause unnecessary undo overhead. */
+  if (wd->id_index) {
+    wd->id_index->dna_offset = wd->write_len;
+  }
   writedata(wd, DNA1, wd->sdna->data_len, wd->sdna->data);
 
   /* end of file */
@@ -4261,6 +4697,10 @@ static bool write_file_handle(Main *mainvar,
   bhead.code = ENDB;
   mywrite(wd, &bhead, sizeof(BHead));
 
+  if (wd->id_index) {
+    write_id_index(wd);
+  }
+
   blo_join_main(&mainlist);
 
   return mywrite_end(wd);
@@ -4341,7 +4781,7 @@ bool BLO_write_file(Main *mainvar,
   BLI_snprintf(tempname, sizeof(tempname), "%s@", filepath);
 
   if (write_flags & G_FILE_COMPRESS) {
-    ww_type = WW_WRAP_ZLIB;
+    ww_type = WW_WRAP_ZLIB_BLOCKS;
   }
   else {
     ww_type = WW_WRAP_NONE;
@@ -4388,9 +4828,12 @@ bool BLO_write_file(Main *mainvar,
   }
 
   /* actual file writing */
-  const bool err = write_file_handle(mainvar, &ww, NULL, NULL, write_flags, thumb);
+  bool err = write_file_handle(mainvar, &ww, NULL, NULL, write_flags, thumb);
 
-  ww.close(&ww);
+  /* Compressed output may only be fully written once the file is closed. */
+  if (ww.close(&ww) == false) {
+    err = true;
+  }
 
   if (UNLIKELY(path_list_backup)) {
     BKE_bpath_list_restore(mainvar, path_list_flag, path_list_backup);
@@ -84,6 +84,12 @@ void DEG_graph_build_from_ids(struct Depsgraph *graph,
 /* Tag relations from the given graph for update. */
 void DEG_graph_tag_relations_update(struct Depsgraph *graph);
 
+/* Tag relations of the given ID for update in the given graph.
+ *
+ * Unlike the tag above, only relations of this ID and of the IDs directly connected to it are
+ * built again, when possible. Use when the change does not affect any other ID's relations. */
+void DEG_graph_tag_relations_update_id(struct Depsgraph *graph, struct ID *id);
+
 /* Create or update relations in the specified graph. */
 void DEG_graph_relations_update(struct Depsgraph *graph,
                                 struct Main *bmain,
@@ -93,6 +99,17 @@ void DEG_graph_relations_update(struct Depsgraph *graph,
 /* Tag all relations in the database for update.*/
 void DEG_relations_tag_update(struct Main *bmain);
 
+/* Tag relations of the given ID for update in all graphs, see
+ * #DEG_graph_tag_relations_update_id. */
+void DEG_relations_tag_update_id(struct Main *bmain, struct ID *id);
+
+/* Build Cache ----------------------------------- */
+
+/* Reuse relations of graphs built for data which did not change since it was read from file,
+ * keeping them in memory and in the given directory, so they survive file reloads.
+ * Pass NULL to disable the cache, which is the default. */
+void DEG_build_cache_set_directory(const char *directory);
+
 /* Add Dependencies  ----------------------------- */
 
 /* Handle for components to define their dependencies from callbacks.
@@ -0,0 +1,419 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2020 Blender Foundation.
+ * All rights reserved.
+ */
+
+/** \file
+ * \ingroup depsgraph
+ *
+ * Incremental update of relations for a set of tagged IDs.
+ *
+ * Nodes and relations of the tagged IDs are removed from the graph and built again, with all the
+ * other IDs considered to be built already. Relations of the direct neighbors are built again as
+ * well, since they were possibly connected to the removed nodes. The ID nodes themselves are kept,
+ * together with their copy-on-write datablocks.
+ *
+ * Only objects are handled this way. Changes which affect bases, collections, rigid body worlds
+ * or physics relation caches still require the graph to be rebuilt from scratch.
+ */
+
+#include "intern/builder/deg_builder_incremental.h"
+
+#include "MEM_guardedalloc.h"
+
+#include "PIL_time.h"
+
+#include "BLI_ghash.h"
+#include "BLI_listbase.h"
+#include "BLI_utildefines.h"
+
+#include "DNA_layer_types.h"
+#include "DNA_object_types.h"
+
+#include "BKE_global.h"
+
+#include "DEG_depsgraph.h"
+
+#include "intern/builder/deg_builder.h"
+#include "intern/builder/deg_builder_cache.h"
+#include "intern/builder/deg_builder_cycle.h"
+#include "intern/builder/deg_builder_nodes.h"
+#include "intern/builder/deg_builder_relations.h"
+#include "intern/builder/deg_builder_transitive.h"
+#include "intern/depsgraph.h"
+#include "intern/depsgraph_relation.h"
+#include "intern/depsgraph_tag.h"
+#include "intern/node/deg_node.h"
+#include "intern/node/deg_node_component.h"
+#include "intern/node/deg_node_id.h"
+#include "intern/node/deg_node_operation.h"
+
+namespace DEG {
+
+namespace {
+
+typedef set<IDNode *> IDNodeSet;
+
+/* Key of a no-op operation which other IDs were connected to, so it can be restored when the
+ * owner ID does not create it on its own (this happens for ID properties used by drivers). */
+struct SavedOperationKey {
+  IDNode *id_node;
+  NodeType component_type;
+  string component_name;
+  OperationCode opcode;
+  string name;
+  int name_tag;
+};
+
+/* Find base of the object in the view layer, matching the base index used by the node builder.
+ * Returns -1 if the object was not pulled into the graph via a base. */
+int find_object_base_index(DepsgraphBuilder *builder,
+                           ViewLayer *view_layer,
+                           Object *object,
+                           Base **r_base)
+{
+  int base_index = 0;
+  LISTBASE_FOREACH (Base *, base, &view_layer->object_bases) {
+    if (!builder->need_pull_base_into_graph(base)) {
+      continue;
+    }
+    if (base->object == object) {
+      if (r_base != nullptr) {
+        *r_base = base;
+      }
+      return base_index;
+    }
+    base_index++;
+  }
+  return -1;
+}
+
+bool id_node_can_update_incremental(IDNode *id_node)
+{
+  if (id_node->id_type != ID_OB) {
+    return false;
+  }
+  /* Objects of set scenes are built in the context of another view layer. */
+  if (id_node->linked_state == DEG_ID_LINKED_VIA_SET) {
+    return false;
+  }
+  /* Rigid body relations are built by the scene. */
+  Object *object = (Object *)id_node->id_orig;
+  if (object->rigidbody_object != nullptr || object->rigidbody_constraint != nullptr) {
+    return false;
+  }
+  return true;
+}
+
+class DepsgraphIncrementalNodeBuilder : public DepsgraphNodeBuilder {
+ public:
+  DepsgraphIncrementalNodeBuilder(Main *bmain,
+                                  Depsgraph *graph,
+                                  DepsgraphBuilderCache *cache,
+                                  const IDNodeSet &rebuild_id_nodes)
+      : DepsgraphNodeBuilder(bmain, graph, cache), rebuild_id_nodes_(rebuild_id_nodes)
+  {
+  }
+
+  virtual void begin_build() override
+  {
+    /* Copy-on-write datablocks stay in their ID nodes, nothing to stash. */
+    id_info_hash_ = BLI_ghash_ptr_new("Depsgraph id hash");
+    scene_ = graph_->scene;
+    view_layer_ = graph_->view_layer;
+    view_layer_index_ = 0;
+    for (IDNode *id_node : graph_->id_nodes) {
+      if (rebuild_id_nodes_.find(id_node) == rebuild_id_nodes_.end()) {
+        built_map_.tagBuild(id_node->id_orig);
+      }
+    }
+    /* Operations of the rebuilt IDs are freed, restore their tags when the build is done. */
+    GSET_FOREACH_BEGIN (OperationNode *, op_node, graph_->entry_tags) {
+      ComponentNode *comp_node = op_node->owner;
+      IDNode *id_node = comp_node->owner;
+      if (rebuild_id_nodes_.find(id_node) == rebuild_id_nodes_.end()) {
+        continue;
+      }
+      SavedEntryTag entry_tag;
+      entry_tag.id_orig = id_node->id_orig;
+      entry_tag.component_type = comp_node->type;
+      entry_tag.opcode = op_node->opcode;
+      entry_tag.name = op_node->name;
+      entry_tag.name_tag = op_node->name_tag;
+      saved_entry_tags_.push_back(entry_tag);
+    }
+    GSET_FOREACH_END();
+  }
+
+  void build_object_incremental(IDNode *id_node, int base_index)
+  {
+    Object *object = (Object *)id_node->id_orig;
+    build_object(base_index, object, id_node->linked_state, id_node->is_directly_visible);
+  }
+
+  void restore_noop_operation(const SavedOperationKey &key)
+  {
+    ComponentNode *comp_node = key.id_node->find_component(key.component_type,
+                                                           key.component_name.c_str());
+    if (comp_node == nullptr) {
+      return;
+    }
+    if (comp_node->find_operation(key.opcode, key.name.c_str(), key.name_tag) != nullptr) {
+      return;
+    }
+    add_operation_node(comp_node, key.opcode, nullptr, key.name.c_str(), key.name_tag);
+  }
+
+ protected:
+  const IDNodeSet &rebuild_id_nodes_;
+};
+
+class DepsgraphIncrementalRelationBuilder : public DepsgraphRelationBuilder {
+ public:
+  DepsgraphIncrementalRelationBuilder(Main *bmain,
+                                      Depsgraph *graph,
+                                      DepsgraphBuilderCache *cache,
+                                      const IDNodeSet &rebuild_id_nodes)
+      : DepsgraphRelationBuilder(bmain, graph, cache), rebuild_id_nodes_(rebuild_id_nodes)
+  {
+  }
+
+  virtual void begin_build() override
+  {
+    scene_ = graph_->scene;
+    for (IDNode *id_node : graph_->id_nodes) {
+      if (rebuild_id_nodes_.find(id_node) == rebuild_id_nodes_.end()) {
+        built_map_.tagBuild(id_node->id_orig);
+      }
+    }
+  }
+
+  void build_object_incremental(IDNode *id_node, Base *base)
+  {
+    build_object(base, (Object *)id_node->id_orig);
+  }
+
+ protected:
+  /* Relations between kept nodes might already exist, avoid duplicating them. */
+  virtual Relation *add_time_relation(TimeSourceNode *timesrc,
+                                      Node *node_to,
+                                      const char *description,
+                                      int flags) override
+  {
+    return DepsgraphRelationBuilder::add_time_relation(
+        timesrc, node_to, description, flags | RELATION_CHECK_BEFORE_ADD);
+  }
+
+  virtual Relation *add_operation_relation(OperationNode *node_from,
+                                           OperationNode *node_to,
+                                           const char *description,
+                                           int flags) override
+  {
+    return DepsgraphRelationBuilder::add_operation_relation(
+        node_from, node_to, description, flags | RELATION_CHECK_BEFORE_ADD);
+  }
+
+  const IDNodeSet &rebuild_id_nodes_;
+};
+
+/* Free all operations and relations of the given ID nodes. Owners of the nodes they were
+ * connected to are added to the neighbors. */
+void clear_id_nodes_operations(Depsgraph *graph,
+                               const vector<IDNode *> &id_nodes,
+                               const IDNodeSet &id_nodes_set,
+                               IDNodeSet *r_neighbors,
+                               vector<SavedOperationKey> *r_noop_keys)
+{
+  for (IDNode *id_node : id_nodes) {
+    GHASH_FOREACH_BEGIN (ComponentNode *, comp_node, id_node->components) {
+      for (OperationNode *op_node : comp_node->operations) {
+        bool is_linked_to_neighbor = false;
+        for (Node::Relations *relations : {&op_node->inlinks, &op_node->outlinks}) {
+          while (!relations->empty()) {
+            Relation *rel = relations->back();
+            Node *other = (rel->from == op_node) ? rel->to : rel->from;
+            if (other->type == NodeType::OPERATION) {
+              IDNode *other_id_node = static_cast<OperationNode *>(other)->owner->owner;
+              if (id_nodes_set.find(other_id_node) == id_nodes_set.end()) {
+                r_neighbors->insert(other_id_node);
+                is_linked_to_neighbor = true;
+              }
+            }
+            rel->unlink();
+            OBJECT_GUARDED_DELETE(rel, Relation);
+          }
+        }
+        if (is_linked_to_neighbor && op_node->is_noop()) {
+          SavedOperationKey key;
+          key.id_node = id_node;
+          key.component_type = comp_node->type;
+          key.component_name = comp_node->name;
+          key.opcode = op_node->opcode;
+          key.name = op_node->name;
+          key.name_tag = op_node->name_tag;
+          r_noop_keys->push_back(key);
+        }
+        BLI_gset_remove(graph->entry_tags, op_node, nullptr);
+      }
+    }
+    GHASH_FOREACH_END();
+  }
+  graph->operations.erase(std::remove_if(graph->operations.begin(),
+                                         graph->operations.end(),
+                                         [&id_nodes_set](OperationNode *op_node) {
+                                           return id_nodes_set.find(op_node->owner->owner) !=
+                                                  id_nodes_set.end();
+                                         }),
+                          graph->operations.end());
+  for (IDNode *id_node : id_nodes) {
+    id_node->clear_components();
+  }
+}
+
+}  // namespace
+
+bool deg_graph_relations_update_incremental(Main *bmain, Depsgraph *graph)
+{
+  if (graph->need_update_all || graph->is_render_pipeline_depsgraph) {
+    return false;
+  }
+  /* Collision and effector caches depend on objects all over the graph. */
+  for (int i = 0; i < DEG_PHYSICS_RELATIONS_NUM; i++) {
+    if (graph->physics_relations[i] != nullptr) {
+      return false;
+    }
+  }
+  double start_time = 0.0;
+  if (G.debug & (G_DEBUG_DEPSGRAPH_BUILD | G_DEBUG_DEPSGRAPH_TIME)) {
+    start_time = PIL_check_seconds_timer();
+  }
+  DepsgraphBuilderCache builder_cache;
+  /* Tagged IDs which are in the graph, in the graph order to keep the build deterministic. */
+  vector<IDNode *> tagged_id_nodes;
+  IDNodeSet tagged_id_nodes_set;
+  for (IDNode *id_node : graph->id_nodes) {
+    if (!BLI_gset_haskey(graph->need_update_ids, id_node->id_orig)) {
+      continue;
+    }
+    if (!id_node_can_update_incremental(id_node)) {
+      return false;
+    }
+    tagged_id_nodes.push_back(id_node);
+    tagged_id_nodes_set.insert(id_node);
+  }
+  if (tagged_id_nodes.empty()) {
+    /* None of the tagged IDs is in this graph. */
+    return true;
+  }
+  DepsgraphIncrementalNodeBuilder node_builder(
+      bmain, graph, &builder_cache, tagged_id_nodes_set);
+  /* Bases of the tagged objects, needed for their flags. */
+  vector<int> base_indices;
+  vector<Base *> bases;
+  for (IDNode *id_node : tagged_id_nodes) {
+    Base *base = nullptr;
+    const int base_index = find_object_base_index(
+        &node_builder, graph->view_layer, (Object *)id_node->id_orig, &base);
+    if (id_node->has_base && base == nullptr) {
+      return false;
+    }
+    base_indices.push_back(base_index);
+    bases.push_back(base);
+  }
+
+  /* From here on the graph is modified. */
+  node_builder.begin_build();
+  for (IDNode *id_node : graph->id_nodes) {
+    id_node->previous_eval_flags = id_node->eval_flags;
+    id_node->previous_customdata_masks = id_node->customdata_masks;
+  }
+  IDNodeSet neighbors;
+  vector<SavedOperationKey> noop_keys;
+  clear_id_nodes_operations(graph, tagged_id_nodes, tagged_id_nodes_set, &neighbors, &noop_keys);
+  for (IDNode *id_node : tagged_id_nodes) {
+    /* Flags and masks are re-added by the IDs depending on this one. */
+    id_node->eval_flags = 0;
+    id_node->customdata_masks = DEGCustomDataMeshMasks();
+  }
+
+  /* Nodes. */
+  const size_t num_id_nodes_kept = graph->id_nodes.size();
+  for (size_t i = 0; i < tagged_id_nodes.size(); i++) {
+    node_builder.build_object_incremental(tagged_id_nodes[i], base_indices[i]);
+  }
+  for (const SavedOperationKey &key : noop_keys) {
+    node_builder.restore_noop_operation(key);
+  }
+  node_builder.end_build();
+  /* IDs which were pulled into the graph by the new nodes. */
+  vector<IDNode *> new_id_nodes(graph->id_nodes.begin() + num_id_nodes_kept,
+                                graph->id_nodes.end());
+
+  /* Relations. */
+  IDNodeSet rebuild_id_nodes = tagged_id_nodes_set;
+  for (IDNode *id_node : neighbors) {
+    /* Relations of the scene to objects are built by the objects themselves. */
+    if (id_node->id_type != ID_SCE) {
+      rebuild_id_nodes.insert(id_node);
+    }
+  }
+  rebuild_id_nodes.insert(new_id_nodes.begin(), new_id_nodes.end());
+  DepsgraphIncrementalRelationBuilder relation_builder(
+      bmain, graph, &builder_cache, rebuild_id_nodes);
+  relation_builder.begin_build();
+  for (size_t i = 0; i < tagged_id_nodes.size(); i++) {
+    relation_builder.build_object_incremental(tagged_id_nodes[i], bases[i]);
+  }
+  for (IDNode *id_node : graph->id_nodes) {
+    if (rebuild_id_nodes.find(id_node) != rebuild_id_nodes.end()) {
+      relation_builder.build_id(id_node->id_orig);
+    }
+  }
+  for (IDNode *id_node : tagged_id_nodes) {
+    relation_builder.build_copy_on_write_relations(id_node);
+    relation_builder.build_driver_relations(id_node);
+  }
+  for (IDNode *id_node : new_id_nodes) {
+    relation_builder.build_copy_on_write_relations(id_node);
+    relation_builder.build_driver_relations(id_node);
+  }
+
+  /* Finalize. */
+  deg_graph_detect_cycles(graph);
+  if (G.debug_value == 799) {
+    vector<OperationNode *> operations;
+    for (OperationNode *op_node : graph->operations) {
+      if (rebuild_id_nodes.find(op_node->owner->owner) != rebuild_id_nodes.end()) {
+        operations.push_back(op_node);
+      }
+    }
+    deg_graph_transitive_reduction(graph, operations);
+  }
+  deg_graph_build_finalize(bmain, graph);
+  for (IDNode *id_node : tagged_id_nodes) {
+    graph_id_tag_update(
+        bmain, graph, id_node->id_orig, ID_RECALC_COPY_ON_WRITE, DEG_UPDATE_SOURCE_RELATIONS);
+  }
+  if (G.debug & (G_DEBUG_DEPSGRAPH_BUILD | G_DEBUG_DEPSGRAPH_TIME)) {
+    printf("Depsgraph relations of %d IDs updated in %f seconds.\n",
+           (int)rebuild_id_nodes.size(),
+           PIL_check_seconds_timer() - start_time);
+  }
+  return true;
+}
+
+}  // namespace DEG
@@ -163,22 +163,20 @@ IDNode *DepsgraphNodeBuilder::add_id_node(ID *id)
 {
   IDNode *id_node = nullptr;
   ID *id_cow = nullptr;
-  IDComponentsMask previously_visible_components_mask = 0;
-  uint32_t previous_eval_flags = 0;
-  DEGCustomDataMeshMasks previous_customdata_masks;
   IDInfo *id_info = (IDInfo *)BLI_ghash_lookup(id_info_hash_, id);
   if (id_info != nullptr) {
     id_cow = id_info->id_cow;
-    previously_visible_components_mask = id_info->previously_visible_components_mask;
-    previous_eval_flags = id_info->previous_eval_flags;
-    previous_customdata_masks = id_info->previous_customdata_masks;
     /* Tag ID info to not free the CoW ID pointer. */
     id_info->id_cow = nullptr;
   }
   id_node = graph_->add_id_node(id, id_cow);
-  id_node->previously_visible_components_mask = previously_visible_components_mask;
-  id_node->previous_eval_flags = previous_eval_flags;
-  id_node->previous_customdata_masks = previous_customdata_masks;
+  /* NOTE: Nodes which are kept by an incremental relations update have no ID info, they keep
+   * their previous state as-is. */
+  if (id_info != nullptr) {
+    id_node->previously_visible_components_mask = id_info->previously_visible_components_mask;
+    id_node->previous_eval_flags = id_info->previous_eval_flags;
+    id_node->previous_customdata_masks = id_info->previous_customdata_masks;
+  }
   /* Currently all ID nodes are supposed to have copy-on-write logic.
    *
    * NOTE: Zero number of components indicates that ID node was just created. */
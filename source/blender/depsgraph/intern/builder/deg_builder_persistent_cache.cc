@@ -0,0 +1,579 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2020 Blender Foundation.
+ * All rights reserved.
+ */
+
+/** \file
+ * \ingroup depsgraph
+ *
+ * Persistent cache of the relations built for dependency graphs.
+ *
+ * Render farms build the very same graph over and over, every time the same file is opened, and
+ * every time the same scene is rendered. Relations of such graphs are stored in memory and in the
+ * cache directory, keyed by a hash of everything they were built from:
+ *
+ * - The files the data was read from, identified by their path, modification time and size.
+ * - The graph evaluation mode, scene and view layer.
+ * - All the operations of the graph, identified by the session UUID of their ID.
+ *
+ * A graph with the same key gets its relations restored by indices of its operations, together
+ * with the evaluation flags and customdata masks which the relations builder gathers. Nodes are
+ * always built, since operations are bound to the evaluated datablocks of their graph.
+ *
+ * Data which was changed after being read is not cached at all: tagging relations for update
+ * disables the cache for the Main database, which is the same contract an existing graph relies
+ * on to stay valid.
+ */
+
+#include "intern/builder/deg_builder_persistent_cache.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "MEM_guardedalloc.h"
+
+#include "BLI_fileops.h"
+#include "BLI_hash_mm2a.h"
+#include "BLI_listbase.h"
+#include "BLI_path_util.h"
+#include "BLI_string.h"
+#include "BLI_system.h"
+#include "BLI_threads.h"
+#include "BLI_utildefines.h"
+
+#include "DNA_ID.h"
+#include "DNA_layer_types.h"
+#include "DNA_scene_types.h"
+
+#include "BKE_blender_version.h"
+#include "BKE_global.h"
+#include "BKE_lib_id.h"
+#include "BKE_main.h"
+
+#include "DEG_depsgraph_build.h"
+#include "DEG_depsgraph_physics.h"
+
+#include "intern/depsgraph.h"
+#include "intern/depsgraph_relation.h"
+#include "intern/node/deg_node.h"
+#include "intern/node/deg_node_component.h"
+#include "intern/node/deg_node_id.h"
+#include "intern/node/deg_node_operation.h"
+#include "intern/node/deg_node_time.h"
+
+#include BLI_SYSTEM_PID_H
+
+namespace DEG {
+
+namespace {
+
+/* Increase when the stored data or the way keys are calculated changes. */
+const uint32_t CACHE_FORMAT_VERSION = 1;
+const char CACHE_FILE_MAGIC[8] = {'D', 'E', 'G', 'C', 'A', 'C', 'H', 'E'};
+/* Amount of graphs kept in memory, the oldest one is freed when it is exceeded. */
+const size_t CACHE_MAX_MEMORY_ENTRIES = 8;
+/* Index of the time source, in place of an operation index. */
+const int32_t CACHE_TIME_SOURCE_INDEX = -1;
+
+struct CachedIDNode {
+  uint32_t eval_flags;
+  DEGCustomDataMeshMasks customdata_masks;
+};
+
+struct CachedRelation {
+  int32_t from;
+  int32_t to;
+  int32_t name_index;
+  int32_t flag;
+};
+
+struct CacheEntry {
+  uint64_t key;
+  uint64_t num_operations;
+  vector<CachedIDNode> id_nodes;
+  /* Interned, so relations of restored graphs can point to them. */
+  vector<const char *> names;
+  vector<CachedRelation> relations;
+};
+
+struct PersistentCache {
+  ThreadMutex mutex = BLI_MUTEX_INITIALIZER;
+  /* Cache is disabled while there is no directory. */
+  string directory;
+  /* Oldest entries first. */
+  deque<CacheEntry *> entries;
+  /* Relation names are static strings when built, restored ones are kept here until exit. */
+  set<string> names;
+};
+
+PersistentCache &persistent_cache()
+{
+  static PersistentCache cache;
+  return cache;
+}
+
+const char *intern_relation_name(const char *name)
+{
+  if (name == nullptr) {
+    return nullptr;
+  }
+  return persistent_cache().names.insert(name).first->c_str();
+}
+
+/* 64 bit hash, made of two 32 bit murmur hashes with different seeds. */
+class CacheKeyHash {
+ public:
+  CacheKeyHash()
+  {
+    BLI_hash_mm2a_init(&hash_[0], 0);
+    BLI_hash_mm2a_init(&hash_[1], 0x9e3779b9);
+  }
+
+  void add(const void *data, size_t size)
+  {
+    for (BLI_HashMurmur2A &hash : hash_) {
+      BLI_hash_mm2a_add(&hash, (const unsigned char *)data, size);
+    }
+  }
+
+  void add_int(int64_t value)
+  {
+    add(&value, sizeof(value));
+  }
+
+  void add_string(const char *str)
+  {
+    const size_t size = strlen(str);
+    add_int((int64_t)size);
+    add(str, size);
+  }
+
+  void add_file_stat(const char *filepath)
+  {
+    add_string(filepath);
+    BLI_stat_t st;
+    if (BLI_stat(filepath, &st) != 0) {
+      add_int(-1);
+      return;
+    }
+    add_int((int64_t)st.st_mtime);
+    add_int((int64_t)st.st_size);
+  }
+
+  uint64_t end()
+  {
+    return ((uint64_t)BLI_hash_mm2a_end(&hash_[0]) << 32) | BLI_hash_mm2a_end(&hash_[1]);
+  }
+
+ private:
+  BLI_HashMurmur2A hash_[2];
+};
+
+uint64_t cache_key_calc(Main *bmain, Depsgraph *graph)
+{
+  const char *filepath = BKE_main_blendfile_path(bmain);
+  if (!bmain->use_depsgraph_build_cache || filepath[0] == '\0' || graph->view_layer == nullptr) {
+    return 0;
+  }
+  CacheKeyHash hash;
+  hash.add_int(CACHE_FORMAT_VERSION);
+  hash.add_int(BLENDER_VERSION);
+  hash.add_int(BLENDER_SUBVERSION);
+  /* Files the data comes from. */
+  hash.add_file_stat(filepath);
+  LISTBASE_FOREACH (Library *, library, &bmain->libraries) {
+    hash.add_file_stat(library->filepath);
+  }
+  /* Graph settings. */
+  hash.add_int(graph->mode);
+  hash.add_int(graph->is_render_pipeline_depsgraph);
+  hash.add_int(G.debug_value == 799);
+  hash.add_string(graph->scene->id.name);
+  hash.add_string(graph->view_layer->name);
+  /* Content of the graph. IDs are identified by their session UUID, which is stable for the same
+   * file. Embedded IDs have none, they are identified by their name and position instead. */
+  hash.add_int((int64_t)graph->id_nodes.size());
+  for (IDNode *id_node : graph->id_nodes) {
+    const ID *id = id_node->id_orig;
+    if (id->session_uuid != MAIN_ID_SESSION_UUID_UNSET) {
+      hash.add_int(id->session_uuid);
+    }
+    else if (id->flag & LIB_EMBEDDED_DATA) {
+      hash.add_string(id->name);
+    }
+    else {
+      return 0;
+    }
+    hash.add_int(id_node->linked_state);
+    hash.add_int(id_node->is_directly_visible);
+  }
+  hash.add_int((int64_t)graph->operations.size());
+  for (OperationNode *op_node : graph->operations) {
+    const ComponentNode *comp_node = op_node->owner;
+    hash.add_int(comp_node->owner->id_orig->session_uuid);
+    hash.add_int((int64_t)comp_node->type);
+    hash.add_string(comp_node->name.c_str());
+    hash.add_int((int64_t)op_node->opcode);
+    hash.add_string(op_node->name.c_str());
+    hash.add_int(op_node->name_tag);
+  }
+  const uint64_t key = hash.end();
+  /* Zero stands for graphs which can not be cached. */
+  return (key != 0) ? key : 1;
+}
+
+/* -------------------------------------------------------------------- */
+/** \name Cache Files
+ * \{ */
+
+string cache_filepath_get(const PersistentCache &cache, const uint64_t key)
+{
+  char filename[FILE_MAXFILE];
+  BLI_snprintf(filename, sizeof(filename), "%016llx.depsgraph", (unsigned long long)key);
+  char filepath[FILE_MAX];
+  BLI_join_dirfile(filepath, sizeof(filepath), cache.directory.c_str(), filename);
+  return filepath;
+}
+
+class CacheWriter {
+ public:
+  template<typename T> void write(const T &value)
+  {
+    buffer.append((const char *)&value, sizeof(value));
+  }
+
+  void write_string(const char *str)
+  {
+    const uint32_t size = (str != nullptr) ? (uint32_t)strlen(str) : 0;
+    write(size);
+    buffer.append(str, size);
+  }
+
+  string buffer;
+};
+
+class CacheReader {
+ public:
+  CacheReader(const char *data, size_t size) : data_(data), size_(size)
+  {
+  }
+
+  template<typename T> bool read(T *r_value)
+  {
+    if (size_ < sizeof(T)) {
+      return false;
+    }
+    memcpy(r_value, data_, sizeof(T));
+    data_ += sizeof(T);
+    size_ -= sizeof(T);
+    return true;
+  }
+
+  bool read_string(string *r_str)
+  {
+    uint32_t size;
+    if (!read(&size) || size_ < size) {
+      return false;
+    }
+    r_str->assign(data_, size);
+    data_ += size;
+    size_ -= size;
+    return true;
+  }
+
+  bool is_at_end() const
+  {
+    return size_ == 0;
+  }
+
+ private:
+  const char *data_;
+  size_t size_;
+};
+
+void cache_entry_write(const PersistentCache &cache, const CacheEntry &entry)
+{
+  CacheWriter writer;
+  writer.buffer.append(CACHE_FILE_MAGIC, sizeof(CACHE_FILE_MAGIC));
+  writer.write(CACHE_FORMAT_VERSION);
+  writer.write(entry.key);
+  writer.write(entry.num_operations);
+  writer.write((uint64_t)entry.id_nodes.size());
+  for (const CachedIDNode &id_node : entry.id_nodes) {
+    writer.write(id_node.eval_flags);
+    writer.write(id_node.customdata_masks);
+  }
+  writer.write((uint64_t)entry.names.size());
+  for (const char *name : entry.names) {
+    writer.write_string(name);
+  }
+  writer.write((uint64_t)entry.relations.size());
+  writer.buffer.append((const char *)entry.relations.data(),
+                       entry.relations.size() * sizeof(CachedRelation));
+
+  /* Write to a temporary file first, so other processes never read a partially written one. */
+  const string filepath = cache_filepath_get(cache, entry.key);
+  const string filepath_tmp = filepath + "." + to_string(abs(getpid())) + ".tmp";
+  FILE *file = BLI_fopen(filepath_tmp.c_str(), "wb");
+  if (file == nullptr) {
+    printf("Error writing depsgraph build cache '%s'\n", filepath_tmp.c_str());
+    return;
+  }
+  const bool ok = fwrite(writer.buffer.data(), 1, writer.buffer.size(), file) ==
+                  writer.buffer.size();
+  fclose(file);
+  if (!ok || BLI_rename(filepath_tmp.c_str(), filepath.c_str()) != 0) {
+    printf("Error writing depsgraph build cache '%s'\n", filepath.c_str());
+    BLI_delete(filepath_tmp.c_str(), false, false);
+  }
+}
+
+bool cache_entry_parse(CacheReader &reader, const uint64_t key, CacheEntry *entry)
+{
+  char magic[sizeof(CACHE_FILE_MAGIC)];
+  uint32_t version;
+  if (!reader.read(&magic) || memcmp(magic, CACHE_FILE_MAGIC, sizeof(magic)) != 0 ||
+      !reader.read(&version) || version != CACHE_FORMAT_VERSION) {
+    return false;
+  }
+  uint64_t num_id_nodes, num_names, num_relations;
+  if (!reader.read(&entry->key) || entry->key != key || !reader.read(&entry->num_operations) ||
+      entry->num_operations > INT32_MAX || !reader.read(&num_id_nodes)) {
+    return false;
+  }
+  for (uint64_t i = 0; i < num_id_nodes; i++) {
+    CachedIDNode id_node;
+    if (!reader.read(&id_node.eval_flags) || !reader.read(&id_node.customdata_masks)) {
+      return false;
+    }
+    entry->id_nodes.push_back(id_node);
+  }
+  if (!reader.read(&num_names)) {
+    return false;
+  }
+  for (uint64_t i = 0; i < num_names; i++) {
+    string name;
+    if (!reader.read_string(&name)) {
+      return false;
+    }
+    entry->names.push_back(intern_relation_name(name.c_str()));
+  }
+  if (!reader.read(&num_relations)) {
+    return false;
+  }
+  const int32_t num_operations = (int32_t)entry->num_operations;
+  for (uint64_t i = 0; i < num_relations; i++) {
+    CachedRelation relation;
+    if (!reader.read(&relation)) {
+      return false;
+    }
+    if (relation.from < CACHE_TIME_SOURCE_INDEX || relation.from >= num_operations ||
+        relation.to < 0 || relation.to >= num_operations || relation.name_index < 0 ||
+        relation.name_index >= (int32_t)num_names) {
+      return false;
+    }
+    entry->relations.push_back(relation);
+  }
+  return reader.is_at_end();
+}
+
+CacheEntry *cache_entry_read(const PersistentCache &cache, const uint64_t key)
+{
+  const string filepath = cache_filepath_get(cache, key);
+  size_t size;
+  char *data = (char *)BLI_file_read_binary_as_mem(filepath.c_str(), 0, &size);
+  if (data == nullptr) {
+    return nullptr;
+  }
+  CacheEntry *entry = OBJECT_GUARDED_NEW(CacheEntry);
+  CacheReader reader(data, size);
+  if (!cache_entry_parse(reader, key, entry)) {
+    printf("Ignoring invalid depsgraph build cache '%s'\n", filepath.c_str());
+    OBJECT_GUARDED_DELETE(entry, CacheEntry);
+    entry = nullptr;
+  }
+  MEM_freeN(data);
+  return entry;
+}
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name Cache Entries
+ * \{ */
+
+void cache_entry_add(PersistentCache &cache, CacheEntry *entry)
+{
+  if (cache.entries.size() == CACHE_MAX_MEMORY_ENTRIES) {
+    OBJECT_GUARDED_DELETE(cache.entries.front(), CacheEntry);
+    cache.entries.pop_front();
+  }
+  cache.entries.push_back(entry);
+}
+
+CacheEntry *cache_entry_find(PersistentCache &cache, const uint64_t key)
+{
+  for (CacheEntry *entry : cache.entries) {
+    if (entry->key == key) {
+      return entry;
+    }
+  }
+  CacheEntry *entry = cache_entry_read(cache, key);
+  if (entry != nullptr) {
+    cache_entry_add(cache, entry);
+  }
+  return entry;
+}
+
+void cache_entries_free(PersistentCache &cache)
+{
+  for (CacheEntry *entry : cache.entries) {
+    OBJECT_GUARDED_DELETE(entry, CacheEntry);
+  }
+  cache.entries.clear();
+}
+
+bool graph_has_physics_relations(const Depsgraph *graph)
+{
+  for (int i = 0; i < DEG_PHYSICS_RELATIONS_NUM; i++) {
+    if (graph->physics_relations[i] != nullptr) {
+      return true;
+    }
+  }
+  return false;
+}
+
+CacheEntry *cache_entry_from_graph(Depsgraph *graph, const uint64_t key)
+{
+  CacheEntry *entry = OBJECT_GUARDED_NEW(CacheEntry);
+  entry->key = key;
+  entry->num_operations = graph->operations.size();
+  for (IDNode *id_node : graph->id_nodes) {
+    entry->id_nodes.push_back({id_node->eval_flags, id_node->customdata_masks});
+  }
+  unordered_map<const Node *, int32_t> node_indices;
+  node_indices[graph->time_source] = CACHE_TIME_SOURCE_INDEX;
+  for (size_t i = 0; i < graph->operations.size(); i++) {
+    node_indices[graph->operations[i]] = (int32_t)i;
+  }
+  map<const char *, int32_t> name_indices;
+  auto add_relations = [&](const Node *node) {
+    for (const Relation *rel : node->outlinks) {
+      auto name_index = name_indices.insert(make_pair(rel->name, (int32_t)entry->names.size()));
+      if (name_index.second) {
+        entry->names.push_back(intern_relation_name(rel->name));
+      }
+      entry->relations.push_back({node_indices.at(rel->from),
+                                  node_indices.at(rel->to),
+                                  name_index.first->second,
+                                  rel->flag});
+    }
+  };
+  /* Follow order of outgoing relations, so evaluation of a restored graph visits nodes in the
+   * same order. */
+  add_relations(graph->time_source);
+  for (OperationNode *op_node : graph->operations) {
+    add_relations(op_node);
+  }
+  return entry;
+}
+
+void cache_entry_apply(const CacheEntry &entry, Depsgraph *graph)
+{
+  for (size_t i = 0; i < graph->id_nodes.size(); i++) {
+    IDNode *id_node = graph->id_nodes[i];
+    id_node->eval_flags |= entry.id_nodes[i].eval_flags;
+    id_node->customdata_masks |= entry.id_nodes[i].customdata_masks;
+  }
+  for (const CachedRelation &relation : entry.relations) {
+    Node *node_from = (relation.from == CACHE_TIME_SOURCE_INDEX) ?
+                          static_cast<Node *>(graph->time_source) :
+                          graph->operations[relation.from];
+    OperationNode *node_to = graph->operations[relation.to];
+    graph->add_new_relation(node_from, node_to, entry.names[relation.name_index], relation.flag);
+  }
+}
+
+/** \} */
+
+}  // namespace
+
+bool deg_persistent_cache_restore_relations(Main *bmain, Depsgraph *graph, uint64_t *r_key)
+{
+  PersistentCache &cache = persistent_cache();
+  *r_key = 0;
+  BLI_mutex_lock(&cache.mutex);
+  if (cache.directory.empty()) {
+    BLI_mutex_unlock(&cache.mutex);
+    return false;
+  }
+  BLI_mutex_unlock(&cache.mutex);
+  const uint64_t key = cache_key_calc(bmain, graph);
+  if (key == 0) {
+    return false;
+  }
+  BLI_mutex_lock(&cache.mutex);
+  const CacheEntry *entry = cache_entry_find(cache, key);
+  const bool is_restored = entry != nullptr &&
+                           entry->num_operations == graph->operations.size() &&
+                           entry->id_nodes.size() == graph->id_nodes.size();
+  if (is_restored) {
+    cache_entry_apply(*entry, graph);
+  }
+  BLI_mutex_unlock(&cache.mutex);
+  if (is_restored) {
+    if (G.debug & G_DEBUG_DEPSGRAPH_BUILD) {
+      printf("Depsgraph relations restored from build cache.\n");
+    }
+    return true;
+  }
+  *r_key = key;
+  return false;
+}
+
+void deg_persistent_cache_store_relations(Depsgraph *graph, uint64_t key)
+{
+  /* Physics relations are gathered by the relations builder, and are not stored. */
+  if (key == 0 || graph_has_physics_relations(graph)) {
+    return;
+  }
+  CacheEntry *entry = cache_entry_from_graph(graph, key);
+  PersistentCache &cache = persistent_cache();
+  BLI_mutex_lock(&cache.mutex);
+  if (cache.directory.empty()) {
+    OBJECT_GUARDED_DELETE(entry, CacheEntry);
+  }
+  else {
+    cache_entry_write(cache, *entry);
+    cache_entry_add(cache, entry);
+  }
+  BLI_mutex_unlock(&cache.mutex);
+}
+
+}  // namespace DEG
+
+void DEG_build_cache_set_directory(const char *directory)
+{
+  DEG::PersistentCache &cache = DEG::persistent_cache();
+  BLI_mutex_lock(&cache.mutex);
+  DEG::cache_entries_free(cache);
+  cache.directory = (directory != nullptr) ? directory : "";
+  if (!cache.directory.empty()) {
+    BLI_dir_create_recursive(directory);
+  }
+  BLI_mutex_unlock(&cache.mutex);
+}
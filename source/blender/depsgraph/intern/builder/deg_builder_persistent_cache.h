@@ -0,0 +1,46 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2020 Blender Foundation.
+ * All rights reserved.
+ */
+
+/** \file
+ * \ingroup depsgraph
+ */
+
+#pragma once
+
+#include "BLI_sys_types.h"
+
+struct Main;
+
+namespace DEG {
+
+struct Depsgraph;
+
+/* Restore relations of the graph from the persistent build cache, instead of building them.
+ * Expects all nodes of the graph to be built already.
+ *
+ * Returns false when there are no cached relations for this graph, it is not modified then.
+ * The key to store the relations once they are built is returned in r_key, it is 0 when the
+ * graph can not be cached. */
+bool deg_persistent_cache_restore_relations(Main *bmain, Depsgraph *graph, uint64_t *r_key);
+
+/* Store relations of the graph in the persistent build cache, using the key returned by a failed
+ * restore. Expects cycles to be solved, and the transitive reduction to be done. */
+void deg_persistent_cache_store_relations(Depsgraph *graph, uint64_t key);
+
+}  // namespace DEG
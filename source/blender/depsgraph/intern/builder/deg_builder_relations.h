@@ -160,7 +160,7 @@ class DepsgraphRelationBuilder : public DepsgraphBuilder {
  public:
   DepsgraphRelationBuilder(Main *bmain, Depsgraph *graph, DepsgraphBuilderCache *cache);
 
-  void begin_build();
+  virtual void begin_build();
 
   template<typename KeyFrom, typename KeyTo>
   Relation *add_relation(const KeyFrom &key_from,
@@ -323,14 +323,14 @@ class DepsgraphRelationBuilder : public DepsgraphBuilder {
   OperationNode *find_node(const OperationKey &key) const;
   bool has_node(const OperationKey &key) const;
 
-  Relation *add_time_relation(TimeSourceNode *timesrc,
-                              Node *node_to,
-                              const char *description,
-                              int flags = 0);
-  Relation *add_operation_relation(OperationNode *node_from,
-                                   OperationNode *node_to,
-                                   const char *description,
-                                   int flags = 0);
+  virtual Relation *add_time_relation(TimeSourceNode *timesrc,
+                                      Node *node_to,
+                                      const char *description,
+                                      int flags = 0);
+  virtual Relation *add_operation_relation(OperationNode *node_from,
+                                           OperationNode *node_to,
+                                           const char *description,
+                                           int flags = 0);
 
   template<typename KeyType>
   DepsNodeHandle create_node_handle(const KeyType &key, const char *default_name = "");
@@ -362,10 +362,13 @@ class DepsgraphRelationBuilder : public DepsgraphBuilder {
 
   static void constraint_walk(bConstraint *con, ID **idpoin, bool is_reference, void *user_data);
 
+ protected:
   /* State which demotes currently built entities. */
   Scene *scene_;
 
   BuilderMap built_map_;
+
+ private:
   RNANodeQuery rna_node_query_;
 };
 
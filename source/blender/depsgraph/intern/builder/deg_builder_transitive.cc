@@ -55,56 +55,75 @@ enum {
   OP_REACHABLE = 2,
 };
 
-static void deg_graph_tag_paths_recursive(Node *node)
+static void deg_graph_tag_paths_recursive(Node *node, vector<Node *> *visited)
 {
   if (node->custom_flags & OP_VISITED) {
     return;
   }
   node->custom_flags |= OP_VISITED;
+  visited->push_back(node);
   for (Relation *rel : node->inlinks) {
-    deg_graph_tag_paths_recursive(rel->from);
+    deg_graph_tag_paths_recursive(rel->from, visited);
     /* Do this only in inlinks loop, so the target node does not get
      * flagged. */
     rel->from->custom_flags |= OP_REACHABLE;
   }
 }
 
-void deg_graph_transitive_reduction(Depsgraph *graph)
+static int deg_graph_transitive_reduction_target(OperationNode *target, vector<Node *> *visited)
 {
   int num_removed_relations = 0;
-  for (OperationNode *target : graph->operations) {
-    /* Clear tags. */
-    for (OperationNode *node : graph->operations) {
-      node->custom_flags = 0;
+  /* Mark nodes from which we can reach the target
+   * start with children, so the target node and direct children are not
+   * flagged. */
+  target->custom_flags |= OP_VISITED;
+  for (Relation *rel : target->inlinks) {
+    deg_graph_tag_paths_recursive(rel->from, visited);
+  }
+  /* Remove redundant paths to the target. */
+  for (Node::Relations::const_iterator it_rel = target->inlinks.begin();
+       it_rel != target->inlinks.end();) {
+    Relation *rel = *it_rel;
+    if (rel->from->type == NodeType::TIMESOURCE) {
+      /* HACK: time source nodes don't get "custom_flags" flag
+       * set/cleared. */
+      /* TODO: there will be other types in future, so iterators above
+       * need modifying. */
+      ++it_rel;
     }
-    /* Mark nodes from which we can reach the target
-     * start with children, so the target node and direct children are not
-     * flagged. */
-    target->custom_flags |= OP_VISITED;
-    for (Relation *rel : target->inlinks) {
-      deg_graph_tag_paths_recursive(rel->from);
+    else if (rel->from->custom_flags & OP_REACHABLE) {
+      rel->unlink();
+      OBJECT_GUARDED_DELETE(rel, Relation);
+      num_removed_relations++;
     }
-    /* Remove redundant paths to the target. */
-    for (Node::Relations::const_iterator it_rel = target->inlinks.begin();
-         it_rel != target->inlinks.end();) {
-      Relation *rel = *it_rel;
-      if (rel->from->type == NodeType::TIMESOURCE) {
-        /* HACK: time source nodes don't get "custom_flags" flag
-         * set/cleared. */
-        /* TODO: there will be other types in future, so iterators above
-         * need modifying. */
-        ++it_rel;
-      }
-      else if (rel->from->custom_flags & OP_REACHABLE) {
-        rel->unlink();
-        OBJECT_GUARDED_DELETE(rel, Relation);
-        num_removed_relations++;
-      }
-      else {
-        ++it_rel;
-      }
+    else {
+      ++it_rel;
     }
   }
+  /* Clear tags, only the visited nodes were touched. */
+  target->custom_flags = 0;
+  for (Node *node : *visited) {
+    node->custom_flags = 0;
+  }
+  visited->clear();
+  return num_removed_relations;
+}
+
+void deg_graph_transitive_reduction(Depsgraph *graph)
+{
+  deg_graph_transitive_reduction(graph, graph->operations);
+}
+
+void deg_graph_transitive_reduction(Depsgraph *graph, const vector<OperationNode *> &targets)
+{
+  int num_removed_relations = 0;
+  vector<Node *> visited;
+  for (OperationNode *node : graph->operations) {
+    node->custom_flags = 0;
+  }
+  for (OperationNode *target : targets) {
+    num_removed_relations += deg_graph_transitive_reduction_target(target, &visited);
+  }
   DEG_DEBUG_PRINTF((::Depsgraph *)graph, BUILD, "Removed %d relations\n", num_removed_relations);
 }
 
@@ -23,11 +23,16 @@
 
 #pragma once
 
+#include "intern/depsgraph_type.h"
+
 namespace DEG {
 
 struct Depsgraph;
+struct OperationNode;
 
 /* Performs a transitive reduction to remove redundant relations. */
 void deg_graph_transitive_reduction(Depsgraph *graph);
+/* Same as above, but only removes redundant relations towards the given operations. */
+void deg_graph_transitive_reduction(Depsgraph *graph, const vector<OperationNode *> &targets);
 
 }  // namespace DEG
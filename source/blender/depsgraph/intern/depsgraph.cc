@@ -69,6 +69,8 @@ template<typename T> static void remove_from_vector(vector<T> *vector, const T &
 Depsgraph::Depsgraph(Main *bmain, Scene *scene, ViewLayer *view_layer, eEvaluationMode mode)
     : time_source(nullptr),
       need_update(true),
+      need_update_priorities(true),
+      need_update_all(true),
       need_update_time(false),
       bmain(bmain),
       scene(scene),
@@ -83,6 +85,7 @@ Depsgraph::Depsgraph(Main *bmain, Scene *scene, ViewLayer *view_layer, eEvaluati
   BLI_spin_init(&lock);
   id_hash = BLI_ghash_ptr_new("Depsgraph id hash");
   entry_tags = BLI_gset_ptr_new("Depsgraph entry_tags");
+  need_update_ids = BLI_gset_ptr_new("Depsgraph need_update_ids");
   memset(id_type_updated, 0, sizeof(id_type_updated));
   memset(id_type_exist, 0, sizeof(id_type_exist));
   memset(physics_relations, 0, sizeof(physics_relations));
@@ -93,6 +96,7 @@ Depsgraph::~Depsgraph()
   clear_id_nodes();
   BLI_ghash_free(id_hash, nullptr, nullptr);
   BLI_gset_free(entry_tags, nullptr);
+  BLI_gset_free(need_update_ids, nullptr);
   if (time_source != nullptr) {
     OBJECT_GUARDED_DELETE(time_source, TimeSourceNode);
   }
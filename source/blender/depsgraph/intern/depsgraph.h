@@ -42,6 +42,7 @@
 
 #include "intern/debug/deg_debug.h"
 #include "intern/depsgraph_type.h"
+#include "intern/eval/deg_eval_stats.h"
 
 struct GHash;
 struct GSet;
@@ -110,6 +111,16 @@ struct Depsgraph {
   /* Indicates whether relations needs to be updated. */
   bool need_update;
 
+  /* Indicates whether the scheduling priorities of the operations need to be calculated again,
+   * see deg_eval_stats_calculate_priorities(). */
+  bool need_update_priorities;
+
+  /* Original IDs whose relations were tagged for update. When only such IDs are tagged the
+   * relations are updated incrementally, around these IDs, otherwise the whole graph is rebuilt
+   * (which is denoted by need_update_all). */
+  GSet *need_update_ids;
+  bool need_update_all;
+
   /* Indicates which ID types were updated. */
   char id_type_updated[MAX_LIBARRAY];
 
@@ -159,6 +170,10 @@ struct Depsgraph {
 
   DepsgraphDebug debug;
 
+  /* Timings of the copy-on-write updates of the last evaluation.
+   * Only gathered when time debugging is enabled. */
+  CopyOnWriteStats copy_on_write_stats;
+
   bool is_evaluating;
 
   /* Is set to truth for dependency graph which are used for post-processing (compositor and
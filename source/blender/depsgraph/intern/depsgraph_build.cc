@@ -48,7 +48,9 @@ extern "C" {
 #include "builder/deg_builder.h"
 #include "builder/deg_builder_cache.h"
 #include "builder/deg_builder_cycle.h"
+#include "builder/deg_builder_incremental.h"
 #include "builder/deg_builder_nodes.h"
+#include "builder/deg_builder_persistent_cache.h"
 #include "builder/deg_builder_relations.h"
 #include "builder/deg_builder_transitive.h"
 
@@ -199,7 +201,7 @@ struct Depsgraph *DEG_get_graph_from_handle(struct DepsNodeHandle *node_handle)
 /* ******************** */
 /* Graph Building API's */
 
-static void graph_build_finalize_common(DEG::Depsgraph *deg_graph, Main *bmain)
+static void graph_build_finalize_relations(DEG::Depsgraph *deg_graph)
 {
   /* Detect and solve cycles. */
   DEG::deg_graph_detect_cycles(deg_graph);
@@ -210,6 +212,10 @@ static void graph_build_finalize_common(DEG::Depsgraph *deg_graph, Main *bmain)
   if (G.debug_value == 799) {
     DEG::deg_graph_transitive_reduction(deg_graph);
   }
+}
+
+static void graph_build_finalize_common(DEG::Depsgraph *deg_graph, Main *bmain)
+{
   /* Store pointers to commonly used valuated datablocks. */
   deg_graph->scene_cow = (Scene *)deg_graph->get_cow_id(&deg_graph->scene->id);
   /* Flush visibility layer and re-schedule nodes for update. */
@@ -223,6 +229,9 @@ static void graph_build_finalize_common(DEG::Depsgraph *deg_graph, Main *bmain)
 #endif
   /* Relations are up to date. */
   deg_graph->need_update = false;
+  deg_graph->need_update_priorities = true;
+  deg_graph->need_update_all = false;
+  BLI_gset_clear(deg_graph->need_update_ids, nullptr);
 }
 
 /* Build depsgraph for the given scene layer, and dump results in given graph container. */
@@ -247,11 +256,16 @@ void DEG_graph_build_from_view_layer(Depsgraph *graph,
   node_builder.build_view_layer(scene, view_layer, DEG::DEG_ID_LINKED_DIRECTLY);
   node_builder.end_build();
   /* Hook up relationships between operations - to determine evaluation order. */
-  DEG::DepsgraphRelationBuilder relation_builder(bmain, deg_graph, &builder_cache);
-  relation_builder.begin_build();
-  relation_builder.build_view_layer(scene, view_layer, DEG::DEG_ID_LINKED_DIRECTLY);
-  relation_builder.build_copy_on_write_relations();
-  relation_builder.build_driver_relations();
+  uint64_t cache_key;
+  if (!DEG::deg_persistent_cache_restore_relations(bmain, deg_graph, &cache_key)) {
+    DEG::DepsgraphRelationBuilder relation_builder(bmain, deg_graph, &builder_cache);
+    relation_builder.begin_build();
+    relation_builder.build_view_layer(scene, view_layer, DEG::DEG_ID_LINKED_DIRECTLY);
+    relation_builder.build_copy_on_write_relations();
+    relation_builder.build_driver_relations();
+    graph_build_finalize_relations(deg_graph);
+    DEG::deg_persistent_cache_store_relations(deg_graph, cache_key);
+  }
   /* Finalize building. */
   graph_build_finalize_common(deg_graph, bmain);
   /* Finish statistics. */
@@ -281,11 +295,16 @@ void DEG_graph_build_for_render_pipeline(Depsgraph *graph,
   node_builder.end_build();
   /* Hook up relationships between operations - to determine evaluation
    * order. */
-  DEG::DepsgraphRelationBuilder relation_builder(bmain, deg_graph, &builder_cache);
-  relation_builder.begin_build();
-  relation_builder.build_scene_render(scene, view_layer);
-  relation_builder.build_copy_on_write_relations();
-  relation_builder.build_driver_relations();
+  uint64_t cache_key;
+  if (!DEG::deg_persistent_cache_restore_relations(bmain, deg_graph, &cache_key)) {
+    DEG::DepsgraphRelationBuilder relation_builder(bmain, deg_graph, &builder_cache);
+    relation_builder.begin_build();
+    relation_builder.build_scene_render(scene, view_layer);
+    relation_builder.build_copy_on_write_relations();
+    relation_builder.build_driver_relations();
+    graph_build_finalize_relations(deg_graph);
+    DEG::deg_persistent_cache_store_relations(deg_graph, cache_key);
+  }
   /* Finalize building. */
   graph_build_finalize_common(deg_graph, bmain);
   /* Finish statistics. */
@@ -321,6 +340,7 @@ void DEG_graph_build_for_compositor_preview(
   relation_builder.build_copy_on_write_relations();
   relation_builder.build_driver_relations();
   /* Finalize building. */
+  graph_build_finalize_relations(deg_graph);
   graph_build_finalize_common(deg_graph, bmain);
   /* Finish statistics. */
   if (G.debug & (G_DEBUG_DEPSGRAPH_BUILD | G_DEBUG_DEPSGRAPH_TIME)) {
@@ -463,6 +483,7 @@ void DEG_graph_build_from_ids(Depsgraph *graph,
   relation_builder.build_copy_on_write_relations();
   relation_builder.build_driver_relations();
   /* Finalize building. */
+  graph_build_finalize_relations(deg_graph);
   graph_build_finalize_common(deg_graph, bmain);
   /* Finish statistics. */
   if (G.debug & (G_DEBUG_DEPSGRAPH_BUILD | G_DEBUG_DEPSGRAPH_TIME)) {
@@ -476,6 +497,8 @@ void DEG_graph_tag_relations_update(Depsgraph *graph)
   DEG_DEBUG_PRINTF(graph, TAG, "%s: Tagging relations for update.\n", __func__);
   DEG::Depsgraph *deg_graph = reinterpret_cast<DEG::Depsgraph *>(graph);
   deg_graph->need_update = true;
+  deg_graph->need_update_all = true;
+  deg_graph->bmain->use_depsgraph_build_cache = false;
   /* NOTE: When relations are updated, it's quite possible that
    * we've got new bases in the scene. This means, we need to
    * re-create flat array of bases in view layer.
@@ -488,6 +511,20 @@ void DEG_graph_tag_relations_update(Depsgraph *graph)
   }
 }
 
+/* Tag relations of the given ID for update in the given graph. */
+void DEG_graph_tag_relations_update_id(Depsgraph *graph, ID *id)
+{
+  DEG::Depsgraph *deg_graph = reinterpret_cast<DEG::Depsgraph *>(graph);
+  deg_graph->bmain->use_depsgraph_build_cache = false;
+  if (deg_graph->find_id_node(id) == nullptr) {
+    /* Relations of an ID which is not in the graph do not affect it. */
+    return;
+  }
+  DEG_DEBUG_PRINTF(graph, TAG, "%s: Tagging relations of %s for update.\n", __func__, id->name);
+  deg_graph->need_update = true;
+  BLI_gset_add(deg_graph->need_update_ids, id);
+}
+
 /* Create or update relations in the specified graph. */
 void DEG_graph_relations_update(Depsgraph *graph, Main *bmain, Scene *scene, ViewLayer *view_layer)
 {
@@ -496,6 +533,12 @@ void DEG_graph_relations_update(Depsgraph *graph, Main *bmain, Scene *scene, Vie
     /* Graph is up to date, nothing to do. */
     return;
   }
+  if (DEG::deg_graph_relations_update_incremental(bmain, deg_graph)) {
+    deg_graph->need_update = false;
+    deg_graph->need_update_priorities = true;
+    BLI_gset_clear(deg_graph->need_update_ids, nullptr);
+    return;
+  }
   DEG_graph_build_from_view_layer(graph, bmain, scene, view_layer);
 }
 
@@ -503,7 +546,19 @@ void DEG_graph_relations_update(Depsgraph *graph, Main *bmain, Scene *scene, Vie
 void DEG_relations_tag_update(Main *bmain)
 {
   DEG_GLOBAL_DEBUG_PRINTF(TAG, "%s: Tagging relations for update.\n", __func__);
+  /* Relations built from the data as it was read from file can not be reused anymore. */
+  bmain->use_depsgraph_build_cache = false;
   for (DEG::Depsgraph *depsgraph : DEG::get_all_registered_graphs(bmain)) {
     DEG_graph_tag_relations_update(reinterpret_cast<Depsgraph *>(depsgraph));
   }
 }
+
+/* Tag relations of the given ID for update in all graphs. */
+void DEG_relations_tag_update_id(Main *bmain, ID *id)
+{
+  DEG_GLOBAL_DEBUG_PRINTF(TAG, "%s: Tagging relations of %s for update.\n", __func__, id->name);
+  bmain->use_depsgraph_build_cache = false;
+  for (DEG::Depsgraph *depsgraph : DEG::get_all_registered_graphs(bmain)) {
+    DEG_graph_tag_relations_update_id(reinterpret_cast<Depsgraph *>(depsgraph), id);
+  }
+}
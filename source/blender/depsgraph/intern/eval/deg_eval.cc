@@ -25,12 +25,16 @@
 
 #include "intern/eval/deg_eval.h"
 
+#include "MEM_guardedalloc.h"
+
 #include "PIL_time.h"
 
 #include "BLI_compiler_attrs.h"
 #include "BLI_ghash.h"
 #include "BLI_gsqueue.h"
+#include "BLI_heap_simple.h"
 #include "BLI_task.h"
+#include "BLI_threads.h"
 #include "BLI_utildefines.h"
 
 #include "BKE_global.h"
@@ -70,11 +74,6 @@ void schedule_children(DepsgraphEvalState *state,
                        ScheduleFunction *schedule_function,
                        ScheduleFunctionArgs... schedule_function_args);
 
-void schedule_node_to_pool(OperationNode *node, const int thread_id, TaskPool *pool)
-{
-  BLI_task_pool_push_from_thread(pool, deg_task_run_func, node, false, NULL, thread_id);
-}
-
 /* Denotes which part of dependency graph is being evaluated. */
 enum class EvaluationStage {
   /* Stage 1: Only  Copy-on-Write operations are to be evaluated, prior to anything else.
@@ -97,32 +96,67 @@ struct DepsgraphEvalState {
   bool do_stats;
   EvaluationStage stage;
   bool need_single_thread_pass;
+  /* Operations ready for threaded evaluation, ordered by their priority. Every task pushed to the
+   * pool evaluates the most important one, rather than the one it was pushed for. This way the
+   * critical path starts as early as possible, instead of waiting behind cheap operations. */
+  HeapSimple *ready_operations;
+  SpinLock ready_operations_lock;
 };
 
+void schedule_node_to_pool(OperationNode *node, const int thread_id, TaskPool *pool)
+{
+  DepsgraphEvalState *state = (DepsgraphEvalState *)BLI_task_pool_userdata(pool);
+  BLI_spin_lock(&state->ready_operations_lock);
+  BLI_heapsimple_insert(state->ready_operations, -(float)node->priority, node);
+  BLI_spin_unlock(&state->ready_operations_lock);
+  BLI_task_pool_push_from_thread(pool, deg_task_run_func, NULL, false, NULL, thread_id);
+}
+
+/* Time spent by this thread in operations evaluated from within the one being evaluated. */
+thread_local double evaluate_node_nested_time = 0.0;
+
 void evaluate_node(const DepsgraphEvalState *state, OperationNode *operation_node)
 {
   ::Depsgraph *depsgraph = reinterpret_cast<::Depsgraph *>(state->graph);
 
   /* Sanity checks. */
   BLI_assert(!operation_node->is_noop() && "NOOP nodes should not actually be scheduled");
-  /* Perform operation. */
-  if (state->do_stats) {
-    const double start_time = PIL_check_seconds_timer();
-    operation_node->evaluate(depsgraph);
-    operation_node->stats.current_time += PIL_check_seconds_timer() - start_time;
+  /* Attribute allocations to the ID and operation, when profiling them. */
+  const bool do_memory_profile = MEM_profile_is_enabled();
+  if (do_memory_profile) {
+    const ComponentNode *comp_node = operation_node->owner;
+    MEM_profile_context_begin(comp_node->owner->name.c_str());
+    MEM_profile_context_begin(
+        (comp_node->name.empty() ? operation_node->identifier() :
+                                   comp_node->name + "/" + operation_node->identifier())
+            .c_str());
   }
-  else {
-    operation_node->evaluate(depsgraph);
+  /* Perform operation, always timed since the timings are used for scheduling priorities.
+   * Operations evaluated by this thread while the operation waits in a reentrant wait are not
+   * counted as its own time. */
+  const double nested_time_prev = evaluate_node_nested_time;
+  evaluate_node_nested_time = 0.0;
+  const double start_time = PIL_check_seconds_timer();
+  operation_node->evaluate(depsgraph);
+  const double time = PIL_check_seconds_timer() - start_time;
+  operation_node->stats.current_time += time - evaluate_node_nested_time;
+  evaluate_node_nested_time = nested_time_prev + time;
+  if (do_memory_profile) {
+    MEM_profile_context_end();
+    MEM_profile_context_end();
   }
 }
 
-void deg_task_run_func(TaskPool *pool, void *taskdata, int thread_id)
+void deg_task_run_func(TaskPool *pool, void * /*taskdata*/, int thread_id)
 {
   void *userdata_v = BLI_task_pool_userdata(pool);
   DepsgraphEvalState *state = (DepsgraphEvalState *)userdata_v;
 
-  /* Evaluate node. */
-  OperationNode *operation_node = reinterpret_cast<OperationNode *>(taskdata);
+  /* Evaluate the most important ready node, there is one for every pushed task. */
+  BLI_spin_lock(&state->ready_operations_lock);
+  OperationNode *operation_node = (OperationNode *)BLI_heapsimple_pop_min(
+      state->ready_operations);
+  BLI_spin_unlock(&state->ready_operations_lock);
   evaluate_node(state, operation_node);
 
   /* Schedule children. */
@@ -181,16 +215,14 @@ void calculate_pending_parents(Depsgraph *graph)
   }
 }
 
-void initialize_execution(DepsgraphEvalState *state, Depsgraph *graph)
+void initialize_execution(DepsgraphEvalState * /*state*/, Depsgraph *graph)
 {
-  const bool do_stats = state->do_stats;
   calculate_pending_parents(graph);
   /* Clear tags and other things which needs to be clear. */
   for (OperationNode *node : graph->operations) {
-    if (do_stats) {
-      node->stats.reset_current();
-    }
+    node->stats.reset_current();
   }
+  deg_eval_stats_calculate_priorities(graph);
 }
 
 bool is_metaball_object_operation(const OperationNode *operation_node)
@@ -376,7 +408,12 @@ void deg_evaluate_on_refresh(Depsgraph *graph)
   DepsgraphEvalState state;
   state.graph = graph;
   state.do_stats = graph->debug.do_time_debug();
+  if (state.do_stats) {
+    graph->copy_on_write_stats.reset();
+  }
   state.need_single_thread_pass = false;
+  state.ready_operations = BLI_heapsimple_new();
+  BLI_spin_init(&state.ready_operations_lock);
   /* Set up task scheduler and pull for threaded evaluation. */
   TaskScheduler *task_scheduler;
   bool need_free_scheduler;
@@ -389,10 +426,15 @@ void deg_evaluate_on_refresh(Depsgraph *graph)
     need_free_scheduler = false;
   }
   TaskPool *task_pool = BLI_task_pool_create_suspended(task_scheduler, &state, TASK_PRIORITY_HIGH);
+  /* Operations which wait for their own parallel loops evaluate other operations meanwhile,
+   * instead of leaving their thread idle. Only for the waits which opt in to this, known not to
+   * hold any lock which other operations may need (split normals for example). */
+  BLI_task_pool_set_reentrant(task_pool, true);
   /* Prepare all nodes for evaluation. */
   initialize_execution(&state, graph);
 
   /* Do actual evaluation now. */
+  const double start_time = PIL_check_seconds_timer();
 
   /* First, process all Copy-On-Write nodes. */
   state.stage = EvaluationStage::COPY_ON_WRITE;
@@ -409,12 +451,19 @@ void deg_evaluate_on_refresh(Depsgraph *graph)
     state.stage = EvaluationStage::SINGLE_THREADED_WORKAROUND;
     evaluate_graph_single_threaded(&state);
   }
+  const double makespan = PIL_check_seconds_timer() - start_time;
+  BLI_heapsimple_free(state.ready_operations, NULL);
+  BLI_spin_end(&state.ready_operations_lock);
 
   /* Finalize statistics gathering. This is because we only gather single
    * operation timing here, without aggregating anything to avoid any extra
    * synchronization. */
+  deg_eval_stats_update_averages(graph);
   if (state.do_stats) {
     deg_eval_stats_aggregate(graph);
+    deg_eval_stats_print_schedule(
+        graph, makespan, BLI_task_scheduler_num_threads(task_scheduler));
+    deg_eval_stats_print_copy_on_write(graph);
   }
   /* Clear any uncleared tags - just in case. */
   deg_graph_clear_tags(graph);
@@ -53,6 +53,10 @@
 
 #include "MEM_guardedalloc.h"
 
+#include "PIL_time.h"
+
+#include "atomic_ops.h"
+
 extern "C" {
 #include "DNA_ID.h"
 #include "DNA_anim_types.h"
@@ -278,8 +282,8 @@ struct ValidateData {
 };
 
 /* Similar to generic BKE_id_copy() but does not require main and assumes pointer
- * is already allocated. */
-bool id_copy_inplace_no_main(const ID *id, ID *newid)
+ * is already allocated. The flag is added to the flags of the copy. */
+bool id_copy_inplace_no_main(const ID *id, ID *newid, const int flag = 0)
 {
   const ID *id_for_copy = id;
 
@@ -288,8 +292,10 @@ bool id_copy_inplace_no_main(const ID *id, ID *newid)
   id_for_copy = nested_id_hack_get_discarded_pointers(&id_hack_storage, id);
 #endif
 
-  bool result = BKE_id_copy_ex(
-      nullptr, (ID *)id_for_copy, &newid, (LIB_ID_COPY_LOCALIZE | LIB_ID_CREATE_NO_ALLOCATE));
+  bool result = BKE_id_copy_ex(nullptr,
+                               (ID *)id_for_copy,
+                               &newid,
+                               (LIB_ID_COPY_LOCALIZE | LIB_ID_CREATE_NO_ALLOCATE | flag));
 
 #ifdef NESTED_ID_NASTY_WORKAROUND
   if (result) {
@@ -862,8 +868,6 @@ ID *deg_expand_copy_on_write_datablock(const Depsgraph *depsgraph,
   }
   // BLI_assert(check_datablock_expanded(id_cow) == false);
   /* Copy data from original ID to a copied version. */
-  /* TODO(sergey): Avoid doing full ID copy somehow, make Mesh to reference
-   * original geometry arrays for until those are modified. */
   /* TODO(sergey): We do some trickery with temp bmain and extra ID pointer
    * just to be able to use existing API. Ideally we need to replace this with
    * in-place copy from existing datablock to a prepared memory.
@@ -887,8 +891,13 @@ ID *deg_expand_copy_on_write_datablock(const Depsgraph *depsgraph,
       break;
     }
     case ID_ME: {
-      /* TODO(sergey): Ideally we want to handle meshes in a special
-       * manner here to avoid initial copy of all the geometry arrays. */
+      /* Share the geometry arrays of the original mesh, which keeps owning them. They are only
+       * duplicated when either of the meshes modifies them through CustomData. Render pipeline
+       * graphs are evaluated from a job while the original can be edited, they keep a full
+       * copy. */
+      if (!depsgraph->is_render_pipeline_depsgraph) {
+        done = id_copy_inplace_no_main(id_orig, id_cow, LIB_ID_COPY_CD_SHARED);
+      }
       break;
     }
     default:
@@ -938,7 +947,20 @@ ID *deg_expand_copy_on_write_datablock(const Depsgraph *depsgraph,
   return deg_expand_copy_on_write_datablock(depsgraph, id_node, node_builder, create_placeholders);
 }
 
-ID *deg_update_copy_on_write_datablock(const Depsgraph *depsgraph, const IDNode *id_node)
+namespace {
+
+uint64_t copy_on_write_stats_time_since(double *time)
+{
+  const double start_time = *time;
+  *time = PIL_check_seconds_timer();
+  return (uint64_t)((*time - start_time) * 1e9);
+}
+
+}  // namespace
+
+ID *deg_update_copy_on_write_datablock(const Depsgraph *depsgraph,
+                                       const IDNode *id_node,
+                                       CopyOnWriteStats *stats)
 {
   const ID *id_orig = id_node->id_orig;
   ID *id_cow = id_node->id_cow;
@@ -946,11 +968,23 @@ ID *deg_update_copy_on_write_datablock(const Depsgraph *depsgraph, const IDNode
   if (!deg_copy_on_write_is_needed(id_orig)) {
     return id_cow;
   }
+  /* Time every stage when gathering stats. */
+  double time = (stats != nullptr) ? PIL_check_seconds_timer() : 0.0;
   RuntimeBackup backup(depsgraph);
   backup.init_from_id(id_cow);
+  if (stats != nullptr) {
+    atomic_add_and_fetch_uint64(&stats->backup_time, copy_on_write_stats_time_since(&time));
+  }
   deg_free_copy_on_write_datablock(id_cow);
   deg_expand_copy_on_write_datablock(depsgraph, id_node);
+  if (stats != nullptr) {
+    atomic_add_and_fetch_uint64(&stats->copy_time, copy_on_write_stats_time_since(&time));
+  }
   backup.restore_to_id(id_cow);
+  if (stats != nullptr) {
+    atomic_add_and_fetch_uint64(&stats->restore_time, copy_on_write_stats_time_since(&time));
+    atomic_add_and_fetch_uint64(&stats->num_updates, 1);
+  }
   return id_cow;
 }
 
@@ -1077,14 +1111,16 @@ void deg_free_copy_on_write_datablock(ID *id_cow)
 
 void deg_evaluate_copy_on_write(struct ::Depsgraph *graph, const IDNode *id_node)
 {
-  const DEG::Depsgraph *depsgraph = reinterpret_cast<const DEG::Depsgraph *>(graph);
+  DEG::Depsgraph *depsgraph = reinterpret_cast<DEG::Depsgraph *>(graph);
   DEG_debug_print_eval(graph, __func__, id_node->id_orig->name, id_node->id_cow);
   if (id_node->id_orig == &depsgraph->scene->id) {
     /* NOTE: This is handled by eval_ctx setup routines, which
      * ensures scene and view layer pointers are valid. */
     return;
   }
-  deg_update_copy_on_write_datablock(depsgraph, id_node);
+  CopyOnWriteStats *stats = depsgraph->debug.do_time_debug() ? &depsgraph->copy_on_write_stats :
+                                                                nullptr;
+  deg_update_copy_on_write_datablock(depsgraph, id_node, stats);
 }
 
 bool deg_validate_copy_on_write_datablock(ID *id_cow)
@@ -45,6 +45,7 @@ struct Depsgraph;
 
 namespace DEG {
 
+struct CopyOnWriteStats;
 struct Depsgraph;
 class DepsgraphNodeBuilder;
 struct IDNode;
@@ -63,8 +64,12 @@ ID *deg_expand_copy_on_write_datablock(const struct Depsgraph *depsgraph,
 
 /* Makes sure given CoW data-block is brought back to state of the original
  * data-block.
+ *
+ * Time spent in the update is added to the given stats, when they are not null.
  */
-ID *deg_update_copy_on_write_datablock(const struct Depsgraph *depsgraph, const IDNode *id_node);
+ID *deg_update_copy_on_write_datablock(const struct Depsgraph *depsgraph,
+                                       const IDNode *id_node,
+                                       CopyOnWriteStats *stats = nullptr);
 ID *deg_update_copy_on_write_datablock(const struct Depsgraph *depsgraph, struct ID *id_orig);
 
 /* Helper function which frees memory used by copy-on-written databnlock. */
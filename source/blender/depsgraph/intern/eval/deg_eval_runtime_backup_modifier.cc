@@ -35,15 +35,9 @@ ModifierDataBackupID::ModifierDataBackupID(ModifierData *modifier_data, Modifier
 {
 }
 
-bool ModifierDataBackupID::operator<(const ModifierDataBackupID &other) const
+bool ModifierDataBackupID::operator==(const ModifierDataBackupID &other) const
 {
-  if (modifier_data < other.modifier_data) {
-    return true;
-  }
-  if (modifier_data == other.modifier_data) {
-    return static_cast<int>(type) < static_cast<int>(other.type);
-  }
-  return false;
+  return modifier_data == other.modifier_data && type == other.type;
 }
 
 }  // namespace DEG
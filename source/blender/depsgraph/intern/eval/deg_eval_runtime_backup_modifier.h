@@ -46,13 +46,15 @@ class ModifierDataBackupID {
   ModifierDataBackupID(const Depsgraph *depsgraph);
   ModifierDataBackupID(ModifierData *modifier_data, ModifierType type);
 
-  bool operator<(const ModifierDataBackupID &other) const;
+  bool operator==(const ModifierDataBackupID &other) const;
 
   ModifierData *modifier_data;
   ModifierType type;
 };
 
-/* Storage for backed up runtime modifier data. */
-typedef map<ModifierDataBackupID, void *> ModifierRuntimeDataBackup;
+/* Storage for backed up runtime modifier data.
+ * Stored in the order of the modifier stack, so restoring it to an unchanged stack is a single
+ * pass over both, without any lookups. */
+typedef vector<pair<ModifierDataBackupID, void *>> ModifierRuntimeDataBackup;
 
 }  // namespace DEG
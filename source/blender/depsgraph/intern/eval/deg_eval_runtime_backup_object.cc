@@ -69,13 +69,14 @@ inline ModifierDataBackupID create_modifier_data_id(const ModifierData *modifier
 
 void ObjectRuntimeBackup::backup_modifier_runtime_data(Object *object)
 {
+  modifier_runtime_data.reserve(BLI_listbase_count(&object->modifiers));
   LISTBASE_FOREACH (ModifierData *, modifier_data, &object->modifiers) {
     if (modifier_data->runtime == nullptr) {
       continue;
     }
     BLI_assert(modifier_data->orig_modifier_data != nullptr);
     ModifierDataBackupID modifier_data_id = create_modifier_data_id(modifier_data);
-    modifier_runtime_data.insert(make_pair(modifier_data_id, modifier_data->runtime));
+    modifier_runtime_data.push_back(make_pair(modifier_data_id, modifier_data->runtime));
     modifier_data->runtime = nullptr;
   }
 }
@@ -83,10 +84,11 @@ void ObjectRuntimeBackup::backup_modifier_runtime_data(Object *object)
 void ObjectRuntimeBackup::backup_pose_channel_runtime_data(Object *object)
 {
   if (object->pose != nullptr) {
+    pose_channel_runtime_data.reserve(BLI_listbase_count(&object->pose->chanbase));
     LISTBASE_FOREACH (bPoseChannel *, pchan, &object->pose->chanbase) {
       /* This is nullptr in Edit mode. */
       if (pchan->orig_pchan != nullptr) {
-        pose_channel_runtime_data[pchan->orig_pchan] = pchan->runtime;
+        pose_channel_runtime_data.push_back(make_pair(pchan->orig_pchan, pchan->runtime));
         BKE_pose_channel_runtime_reset(&pchan->runtime);
       }
     }
@@ -148,19 +150,36 @@ void ObjectRuntimeBackup::restore_to_object(Object *object)
   restore_pose_channel_runtime_data(object);
 }
 
+/* Find index of the backup entry with the given key. The backup is stored in the same order as
+ * the restored list, so the entry following the previously restored one is checked first, and
+ * the whole backup is only searched when the list changed since the backup was made. */
+template<typename BackupType, typename KeyType>
+static int find_backup_index(const BackupType &backup, const KeyType &key, const int start_index)
+{
+  const int size = backup.size();
+  for (int i = 0; i < size; i++) {
+    const int index = (start_index + i) % size;
+    if (backup[index].first == key) {
+      return index;
+    }
+  }
+  return -1;
+}
+
 void ObjectRuntimeBackup::restore_modifier_runtime_data(Object *object)
 {
+  int start_index = 0;
   LISTBASE_FOREACH (ModifierData *, modifier_data, &object->modifiers) {
     BLI_assert(modifier_data->orig_modifier_data != nullptr);
     ModifierDataBackupID modifier_data_id = create_modifier_data_id(modifier_data);
-    ModifierRuntimeDataBackup::iterator runtime_data_iterator = modifier_runtime_data.find(
-        modifier_data_id);
-    if (runtime_data_iterator != modifier_runtime_data.end()) {
-      modifier_data->runtime = runtime_data_iterator->second;
-      runtime_data_iterator->second = nullptr;
+    const int index = find_backup_index(modifier_runtime_data, modifier_data_id, start_index);
+    if (index != -1) {
+      modifier_data->runtime = modifier_runtime_data[index].second;
+      modifier_runtime_data[index].second = nullptr;
+      start_index = index + 1;
     }
   }
-  for (ModifierRuntimeDataBackup::value_type value : modifier_runtime_data) {
+  for (ModifierRuntimeDataBackup::value_type &value : modifier_runtime_data) {
     const ModifierDataBackupID modifier_data_id = value.first;
     void *runtime = value.second;
     if (value.second == nullptr) {
@@ -175,19 +194,25 @@ void ObjectRuntimeBackup::restore_modifier_runtime_data(Object *object)
 void ObjectRuntimeBackup::restore_pose_channel_runtime_data(Object *object)
 {
   if (object->pose != nullptr) {
+    int start_index = 0;
     LISTBASE_FOREACH (bPoseChannel *, pchan, &object->pose->chanbase) {
       /* This is nullptr in Edit mode. */
       if (pchan->orig_pchan != nullptr) {
-        PoseChannelRuntimeDataBackup::iterator runtime_data_iterator =
-            pose_channel_runtime_data.find(pchan->orig_pchan);
-        if (runtime_data_iterator != pose_channel_runtime_data.end()) {
-          pchan->runtime = runtime_data_iterator->second;
-          pose_channel_runtime_data.erase(runtime_data_iterator);
+        const int index = find_backup_index(
+            pose_channel_runtime_data, pchan->orig_pchan, start_index);
+        if (index != -1) {
+          pchan->runtime = pose_channel_runtime_data[index].second;
+          /* Mark the entry as restored, so it is neither found nor freed again. */
+          pose_channel_runtime_data[index].first = nullptr;
+          start_index = index + 1;
         }
       }
     }
   }
   for (PoseChannelRuntimeDataBackup::value_type &value : pose_channel_runtime_data) {
+    if (value.first == nullptr) {
+      continue;
+    }
     BKE_pose_channel_runtime_free(&value.second);
   }
 }
@@ -31,7 +31,7 @@ struct bPoseChannel;
 
 namespace DEG {
 
-/* Storage for backed up pose channel runtime data. */
-typedef map<bPoseChannel *, bPoseChannel_Runtime> PoseChannelRuntimeDataBackup;
+/* Storage for backed up pose channel runtime data, in the order of the pose channels. */
+typedef vector<pair<bPoseChannel *, bPoseChannel_Runtime>> PoseChannelRuntimeDataBackup;
 
 }  // namespace DEG
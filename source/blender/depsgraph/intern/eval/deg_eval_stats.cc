@@ -23,10 +23,14 @@
 
 #include "intern/eval/deg_eval_stats.h"
 
+#include <cstdio>
+
 #include "BLI_ghash.h"
+#include "BLI_math_base.h"
 #include "BLI_utildefines.h"
 
 #include "intern/depsgraph.h"
+#include "intern/depsgraph_relation.h"
 
 #include "intern/node/deg_node.h"
 #include "intern/node/deg_node_component.h"
@@ -35,6 +39,19 @@
 
 namespace DEG {
 
+CopyOnWriteStats::CopyOnWriteStats()
+{
+  reset();
+}
+
+void CopyOnWriteStats::reset()
+{
+  num_updates = 0;
+  backup_time = 0;
+  restore_time = 0;
+  copy_time = 0;
+}
+
 void deg_eval_stats_aggregate(Depsgraph *graph)
 {
   /* Reset current evaluation stats for ID and component nodes.
@@ -56,4 +73,144 @@ void deg_eval_stats_aggregate(Depsgraph *graph)
   }
 }
 
+namespace {
+
+/* Overhead of scheduling an operation, so operations which were not timed yet still make
+ * longer chains more important. */
+const double OPERATION_SCHEDULE_COST = 1e-6;
+
+/* Change of an average timing since the priorities were calculated, relative to the cost used
+ * for them, which makes them outdated. Smaller changes in seconds are ignored. */
+const double PRIORITY_COST_CHANGE_FACTOR = 0.25;
+const double PRIORITY_COST_CHANGE_MIN = 1e-4;
+
+double operation_cost(const OperationNode *op_node)
+{
+  if (op_node->is_noop()) {
+    return 0.0;
+  }
+  return op_node->stats.average_time + OPERATION_SCHEDULE_COST;
+}
+
+}  // namespace
+
+void deg_eval_stats_update_averages(Depsgraph *graph)
+{
+  for (OperationNode *op_node : graph->operations) {
+    if (op_node->scheduled && !op_node->is_noop()) {
+      op_node->stats.add_current_to_average();
+      const double cost_change = fabs(operation_cost(op_node) - op_node->priority_cost);
+      if (cost_change > max_dd(op_node->priority_cost * PRIORITY_COST_CHANGE_FACTOR,
+                               PRIORITY_COST_CHANGE_MIN)) {
+        graph->need_update_priorities = true;
+      }
+    }
+  }
+}
+
+namespace {
+
+bool is_cyclic_or_to_non_operation(const Relation *rel)
+{
+  return (rel->flag & RELATION_FLAG_CYCLIC) || rel->to->type != NodeType::OPERATION ||
+         rel->from->type != NodeType::OPERATION;
+}
+
+/* Set priority of every operation to its cost plus the highest priority of its children, in
+ * reverse topological order. Relations of dependency cycles are ignored.
+ *
+ * Returns the highest priority, which is the length of the critical path. */
+template<typename CostFunction>
+double calculate_bottom_levels(Depsgraph *graph, const CostFunction &cost_function)
+{
+  vector<OperationNode *> ready;
+  for (OperationNode *op_node : graph->operations) {
+    op_node->custom_flags = 0;
+    for (Relation *rel : op_node->outlinks) {
+      if (!is_cyclic_or_to_non_operation(rel)) {
+        op_node->custom_flags++;
+      }
+    }
+    if (op_node->custom_flags == 0) {
+      ready.push_back(op_node);
+    }
+  }
+
+  double critical_path = 0.0;
+  while (!ready.empty()) {
+    OperationNode *op_node = ready.back();
+    ready.pop_back();
+
+    double children_priority = 0.0;
+    for (Relation *rel : op_node->outlinks) {
+      if (!is_cyclic_or_to_non_operation(rel)) {
+        children_priority = max_dd(children_priority, ((OperationNode *)rel->to)->priority);
+      }
+    }
+    op_node->priority = cost_function(op_node) + children_priority;
+    critical_path = max_dd(critical_path, op_node->priority);
+
+    for (Relation *rel : op_node->inlinks) {
+      if (!is_cyclic_or_to_non_operation(rel)) {
+        OperationNode *parent = (OperationNode *)rel->from;
+        if (--parent->custom_flags == 0) {
+          ready.push_back(parent);
+        }
+      }
+    }
+  }
+  return critical_path;
+}
+
+}  // namespace
+
+void deg_eval_stats_calculate_priorities(Depsgraph *graph)
+{
+  if (!graph->need_update_priorities) {
+    return;
+  }
+  /* All operations are counted, not only the ones tagged for update, so the priorities stay
+   * valid for the following evaluations. */
+  calculate_bottom_levels(graph, [](OperationNode *op_node) {
+    op_node->priority_cost = operation_cost(op_node);
+    return op_node->priority_cost;
+  });
+  graph->need_update_priorities = false;
+}
+
+void deg_eval_stats_print_schedule(Depsgraph *graph, double makespan, int num_threads)
+{
+  double total_time = 0.0;
+  for (OperationNode *op_node : graph->operations) {
+    total_time += op_node->stats.current_time;
+  }
+  /* Overwrites priorities, they are calculated again for the next evaluation. */
+  const double critical_path = calculate_bottom_levels(
+      graph, [](const OperationNode *op_node) { return op_node->stats.current_time; });
+  graph->need_update_priorities = true;
+  const double lower_bound = max_dd(critical_path, total_time / num_threads);
+
+  printf("Depsgraph schedule: makespan %f, critical path %f, work %f over %d threads\n",
+         makespan,
+         critical_path,
+         total_time,
+         num_threads);
+  printf("Depsgraph schedule: %.1f%% of the lower bound %f\n",
+         (lower_bound > 0.0) ? makespan / lower_bound * 100.0 : 100.0,
+         lower_bound);
+}
+
+void deg_eval_stats_print_copy_on_write(Depsgraph *graph)
+{
+  const CopyOnWriteStats &stats = graph->copy_on_write_stats;
+  if (stats.num_updates == 0) {
+    return;
+  }
+  printf("Depsgraph copy-on-write: %d updates, backup %f, copy %f, restore %f\n",
+         (int)stats.num_updates,
+         stats.backup_time * 1e-9,
+         stats.copy_time * 1e-9,
+         stats.restore_time * 1e-9);
+}
+
 }  // namespace DEG
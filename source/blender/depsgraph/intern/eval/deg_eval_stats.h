@@ -23,11 +23,43 @@
 
 #pragma once
 
+#include "BLI_sys_types.h"
+
 namespace DEG {
 
 struct Depsgraph;
 
+/* Time spent in copy-on-write updates of an evaluation, summed over all updated IDs.
+ * Updates run from multiple threads, so times are added atomically, in nanoseconds. */
+struct CopyOnWriteStats {
+  CopyOnWriteStats();
+
+  void reset();
+
+  uint64_t num_updates;
+  /* Backup of the runtime data of the evaluated ID, and its restore after the copy. */
+  uint64_t backup_time;
+  uint64_t restore_time;
+  /* Freeing the evaluated ID and copying the original into it again. */
+  uint64_t copy_time;
+};
+
 /* Aggregate operation timings to overall component and ID nodes timing. */
 void deg_eval_stats_aggregate(Depsgraph *graph);
 
+/* Add the operation timings of the evaluation to their averages, tagging the priorities for
+ * update when an average changed notably since they were calculated. */
+void deg_eval_stats_update_averages(Depsgraph *graph);
+
+/* Calculate scheduling priority of the operations from their average timings, when tagged for
+ * update by a relations update or by changed timings. Does nothing otherwise. */
+void deg_eval_stats_calculate_priorities(Depsgraph *graph);
+
+/* Print the time the evaluation took compared to the lower bound given by the critical path
+ * and the total work divided over all threads, using the operation timings of the evaluation. */
+void deg_eval_stats_print_schedule(Depsgraph *graph, double makespan, int num_threads);
+
+/* Print the time copy-on-write updates of the evaluation spent in each of their stages. */
+void deg_eval_stats_print_copy_on_write(Depsgraph *graph);
+
 }  // namespace DEG
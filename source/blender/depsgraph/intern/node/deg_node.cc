@@ -274,6 +274,7 @@ Node::Stats::Stats()
 void Node::Stats::reset()
 {
   current_time = 0.0;
+  average_time = 0.0;
 }
 
 void Node::Stats::reset_current()
@@ -281,6 +282,17 @@ void Node::Stats::reset_current()
   current_time = 0.0;
 }
 
+void Node::Stats::add_current_to_average()
+{
+  /* Weight recent evaluations more, so the average follows changes in the scene. */
+  if (average_time == 0.0) {
+    average_time = current_time;
+  }
+  else {
+    average_time += (current_time - average_time) * 0.25;
+  }
+}
+
 /*******************************************************************************
  * Node itself.
  */
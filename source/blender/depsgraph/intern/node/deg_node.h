@@ -156,8 +156,13 @@ struct Node {
     /* Reset counters needed for the current graph evaluation, does not
      * touch averaging accumulators. */
     void reset_current();
+    /* Accumulate time of the current graph evaluation into the average. */
+    void add_current_to_average();
     /* Time spend on this node during current graph evaluation. */
     double current_time;
+    /* Moving average of the time spent on this node over graph evaluations, zero until it was
+     * evaluated at least once. */
+    double average_time;
   };
   /* Relationships between nodes
    * The reason why all depsgraph nodes are descended from this type (apart
@@ -172,6 +172,11 @@ void IDNode::destroy()
   id_orig = nullptr;
 }
 
+void IDNode::clear_components()
+{
+  BLI_ghash_clear(components, id_deps_node_hash_key_free, id_deps_node_hash_value_free);
+}
+
 string IDNode::identifier() const
 {
   char orig_ptr[24], cow_ptr[24];
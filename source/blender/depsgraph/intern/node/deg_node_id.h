@@ -66,6 +66,8 @@ struct IDNode : public Node {
 
   ComponentNode *find_component(NodeType type, const char *name = "") const;
   ComponentNode *add_component(NodeType type, const char *name = "");
+  /* Free all components and their operations, keeping the copy-on-write datablock. */
+  void clear_components();
 
   virtual void tag_update(Depsgraph *graph, eUpdateSource source) override;
 
@@ -258,6 +258,13 @@ struct OperationNode : public Node {
   uint32_t num_links_pending;
   bool scheduled;
 
+  /* Estimated time in seconds from the start of this operation until all operations depending on
+   * it are evaluated (bottom level). Ready operations with the longest path are evaluated first,
+   * see deg_eval_stats_calculate_priorities(). */
+  double priority;
+  /* Cost of this operation used for the priorities. */
+  double priority_cost;
+
   /* Identifier for the operation being performed. */
   OperationCode opcode;
   int name_tag;
@@ -38,6 +38,7 @@ struct BMLoop;
 struct BMVert;
 struct BMesh;
 struct Base;
+struct CustomData_MeshMasks;
 struct Depsgraph;
 struct ID;
 struct MDeformVert;
@@ -156,6 +157,8 @@ void EDBM_automerge_and_split(struct Object *ob,
 
 /* editmesh_undo.c */
 void ED_mesh_undosys_type(struct UndoType *ut);
+void EDBM_undo_tag_cd_dirty(struct BMEditMesh *em, const struct CustomData_MeshMasks *cd_mask);
+void EDBM_undo_tag_select(struct BMEditMesh *em);
 
 /* editmesh_select.c */
 void EDBM_select_mirrored(struct BMEditMesh *em,
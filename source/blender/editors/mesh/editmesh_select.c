@@ -1895,6 +1895,7 @@ static int edbm_select_all_exec(bContext *C, wmOperator *op)
         EDBM_selectmode_flush(em);
         break;
     }
+    EDBM_undo_tag_select(em);
     DEG_id_tag_update(obedit->data, ID_RECALC_SELECT);
     WM_event_add_notifier(C, NC_GEOM | ND_SELECT, obedit->data);
   }
@@ -2002,7 +2003,9 @@ bool EDBM_select_pick(bContext *C, const int mval[2], bool extend, bool deselect
       for (uint base_index = 0; base_index < bases_len; base_index++) {
         Base *base_iter = bases[base_index];
         Object *ob_iter = base_iter->object;
-        EDBM_flag_disable_all(BKE_editmesh_from_object(ob_iter), BM_ELEM_SELECT);
+        BMEditMesh *em_iter = BKE_editmesh_from_object(ob_iter);
+        EDBM_flag_disable_all(em_iter, BM_ELEM_SELECT);
+        EDBM_undo_tag_select(em_iter);
         if (basact->object != ob_iter) {
           DEG_id_tag_update(ob_iter->data, ID_RECALC_SELECT);
           WM_event_add_notifier(C, NC_GEOM | ND_SELECT, ob_iter->data);
@@ -2090,6 +2093,7 @@ bool EDBM_select_pick(bContext *C, const int mval[2], bool extend, bool deselect
     }
 
     EDBM_selectmode_flush(vc.em);
+    EDBM_undo_tag_select(vc.em);
 
     if (efa) {
       /* Change active material on object. */
@@ -30,6 +30,7 @@
 
 #include "BLI_array_utils.h"
 #include "BLI_listbase.h"
+#include "BLI_task.h"
 
 #include "BKE_context.h"
 #include "BKE_editmesh.h"
@@ -49,6 +50,8 @@
 #include "WM_api.h"
 #include "WM_types.h"
 
+#include "atomic_ops.h"
+
 #define USE_ARRAY_STORE
 
 #ifdef USE_ARRAY_STORE
@@ -60,16 +63,13 @@
 
 #  include "BLI_array_store.h"
 #  include "BLI_array_store_utils.h"
+#  include "BLI_memarena.h"
 /* check on best size later... */
 #  define ARRAY_CHUNK_SIZE 256
 
 #  define USE_ARRAY_STORE_THREAD
 #endif
 
-#ifdef USE_ARRAY_STORE_THREAD
-#  include "BLI_task.h"
-#endif
-
 /** We only need this locally. */
 static CLG_LogRef LOG = {"ed.undo.mesh"};
 
@@ -103,6 +103,9 @@ typedef struct UndoMesh {
    * object and editmode operations - Campbell. */
   int shapenr;
 
+  /** Unique for the session, referenced by #BMEditMesh.undo_mesh_ref_uuid (never zero). */
+  uint session_uuid;
+
 #ifdef USE_ARRAY_STORE
   /* NULL arrays are considered empty */
   struct { /* most data is stored as 'custom' data */
@@ -120,8 +123,23 @@ typedef struct UndoMesh {
 /** \name Array Store
  * \{ */
 
+/**
+ * Arrays from each domain are added to their own stores so they can be compacted in parallel,
+ * since a #BArrayStore may only be used by one thread at a time.
+ * Little is lost by this as arrays from different domains rarely share any contents.
+ */
+enum {
+  UM_ARRAYSTORE_VDATA = 0,
+  UM_ARRAYSTORE_EDATA,
+  UM_ARRAYSTORE_LDATA,
+  UM_ARRAYSTORE_PDATA,
+  UM_ARRAYSTORE_KEYBLOCKS,
+  UM_ARRAYSTORE_MSELECT,
+};
+#  define UM_ARRAYSTORE_DOMAIN_NUM 6
+
 static struct {
-  struct BArrayStore_AtSize bs_stride;
+  struct BArrayStore_AtSize bs_stride[UM_ARRAYSTORE_DOMAIN_NUM];
   int users;
 
   /* We could have the undo API pass in the previous state, for now store a local list */
@@ -131,14 +149,135 @@ static struct {
   TaskPool *task_pool;
 #  endif
 
-} um_arraystore = {{NULL}};
+} um_arraystore = {{{NULL}}};
+
+/**
+ * An array to add to a store.
+ */
+typedef struct UMArrayStoreTask {
+  struct UMArrayStoreTask *next;
+  const void *data;
+  size_t data_len;
+  const BArrayState *state_reference;
+  /** The data is known to be unchanged since `state_reference`, share it without comparing. */
+  bool use_state_reference_as_is;
+  BArrayState **r_state;
+} UMArrayStoreTask;
+
+/**
+ * All arrays to add to a single store, these are added in order from a single thread.
+ */
+typedef struct UMArrayStoreQueue {
+  struct UMArrayStoreQueue *next;
+  BArrayStore *bs;
+  UMArrayStoreTask *task_first, *task_last;
+} UMArrayStoreQueue;
+
+typedef struct UMArrayStoreTasks {
+  MemArena *arena;
+  UMArrayStoreQueue *queue_first;
+  int queue_len;
+} UMArrayStoreTasks;
+
+static void um_arraystore_task_add(UMArrayStoreTasks *tasks,
+                                   BArrayStore *bs,
+                                   const void *data,
+                                   const size_t data_len,
+                                   const BArrayState *state_reference,
+                                   const bool use_state_reference_as_is,
+                                   BArrayState **r_state)
+{
+  UMArrayStoreQueue *queue = tasks->queue_first;
+  while (queue && (queue->bs != bs)) {
+    queue = queue->next;
+  }
+  if (queue == NULL) {
+    queue = BLI_memarena_calloc(tasks->arena, sizeof(*queue));
+    queue->bs = bs;
+    queue->next = tasks->queue_first;
+    tasks->queue_first = queue;
+    tasks->queue_len += 1;
+  }
+
+  UMArrayStoreTask *task = BLI_memarena_alloc(tasks->arena, sizeof(*task));
+  task->next = NULL;
+  task->data = data;
+  task->data_len = data_len;
+  task->state_reference = state_reference;
+  task->use_state_reference_as_is = use_state_reference_as_is;
+  task->r_state = r_state;
+
+  if (queue->task_last) {
+    queue->task_last->next = task;
+  }
+  else {
+    queue->task_first = task;
+  }
+  queue->task_last = task;
+}
+
+static void um_arraystore_queue_run(UMArrayStoreQueue *queue)
+{
+  for (UMArrayStoreTask *task = queue->task_first; task; task = task->next) {
+    if (task->use_state_reference_as_is) {
+      *task->r_state = BLI_array_store_state_add_shared(queue->bs, task->state_reference);
+    }
+    else {
+      *task->r_state = BLI_array_store_state_add(
+          queue->bs, task->data, task->data_len, task->state_reference);
+    }
+  }
+}
+
+#  ifdef USE_ARRAY_STORE_THREAD
+static void um_arraystore_queue_run_cb(void *__restrict userdata,
+                                       const int iter,
+                                       const TaskParallelTLS *__restrict UNUSED(tls))
+{
+  UMArrayStoreQueue **queues = userdata;
+  um_arraystore_queue_run(queues[iter]);
+}
+#  endif
+
+/**
+ * Add all arrays, stores are filled in parallel.
+ */
+static void um_arraystore_tasks_run(UMArrayStoreTasks *tasks)
+{
+#  ifdef USE_ARRAY_STORE_THREAD
+  UMArrayStoreQueue **queues = MEM_mallocN(sizeof(*queues) * tasks->queue_len, __func__);
+  int i = 0;
+  for (UMArrayStoreQueue *queue = tasks->queue_first; queue; queue = queue->next) {
+    queues[i++] = queue;
+  }
+
+  TaskParallelSettings settings;
+  BLI_parallel_range_settings_defaults(&settings);
+  settings.use_threading = (tasks->queue_len > 1);
+  settings.min_iter_per_thread = 1;
+  BLI_task_parallel_range(0, tasks->queue_len, queues, um_arraystore_queue_run_cb, &settings);
 
+  MEM_freeN(queues);
+#  else
+  for (UMArrayStoreQueue *queue = tasks->queue_first; queue; queue = queue->next) {
+    um_arraystore_queue_run(queue);
+  }
+#  endif
+}
+
+/**
+ * \param cd_mask_dirty: Layers outside this mask are unchanged since \a bcd_reference.
+ * \param tasks: Arrays to add to the stores are queued here, when NULL the arrays are freed.
+ */
 static void um_arraystore_cd_compact(struct CustomData *cdata,
                                      const size_t data_len,
-                                     bool create,
+                                     const int domain,
+                                     const CustomDataMask cd_mask_dirty,
                                      const BArrayCustomData *bcd_reference,
-                                     BArrayCustomData **r_bcd_first)
+                                     BArrayCustomData **r_bcd_first,
+                                     UMArrayStoreTasks *tasks)
 {
+  const bool create = (tasks != NULL);
   if (data_len == 0) {
     if (create) {
       *r_bcd_first = NULL;
@@ -157,13 +296,16 @@ static void um_arraystore_cd_compact(struct CustomData *cdata,
 
     const int stride = CustomData_sizeof(type);
     BArrayStore *bs = create ? BLI_array_store_at_size_ensure(
-                                   &um_arraystore.bs_stride, stride, ARRAY_CHUNK_SIZE) :
+                                   &um_arraystore.bs_stride[domain], stride, ARRAY_CHUNK_SIZE) :
                                NULL;
     const int layer_len = layer_end - layer_start;
+    bool is_layer_clean = false;
 
     if (create) {
       if (bcd_reference_current && (bcd_reference_current->type == type)) {
         /* common case, the reference is aligned */
+        is_layer_clean = ((cd_mask_dirty & CD_TYPE_AS_MASK(type)) == 0) &&
+                         (bcd_reference_current->states_len == layer_len);
       }
       else {
         bcd_reference_current = NULL;
@@ -206,15 +348,17 @@ static void um_arraystore_cd_compact(struct CustomData *cdata,
                                           i < bcd_reference_current->states_len) ?
                                              bcd_reference_current->states[i] :
                                              NULL;
-          bcd->states[i] = BLI_array_store_state_add(
-              bs, layer->data, (size_t)data_len * stride, state_reference);
+          const size_t state_len = (size_t)data_len * stride;
+          const bool is_clean = is_layer_clean && state_reference &&
+                                (BLI_array_store_state_size_get(state_reference) == state_len);
+          um_arraystore_task_add(
+              tasks, bs, layer->data, state_len, state_reference, is_clean, &bcd->states[i]);
         }
         else {
           bcd->states[i] = NULL;
         }
       }
-
-      if (layer->data) {
+      else if (layer->data) {
         MEM_freeN(layer->data);
         layer->data = NULL;
       }
@@ -260,12 +404,12 @@ static void um_arraystore_cd_expand(const BArrayCustomData *bcd,
   }
 }
 
-static void um_arraystore_cd_free(BArrayCustomData *bcd)
+static void um_arraystore_cd_free(BArrayCustomData *bcd, const int domain)
 {
   while (bcd) {
     BArrayCustomData *bcd_next = bcd->next;
     const int stride = CustomData_sizeof(bcd->type);
-    BArrayStore *bs = BLI_array_store_at_size_get(&um_arraystore.bs_stride, stride);
+    BArrayStore *bs = BLI_array_store_at_size_get(&um_arraystore.bs_stride[domain], stride);
     for (int i = 0; i < bcd->states_len; i++) {
       if (bcd->states[i]) {
         BLI_array_store_state_remove(bs, bcd->states[i]);
@@ -277,28 +421,62 @@ static void um_arraystore_cd_free(BArrayCustomData *bcd)
 }
 
 /**
- * \param create: When false, only free the arrays.
+ * \param tasks: When NULL, only free the arrays, otherwise queue them for adding to the stores
+ * (they must be freed once the tasks have run).
  * This is done since when reading from an undo state, they must be temporarily expanded.
  * then discarded afterwards, having this argument avoids having 2x code paths.
+ * \param cd_mask_dirty: Layers which changed since \a um_ref, others are shared as-is.
  */
-static void um_arraystore_compact_ex(UndoMesh *um, const UndoMesh *um_ref, bool create)
+static void um_arraystore_compact_ex(UndoMesh *um,
+                                     const UndoMesh *um_ref,
+                                     const CustomData_MeshMasks *cd_mask_dirty,
+                                     UMArrayStoreTasks *tasks)
 {
   Mesh *me = &um->me;
+  const bool create = (tasks != NULL);
+  const CustomData_MeshMasks cd_mask_all = {~0ULL, ~0ULL, ~0ULL, ~0ULL, ~0ULL};
+  if (cd_mask_dirty == NULL) {
+    cd_mask_dirty = &cd_mask_all;
+  }
 
-  um_arraystore_cd_compact(
-      &me->vdata, me->totvert, create, um_ref ? um_ref->store.vdata : NULL, &um->store.vdata);
-  um_arraystore_cd_compact(
-      &me->edata, me->totedge, create, um_ref ? um_ref->store.edata : NULL, &um->store.edata);
-  um_arraystore_cd_compact(
-      &me->ldata, me->totloop, create, um_ref ? um_ref->store.ldata : NULL, &um->store.ldata);
-  um_arraystore_cd_compact(
-      &me->pdata, me->totpoly, create, um_ref ? um_ref->store.pdata : NULL, &um->store.pdata);
+  um_arraystore_cd_compact(&me->vdata,
+                           me->totvert,
+                           UM_ARRAYSTORE_VDATA,
+                           cd_mask_dirty->vmask,
+                           um_ref ? um_ref->store.vdata : NULL,
+                           &um->store.vdata,
+                           tasks);
+  um_arraystore_cd_compact(&me->edata,
+                           me->totedge,
+                           UM_ARRAYSTORE_EDATA,
+                           cd_mask_dirty->emask,
+                           um_ref ? um_ref->store.edata : NULL,
+                           &um->store.edata,
+                           tasks);
+  um_arraystore_cd_compact(&me->ldata,
+                           me->totloop,
+                           UM_ARRAYSTORE_LDATA,
+                           cd_mask_dirty->lmask,
+                           um_ref ? um_ref->store.ldata : NULL,
+                           &um->store.ldata,
+                           tasks);
+  um_arraystore_cd_compact(&me->pdata,
+                           me->totpoly,
+                           UM_ARRAYSTORE_PDATA,
+                           cd_mask_dirty->pmask,
+                           um_ref ? um_ref->store.pdata : NULL,
+                           &um->store.pdata,
+                           tasks);
 
   if (me->key && me->key->totkey) {
     const size_t stride = me->key->elemsize;
     BArrayStore *bs = create ? BLI_array_store_at_size_ensure(
-                                   &um_arraystore.bs_stride, stride, ARRAY_CHUNK_SIZE) :
+                                   &um_arraystore.bs_stride[UM_ARRAYSTORE_KEYBLOCKS],
+                                   stride,
+                                   ARRAY_CHUNK_SIZE) :
                                NULL;
+    /* Shape keys are stored in their own arrays while in edit-mode. */
+    const bool is_clean = (cd_mask_dirty->vmask & CD_MASK_SHAPEKEY) == 0;
     if (create) {
       um->store.keyblocks = MEM_mallocN(me->key->totkey * sizeof(*um->store.keyblocks), __func__);
     }
@@ -308,11 +486,17 @@ static void um_arraystore_compact_ex(UndoMesh *um, const UndoMesh *um_ref, bool
         BArrayState *state_reference = (um_ref && um_ref->me.key && (i < um_ref->me.key->totkey)) ?
                                            um_ref->store.keyblocks[i] :
                                            NULL;
-        um->store.keyblocks[i] = BLI_array_store_state_add(
-            bs, keyblock->data, (size_t)keyblock->totelem * stride, state_reference);
+        const size_t state_len = (size_t)keyblock->totelem * stride;
+        um_arraystore_task_add(tasks,
+                               bs,
+                               keyblock->data,
+                               state_len,
+                               state_reference,
+                               is_clean && state_reference &&
+                                   (BLI_array_store_state_size_get(state_reference) == state_len),
+                               &um->store.keyblocks[i]);
       }
-
-      if (keyblock->data) {
+      else if (keyblock->data) {
         MEM_freeN(keyblock->data);
         keyblock->data = NULL;
       }
@@ -325,44 +509,99 @@ static void um_arraystore_compact_ex(UndoMesh *um, const UndoMesh *um_ref, bool
       BArrayState *state_reference = um_ref ? um_ref->store.mselect : NULL;
       const size_t stride = sizeof(*me->mselect);
       BArrayStore *bs = BLI_array_store_at_size_ensure(
-          &um_arraystore.bs_stride, stride, ARRAY_CHUNK_SIZE);
-      um->store.mselect = BLI_array_store_state_add(
-          bs, me->mselect, (size_t)me->totselect * stride, state_reference);
+          &um_arraystore.bs_stride[UM_ARRAYSTORE_MSELECT], stride, ARRAY_CHUNK_SIZE);
+      um_arraystore_task_add(tasks,
+                             bs,
+                             me->mselect,
+                             (size_t)me->totselect * stride,
+                             state_reference,
+                             false,
+                             &um->store.mselect);
+    }
+    else {
+      /* keep me->totselect for validation */
+      MEM_freeN(me->mselect);
+      me->mselect = NULL;
     }
-
-    /* keep me->totselect for validation */
-    MEM_freeN(me->mselect);
-    me->mselect = NULL;
   }
 
   if (create) {
     um_arraystore.users += 1;
   }
-
-  BKE_mesh_update_customdata_pointers(me, false);
+  else {
+    BKE_mesh_update_customdata_pointers(me, false);
+  }
 }
 
+/**
+ * The undo meshes of a single undo step, with the information needed to compact them.
+ */
+struct UMArrayData {
+  UndoMesh *um;
+  const UndoMesh *um_ref; /* can be NULL */
+  /** Layers which changed since `um_ref` (only when `use_cd_mask_dirty` is set). */
+  CustomData_MeshMasks cd_mask_dirty;
+  bool use_cd_mask_dirty;
+};
+
+struct UMArrayStepData {
+  uint data_len;
+  struct UMArrayData data[];
+};
+
 /**
  * Move data from allocated arrays to de-duplicated states and clear arrays.
+ *
+ * All arrays of all meshes are collected first, then each store is filled from its own thread.
  */
-static void um_arraystore_compact(UndoMesh *um, const UndoMesh *um_ref)
+static void um_arraystore_compact(struct UMArrayData *data, const uint data_len)
+{
+  UMArrayStoreTasks tasks = {NULL};
+  tasks.arena = BLI_memarena_new(BLI_MEMARENA_STD_BUFSIZE, __func__);
+
+  for (uint i = 0; i < data_len; i++) {
+    um_arraystore_compact_ex(data[i].um,
+                             data[i].um_ref,
+                             data[i].use_cd_mask_dirty ? &data[i].cd_mask_dirty : NULL,
+                             &tasks);
+  }
+
+  um_arraystore_tasks_run(&tasks);
+
+  for (uint i = 0; i < data_len; i++) {
+    um_arraystore_compact_ex(data[i].um, NULL, NULL, NULL);
+  }
+
+  BLI_memarena_free(tasks.arena);
+}
+
+#  ifdef DEBUG_PRINT
+static void um_arraystore_calc_memory_usage(size_t *r_size_expanded, size_t *r_size_compacted)
 {
-  um_arraystore_compact_ex(um, um_ref, true);
+  *r_size_expanded = 0;
+  *r_size_compacted = 0;
+  for (int domain = 0; domain < UM_ARRAYSTORE_DOMAIN_NUM; domain++) {
+    size_t size_expanded, size_compacted;
+    BLI_array_store_at_size_calc_memory_usage(
+        &um_arraystore.bs_stride[domain], &size_expanded, &size_compacted);
+    *r_size_expanded += size_expanded;
+    *r_size_compacted += size_compacted;
+  }
 }
+#  endif
 
-static void um_arraystore_compact_with_info(UndoMesh *um, const UndoMesh *um_ref)
+static void um_arraystore_compact_with_info(struct UMArrayData *data, const uint data_len)
 {
 #  ifdef DEBUG_PRINT
   size_t size_expanded_prev, size_compacted_prev;
-  BLI_array_store_at_size_calc_memory_usage(
-      &um_arraystore.bs_stride, &size_expanded_prev, &size_compacted_prev);
+  um_arraystore_calc_memory_usage(&size_expanded_prev, &size_compacted_prev);
 #  endif
 
 #  ifdef DEBUG_TIME
   TIMEIT_START(mesh_undo_compact);
 #  endif
 
-  um_arraystore_compact(um, um_ref);
+  um_arraystore_compact(data, data_len);
 
 #  ifdef DEBUG_TIME
   TIMEIT_END(mesh_undo_compact);
@@ -371,8 +610,7 @@ static void um_arraystore_compact_with_info(UndoMesh *um, const UndoMesh *um_ref
 #  ifdef DEBUG_PRINT
   {
     size_t size_expanded, size_compacted;
-    BLI_array_store_at_size_calc_memory_usage(
-        &um_arraystore.bs_stride, &size_expanded, &size_compacted);
+    um_arraystore_calc_memory_usage(&size_expanded, &size_compacted);
 
     const double percent_total = size_expanded ?
                                      (((double)size_compacted / (double)size_expanded) * 100.0) :
@@ -393,26 +631,83 @@ static void um_arraystore_compact_with_info(UndoMesh *um, const UndoMesh *um_ref
 
 #  ifdef USE_ARRAY_STORE_THREAD
 
-struct UMArrayData {
-  UndoMesh *um;
-  const UndoMesh *um_ref; /* can be NULL */
-};
 static void um_arraystore_compact_cb(TaskPool *__restrict UNUSED(pool),
                                      void *taskdata,
                                      int UNUSED(threadid))
 {
-  struct UMArrayData *um_data = taskdata;
-  um_arraystore_compact_with_info(um_data->um, um_data->um_ref);
+  struct UMArrayStepData *step_data = taskdata;
+  um_arraystore_compact_with_info(step_data->data, step_data->data_len);
 }
 
 #  endif /* USE_ARRAY_STORE_THREAD */
 
+/**
+ * Compact all undo meshes of an undo step (in the background when threaded).
+ *
+ * \param ems: The edit-meshes the undo meshes were created from, used to find the previous state
+ * of each mesh and the layers which changed since then (see #EDBM_undo_tag_cd_dirty).
+ */
+static void um_arraystore_compact_step(UndoMesh **ums, BMEditMesh **ems, const uint ums_len)
+{
+  struct UMArrayStepData *step_data = MEM_mallocN(
+      sizeof(*step_data) + sizeof(*step_data->data) * ums_len, __func__);
+  step_data->data_len = ums_len;
+
+  /* Used as a reference when there is no previous state of the same mesh. */
+  const UndoMesh *um_last = um_arraystore.local_links.last ?
+                                ((LinkData *)um_arraystore.local_links.last)->data :
+                                NULL;
+
+  for (uint i = 0; i < ums_len; i++) {
+    struct UMArrayData *data = &step_data->data[i];
+    BMEditMesh *em = ems[i];
+
+    const UndoMesh *um_ref = NULL;
+    if (em->undo_mesh_ref_uuid != 0) {
+      LISTBASE_FOREACH (LinkData *, link, &um_arraystore.local_links) {
+        if (((const UndoMesh *)link->data)->session_uuid == em->undo_mesh_ref_uuid) {
+          um_ref = link->data;
+          break;
+        }
+      }
+    }
+
+    data->um = ums[i];
+    data->um_ref = um_ref ? um_ref : um_last;
+    data->use_cd_mask_dirty = (um_ref != NULL) &&
+                              (em->undo_cd_dirty_state == EM_UNDO_CD_DIRTY_MASK);
+    data->cd_mask_dirty = em->undo_cd_dirty_mask;
+
+    /* The edit-mesh now matches the new state. */
+    em->undo_mesh_ref_uuid = ums[i]->session_uuid;
+    em->undo_cd_dirty_state = EM_UNDO_CD_DIRTY_UNKNOWN;
+    memset(&em->undo_cd_dirty_mask, 0, sizeof(em->undo_cd_dirty_mask));
+  }
+
+  /* Add ourselves (after finding the references, which must be from previous steps). */
+  for (uint i = 0; i < ums_len; i++) {
+    BLI_addtail(&um_arraystore.local_links, BLI_genericNodeN(ums[i]));
+  }
+
+#  ifdef USE_ARRAY_STORE_THREAD
+  if (um_arraystore.task_pool == NULL) {
+    TaskScheduler *scheduler = BLI_task_scheduler_get();
+    um_arraystore.task_pool = BLI_task_pool_create_background(scheduler, NULL, TASK_PRIORITY_LOW);
+  }
+
+  BLI_task_pool_push(um_arraystore.task_pool, um_arraystore_compact_cb, step_data, true, NULL);
+#  else
+  um_arraystore_compact_with_info(step_data->data, step_data->data_len);
+  MEM_freeN(step_data);
+#  endif
+}
+
 /**
  * Remove data we only expanded for temporary use.
  */
 static void um_arraystore_expand_clear(UndoMesh *um)
 {
-  um_arraystore_compact_ex(um, NULL, false);
+  um_arraystore_compact_ex(um, NULL, NULL, NULL);
 }
 
 static void um_arraystore_expand(UndoMesh *um)
@@ -453,14 +748,15 @@ static void um_arraystore_free(UndoMesh *um)
 {
   Mesh *me = &um->me;
 
-  um_arraystore_cd_free(um->store.vdata);
-  um_arraystore_cd_free(um->store.edata);
-  um_arraystore_cd_free(um->store.ldata);
-  um_arraystore_cd_free(um->store.pdata);
+  um_arraystore_cd_free(um->store.vdata, UM_ARRAYSTORE_VDATA);
+  um_arraystore_cd_free(um->store.edata, UM_ARRAYSTORE_EDATA);
+  um_arraystore_cd_free(um->store.ldata, UM_ARRAYSTORE_LDATA);
+  um_arraystore_cd_free(um->store.pdata, UM_ARRAYSTORE_PDATA);
 
   if (um->store.keyblocks) {
     const size_t stride = me->key->elemsize;
-    BArrayStore *bs = BLI_array_store_at_size_get(&um_arraystore.bs_stride, stride);
+    BArrayStore *bs = BLI_array_store_at_size_get(
+        &um_arraystore.bs_stride[UM_ARRAYSTORE_KEYBLOCKS], stride);
     for (int i = 0; i < me->key->totkey; i++) {
       BArrayState *state = um->store.keyblocks[i];
       BLI_array_store_state_remove(bs, state);
@@ -471,7 +767,8 @@ static void um_arraystore_free(UndoMesh *um)
 
   if (um->store.mselect) {
     const size_t stride = sizeof(*me->mselect);
-    BArrayStore *bs = BLI_array_store_at_size_get(&um_arraystore.bs_stride, stride);
+    BArrayStore *bs = BLI_array_store_at_size_get(&um_arraystore.bs_stride[UM_ARRAYSTORE_MSELECT],
+                                                  stride);
     BArrayState *state = um->store.mselect;
     BLI_array_store_state_remove(bs, state);
     um->store.mselect = NULL;
@@ -485,7 +782,9 @@ static void um_arraystore_free(UndoMesh *um)
 #  ifdef DEBUG_PRINT
     printf("mesh undo store: freeing all data!\n");
 #  endif
-    BLI_array_store_at_size_clear(&um_arraystore.bs_stride);
+    for (int domain = 0; domain < UM_ARRAYSTORE_DOMAIN_NUM; domain++) {
+      BLI_array_store_at_size_clear(&um_arraystore.bs_stride[domain]);
+    }
 
 #  ifdef USE_ARRAY_STORE_THREAD
     BLI_task_pool_free(um_arraystore.task_pool);
@@ -503,12 +802,6 @@ static void um_arraystore_free(UndoMesh *um)
 static void *undomesh_from_editmesh(UndoMesh *um, BMEditMesh *em, Key *key)
 {
   BLI_assert(BLI_array_is_zeroed(um, 1));
-#ifdef USE_ARRAY_STORE_THREAD
-  /* changes this waits is low, but must have finished */
-  if (um_arraystore.task_pool) {
-    BLI_task_pool_work_and_wait(um_arraystore.task_pool);
-  }
-#endif
   /* make sure shape keys work */
   um->me.key = key ? BKE_key_copy_nolib(key) : NULL;
 
@@ -528,34 +821,12 @@ static void *undomesh_from_editmesh(UndoMesh *um, BMEditMesh *em, Key *key)
   um->selectmode = em->selectmode;
   um->shapenr = em->bm->shapenr;
 
-#ifdef USE_ARRAY_STORE
-  {
-    /* We could be more clever here,
-     * the previous undo state may be from a separate mesh. */
-    const UndoMesh *um_ref = um_arraystore.local_links.last ?
-                                 ((LinkData *)um_arraystore.local_links.last)->data :
-                                 NULL;
-
-    /* add oursrlves */
-    BLI_addtail(&um_arraystore.local_links, BLI_genericNodeN(um));
-
-#  ifdef USE_ARRAY_STORE_THREAD
-    if (um_arraystore.task_pool == NULL) {
-      TaskScheduler *scheduler = BLI_task_scheduler_get();
-      um_arraystore.task_pool = BLI_task_pool_create_background(
-          scheduler, NULL, TASK_PRIORITY_LOW);
-    }
-
-    struct UMArrayData *um_data = MEM_mallocN(sizeof(*um_data), __func__);
-    um_data->um = um;
-    um_data->um_ref = um_ref;
-
-    BLI_task_pool_push(um_arraystore.task_pool, um_arraystore_compact_cb, um_data, true, NULL);
-#  else
-    um_arraystore_compact_with_info(um, um_ref);
-#  endif
+  /* Meshes of multiple objects are converted in parallel, see #mesh_undosys_step_encode. */
+  static uint32_t session_uuid_last = 0;
+  um->session_uuid = atomic_add_and_fetch_uint32(&session_uuid_last, 1);
+  if (UNLIKELY(um->session_uuid == 0)) {
+    um->session_uuid = atomic_add_and_fetch_uint32(&session_uuid_last, 1);
   }
-#endif
 
   return um;
 }
@@ -603,6 +874,9 @@ static void undomesh_to_editmesh(UndoMesh *um, Object *ob, BMEditMesh *em, Key *
   em_tmp = BKE_editmesh_create(bm, true);
   *em = *em_tmp;
 
+  /* Unchanged layers may be shared with this state on the next undo push. */
+  em->undo_mesh_ref_uuid = um->session_uuid;
+
   em->selectmode = um->selectmode;
   bm->selectmode = um->selectmode;
 
@@ -708,6 +982,15 @@ static bool mesh_undosys_poll(bContext *C)
   return editmesh_object_from_context(C) != NULL;
 }
 
+static void mesh_undosys_step_encode_elem_cb(void *__restrict userdata,
+                                             const int iter,
+                                             const TaskParallelTLS *__restrict UNUSED(tls))
+{
+  MeshUndoStep_Elem *elem = &((MeshUndoStep_Elem *)userdata)[iter];
+  Mesh *me = elem->obedit_ref.ptr->data;
+  undomesh_from_editmesh(&elem->data, me->edit_mesh, me->key);
+}
+
 static bool mesh_undosys_step_encode(struct bContext *C, struct Main *bmain, UndoStep *us_p)
 {
   MeshUndoStep *us = (MeshUndoStep *)us_p;
@@ -721,18 +1004,46 @@ static bool mesh_undosys_step_encode(struct bContext *C, struct Main *bmain, Und
   us->elems = MEM_callocN(sizeof(*us->elems) * objects_len, __func__);
   us->elems_len = objects_len;
 
+#ifdef USE_ARRAY_STORE_THREAD
+  /* changes this waits is low, but must have finished */
+  if (um_arraystore.task_pool) {
+    BLI_task_pool_work_and_wait(um_arraystore.task_pool);
+  }
+#endif
+
   for (uint i = 0; i < objects_len; i++) {
-    Object *ob = objects[i];
-    MeshUndoStep_Elem *elem = &us->elems[i];
+    us->elems[i].obedit_ref.ptr = objects[i];
+  }
+  MEM_freeN(objects);
+
+  /* Meshes are converted independently of each other. */
+  TaskParallelSettings settings;
+  BLI_parallel_range_settings_defaults(&settings);
+  settings.use_threading = (objects_len > 1);
+  settings.min_iter_per_thread = 1;
+  BLI_task_parallel_range(0, objects_len, us->elems, mesh_undosys_step_encode_elem_cb, &settings);
+
+#ifdef USE_ARRAY_STORE
+  {
+    UndoMesh **ums = MEM_mallocN(sizeof(*ums) * objects_len, __func__);
+    BMEditMesh **ems = MEM_mallocN(sizeof(*ems) * objects_len, __func__);
+    for (uint i = 0; i < objects_len; i++) {
+      Mesh *me = us->elems[i].obedit_ref.ptr->data;
+      ums[i] = &us->elems[i].data;
+      ems[i] = me->edit_mesh;
+    }
+    um_arraystore_compact_step(ums, ems, objects_len);
+    MEM_freeN(ums);
+    MEM_freeN(ems);
+  }
+#endif
 
-    elem->obedit_ref.ptr = ob;
+  for (uint i = 0; i < objects_len; i++) {
+    MeshUndoStep_Elem *elem = &us->elems[i];
     Mesh *me = elem->obedit_ref.ptr->data;
-    BMEditMesh *em = me->edit_mesh;
-    undomesh_from_editmesh(&elem->data, me->edit_mesh, me->key);
-    em->needs_flush_to_id = 1;
+    me->edit_mesh->needs_flush_to_id = 1;
     us->step.data_size += elem->data.undo_size;
   }
-  MEM_freeN(objects);
 
   bmain->is_memfile_undo_flush_needed = true;
 
@@ -820,3 +1131,39 @@ void ED_mesh_undosys_type(UndoType *ut)
 }
 
 /** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name Dirty Layer Tagging
+ * \{ */
+
+/**
+ * Tag custom-data layers as changed since the last undo push.
+ *
+ * When all changes are tagged, the next undo push shares the other layers with the previous
+ * undo step of this mesh instead of storing them again, this avoids comparing all arrays of
+ * large meshes when only a few layers change (selecting for example).
+ * Changes made with #EDBM_update_generic cause all layers to be stored.
+ */
+void EDBM_undo_tag_cd_dirty(BMEditMesh *em, const CustomData_MeshMasks *cd_mask)
+{
+  if (em->undo_cd_dirty_state == EM_UNDO_CD_DIRTY_ALL) {
+    return;
+  }
+  em->undo_cd_dirty_state = EM_UNDO_CD_DIRTY_MASK;
+  CustomData_MeshMasks_update(&em->undo_cd_dirty_mask, cd_mask);
+}
+
+/**
+ * Tag the layers holding selection & hidden state as changed, see #EDBM_undo_tag_cd_dirty.
+ */
+void EDBM_undo_tag_select(BMEditMesh *em)
+{
+  const CustomData_MeshMasks cd_mask = {
+      .vmask = CD_MASK_MVERT,
+      .emask = CD_MASK_MEDGE,
+      .pmask = CD_MASK_MPOLY,
+  };
+  EDBM_undo_tag_cd_dirty(em, &cd_mask);
+}
+
+/** \} */
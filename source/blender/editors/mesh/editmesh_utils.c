@@ -1083,6 +1083,8 @@ void EDBM_verts_mirror_cache_begin_ex(BMEditMesh *em,
 
   /* one or the other is used depending if topo is enabled */
   KDTree_3d *tree = NULL;
+  float(*mirr_co)[3] = NULL;
+  KDTreeNearest_3d *mirr_nearest = NULL;
   MirrTopoStore_t mesh_topo_store = {NULL, -1, -1, -1};
 
   BM_mesh_elem_table_ensure(bm, BM_VERT);
@@ -1114,6 +1116,16 @@ void EDBM_verts_mirror_cache_begin_ex(BMEditMesh *em,
       BLI_kdtree_3d_insert(tree, i, v->co);
     }
     BLI_kdtree_3d_balance(tree);
+
+    /* Look up all mirrored coordinates at once, in parallel. */
+    mirr_co = MEM_mallocN(sizeof(*mirr_co) * (size_t)bm->totvert, __func__);
+    BM_ITER_MESH_INDEX (v, &iter, bm, BM_VERTS_OF_MESH, i) {
+      copy_v3_v3(mirr_co[i], v->co);
+      mirr_co[i][axis] *= -1.0f;
+    }
+    mirr_nearest = MEM_mallocN(sizeof(*mirr_nearest) * (size_t)bm->totvert, __func__);
+    BLI_kdtree_3d_find_nearest_batch(
+        tree, (const float(*)[3])mirr_co, (uint)bm->totvert, mirr_nearest);
   }
 
 #define VERT_INTPTR(_v, _i) (r_index ? &r_index[_i] : BM_ELEM_CD_GET_VOID_P(_v, cd_vmirr_offset))
@@ -1133,16 +1145,11 @@ void EDBM_verts_mirror_cache_begin_ex(BMEditMesh *em,
         v_mirr = cache_mirr_intptr_as_bmvert(mesh_topo_store.index_lookup, i);
       }
       else {
-        int i_mirr;
-        float co[3];
-        copy_v3_v3(co, v->co);
-        co[axis] *= -1.0f;
-
+        const int i_mirr = mirr_nearest[i].index;
         v_mirr = NULL;
-        i_mirr = BLI_kdtree_3d_find_nearest(tree, co, NULL);
         if (i_mirr != -1) {
           BMVert *v_test = BM_vert_at_index(bm, i_mirr);
-          if (len_squared_v3v3(co, v_test->co) < maxdist_sq) {
+          if (len_squared_v3v3(mirr_co[i], v_test->co) < maxdist_sq) {
             v_mirr = v_test;
           }
         }
@@ -1167,6 +1174,8 @@ void EDBM_verts_mirror_cache_begin_ex(BMEditMesh *em,
   }
   else {
     BLI_kdtree_3d_free(tree);
+    MEM_freeN(mirr_co);
+    MEM_freeN(mirr_nearest);
   }
 }
 
@@ -1438,6 +1447,9 @@ void EDBM_update_generic(Mesh *mesh, const bool do_tessellation, const bool is_d
     BKE_editmesh_looptri_calc(em);
   }
 
+  /* Changed layers are unknown, the next undo step must store all of them. */
+  em->undo_cd_dirty_state = EM_UNDO_CD_DIRTY_ALL;
+
   if (is_destructive) {
     /* TODO. we may be able to remove this now! - Campbell */
     // BM_mesh_elem_table_free(em->bm, BM_ALL_NOLOOP);
@@ -20,10 +20,13 @@
  * Wrapper between 'ED_undo.h' and 'BKE_undo_system.h' API's.
  */
 
+#include "CLG_log.h"
+
 #include "BLI_sys_types.h"
 #include "BLI_utildefines.h"
 
 #include "BLI_ghash.h"
+#include "BLI_listbase.h"
 
 #include "DNA_node_types.h"
 #include "DNA_object_enums.h"
@@ -52,6 +55,8 @@
 
 #include "undo_intern.h"
 
+static CLG_LogRef LOG = {"ed.undo.memfile"};
+
 /* -------------------------------------------------------------------- */
 /** \name Implements ED Undo System
  * \{ */
@@ -96,6 +101,18 @@ static bool memfile_undosys_step_encode(struct bContext *UNUSED(C),
   us->data = BKE_memfile_undo_encode(bmain, us_prev ? us_prev->data : NULL);
   us->step.data_size = us->data->undo_size;
 
+  {
+    const MemFile *memfile = &us->data->memfile;
+    CLOG_INFO(&LOG,
+              1,
+              "step memory: total=%zu, new=%zu, shared=%zu (moved=%zu), chunks=%d",
+              memfile->size_total,
+              memfile->size,
+              memfile->size_total - memfile->size,
+              memfile->size_shared_moved,
+              BLI_listbase_count(&memfile->chunks));
+  }
+
   /* Store the fact that we should not re-use old data with that undo step, and reset the Main
    * flag. */
   us->step.use_old_bmain_data = !bmain->use_memfile_full_barrier;
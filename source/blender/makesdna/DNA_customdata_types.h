@@ -232,6 +232,8 @@ enum {
   CD_FLAG_EXTERNAL = (1 << 3),
   /* Indicates external data is read into memory */
   CD_FLAG_IN_MEMORY = (1 << 4),
+  /* Indicates layer data may be shared with layers of other CustomData, see #CD_SHARED */
+  CD_FLAG_SHARED = (1 << 5),
 };
 
 /* Limits */
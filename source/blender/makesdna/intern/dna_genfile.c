@@ -799,24 +799,21 @@ static eSDNA_Type sdna_type_nr(const char *dna_type)
  * Note there is no optimization for the case where otype and ctype are the same:
  * assumption is that caller will handle this case.
  *
- * \param ctype: Name of type to convert to
- * \param otype: Name of type to convert from
+ * \param ctypenr: Type to convert to
+ * \param otypenr: Type to convert from
  * \param name_array_len: Result of #DNA_elem_array_size for this element.
  * \param curdata: Where to put converted data
  * \param olddata: Data of type otype to convert
  */
-static void cast_elem(
-    const char *ctype, const char *otype, int name_array_len, char *curdata, const char *olddata)
+static void cast_elem(const eSDNA_Type ctypenr,
+                      const eSDNA_Type otypenr,
+                      int name_array_len,
+                      char *curdata,
+                      const char *olddata)
 {
   double val = 0.0;
   int curlen = 1, oldlen = 1;
 
-  eSDNA_Type ctypenr, otypenr;
-
-  if ((otypenr = sdna_type_nr(otype)) == -1 || (ctypenr = sdna_type_nr(ctype)) == -1) {
-    return;
-  }
-
   /* define lengths */
   oldlen = DNA_elem_type_size(otypenr);
   curlen = DNA_elem_type_size(ctypenr);
@@ -1078,24 +1075,171 @@ static const char *find_elem(const SDNA *sdna,
 }
 
 /**
- * Converts the contents of a single field of a struct, of a non-struct type,
+ * Same as #find_elem, returning the offset of the field within the old struct,
+ * or -1 if no such field can be found.
+ */
+static int find_elem_offset(const SDNA *sdna,
+                            const char *type,
+                            const char *name,
+                            const short *old,
+                            const short **sppo)
+{
+  int a, elemcount, offset = 0;
+
+  elemcount = old[1];
+  old += 2;
+  for (a = 0; a < elemcount; a++, old += 2) {
+    const char *otype = sdna->types[old[0]];
+    const char *oname = sdna->names[old[1]];
+
+    if (elem_strcmp(name, oname) == 0) { /* name equal */
+      if (strcmp(type, otype) == 0) {    /* type equal */
+        *sppo = old;
+        return offset;
+      }
+      return -1;
+    }
+
+    offset += DNA_elem_size_nr(sdna, old[0], old[1]);
+  }
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/** \name Struct Reconstruction
+ *
+ * Converting a struct from the file SDNA to the current SDNA requires matching every field of
+ * the current struct against the old struct by name and type. Doing this with string
+ * comparisons for every struct instance is slow, so the conversion is compiled once per
+ * file into a list of steps for each old struct, which are then applied to all instances.
+ * \{ */
+
+typedef enum eReconstructStepType {
+  /** Copy bytes unchanged. */
+  RECONSTRUCT_STEP_MEMCPY,
+  /** Copy a char array which is shorter in the current SDNA, keeping it null-terminated. */
+  RECONSTRUCT_STEP_MEMCPY_STRING,
+  /** Convert an array of primitive values of one type to another. */
+  RECONSTRUCT_STEP_CAST_PRIMITIVE,
+  /** Convert an array of pointers to the current pointer size. */
+  RECONSTRUCT_STEP_CAST_POINTER,
+  /** Reconstruct an array of nested structs that are not equal. */
+  RECONSTRUCT_STEP_SUBSTRUCT,
+} eReconstructStepType;
+
+typedef struct ReconstructStep {
+  eReconstructStepType type;
+  int old_offset;
+  int new_offset;
+  union {
+    struct {
+      int size;
+    } memcpy;
+    struct {
+      eSDNA_Type old_type;
+      eSDNA_Type new_type;
+      int array_len;
+    } cast_primitive;
+    struct {
+      int array_len;
+    } cast_pointer;
+    struct {
+      int old_struct_nr;
+      int old_struct_size;
+      int new_struct_size;
+      int array_len;
+    } substruct;
+  } data;
+} ReconstructStep;
+
+typedef struct DNA_ReconstructInfo {
+  const SDNA *oldsdna;
+  const SDNA *newsdna;
+  const char *compare_flags;
+  /** Number of old structs, stored so freeing does not depend on the lifetime of #oldsdna. */
+  int old_structs_len;
+
+  /** Size of the current struct matching each old struct, zero when removed. */
+  int *new_struct_sizes;
+  /** Conversion steps for each old struct with #SDNA_CMP_NOT_EQUAL, NULL for others. */
+  ReconstructStep **steps;
+  int *steps_len;
+} DNA_ReconstructInfo;
+
+/**
+ * Adds a step, merging copies of adjacent memory into the previous step.
+ */
+static void reconstruct_steps_add(ReconstructStep *steps,
+                                  int *steps_len,
+                                  const ReconstructStep *step)
+{
+  if (step->type == RECONSTRUCT_STEP_MEMCPY && *steps_len > 0) {
+    ReconstructStep *prev = &steps[*steps_len - 1];
+    if (prev->type == RECONSTRUCT_STEP_MEMCPY &&
+        prev->old_offset + prev->data.memcpy.size == step->old_offset &&
+        prev->new_offset + prev->data.memcpy.size == step->new_offset) {
+      prev->data.memcpy.size += step->data.memcpy.size;
+      return;
+    }
+  }
+  steps[(*steps_len)++] = *step;
+}
+
+/**
+ * Adds the step converting a pointer field, pointers of equal size are copied.
+ */
+static void reconstruct_step_init_pointer(const SDNA *oldsdna,
+                                          const SDNA *newsdna,
+                                          int array_len,
+                                          ReconstructStep *step)
+{
+  if (newsdna->pointer_size == oldsdna->pointer_size) {
+    step->type = RECONSTRUCT_STEP_MEMCPY;
+    step->data.memcpy.size = newsdna->pointer_size * array_len;
+  }
+  else {
+    step->type = RECONSTRUCT_STEP_CAST_POINTER;
+    step->data.cast_pointer.array_len = array_len;
+  }
+}
+
+/**
+ * Adds the step converting primitive values, returns false when either type
+ * is not a primitive, in which case the field is left zero initialized.
+ */
+static bool reconstruct_step_init_primitive(const char *type,
+                                            const char *otype,
+                                            int array_len,
+                                            ReconstructStep *step)
+{
+  const eSDNA_Type new_type = sdna_type_nr(type);
+  const eSDNA_Type old_type = sdna_type_nr(otype);
+  if (new_type == -1 || old_type == -1) {
+    return false;
+  }
+  step->type = RECONSTRUCT_STEP_CAST_PRIMITIVE;
+  step->data.cast_primitive.old_type = old_type;
+  step->data.cast_primitive.new_type = new_type;
+  step->data.cast_primitive.array_len = array_len;
+  return true;
+}
+
+/**
+ * Finds how a single field of a struct, of a non-struct type, is converted
  * from oldsdna to newsdna format.
  *
- * \param newsdna: SDNA of current Blender
- * \param oldsdna: SDNA of Blender that saved file
  * \param type: current field type name
  * \param new_name_nr: current field name number.
- * \param curdata: put field data converted to newsdna here
  * \param old: pointer to struct info in oldsdna
- * \param olddata: struct contents laid out according to oldsdna
+ * \param step: step to fill in, the new offset is already set.
+ * \return false when the field doesn't exist in the old struct.
  */
-static void reconstruct_elem(const SDNA *newsdna,
-                             const SDNA *oldsdna,
-                             const char *type,
-                             const int new_name_nr,
-                             char *curdata,
-                             const short *old,
-                             const char *olddata)
+static bool reconstruct_step_init_elem(const SDNA *newsdna,
+                                       const SDNA *oldsdna,
+                                       const char *type,
+                                       const int new_name_nr,
+                                       const short *old,
+                                       ReconstructStep *step)
 {
   /* rules: test for NAME:
    *      - name equal:
@@ -1106,7 +1250,7 @@ static void reconstruct_elem(const SDNA *newsdna,
    * (nzc 2-4-2001 I want the 'unsigned' bit to be parsed as well. Where
    * can I force this?)
    */
-  int a, elemcount, len, countpos, mul;
+  int a, elemcount, len, countpos, old_offset;
   const char *otype, *oname, *cp;
 
   /* is 'name' an array? */
@@ -1124,29 +1268,28 @@ static void reconstruct_elem(const SDNA *newsdna,
   /* in old is the old struct */
   elemcount = old[1];
   old += 2;
+  old_offset = 0;
   for (a = 0; a < elemcount; a++, old += 2) {
     const int old_name_nr = old[1];
     otype = oldsdna->types[old[0]];
     oname = oldsdna->names[old[1]];
     len = DNA_elem_size_nr(oldsdna, old[0], old[1]);
 
+    step->old_offset = old_offset;
+
     if (strcmp(name, oname) == 0) { /* name equal */
+      const int new_name_array_len = newsdna->names_array_len[new_name_nr];
 
       if (ispointer(name)) { /* pointer of functionpointer afhandelen */
-        cast_pointer(newsdna->pointer_size,
-                     oldsdna->pointer_size,
-                     newsdna->names_array_len[new_name_nr],
-                     curdata,
-                     olddata);
+        reconstruct_step_init_pointer(oldsdna, newsdna, new_name_array_len, step);
+        return true;
       }
       else if (strcmp(type, otype) == 0) { /* type equal */
-        memcpy(curdata, olddata, len);
-      }
-      else {
-        cast_elem(type, otype, newsdna->names_array_len[new_name_nr], curdata, olddata);
+        step->type = RECONSTRUCT_STEP_MEMCPY;
+        step->data.memcpy.size = len;
+        return true;
       }
-
-      return;
+      return reconstruct_step_init_primitive(type, otype, new_name_array_len, step);
     }
     else if (countpos != 0) { /* name is an array */
 
@@ -1156,148 +1299,241 @@ static void reconstruct_elem(const SDNA *newsdna,
         const int min_name_array_len = MIN2(new_name_array_len, old_name_array_len);
 
         if (ispointer(name)) { /* handle pointer or functionpointer */
-          cast_pointer(
-              newsdna->pointer_size, oldsdna->pointer_size, min_name_array_len, curdata, olddata);
+          reconstruct_step_init_pointer(oldsdna, newsdna, min_name_array_len, step);
+          return true;
         }
         else if (strcmp(type, otype) == 0) { /* type equal */
-          /* size of single old array element */
-          mul = len / old_name_array_len;
-          /* smaller of sizes of old and new arrays */
-          mul *= min_name_array_len;
-
-          memcpy(curdata, olddata, mul);
-
+          /* size of single old array element, times the smaller of sizes of old and new arrays */
+          const int size = (len / old_name_array_len) * min_name_array_len;
           if (old_name_array_len > new_name_array_len && strcmp(type, "char") == 0) {
-            /* string had to be truncated, ensure it's still null-terminated */
-            curdata[mul - 1] = '\0';
+            /* string has to be truncated, ensure it's still null-terminated */
+            step->type = RECONSTRUCT_STEP_MEMCPY_STRING;
           }
+          else {
+            step->type = RECONSTRUCT_STEP_MEMCPY;
+          }
+          step->data.memcpy.size = size;
+          return true;
         }
-        else {
-          cast_elem(type, otype, min_name_array_len, curdata, olddata);
-        }
-        return;
+        return reconstruct_step_init_primitive(type, otype, min_name_array_len, step);
       }
     }
-    olddata += len;
+    old_offset += len;
   }
+  return false;
 }
 
 /**
- * Converts the contents of an entire struct from oldsdna to newsdna format.
+ * Compiles the steps converting an entire struct from oldsdna to newsdna format.
  *
- * \param newsdna: SDNA of current Blender
- * \param oldsdna: SDNA of Blender that saved file
- * \param compflags:
- *
- * Result from DNA_struct_get_compareflags to avoid needless conversions.
- * \param oldSDNAnr: Index of old struct definition in oldsdna
- * \param data: Struct contents laid out according to oldsdna
- * \param curSDNAnr: Index of current struct definition in newsdna
- * \param cur: Where to put converted struct contents
+ * \param old_struct_nr: Index of old struct definition in oldsdna
+ * \param new_struct_nr: Index of current struct definition in newsdna
+ * \param r_steps: Array with room for a step for every field of the current struct.
+ * \return The number of steps.
  */
-static void reconstruct_struct(const SDNA *newsdna,
-                               const SDNA *oldsdna,
-                               const char *compflags,
-
-                               int oldSDNAnr,
-                               const char *data,
-                               int curSDNAnr,
-                               char *cur)
+static int reconstruct_struct_steps_compile(const SDNA *newsdna,
+                                            const SDNA *oldsdna,
+                                            const char *compare_flags,
+                                            const int old_struct_nr,
+                                            const int new_struct_nr,
+                                            ReconstructStep *r_steps)
 {
-  /* Recursive!
-   * Per element from cur_struct, read data from old_struct.
-   * If element is a struct, call recursive.
-   */
-  int a, elemcount, elen, eleno, mul, mulo, firststructtypenr;
+  int a, elemcount, elen, eleno, mul, mulo, firststructtypenr, new_offset;
   const short *spo, *spc, *sppo;
   const char *type;
-  const char *cpo;
-  char *cpc;
   const char *name;
-
-  unsigned int oldsdna_index_last = UINT_MAX;
-  unsigned int cursdna_index_last = UINT_MAX;
-
-  if (oldSDNAnr == -1) {
-    return;
-  }
-  if (curSDNAnr == -1) {
-    return;
-  }
-
-  if (compflags[oldSDNAnr] == SDNA_CMP_EQUAL) {
-    /* if recursive: test for equal */
-    spo = oldsdna->structs[oldSDNAnr];
-    elen = oldsdna->types_size[spo[0]];
-    memcpy(cur, data, elen);
-
-    return;
-  }
+  int steps_len = 0;
 
   firststructtypenr = *(newsdna->structs[0]);
 
-  spo = oldsdna->structs[oldSDNAnr];
-  spc = newsdna->structs[curSDNAnr];
+  spo = oldsdna->structs[old_struct_nr];
+  spc = newsdna->structs[new_struct_nr];
 
   elemcount = spc[1];
 
   spc += 2;
-  cpc = cur;
-  for (a = 0; a < elemcount; a++, spc += 2) { /* convert each field */
+  new_offset = 0;
+  for (a = 0; a < elemcount; a++, spc += 2, new_offset += elen) { /* convert each field */
+    ReconstructStep step = {0};
+
     type = newsdna->types[spc[0]];
     name = newsdna->names[spc[1]];
 
     elen = DNA_elem_size_nr(newsdna, spc[0], spc[1]);
 
+    step.new_offset = new_offset;
+
     /* Skip pad bytes which must start with '_pad', see makesdna.c 'is_name_legal'.
      * for exact rules. Note that if we fail to skip a pad byte it's harmless,
      * this just avoids unnecessary reconstruction. */
     if (name[0] == '_' || (name[0] == '*' && name[1] == '_')) {
-      cpc += elen;
+      continue;
     }
     else if (spc[0] >= firststructtypenr && !ispointer(name)) {
       /* struct field type */
 
       /* where does the old struct data start (and is there an old one?) */
-      cpo = (char *)find_elem(oldsdna, type, name, spo, data, &sppo);
-
-      if (cpo) {
-        oldSDNAnr = DNA_struct_find_nr_ex(oldsdna, type, &oldsdna_index_last);
-        curSDNAnr = DNA_struct_find_nr_ex(newsdna, type, &cursdna_index_last);
+      step.old_offset = find_elem_offset(oldsdna, type, name, spo, &sppo);
+      if (step.old_offset == -1) {
+        continue; /* skip field no longer present */
+      }
 
-        /* array! */
-        mul = newsdna->names_array_len[spc[1]];
-        mulo = oldsdna->names_array_len[sppo[1]];
+      const int sub_old_struct_nr = DNA_struct_find_nr(oldsdna, type);
+      if (sub_old_struct_nr == -1) {
+        continue; /* skip field which type is no struct in the old SDNA, it stays zeroed */
+      }
 
-        eleno = DNA_elem_size_nr(oldsdna, sppo[0], sppo[1]);
+      /* array! */
+      mul = newsdna->names_array_len[spc[1]];
+      mulo = oldsdna->names_array_len[sppo[1]];
 
-        elen /= mul;
-        eleno /= mulo;
+      eleno = DNA_elem_size_nr(oldsdna, sppo[0], sppo[1]) / mulo;
 
-        while (mul--) {
-          reconstruct_struct(newsdna, oldsdna, compflags, oldSDNAnr, cpo, curSDNAnr, cpc);
-          cpo += eleno;
-          cpc += elen;
-
-          /* new struct array larger than old */
-          mulo--;
-          if (mulo <= 0) {
-            break;
-          }
-        }
+      if (compare_flags[sub_old_struct_nr] == SDNA_CMP_EQUAL) {
+        step.type = RECONSTRUCT_STEP_MEMCPY;
+        step.data.memcpy.size = eleno * MIN2(mul, mulo);
       }
       else {
-        cpc += elen; /* skip field no longer present */
+        step.type = RECONSTRUCT_STEP_SUBSTRUCT;
+        step.data.substruct.old_struct_nr = sub_old_struct_nr;
+        step.data.substruct.old_struct_size = eleno;
+        step.data.substruct.new_struct_size = elen / mul;
+        step.data.substruct.array_len = MIN2(mul, mulo);
       }
     }
     else {
       /* non-struct field type */
-      reconstruct_elem(newsdna, oldsdna, type, spc[1], cpc, spo, data);
-      cpc += elen;
+      if (!reconstruct_step_init_elem(newsdna, oldsdna, type, spc[1], spo, &step)) {
+        continue;
+      }
     }
+
+    reconstruct_steps_add(r_steps, &steps_len, &step);
   }
+
+  return steps_len;
 }
 
+/**
+ * Applies the compiled steps to convert a single struct.
+ */
+static void reconstruct_struct(const DNA_ReconstructInfo *reconstruct_info,
+                               const int old_struct_nr,
+                               const char *old_data,
+                               char *new_data)
+{
+  const ReconstructStep *steps = reconstruct_info->steps[old_struct_nr];
+  const int steps_len = reconstruct_info->steps_len[old_struct_nr];
+
+  for (int a = 0; a < steps_len; a++) {
+    const ReconstructStep *step = &steps[a];
+    const char *olddata = old_data + step->old_offset;
+    char *curdata = new_data + step->new_offset;
+
+    switch (step->type) {
+      case RECONSTRUCT_STEP_MEMCPY:
+        memcpy(curdata, olddata, step->data.memcpy.size);
+        break;
+      case RECONSTRUCT_STEP_MEMCPY_STRING:
+        memcpy(curdata, olddata, step->data.memcpy.size);
+        curdata[step->data.memcpy.size - 1] = '\0';
+        break;
+      case RECONSTRUCT_STEP_CAST_PRIMITIVE:
+        cast_elem(step->data.cast_primitive.new_type,
+                  step->data.cast_primitive.old_type,
+                  step->data.cast_primitive.array_len,
+                  curdata,
+                  olddata);
+        break;
+      case RECONSTRUCT_STEP_CAST_POINTER:
+        cast_pointer(reconstruct_info->newsdna->pointer_size,
+                     reconstruct_info->oldsdna->pointer_size,
+                     step->data.cast_pointer.array_len,
+                     curdata,
+                     olddata);
+        break;
+      case RECONSTRUCT_STEP_SUBSTRUCT:
+        for (int i = 0; i < step->data.substruct.array_len; i++) {
+          reconstruct_struct(
+              reconstruct_info, step->data.substruct.old_struct_nr, olddata, curdata);
+          olddata += step->data.substruct.old_struct_size;
+          curdata += step->data.substruct.new_struct_size;
+        }
+        break;
+    }
+  }
+}
+
+/**
+ * Compiles the conversion of all structs from \a oldsdna which differ from \a newsdna,
+ * the result can be shared between threads.
+ *
+ * \param compare_flags: Result from #DNA_struct_get_compareflags, must stay valid
+ * as long as the returned info is used.
+ */
+DNA_ReconstructInfo *DNA_reconstruct_info_create(const SDNA *oldsdna,
+                                                 const SDNA *newsdna,
+                                                 const char *compare_flags)
+{
+  DNA_ReconstructInfo *reconstruct_info = MEM_callocN(sizeof(*reconstruct_info), __func__);
+  reconstruct_info->oldsdna = oldsdna;
+  reconstruct_info->newsdna = newsdna;
+  reconstruct_info->compare_flags = compare_flags;
+  reconstruct_info->old_structs_len = oldsdna->structs_len;
+  reconstruct_info->new_struct_sizes = MEM_callocN(sizeof(int) * oldsdna->structs_len, __func__);
+  reconstruct_info->steps = MEM_callocN(sizeof(*reconstruct_info->steps) * oldsdna->structs_len,
+                                        __func__);
+  reconstruct_info->steps_len = MEM_callocN(sizeof(int) * oldsdna->structs_len, __func__);
+
+  /* Fields of the current structs are at most this many steps. */
+  int elems_len_max = 0;
+  for (int new_struct_nr = 0; new_struct_nr < newsdna->structs_len; new_struct_nr++) {
+    elems_len_max = MAX2(elems_len_max, newsdna->structs[new_struct_nr][1]);
+  }
+  ReconstructStep *steps = MEM_mallocN(sizeof(*steps) * MAX2(elems_len_max, 1), __func__);
+
+  for (int old_struct_nr = 0; old_struct_nr < oldsdna->structs_len; old_struct_nr++) {
+    if (compare_flags[old_struct_nr] == SDNA_CMP_REMOVED) {
+      continue;
+    }
+    const short *spo = oldsdna->structs[old_struct_nr];
+    const int new_struct_nr = DNA_struct_find_nr(newsdna, oldsdna->types[spo[0]]);
+    if (new_struct_nr == -1) {
+      continue;
+    }
+    const short *spc = newsdna->structs[new_struct_nr];
+    reconstruct_info->new_struct_sizes[old_struct_nr] = newsdna->types_size[spc[0]];
+
+    if (compare_flags[old_struct_nr] != SDNA_CMP_NOT_EQUAL) {
+      continue;
+    }
+    const int steps_len = reconstruct_struct_steps_compile(
+        newsdna, oldsdna, compare_flags, old_struct_nr, new_struct_nr, steps);
+    if (steps_len != 0) {
+      reconstruct_info->steps[old_struct_nr] = MEM_mallocN(sizeof(*steps) * steps_len, __func__);
+      memcpy(reconstruct_info->steps[old_struct_nr], steps, sizeof(*steps) * steps_len);
+      reconstruct_info->steps_len[old_struct_nr] = steps_len;
+    }
+  }
+
+  MEM_freeN(steps);
+
+  return reconstruct_info;
+}
+
+void DNA_reconstruct_info_free(DNA_ReconstructInfo *reconstruct_info)
+{
+  for (int old_struct_nr = 0; old_struct_nr < reconstruct_info->old_structs_len; old_struct_nr++) {
+    MEM_SAFE_FREE(reconstruct_info->steps[old_struct_nr]);
+  }
+  MEM_freeN(reconstruct_info->steps);
+  MEM_freeN(reconstruct_info->steps_len);
+  MEM_freeN(reconstruct_info->new_struct_sizes);
+  MEM_freeN(reconstruct_info);
+}
+
+/** \} */
+
 /**
  * Does endian swapping on the fields of a struct value.
  *
@@ -1392,53 +1628,71 @@ void DNA_struct_switch_endian(const SDNA *oldsdna, int oldSDNAnr, char *data)
 }
 
 /**
- * \param newsdna: SDNA of current Blender
- * \param oldsdna: SDNA of Blender that saved file
- * \param compflags:
+ * \param old_struct_nr: Index of struct info within oldsdna
+ * \return The size of the struct a struct from oldsdna is reconstructed into,
+ * zero when it doesn't exist in newsdna anymore.
+ */
+int DNA_struct_reconstruct_size(const DNA_ReconstructInfo *reconstruct_info, int old_struct_nr)
+{
+  return reconstruct_info->new_struct_sizes[old_struct_nr];
+}
+
+/**
+ * Reconstructs an array of structs into zero initialized memory of
+ * \a blocks times #DNA_struct_reconstruct_size, may be called from multiple threads.
  *
- * Result from DNA_struct_get_compareflags to avoid needless conversions
- * \param oldSDNAnr: Index of struct info within oldsdna
+ * \param old_struct_nr: Index of struct info within oldsdna
  * \param blocks: The number of array elements
- * \param data: Array of struct data
- * \return An allocated reconstructed struct
+ * \param old_blocks: Array of struct data
+ * \param new_blocks: Where to put converted struct contents
  */
-void *DNA_struct_reconstruct(const SDNA *newsdna,
-                             const SDNA *oldsdna,
-                             const char *compflags,
-                             int oldSDNAnr,
-                             int blocks,
-                             const void *data)
+void DNA_struct_reconstruct_blocks(const DNA_ReconstructInfo *reconstruct_info,
+                                   int old_struct_nr,
+                                   int blocks,
+                                   const void *old_blocks,
+                                   void *new_blocks)
 {
-  int a, curSDNAnr, curlen = 0, oldlen;
-  const short *spo, *spc;
-  char *cur, *cpc;
-  const char *cpo;
-  const char *type;
-
-  /* oldSDNAnr == structnr, we're looking for the corresponding 'cur' number */
-  spo = oldsdna->structs[oldSDNAnr];
-  type = oldsdna->types[spo[0]];
-  oldlen = oldsdna->types_size[spo[0]];
-  curSDNAnr = DNA_struct_find_nr(newsdna, type);
+  const SDNA *oldsdna = reconstruct_info->oldsdna;
+  const short *spo = oldsdna->structs[old_struct_nr];
+  const int oldlen = oldsdna->types_size[spo[0]];
+  const int curlen = reconstruct_info->new_struct_sizes[old_struct_nr];
+  const char *cpo = old_blocks;
+  char *cpc = new_blocks;
 
-  /* init data and alloc */
-  if (curSDNAnr != -1) {
-    spc = newsdna->structs[curSDNAnr];
-    curlen = newsdna->types_size[spc[0]];
-  }
   if (curlen == 0) {
-    return NULL;
+    return;
   }
 
-  cur = MEM_callocN(blocks * curlen, "reconstruct");
-  cpc = cur;
-  cpo = data;
-  for (a = 0; a < blocks; a++) {
-    reconstruct_struct(newsdna, oldsdna, compflags, oldSDNAnr, cpo, curSDNAnr, cpc);
+  if (reconstruct_info->compare_flags[old_struct_nr] == SDNA_CMP_EQUAL) {
+    memcpy(cpc, cpo, (size_t)blocks * curlen);
+    return;
+  }
+
+  for (int a = 0; a < blocks; a++) {
+    reconstruct_struct(reconstruct_info, old_struct_nr, cpo, cpc);
     cpc += curlen;
     cpo += oldlen;
   }
+}
+
+/**
+ * \param old_struct_nr: Index of struct info within oldsdna
+ * \param blocks: The number of array elements
+ * \param old_blocks: Array of struct data
+ * \return An allocated reconstructed struct
+ */
+void *DNA_struct_reconstruct(const DNA_ReconstructInfo *reconstruct_info,
+                             int old_struct_nr,
+                             int blocks,
+                             const void *old_blocks)
+{
+  const int curlen = reconstruct_info->new_struct_sizes[old_struct_nr];
+  if (curlen == 0) {
+    return NULL;
+  }
 
+  void *cur = MEM_callocN((size_t)blocks * curlen, "reconstruct");
+  DNA_struct_reconstruct_blocks(reconstruct_info, old_struct_nr, blocks, old_blocks, cur);
   return cur;
 }
 
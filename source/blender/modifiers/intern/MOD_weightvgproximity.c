@@ -27,7 +27,6 @@
 #include "BLI_listbase.h"
 #include "BLI_math.h"
 #include "BLI_rand.h"
-#include "BLI_task.h"
 
 #include "DNA_mesh_types.h"
 #include "DNA_meshdata_types.h"
@@ -67,77 +66,6 @@
 /* Util macro. */
 #define OUT_OF_MEMORY() ((void)printf("WeightVGProximity: Out of memory.\n"))
 
-typedef struct Vert2GeomData {
-  /* Read-only data */
-  float (*v_cos)[3];
-
-  const SpaceTransform *loc2trgt;
-
-  BVHTreeFromMesh *treeData[3];
-
-  /* Write data, but not needing locking (two different threads will never write same index). */
-  float *dist[3];
-} Vert2GeomData;
-
-/**
- * Data which is localized to each computed chunk
- * (i.e. thread-safe, and with continuous subset of index range).
- */
-typedef struct Vert2GeomDataChunk {
-  /* Read-only data */
-  float last_hit_co[3][3];
-  bool is_init[3];
-} Vert2GeomDataChunk;
-
-/**
- * Callback used by BLI_task 'for loop' helper.
- */
-static void vert2geom_task_cb_ex(void *__restrict userdata,
-                                 const int iter,
-                                 const TaskParallelTLS *__restrict tls)
-{
-  Vert2GeomData *data = userdata;
-  Vert2GeomDataChunk *data_chunk = tls->userdata_chunk;
-
-  float tmp_co[3];
-  int i;
-
-  /* Convert the vertex to tree coordinates. */
-  copy_v3_v3(tmp_co, data->v_cos[iter]);
-  BLI_space_transform_apply(data->loc2trgt, tmp_co);
-
-  for (i = 0; i < ARRAY_SIZE(data->dist); i++) {
-    if (data->dist[i]) {
-      BVHTreeNearest nearest = {0};
-
-      /* Note that we use local proximity heuristics (to reduce the nearest search).
-       *
-       * If we already had an hit before in same chunk of tasks (i.e. previous vertex by index),
-       * we assume this vertex is going to have a close hit to that other vertex,
-       * so we can initiate the "nearest.dist" with the expected value to that last hit.
-       * This will lead in pruning of the search tree.
-       */
-      nearest.dist_sq = data_chunk->is_init[i] ?
-                            len_squared_v3v3(tmp_co, data_chunk->last_hit_co[i]) :
-                            FLT_MAX;
-      nearest.index = -1;
-
-      /* Compute and store result. If invalid (-1 idx), keep FLT_MAX dist. */
-      BLI_bvhtree_find_nearest(data->treeData[i]->tree,
-                               tmp_co,
-                               &nearest,
-                               data->treeData[i]->nearest_callback,
-                               data->treeData[i]);
-      data->dist[i][iter] = sqrtf(nearest.dist_sq);
-
-      if (nearest.index != -1) {
-        copy_v3_v3(data_chunk->last_hit_co[i], nearest.co);
-        data_chunk->is_init[i] = true;
-      }
-    }
-  }
-}
-
 /**
  * Find nearest vertex and/or edge and/or face, for each vertex (adapted from shrinkwrap.c).
  */
@@ -149,63 +77,57 @@ static void get_vert2geom_distance(int numVerts,
                                    Mesh *target,
                                    const SpaceTransform *loc2trgt)
 {
-  Vert2GeomData data = {0};
-  Vert2GeomDataChunk data_chunk = {{{0}}};
-
-  BVHTreeFromMesh treeData_v = {NULL};
-  BVHTreeFromMesh treeData_e = {NULL};
-  BVHTreeFromMesh treeData_f = {NULL};
-
-  if (dist_v) {
-    /* Create a bvh-tree of the given target's verts. */
-    BKE_bvhtree_from_mesh_get(&treeData_v, target, BVHTREE_FROM_VERTS, 2);
-    if (treeData_v.tree == NULL) {
-      OUT_OF_MEMORY();
-      return;
+  BVHTreeFromMesh treeData[3] = {{NULL}};
+  float *dist[3] = {dist_v, dist_e, dist_f};
+  const int tree_types[3] = {BVHTREE_FROM_VERTS, BVHTREE_FROM_EDGES, BVHTREE_FROM_LOOPTRI};
+  int i, j;
+
+  for (i = 0; i < ARRAY_SIZE(dist); i++) {
+    if (dist[i]) {
+      /* Create a bvh-tree of the given target's verts, edges or faces. */
+      BKE_bvhtree_from_mesh_get(&treeData[i], target, tree_types[i], 2);
+      if (treeData[i].tree == NULL) {
+        OUT_OF_MEMORY();
+        for (j = 0; j < i; j++) {
+          free_bvhtree_from_mesh(&treeData[j]);
+        }
+        return;
+      }
     }
   }
-  if (dist_e) {
-    /* Create a bvh-tree of the given target's edges. */
-    BKE_bvhtree_from_mesh_get(&treeData_e, target, BVHTREE_FROM_EDGES, 2);
-    if (treeData_e.tree == NULL) {
-      OUT_OF_MEMORY();
-      return;
-    }
+
+  /* Convert the vertices to tree coordinates. */
+  float(*tree_cos)[3] = MEM_malloc_arrayN((size_t)numVerts, sizeof(*tree_cos), __func__);
+  BVHTreeNearest *nearest = MEM_malloc_arrayN((size_t)numVerts, sizeof(*nearest), __func__);
+  for (j = 0; j < numVerts; j++) {
+    copy_v3_v3(tree_cos[j], v_cos[j]);
+    BLI_space_transform_apply(loc2trgt, tree_cos[j]);
   }
-  if (dist_f) {
-    /* Create a bvh-tree of the given target's faces. */
-    BKE_bvhtree_from_mesh_get(&treeData_f, target, BVHTREE_FROM_LOOPTRI, 2);
-    if (treeData_f.tree == NULL) {
-      OUT_OF_MEMORY();
-      return;
+
+  for (i = 0; i < ARRAY_SIZE(dist); i++) {
+    if (dist[i]) {
+      for (j = 0; j < numVerts; j++) {
+        nearest[j].index = -1;
+        nearest[j].dist_sq = FLT_MAX;
+      }
+
+      /* Nearby vertices are queried together, sharing their search of the tree.
+       * If invalid (-1 idx), keep FLT_MAX dist. */
+      BLI_bvhtree_find_nearest_batch(treeData[i].tree,
+                                     (const float(*)[3])tree_cos,
+                                     numVerts,
+                                     nearest,
+                                     treeData[i].nearest_callback,
+                                     &treeData[i]);
+      for (j = 0; j < numVerts; j++) {
+        dist[i][j] = sqrtf(nearest[j].dist_sq);
+      }
+      free_bvhtree_from_mesh(&treeData[i]);
     }
   }
 
-  data.v_cos = v_cos;
-  data.loc2trgt = loc2trgt;
-  data.treeData[0] = &treeData_v;
-  data.treeData[1] = &treeData_e;
-  data.treeData[2] = &treeData_f;
-  data.dist[0] = dist_v;
-  data.dist[1] = dist_e;
-  data.dist[2] = dist_f;
-
-  TaskParallelSettings settings;
-  BLI_parallel_range_settings_defaults(&settings);
-  settings.use_threading = (numVerts > 10000);
-  settings.userdata_chunk = &data_chunk;
-  settings.userdata_chunk_size = sizeof(data_chunk);
-  BLI_task_parallel_range(0, numVerts, &data, vert2geom_task_cb_ex, &settings);
-
-  if (dist_v) {
-    free_bvhtree_from_mesh(&treeData_v);
-  }
-  if (dist_e) {
-    free_bvhtree_from_mesh(&treeData_e);
-  }
-  if (dist_f) {
-    free_bvhtree_from_mesh(&treeData_f);
-  }
+  MEM_freeN(tree_cos);
+  MEM_freeN(nearest);
 }
 
 /**
@@ -1461,6 +1461,20 @@ static bool wm_file_write(bContext *C, const char *filepath, int fileflags, Repo
 /** \name Auto-Save API
  * \{ */
 
+/** Auto-save of the undo memfile which is still being written from a background thread. */
+static struct MemFileWriteAsync *wm_autosave_write_async = NULL;
+
+/**
+ * Wait for a pending background auto-save write to complete.
+ */
+static void wm_autosave_write_async_finish(void)
+{
+  if (wm_autosave_write_async) {
+    BLO_memfile_write_async_finish(wm_autosave_write_async, false);
+    wm_autosave_write_async = NULL;
+  }
+}
+
 void wm_autosave_location(char *filepath)
 {
   const int pid = abs(getpid());
@@ -1528,13 +1542,26 @@ void wm_autosave_timer(Main *bmain, wmWindowManager *wm, wmTimer *UNUSED(wt))
     }
   }
 
+  /* if the previous auto-save is still being written, try again in 10 seconds */
+  if (wm_autosave_write_async) {
+    if (!BLO_memfile_write_async_is_done(wm_autosave_write_async)) {
+      wm->autosavetimer = WM_event_add_timer(wm, NULL, TIMERAUTOSAVE, 10.0);
+      if (G.debug) {
+        printf("Skipping auto-save, still writing previous one, retrying in ten seconds...\n");
+      }
+      return;
+    }
+    wm_autosave_write_async_finish();
+  }
+
   wm_autosave_location(filepath);
 
   if (U.uiflag & USER_GLOBALUNDO) {
-    /* fast save of last undobuffer, now with UI */
+    /* fast save of last undobuffer, now with UI,
+     * the undo chunks are written from a background thread */
     struct MemFile *memfile = ED_undosys_stack_memfile_get_active(wm->undo_stack);
     if (memfile) {
-      BLO_memfile_write_file(memfile, filepath);
+      wm_autosave_write_async = BLO_memfile_write_file_async(memfile, filepath);
     }
   }
   else {
@@ -1556,6 +1583,7 @@ void wm_autosave_timer_ended(wmWindowManager *wm)
     WM_event_remove_timer(wm, NULL, wm->autosavetimer);
     wm->autosavetimer = NULL;
   }
+  wm_autosave_write_async_finish();
 }
 
 void wm_autosave_delete(void)
@@ -281,7 +281,12 @@ int main(int argc,
   {
     int i;
     for (i = 0; i < argc; i++) {
-      if (STR_ELEM(argv[i], "-d", "--debug", "--debug-memory", "--debug-all")) {
+      if (STR_ELEM(argv[i],
+                   "-d",
+                   "--debug",
+                   "--debug-memory",
+                   "--debug-memory-profile",
+                   "--debug-all")) {
         printf("Switching to fully guarded memory allocator.\n");
         MEM_use_guarded_allocator();
         break;
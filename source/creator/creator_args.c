@@ -45,6 +45,7 @@
 
 #  include "BLO_readfile.h" /* only for BLO_has_bfile_extension */
 
+#  include "BKE_blender.h"
 #  include "BKE_blender_version.h"
 #  include "BKE_context.h"
 
@@ -527,6 +528,7 @@ static int arg_handle_print_help(int UNUSED(argc), const char **UNUSED(argv), vo
   BLI_argsPrintArgDoc(ba, "--render-output");
   BLI_argsPrintArgDoc(ba, "--engine");
   BLI_argsPrintArgDoc(ba, "--threads");
+  BLI_argsPrintArgDoc(ba, "--depsgraph-build-cache");
 
   printf("\n");
   printf("Format Options:\n");
@@ -589,6 +591,7 @@ static int arg_handle_print_help(int UNUSED(argc), const char **UNUSED(argv), vo
   BLI_argsPrintArgDoc(ba, "--debug-cycles");
 #  endif
   BLI_argsPrintArgDoc(ba, "--debug-memory");
+  BLI_argsPrintArgDoc(ba, "--debug-memory-profile");
   BLI_argsPrintArgDoc(ba, "--debug-jobs");
   BLI_argsPrintArgDoc(ba, "--debug-python");
   BLI_argsPrintArgDoc(ba, "--debug-depsgraph");
@@ -1059,6 +1062,56 @@ static int arg_handle_debug_mode_memory_set(int UNUSED(argc),
   return 0;
 }
 
+/* Average bytes allocated between samples of the allocation profiler. */
+#  define MEMORY_PROFILE_SAMPLE_INTERVAL (64 * 1024)
+
+static char memory_profile_filepath[FILE_MAX];
+
+static void memory_profile_atexit(void *UNUSED(user_data))
+{
+  char timeline_filepath[FILE_MAX];
+  BLI_snprintf(
+      timeline_filepath, sizeof(timeline_filepath), "%s.timeline.csv", memory_profile_filepath);
+
+  MEM_profile_print_stats();
+  if (MEM_profile_write(memory_profile_filepath)) {
+    printf("Allocation profile written to '%s'\n", memory_profile_filepath);
+  }
+  else {
+    printf("Error: could not write allocation profile to '%s'\n", memory_profile_filepath);
+  }
+  if (MEM_profile_write_timeline(timeline_filepath)) {
+    printf("Allocation timeline written to '%s'\n", timeline_filepath);
+  }
+  else {
+    printf("Error: could not write allocation timeline to '%s'\n", timeline_filepath);
+  }
+}
+
+static const char arg_handle_debug_mode_memory_profile_set_doc[] =
+    "<filepath>\n"
+    "\tEnable the sampling allocation profiler (uses the guarded allocator), on exit print\n"
+    "\tallocated and peak bytes per block name, write the bytes allocated per depsgraph\n"
+    "\toperation and block name to <filepath> as folded stacks for flame graphs, and the\n"
+    "\tallocated and live bytes per block name over time to '<filepath>.timeline.csv'.";
+static int arg_handle_debug_mode_memory_profile_set(int argc,
+                                                    const char **argv,
+                                                    void *UNUSED(data))
+{
+  const char *arg_id = "--debug-memory-profile";
+  if (argc > 1) {
+    if (!MEM_profile_enable(MEMORY_PROFILE_SAMPLE_INTERVAL)) {
+      printf("\nError: '%s' requires the guarded allocator.\n", arg_id);
+      return 1;
+    }
+    BLI_strncpy(memory_profile_filepath, argv[1], sizeof(memory_profile_filepath));
+    BKE_blender_atexit_register(memory_profile_atexit, NULL);
+    return 1;
+  }
+  printf("\nError: you must specify a filepath after '%s'.\n", arg_id);
+  return 0;
+}
+
 static const char arg_handle_debug_value_set_doc[] =
     "<value>\n"
     "\tSet debug value of <value> on startup.";
@@ -1492,6 +1545,29 @@ static int arg_handle_threads_set(int argc, const char **argv, void *UNUSED(data
   }
 }
 
+static void depsgraph_build_cache_atexit(void *UNUSED(user_data))
+{
+  DEG_build_cache_set_directory(NULL);
+}
+
+static const char arg_handle_depsgraph_build_cache_set_doc[] =
+    "<path>\n"
+    "\tReuse dependency graph relations built for files which did not change since they were\n"
+    "\tread, storing them in the <path> directory, to speed up opening the same file again.";
+static int arg_handle_depsgraph_build_cache_set(int argc,
+                                                const char **argv,
+                                                void *UNUSED(data))
+{
+  const char *arg_id = "--depsgraph-build-cache";
+  if (argc > 1) {
+    DEG_build_cache_set_directory(argv[1]);
+    BKE_blender_atexit_register(depsgraph_build_cache_atexit, NULL);
+    return 1;
+  }
+  printf("\nError: you must specify a path after '%s'.\n", arg_id);
+  return 0;
+}
+
 static const char arg_handle_verbosity_set_doc[] =
     "<verbose>\n"
     "\tSet logging verbosity level for debug messages which supports it.";
@@ -2137,6 +2213,12 @@ void main_args_setup(bContext *C, bArgs *ba)
   BLI_argsAdd(ba, 1, NULL, "--debug-cycles", CB(arg_handle_debug_mode_cycles), NULL);
 #  endif
   BLI_argsAdd(ba, 1, NULL, "--debug-memory", CB(arg_handle_debug_mode_memory_set), NULL);
+  BLI_argsAdd(ba,
+              1,
+              NULL,
+              "--debug-memory-profile",
+              CB(arg_handle_debug_mode_memory_profile_set),
+              NULL);
 
   BLI_argsAdd(ba, 1, NULL, "--debug-value", CB(arg_handle_debug_value_set), NULL);
   BLI_argsAdd(ba,
@@ -2264,6 +2346,12 @@ void main_args_setup(bContext *C, bArgs *ba)
 
   BLI_argsAdd(ba, 4, "-F", "--render-format", CB(arg_handle_image_type_set), C);
   BLI_argsAdd(ba, 1, "-t", "--threads", CB(arg_handle_threads_set), NULL);
+  BLI_argsAdd(ba,
+              1,
+              NULL,
+              "--depsgraph-build-cache",
+              CB(arg_handle_depsgraph_build_cache_set),
+              NULL);
   BLI_argsAdd(ba, 4, "-x", "--use-extension", CB(arg_handle_extension_set), C);
 
 #  undef CB
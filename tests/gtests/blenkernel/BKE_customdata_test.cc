@@ -0,0 +1,255 @@
+/* Apache License, Version 2.0 */
+
+#include "testing/testing.h"
+
+#include "MEM_guardedalloc.h"
+
+extern "C" {
+#include "BLI_threads.h"
+#include "BLI_utildefines.h"
+
+#include "DNA_customdata_types.h"
+#include "DNA_meshdata_types.h"
+
+#include "BKE_customdata.h"
+}
+
+/* Large enough to be copied in parallel chunks, see #CUSTOMDATA_PARALLEL_COPY_CHUNK_SIZE. */
+#define LARGE_TOTELEM (1 << 20)
+
+static void fill_deform_verts(MDeformVert *dvert, const int totelem)
+{
+  for (int i = 0; i < totelem; i++) {
+    dvert[i].totweight = i % 3;
+    if (dvert[i].totweight == 0) {
+      continue;
+    }
+    dvert[i].dw = (MDeformWeight *)MEM_calloc_arrayN(
+        dvert[i].totweight, sizeof(MDeformWeight), __func__);
+    for (int j = 0; j < dvert[i].totweight; j++) {
+      dvert[i].dw[j].def_nr = (i + j) % 7;
+      dvert[i].dw[j].weight = (float)i * 0.001f;
+    }
+  }
+}
+
+static void expect_deform_verts_copied(const MDeformVert *dvert_src,
+                                       const MDeformVert *dvert_dst,
+                                       const int totelem)
+{
+  EXPECT_NE(dvert_src, dvert_dst);
+  for (int i = 0; i < totelem; i++) {
+    ASSERT_EQ(dvert_src[i].totweight, dvert_dst[i].totweight);
+    if (dvert_src[i].totweight == 0) {
+      continue;
+    }
+    /* Weights must be allocated for the copy, not shared with the source. */
+    ASSERT_NE(dvert_src[i].dw, dvert_dst[i].dw);
+    for (int j = 0; j < dvert_src[i].totweight; j++) {
+      EXPECT_EQ(dvert_src[i].dw[j].def_nr, dvert_dst[i].dw[j].def_nr);
+      EXPECT_EQ(dvert_src[i].dw[j].weight, dvert_dst[i].dw[j].weight);
+    }
+  }
+}
+
+TEST(customdata, SharedCopyOfReferencedLayer)
+{
+  BLI_threadapi_init();
+
+  CustomData data, data_ref, data_dup, data_shared;
+  CustomData_reset(&data);
+  float *values = (float *)CustomData_add_layer(
+      &data, CD_PROP_FLT, CD_CALLOC, NULL, LARGE_TOTELEM);
+  for (int i = 0; i < LARGE_TOTELEM; i++) {
+    values[i] = (float)i;
+  }
+
+  /* Referenced layers are duplicated for copy-on-write copies, large ones in parallel. */
+  CustomData_copy(&data, &data_ref, CD_MASK_ALL, CD_REFERENCE, LARGE_TOTELEM);
+  CustomData_copy(&data, &data_dup, CD_MASK_ALL, CD_DUPLICATE, LARGE_TOTELEM);
+  CustomData_copy(&data_ref, &data_shared, CD_MASK_ALL, CD_SHARED, LARGE_TOTELEM);
+
+  const float *values_dup = (const float *)CustomData_get_layer(&data_dup, CD_PROP_FLT);
+  const float *values_shared = (const float *)CustomData_get_layer(&data_shared, CD_PROP_FLT);
+  EXPECT_NE(values_shared, values);
+  EXPECT_EQ(memcmp(values_shared, values_dup, sizeof(float) * LARGE_TOTELEM), 0);
+
+  CustomData_free(&data_shared, LARGE_TOTELEM);
+  CustomData_free(&data_dup, LARGE_TOTELEM);
+  CustomData_free(&data_ref, LARGE_TOTELEM);
+  CustomData_free(&data, LARGE_TOTELEM);
+
+  BLI_threadapi_exit();
+}
+
+TEST(customdata, SharedCopyOfReferencedLayerWithCopyCallback)
+{
+  BLI_threadapi_init();
+
+  /* Copy callbacks allocate per element, the result must match a serial copy. */
+  const int totelem = LARGE_TOTELEM / 4;
+  CustomData data, data_ref, data_dup, data_shared;
+  CustomData_reset(&data);
+  MDeformVert *dvert = (MDeformVert *)CustomData_add_layer(
+      &data, CD_MDEFORMVERT, CD_CALLOC, NULL, totelem);
+  fill_deform_verts(dvert, totelem);
+
+  CustomData_copy(&data, &data_ref, CD_MASK_ALL, CD_REFERENCE, totelem);
+  CustomData_copy(&data, &data_dup, CD_MASK_ALL, CD_DUPLICATE, totelem);
+  CustomData_copy(&data_ref, &data_shared, CD_MASK_ALL, CD_SHARED, totelem);
+
+  const MDeformVert *dvert_dup = (const MDeformVert *)CustomData_get_layer(&data_dup,
+                                                                           CD_MDEFORMVERT);
+  const MDeformVert *dvert_shared = (const MDeformVert *)CustomData_get_layer(&data_shared,
+                                                                              CD_MDEFORMVERT);
+  expect_deform_verts_copied(dvert, dvert_dup, totelem);
+  expect_deform_verts_copied(dvert, dvert_shared, totelem);
+
+  CustomData_free(&data_shared, totelem);
+  CustomData_free(&data_dup, totelem);
+  CustomData_free(&data_ref, totelem);
+  CustomData_free(&data, totelem);
+
+  BLI_threadapi_exit();
+}
+
+/* -------------------------------------------------------------------- */
+/** \name Shared Layers
+ *
+ * Layers copied with CD_SHARED use the array of their source, which has to stay valid until the
+ * last layer using it is freed, whichever is freed first. Deform vertices are used since freeing
+ * them frees the weights too, leaks or double frees show in the number of blocks in use.
+ * \{ */
+
+#define SHARED_TOTELEM 100
+
+struct SharedLayerTest {
+  unsigned int blocks_in_use;
+  CustomData data, data_shared;
+  MDeformVert *dvert;
+
+  SharedLayerTest()
+  {
+    blocks_in_use = MEM_get_memory_blocks_in_use();
+    CustomData_reset(&data);
+    dvert = (MDeformVert *)CustomData_add_layer(
+        &data, CD_MDEFORMVERT, CD_CALLOC, NULL, SHARED_TOTELEM);
+    fill_deform_verts(dvert, SHARED_TOTELEM);
+    CustomData_copy(&data, &data_shared, CD_MASK_ALL, CD_SHARED, SHARED_TOTELEM);
+  }
+
+  const MDeformVert *dvert_shared()
+  {
+    return (const MDeformVert *)CustomData_get_layer(&data_shared, CD_MDEFORMVERT);
+  }
+
+  bool is_shared()
+  {
+    return (data_shared.layers[0].flag & CD_FLAG_SHARED) != 0;
+  }
+
+  void expect_weights(const MDeformVert *dvert_test)
+  {
+    for (int i = 0; i < SHARED_TOTELEM; i++) {
+      ASSERT_EQ(dvert_test[i].totweight, i % 3);
+      for (int j = 0; j < dvert_test[i].totweight; j++) {
+        EXPECT_EQ(dvert_test[i].dw[j].def_nr, (i + j) % 7);
+      }
+    }
+  }
+};
+
+TEST(customdata, SharedLayerFreeSourceFirst)
+{
+  SharedLayerTest test;
+  EXPECT_EQ(test.dvert_shared(), test.dvert);
+  EXPECT_TRUE(test.is_shared());
+
+  CustomData_free(&test.data, SHARED_TOTELEM);
+  /* The copy frees the array, it's still valid. */
+  test.expect_weights(test.dvert_shared());
+  CustomData_free(&test.data_shared, SHARED_TOTELEM);
+
+  EXPECT_EQ(MEM_get_memory_blocks_in_use(), test.blocks_in_use);
+}
+
+TEST(customdata, SharedLayerFreeCopyFirst)
+{
+  SharedLayerTest test;
+
+  CustomData_free(&test.data_shared, SHARED_TOTELEM);
+  test.expect_weights(test.dvert);
+  CustomData_free(&test.data, SHARED_TOTELEM);
+
+  EXPECT_EQ(MEM_get_memory_blocks_in_use(), test.blocks_in_use);
+}
+
+TEST(customdata, SharedLayerDuplicateReferenced)
+{
+  SharedLayerTest test;
+
+  /* The copy gets its own array to write to, the source keeps its array. */
+  MDeformVert *dvert_copy = (MDeformVert *)CustomData_duplicate_referenced_layer(
+      &test.data_shared, CD_MDEFORMVERT, SHARED_TOTELEM);
+  EXPECT_NE(dvert_copy, test.dvert);
+  EXPECT_FALSE(test.is_shared());
+  EXPECT_FALSE(CustomData_is_referenced_layer(&test.data_shared, CD_MDEFORMVERT));
+  expect_deform_verts_copied(test.dvert, dvert_copy, SHARED_TOTELEM);
+
+  dvert_copy[1].dw[0].def_nr = 100;
+  EXPECT_EQ(test.dvert[1].dw[0].def_nr, 1);
+
+  /* Writing to the source while the array was shared leaves the array to the copy. */
+  CustomData_free(&test.data_shared, SHARED_TOTELEM);
+  CustomData_copy(&test.data, &test.data_shared, CD_MASK_ALL, CD_SHARED, SHARED_TOTELEM);
+  EXPECT_TRUE(test.is_shared());
+  MDeformVert *dvert_source = (MDeformVert *)CustomData_duplicate_referenced_layer(
+      &test.data, CD_MDEFORMVERT, SHARED_TOTELEM);
+  EXPECT_NE(dvert_source, test.dvert);
+  EXPECT_EQ(test.dvert_shared(), test.dvert);
+  test.expect_weights(dvert_source);
+
+  CustomData_free(&test.data, SHARED_TOTELEM);
+  test.expect_weights(test.dvert_shared());
+  CustomData_free(&test.data_shared, SHARED_TOTELEM);
+
+  EXPECT_EQ(MEM_get_memory_blocks_in_use(), test.blocks_in_use);
+}
+
+TEST(customdata, SharedLayerRealloc)
+{
+  SharedLayerTest test;
+
+  CustomData_realloc(&test.data_shared, SHARED_TOTELEM * 2);
+  EXPECT_NE(test.dvert_shared(), test.dvert);
+  EXPECT_FALSE(test.is_shared());
+  expect_deform_verts_copied(test.dvert, test.dvert_shared(), SHARED_TOTELEM);
+  test.expect_weights(test.dvert);
+
+  /* Added elements are not initialized. */
+  memset((void *)(test.dvert_shared() + SHARED_TOTELEM), 0, sizeof(MDeformVert) * SHARED_TOTELEM);
+  CustomData_free(&test.data_shared, SHARED_TOTELEM * 2);
+  CustomData_free(&test.data, SHARED_TOTELEM);
+
+  EXPECT_EQ(MEM_get_memory_blocks_in_use(), test.blocks_in_use);
+}
+
+TEST(customdata, SharedLayerSetLayer)
+{
+  SharedLayerTest test;
+
+  /* Replacing the array of the copy only stops sharing, the source still owns it. */
+  MDeformVert *dvert_new = (MDeformVert *)MEM_calloc_arrayN(
+      SHARED_TOTELEM, sizeof(MDeformVert), __func__);
+  CustomData_set_layer(&test.data_shared, CD_MDEFORMVERT, dvert_new);
+  EXPECT_EQ(test.dvert_shared(), dvert_new);
+  EXPECT_FALSE(test.is_shared());
+  test.expect_weights(test.dvert);
+
+  CustomData_free(&test.data_shared, SHARED_TOTELEM);
+  CustomData_free(&test.data, SHARED_TOTELEM);
+
+  EXPECT_EQ(MEM_get_memory_blocks_in_use(), test.blocks_in_use);
+}
+
+/** \} */
@@ -386,6 +386,32 @@ TEST(array_store, DoubleDiff)
   BLI_array_store_destroy(bs);
 }
 
+TEST(array_store, DoubleShared)
+{
+  BArrayStore *bs = BLI_array_store_create(1, 32);
+  const char data_src[] = "test";
+  const char *data_dst;
+
+  BArrayState *state_a = BLI_array_store_state_add(bs, data_src, sizeof(data_src), NULL);
+  BArrayState *state_b = BLI_array_store_state_add_shared(bs, state_a);
+
+  EXPECT_EQ(BLI_array_store_calc_size_compacted_get(bs), sizeof(data_src));
+  EXPECT_EQ(BLI_array_store_calc_size_expanded_get(bs), sizeof(data_src) * 2);
+  EXPECT_TRUE(BLI_array_store_is_valid(bs));
+
+  /* Removing the reference keeps the shared data. */
+  BLI_array_store_state_remove(bs, state_a);
+  EXPECT_TRUE(BLI_array_store_is_valid(bs));
+
+  size_t data_dst_len;
+  data_dst = (char *)BLI_array_store_state_data_get_alloc(state_b, &data_dst_len);
+  EXPECT_STREQ(data_src, data_dst);
+  EXPECT_EQ(data_dst_len, sizeof(data_src));
+  MEM_freeN((void *)data_dst);
+
+  BLI_array_store_destroy(bs);
+}
+
 TEST(array_store, TextMixed)
 {
   TESTBUFFER_STRINGS(1, 4, "", );
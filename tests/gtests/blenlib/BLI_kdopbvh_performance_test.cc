@@ -0,0 +1,275 @@
+/* Apache License, Version 2.0 */
+
+#include "testing/testing.h"
+
+#include "MEM_guardedalloc.h"
+
+extern "C" {
+#include "BLI_utildefines.h"
+
+#include "BLI_kdopbvh.h"
+#include "BLI_math.h"
+#include "BLI_rand.h"
+
+#include "PIL_time.h"
+}
+
+#include "stubs/bf_intern_eigen_stubs.h"
+
+#define NUM_RUN_AVERAGED 10
+#define NUM_QUERIES 200000
+
+/* Triangle mesh of a sphere with noisy displacement and rings concentrated towards one pole,
+ * so triangles have uneven sizes and density, closer to production meshes than a regular grid.
+ */
+typedef struct TestMesh {
+  float (*verts)[3];
+  int (*tris)[3];
+  int verts_len;
+  int tris_len;
+} TestMesh;
+
+static void test_mesh_create(TestMesh *mesh, const int segments, const int random_seed)
+{
+  const int rings = segments / 2;
+  struct RNG *rng = BLI_rng_new(random_seed);
+
+  mesh->verts_len = (rings + 1) * segments;
+  mesh->tris_len = rings * segments * 2;
+  mesh->verts = (float(*)[3])MEM_mallocN(sizeof(*mesh->verts) * mesh->verts_len, __func__);
+  mesh->tris = (int(*)[3])MEM_mallocN(sizeof(*mesh->tris) * mesh->tris_len, __func__);
+
+  for (int r = 0; r <= rings; r++) {
+    const float phi = (float)M_PI * powf((float)r / (float)rings, 3.0f);
+    for (int s = 0; s < segments; s++) {
+      const float theta = 2.0f * (float)M_PI * (float)s / (float)segments;
+      const float radius = 1.0f + 0.1f * sinf(theta * 7.0f) * sinf(phi * 5.0f) +
+                           0.02f * BLI_rng_get_float(rng);
+      float *co = mesh->verts[r * segments + s];
+      co[0] = radius * sinf(phi) * cosf(theta);
+      co[1] = radius * sinf(phi) * sinf(theta);
+      co[2] = radius * cosf(phi);
+    }
+  }
+
+  for (int r = 0; r < rings; r++) {
+    for (int s = 0; s < segments; s++) {
+      const int v1 = r * segments + s;
+      const int v2 = r * segments + (s + 1) % segments;
+      const int v3 = v1 + segments;
+      const int v4 = v2 + segments;
+      int *tri = mesh->tris[(r * segments + s) * 2];
+      ARRAY_SET_ITEMS(tri, v1, v3, v2);
+      ARRAY_SET_ITEMS(tri + 3, v2, v3, v4);
+    }
+  }
+  BLI_rng_free(rng);
+}
+
+static void test_mesh_free(TestMesh *mesh)
+{
+  MEM_freeN(mesh->verts);
+  MEM_freeN(mesh->tris);
+}
+
+static BVHTree *test_mesh_bvhtree(const TestMesh *mesh, const int balance_flag)
+{
+  BVHTree *tree = BLI_bvhtree_new(mesh->tris_len, 0.0f, 4, 6);
+  for (int i = 0; i < mesh->tris_len; i++) {
+    float co[3][3];
+    copy_v3_v3(co[0], mesh->verts[mesh->tris[i][0]]);
+    copy_v3_v3(co[1], mesh->verts[mesh->tris[i][1]]);
+    copy_v3_v3(co[2], mesh->verts[mesh->tris[i][2]]);
+    BLI_bvhtree_insert(tree, i, co[0], 3);
+  }
+  BLI_bvhtree_balance_ex(tree, balance_flag);
+  return tree;
+}
+
+static int test_mesh_refit_cb(void *userdata, int index, float r_co[BVH_REFIT_POINTS_MAX][3])
+{
+  const TestMesh *mesh = (const TestMesh *)userdata;
+  const int *tri = mesh->tris[index];
+  copy_v3_v3(r_co[0], mesh->verts[tri[0]]);
+  copy_v3_v3(r_co[1], mesh->verts[tri[1]]);
+  copy_v3_v3(r_co[2], mesh->verts[tri[2]]);
+  return 3;
+}
+
+static void test_mesh_raycast_cb(void *userdata,
+                                 int index,
+                                 const BVHTreeRay *ray,
+                                 BVHTreeRayHit *hit)
+{
+  const TestMesh *mesh = (const TestMesh *)userdata;
+  const int *tri = mesh->tris[index];
+  float dist;
+  if (isect_ray_tri_v3(ray->origin,
+                       ray->direction,
+                       mesh->verts[tri[0]],
+                       mesh->verts[tri[1]],
+                       mesh->verts[tri[2]],
+                       &dist,
+                       NULL) &&
+      dist < hit->dist) {
+    hit->index = index;
+    hit->dist = dist;
+  }
+}
+
+static void test_mesh_nearest_cb(void *userdata,
+                                 int index,
+                                 const float co[3],
+                                 BVHTreeNearest *nearest)
+{
+  const TestMesh *mesh = (const TestMesh *)userdata;
+  const int *tri = mesh->tris[index];
+  float nearest_tmp[3];
+  closest_on_tri_to_point_v3(
+      nearest_tmp, co, mesh->verts[tri[0]], mesh->verts[tri[1]], mesh->verts[tri[2]]);
+  const float dist_sq = len_squared_v3v3(co, nearest_tmp);
+  if (dist_sq < nearest->dist_sq) {
+    nearest->index = index;
+    nearest->dist_sq = dist_sq;
+    copy_v3_v3(nearest->co, nearest_tmp);
+  }
+}
+
+static void kdopbvh_query_test_do(const char *id, const int segments, const int balance_flag)
+{
+  TestMesh mesh;
+  test_mesh_create(&mesh, segments, 1234);
+
+  double build_time = 0.0;
+  for (int i = 0; i < NUM_RUN_AVERAGED; i++) {
+    const double init_time = PIL_check_seconds_timer();
+    BVHTree *tree = test_mesh_bvhtree(&mesh, balance_flag);
+    build_time += PIL_check_seconds_timer() - init_time;
+    BLI_bvhtree_free(tree);
+  }
+
+  BVHTree *tree = test_mesh_bvhtree(&mesh, balance_flag);
+  struct RNG *rng = BLI_rng_new(4321);
+
+  double refit_time = 0.0;
+  for (int i = 0; i < NUM_RUN_AVERAGED; i++) {
+    const double init_time = PIL_check_seconds_timer();
+    BLI_bvhtree_refit(tree, test_mesh_refit_cb, &mesh);
+    refit_time += PIL_check_seconds_timer() - init_time;
+  }
+
+  BVHTreeRay *rays = (BVHTreeRay *)MEM_mallocN(sizeof(*rays) * NUM_QUERIES, __func__);
+  BVHTreeRayHit *hits = (BVHTreeRayHit *)MEM_mallocN(sizeof(*hits) * NUM_QUERIES, __func__);
+  float(*nearest_co)[3] = (float(*)[3])MEM_mallocN(sizeof(*nearest_co) * NUM_QUERIES, __func__);
+  BVHTreeNearest *nearest = (BVHTreeNearest *)MEM_mallocN(sizeof(*nearest) * NUM_QUERIES,
+                                                          __func__);
+
+  /* Rays from around the mesh, towards a random point close to its center. */
+  for (int i = 0; i < NUM_QUERIES; i++) {
+    float *co = rays[i].origin, *dir = rays[i].direction;
+    BLI_rng_get_float_unit_v3(rng, co);
+    mul_v3_fl(co, 2.0f);
+    BLI_rng_get_float_unit_v3(rng, dir);
+    madd_v3_v3fl(dir, co, -1.0f);
+    normalize_v3(dir);
+    rays[i].radius = 0.0f;
+  }
+
+  /* Points inside and around the mesh. */
+  for (int i = 0; i < NUM_QUERIES; i++) {
+    BLI_rng_get_float_unit_v3(rng, nearest_co[i]);
+    mul_v3_fl(nearest_co[i], 0.5f + BLI_rng_get_float(rng));
+  }
+
+  int hits_len = 0;
+  double init_time = PIL_check_seconds_timer();
+  for (int i = 0; i < NUM_QUERIES; i++) {
+    BVHTreeRayHit hit;
+    hit.index = -1;
+    hit.dist = BVH_RAYCAST_DIST_MAX;
+    BLI_bvhtree_ray_cast(
+        tree, rays[i].origin, rays[i].direction, 0.0f, &hit, test_mesh_raycast_cb, &mesh);
+    hits_len += (hit.index != -1);
+  }
+  const double raycast_time = PIL_check_seconds_timer() - init_time;
+
+  init_time = PIL_check_seconds_timer();
+  for (int i = 0; i < NUM_QUERIES; i++) {
+    hits[i].index = -1;
+    hits[i].dist = BVH_RAYCAST_DIST_MAX;
+  }
+  BLI_bvhtree_ray_cast_batch(
+      tree, rays, NUM_QUERIES, hits, test_mesh_raycast_cb, &mesh, BVH_RAYCAST_DEFAULT);
+  const double raycast_batch_time = PIL_check_seconds_timer() - init_time;
+
+  init_time = PIL_check_seconds_timer();
+  for (int i = 0; i < NUM_QUERIES; i++) {
+    BVHTreeNearest nearest_single;
+    nearest_single.index = -1;
+    nearest_single.dist_sq = FLT_MAX;
+    BLI_bvhtree_find_nearest(tree, nearest_co[i], &nearest_single, test_mesh_nearest_cb, &mesh);
+    EXPECT_NE(nearest_single.index, -1);
+  }
+  const double nearest_time = PIL_check_seconds_timer() - init_time;
+
+  init_time = PIL_check_seconds_timer();
+  for (int i = 0; i < NUM_QUERIES; i++) {
+    nearest[i].index = -1;
+    nearest[i].dist_sq = FLT_MAX;
+  }
+  BLI_bvhtree_find_nearest_batch(
+      tree, nearest_co, NUM_QUERIES, nearest, test_mesh_nearest_cb, &mesh);
+  const double nearest_batch_time = PIL_check_seconds_timer() - init_time;
+
+  printf("\t%s (%d triangles): build %fs, refit %fs on average over %d runs\n",
+         id,
+         mesh.tris_len,
+         build_time / NUM_RUN_AVERAGED,
+         refit_time / NUM_RUN_AVERAGED,
+         NUM_RUN_AVERAGED);
+  printf("\t\tray-cast: %.0f rays/s (%d hits), nearest: %.0f queries/s\n",
+         (double)NUM_QUERIES / raycast_time,
+         hits_len,
+         (double)NUM_QUERIES / nearest_time);
+  printf("\t\tbatched ray-cast: %.0f rays/s, batched nearest: %.0f queries/s\n",
+         (double)NUM_QUERIES / raycast_batch_time,
+         (double)NUM_QUERIES / nearest_batch_time);
+
+  MEM_freeN(rays);
+  MEM_freeN(hits);
+  MEM_freeN(nearest_co);
+  MEM_freeN(nearest);
+  BLI_rng_free(rng);
+  BLI_bvhtree_free(tree);
+  test_mesh_free(&mesh);
+}
+
+TEST(kdopbvh, Query100K)
+{
+  kdopbvh_query_test_do("Median build", 224, 0);
+}
+
+TEST(kdopbvh, Query100KSAH)
+{
+  kdopbvh_query_test_do("SAH build", 224, BVH_BALANCE_SAH);
+}
+
+TEST(kdopbvh, Query100KWide)
+{
+  kdopbvh_query_test_do("Median build, wide nodes", 224, BVH_BALANCE_WIDE);
+}
+
+TEST(kdopbvh, Query100KSAHWide)
+{
+  kdopbvh_query_test_do("SAH build, wide nodes", 224, BVH_BALANCE_SAH | BVH_BALANCE_WIDE);
+}
+
+TEST(kdopbvh, Query1M)
+{
+  kdopbvh_query_test_do("Median build", 708, 0);
+}
+
+TEST(kdopbvh, Query1MSAHWide)
+{
+  kdopbvh_query_test_do("SAH build, wide nodes", 708, BVH_BALANCE_SAH | BVH_BALANCE_WIDE);
+}
@@ -70,11 +70,16 @@ static void optimal_check_callback(void *userdata,
  * Note that a small epsilon is added to the BVH nodes bounds, even if we pass in zero.
  * Use rounding to ensure very close nodes don't cause the wrong node to be found as nearest.
  */
-static void find_nearest_points_test(
-    int points_len, float scale, int round, int random_seed, bool optimal = false)
+static void find_nearest_points_test(int points_len,
+                                     float scale,
+                                     int round,
+                                     int random_seed,
+                                     bool optimal = false,
+                                     int balance_flag = 0,
+                                     char tree_type = 8)
 {
   struct RNG *rng = BLI_rng_new(random_seed);
-  BVHTree *tree = BLI_bvhtree_new(points_len, 0.0, 8, 8);
+  BVHTree *tree = BLI_bvhtree_new(points_len, 0.0, tree_type, 8);
 
   void *mem = MEM_mallocN(sizeof(float[3]) * points_len, __func__);
   float(*points)[3] = (float(*)[3])mem;
@@ -83,7 +88,7 @@ static void find_nearest_points_test(
     rng_v3_round(points[i], 3, rng, round, scale);
     BLI_bvhtree_insert(tree, i, points[i], 1);
   }
-  BLI_bvhtree_balance(tree);
+  BLI_bvhtree_balance_ex(tree, balance_flag);
 
   /* first find each point */
   BVHTree_NearestPointCallback callback = optimal ? optimal_check_callback : NULL;
@@ -136,3 +141,278 @@ TEST(kdopbvh, OptimalFindNearest_500)
 {
   find_nearest_points_test(500, 1.0, 1000, 12, true);
 }
+
+TEST(kdopbvh, FindNearest_500_SAH)
+{
+  find_nearest_points_test(500, 1.0, 1000, 12, false, BVH_BALANCE_SAH);
+}
+TEST(kdopbvh, FindNearest_500_Wide4)
+{
+  find_nearest_points_test(500, 1.0, 1000, 12, false, BVH_BALANCE_WIDE, 4);
+}
+TEST(kdopbvh, FindNearest_500_SAHWide8)
+{
+  find_nearest_points_test(500, 1.0, 1000, 12, false, BVH_BALANCE_SAH | BVH_BALANCE_WIDE);
+}
+TEST(kdopbvh, OptimalFindNearest_500_SAHWide4)
+{
+  find_nearest_points_test(500, 1.0, 1000, 12, true, BVH_BALANCE_SAH | BVH_BALANCE_WIDE, 4);
+}
+
+#define RAYCAST_SPHERE_RADIUS 0.02f
+
+/* Hit spheres around the points, so the closest hit doesn't depend on the tree layout. */
+static void raycast_sphere_callback(void *userdata,
+                                    int index,
+                                    const BVHTreeRay *ray,
+                                    BVHTreeRayHit *hit)
+{
+  const float(*points)[3] = (const float(*)[3])userdata;
+  float dir[3];
+  sub_v3_v3v3(dir, points[index], ray->origin);
+  const float t = dot_v3v3(dir, ray->direction);
+  const float dist_sq = len_squared_v3(dir) - t * t;
+  const float radius_sq = RAYCAST_SPHERE_RADIUS * RAYCAST_SPHERE_RADIUS;
+  if (dist_sq > radius_sq) {
+    return;
+  }
+  const float dist = t - sqrtf(radius_sq - dist_sq);
+  if (dist >= 0.0f && dist < hit->dist) {
+    hit->index = index;
+    hit->dist = dist;
+  }
+}
+
+static void raycast_points_test(int points_len, int rays_len, int random_seed)
+{
+  struct RNG *rng = BLI_rng_new(random_seed);
+  const int trees_len = 4;
+  const int balance_flags[trees_len] = {
+      0, BVH_BALANCE_SAH, BVH_BALANCE_WIDE, BVH_BALANCE_SAH | BVH_BALANCE_WIDE};
+  BVHTree *trees[trees_len];
+
+  float(*points)[3] = (float(*)[3])MEM_mallocN(sizeof(float[3]) * points_len, __func__);
+  for (int i = 0; i < points_len; i++) {
+    rng_v3_round(points[i], 3, rng, 1000, 1.0f);
+  }
+
+  for (int t = 0; t < trees_len; t++) {
+    trees[t] = BLI_bvhtree_new(points_len, RAYCAST_SPHERE_RADIUS, 4, 6);
+    for (int i = 0; i < points_len; i++) {
+      BLI_bvhtree_insert(trees[t], i, points[i], 1);
+    }
+    BLI_bvhtree_balance_ex(trees[t], balance_flags[t]);
+  }
+
+  int hits_len = 0;
+  for (int r = 0; r < rays_len; r++) {
+    float co[3], dir[3];
+    rng_v3_round(co, 3, rng, 1000, 2.0f);
+    BLI_rng_get_float_unit_v3(rng, dir);
+    /* Check axis aligned rays too. */
+    if (r % 8 == 0) {
+      dir[r % 3] = dir[(r + 1) % 3] = 0.0f;
+      normalize_v3(dir);
+    }
+
+    BVHTreeRayHit hit_first;
+    for (int t = 0; t < trees_len; t++) {
+      BVHTreeRayHit hit;
+      hit.index = -1;
+      hit.dist = BVH_RAYCAST_DIST_MAX;
+      BLI_bvhtree_ray_cast(trees[t], co, dir, 0.0f, &hit, raycast_sphere_callback, points);
+      if (t == 0) {
+        hit_first = hit;
+        hits_len += (hit.index != -1);
+      }
+      else {
+        EXPECT_EQ(hit_first.index, hit.index);
+        EXPECT_EQ(hit_first.dist, hit.dist);
+      }
+    }
+  }
+  /* Ensure the test is meaningful. */
+  EXPECT_GT(hits_len, 0);
+
+  for (int t = 0; t < trees_len; t++) {
+    BLI_bvhtree_free(trees[t]);
+  }
+  BLI_rng_free(rng);
+  MEM_freeN(points);
+}
+
+TEST(kdopbvh, RayCast_1000)
+{
+  raycast_points_test(1000, 1000, 123);
+}
+TEST(kdopbvh, RayCast_5000)
+{
+  raycast_points_test(5000, 1000, 12);
+}
+
+static void nearest_point_callback(void *userdata,
+                                   int index,
+                                   const float co[3],
+                                   BVHTreeNearest *nearest)
+{
+  const float(*points)[3] = (const float(*)[3])userdata;
+  const float dist_sq = len_squared_v3v3(co, points[index]);
+  if (dist_sq < nearest->dist_sq) {
+    nearest->index = index;
+    nearest->dist_sq = dist_sq;
+    copy_v3_v3(nearest->co, points[index]);
+  }
+}
+
+/* Batched queries must give the same results as one query at a time. */
+static void batch_points_test(int points_len, int queries_len, int random_seed, int balance_flag)
+{
+  struct RNG *rng = BLI_rng_new(random_seed);
+  BVHTree *tree = BLI_bvhtree_new(points_len, RAYCAST_SPHERE_RADIUS, 4, 6);
+
+  float(*points)[3] = (float(*)[3])MEM_mallocN(sizeof(float[3]) * points_len, __func__);
+  for (int i = 0; i < points_len; i++) {
+    rng_v3_round(points[i], 3, rng, 1000, 1.0f);
+    BLI_bvhtree_insert(tree, i, points[i], 1);
+  }
+  BLI_bvhtree_balance_ex(tree, balance_flag);
+
+  float(*co)[3] = (float(*)[3])MEM_mallocN(sizeof(float[3]) * queries_len, __func__);
+  BVHTreeNearest *nearest = (BVHTreeNearest *)MEM_mallocN(sizeof(*nearest) * queries_len,
+                                                          __func__);
+  BVHTreeRay *rays = (BVHTreeRay *)MEM_mallocN(sizeof(*rays) * queries_len, __func__);
+  BVHTreeRayHit *hits = (BVHTreeRayHit *)MEM_mallocN(sizeof(*hits) * queries_len, __func__);
+
+  for (int i = 0; i < queries_len; i++) {
+    rng_v3_round(co[i], 3, rng, 1000, 1.5f);
+    nearest[i].index = -1;
+    /* Limit the distance of some queries, so they find nothing. */
+    nearest[i].dist_sq = (i % 16 == 0) ? 1e-6f : FLT_MAX;
+
+    rng_v3_round(rays[i].origin, 3, rng, 1000, 2.0f);
+    BLI_rng_get_float_unit_v3(rng, rays[i].direction);
+    rays[i].radius = (i % 4 == 0) ? RAYCAST_SPHERE_RADIUS : 0.0f;
+    hits[i].index = -1;
+    hits[i].dist = BVH_RAYCAST_DIST_MAX;
+  }
+
+  BLI_bvhtree_find_nearest_batch(
+      tree, co, queries_len, nearest, nearest_point_callback, points);
+  BLI_bvhtree_ray_cast_batch(
+      tree, rays, queries_len, hits, raycast_sphere_callback, points, BVH_RAYCAST_DEFAULT);
+
+  int hits_len = 0;
+  for (int i = 0; i < queries_len; i++) {
+    BVHTreeNearest nearest_single;
+    nearest_single.index = -1;
+    nearest_single.dist_sq = (i % 16 == 0) ? 1e-6f : FLT_MAX;
+    BLI_bvhtree_find_nearest(tree, co[i], &nearest_single, nearest_point_callback, points);
+    EXPECT_EQ(nearest_single.index, nearest[i].index);
+    EXPECT_EQ(nearest_single.dist_sq, nearest[i].dist_sq);
+
+    BVHTreeRayHit hit_single;
+    hit_single.index = -1;
+    hit_single.dist = BVH_RAYCAST_DIST_MAX;
+    BLI_bvhtree_ray_cast(tree,
+                         rays[i].origin,
+                         rays[i].direction,
+                         rays[i].radius,
+                         &hit_single,
+                         raycast_sphere_callback,
+                         points);
+    EXPECT_EQ(hit_single.index, hits[i].index);
+    EXPECT_EQ(hit_single.dist, hits[i].dist);
+    hits_len += (hits[i].index != -1);
+  }
+  /* Ensure the test is meaningful. */
+  EXPECT_GT(hits_len, 0);
+
+  BLI_bvhtree_free(tree);
+  BLI_rng_free(rng);
+  MEM_freeN(points);
+  MEM_freeN(co);
+  MEM_freeN(nearest);
+  MEM_freeN(rays);
+  MEM_freeN(hits);
+}
+
+TEST(kdopbvh, Batch_100)
+{
+  batch_points_test(2000, 100, 12, 0);
+}
+TEST(kdopbvh, Batch_2000)
+{
+  batch_points_test(1000, 2000, 123, 0);
+}
+TEST(kdopbvh, Batch_2000_SAHWide)
+{
+  batch_points_test(5000, 2000, 1234, BVH_BALANCE_SAH | BVH_BALANCE_WIDE);
+}
+
+static int refit_points_callback(void *userdata, int index, float r_co[BVH_REFIT_POINTS_MAX][3])
+{
+  const float(*points)[3] = (const float(*)[3])userdata;
+  copy_v3_v3(r_co[0], points[index]);
+  return 1;
+}
+
+/* A refit tree must give the same results as a tree built for the moved points. */
+static void refit_points_test(int points_len, int random_seed, int balance_flag)
+{
+  struct RNG *rng = BLI_rng_new(random_seed);
+  BVHTree *tree = BLI_bvhtree_new(points_len, 0.0f, 4, 6);
+
+  float(*points)[3] = (float(*)[3])MEM_mallocN(sizeof(float[3]) * points_len, __func__);
+  for (int i = 0; i < points_len; i++) {
+    rng_v3_round(points[i], 3, rng, 1000, 1.0f);
+    BLI_bvhtree_insert(tree, i, points[i], 1);
+  }
+  BLI_bvhtree_balance_ex(tree, balance_flag);
+  const float cost_build = BLI_bvhtree_cost(tree);
+  EXPECT_GT(cost_build, 1.0f);
+
+  /* Deform, points stay close to their neighbors. */
+  for (int i = 0; i < points_len; i++) {
+    points[i][0] = points[i][0] * 2.0f + 0.1f;
+    points[i][1] += 0.5f * points[i][2];
+  }
+  BLI_bvhtree_refit(tree, refit_points_callback, points);
+  EXPECT_LT(BLI_bvhtree_cost(tree), cost_build * 1.5f);
+
+  BVHTree *tree_new = BLI_bvhtree_new(points_len, 0.0f, 4, 6);
+  for (int i = 0; i < points_len; i++) {
+    BLI_bvhtree_insert(tree_new, i, points[i], 1);
+  }
+  BLI_bvhtree_balance_ex(tree_new, balance_flag);
+
+  for (int i = 0; i < 200; i++) {
+    float co[3];
+    rng_v3_round(co, 3, rng, 1000, 2.0f);
+
+    BVHTreeNearest nearest, nearest_new;
+    nearest.index = nearest_new.index = -1;
+    nearest.dist_sq = nearest_new.dist_sq = FLT_MAX;
+    BLI_bvhtree_find_nearest(tree, co, &nearest, nearest_point_callback, points);
+    BLI_bvhtree_find_nearest(tree_new, co, &nearest_new, nearest_point_callback, points);
+    EXPECT_EQ(nearest.dist_sq, nearest_new.dist_sq);
+  }
+
+  /* Shuffle, the refit tree gets much worse than a new tree. */
+  BLI_array_randomize(points, sizeof(*points), points_len, random_seed);
+  BLI_bvhtree_refit(tree, refit_points_callback, points);
+  EXPECT_GT(BLI_bvhtree_cost(tree), cost_build * 1.5f);
+
+  BLI_bvhtree_free(tree);
+  BLI_bvhtree_free(tree_new);
+  BLI_rng_free(rng);
+  MEM_freeN(points);
+}
+
+TEST(kdopbvh, Refit_2000)
+{
+  refit_points_test(2000, 12, 0);
+}
+TEST(kdopbvh, Refit_2000_SAHWide)
+{
+  refit_points_test(2000, 123, BVH_BALANCE_SAH | BVH_BALANCE_WIDE);
+}
@@ -0,0 +1,123 @@
+/* Apache License, Version 2.0 */
+
+#include "testing/testing.h"
+
+#include "MEM_guardedalloc.h"
+
+extern "C" {
+#include "BLI_kdtree.h"
+#include "BLI_math_vector.h"
+#include "BLI_rand.h"
+
+#include "PIL_time.h"
+}
+
+#define NUM_RUN_AVERAGED 5
+#define NUM_NEAREST_N 8
+
+/* Points on a jittered grid, in grid order as vertices of a mesh usually are,
+ * every point has a close neighbor for the duplicates search. */
+static float (*kdtree_test_points(const int grid_len, const int random_seed))[3]
+{
+  const int points_len = grid_len * grid_len * grid_len;
+  struct RNG *rng = BLI_rng_new(random_seed);
+  float(*points)[3] = (float(*)[3])MEM_mallocN(sizeof(*points) * points_len, __func__);
+  for (int i = 0; i < points_len; i++) {
+    points[i][0] = (float)(i % grid_len);
+    points[i][1] = (float)((i / grid_len) % grid_len);
+    points[i][2] = (float)(i / (grid_len * grid_len));
+    for (int j = 0; j < 3; j++) {
+      points[i][j] += 0.9f * BLI_rng_get_float(rng);
+    }
+  }
+  BLI_rng_free(rng);
+  return points;
+}
+
+static KDTree_3d *kdtree_test_create(const float (*points)[3], const int points_len)
+{
+  KDTree_3d *tree = BLI_kdtree_3d_new((uint)points_len);
+  for (int i = 0; i < points_len; i++) {
+    BLI_kdtree_3d_insert(tree, i, points[i]);
+  }
+  BLI_kdtree_3d_balance(tree);
+  return tree;
+}
+
+static void kdtree_test_do(const int grid_len)
+{
+  const int points_len = grid_len * grid_len * grid_len;
+  float(*points)[3] = kdtree_test_points(grid_len, 1234);
+
+  double balance_time = 0.0;
+  for (int i = 0; i < NUM_RUN_AVERAGED; i++) {
+    const double init_time = PIL_check_seconds_timer();
+    KDTree_3d *tree = kdtree_test_create(points, points_len);
+    balance_time += PIL_check_seconds_timer() - init_time;
+    BLI_kdtree_3d_free(tree);
+  }
+
+  KDTree_3d *tree = kdtree_test_create(points, points_len);
+  KDTreeNearest_3d *nearest = (KDTreeNearest_3d *)MEM_mallocN(
+      sizeof(*nearest) * points_len * NUM_NEAREST_N, __func__);
+  int *nearest_len = (int *)MEM_mallocN(sizeof(int) * points_len, __func__);
+
+  double init_time = PIL_check_seconds_timer();
+  for (int i = 0; i < points_len; i++) {
+    BLI_kdtree_3d_find_nearest(tree, points[i], &nearest[i]);
+  }
+  const double nearest_time = PIL_check_seconds_timer() - init_time;
+
+  init_time = PIL_check_seconds_timer();
+  BLI_kdtree_3d_find_nearest_batch(tree, points, (uint)points_len, nearest);
+  const double nearest_batch_time = PIL_check_seconds_timer() - init_time;
+
+  init_time = PIL_check_seconds_timer();
+  for (int i = 0; i < points_len; i++) {
+    nearest_len[i] = BLI_kdtree_3d_find_nearest_n(
+        tree, points[i], &nearest[i * NUM_NEAREST_N], NUM_NEAREST_N);
+  }
+  const double nearest_n_time = PIL_check_seconds_timer() - init_time;
+
+  init_time = PIL_check_seconds_timer();
+  BLI_kdtree_3d_find_nearest_n_batch(
+      tree, points, (uint)points_len, nearest, NUM_NEAREST_N, nearest_len);
+  const double nearest_n_batch_time = PIL_check_seconds_timer() - init_time;
+
+  int *duplicates = (int *)MEM_mallocN(sizeof(int) * points_len, __func__);
+  for (int i = 0; i < points_len; i++) {
+    duplicates[i] = -1;
+  }
+  init_time = PIL_check_seconds_timer();
+  const int duplicates_len = BLI_kdtree_3d_calc_duplicates_fast(tree, 0.3f, true, duplicates);
+  const double duplicates_time = PIL_check_seconds_timer() - init_time;
+
+  printf("\t%d points: balance %fs on average over %d runs\n",
+         points_len,
+         balance_time / NUM_RUN_AVERAGED,
+         NUM_RUN_AVERAGED);
+  printf("\t\tnearest: %.0f queries/s, batched: %.0f queries/s\n",
+         (double)points_len / nearest_time,
+         (double)points_len / nearest_batch_time);
+  printf("\t\t%d nearest: %.0f queries/s, batched: %.0f queries/s\n",
+         NUM_NEAREST_N,
+         (double)points_len / nearest_n_time,
+         (double)points_len / nearest_n_batch_time);
+  printf("\t\tcalc duplicates fast: %fs (%d found)\n", duplicates_time, duplicates_len);
+
+  MEM_freeN(duplicates);
+  MEM_freeN(nearest);
+  MEM_freeN(nearest_len);
+  MEM_freeN(points);
+  BLI_kdtree_3d_free(tree);
+}
+
+TEST(kdtree, Query100K)
+{
+  kdtree_test_do(46);
+}
+
+TEST(kdtree, Query1M)
+{
+  kdtree_test_do(100);
+}
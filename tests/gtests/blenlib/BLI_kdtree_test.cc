@@ -0,0 +1,181 @@
+/* Apache License, Version 2.0 */
+
+#include "testing/testing.h"
+
+#include "MEM_guardedalloc.h"
+
+extern "C" {
+#include "BLI_kdtree.h"
+#include "BLI_math_vector.h"
+#include "BLI_rand.h"
+}
+
+/* -------------------------------------------------------------------- */
+/* Helper Functions */
+
+static KDTree_3d *kdtree_random_points(int points_len, int random_seed, float (**r_points)[3])
+{
+  struct RNG *rng = BLI_rng_new(random_seed);
+  float(*points)[3] = (float(*)[3])MEM_mallocN(sizeof(*points) * points_len, __func__);
+  KDTree_3d *tree = BLI_kdtree_3d_new(points_len);
+  for (int i = 0; i < points_len; i++) {
+    BLI_rng_get_float_unit_v3(rng, points[i]);
+    mul_v3_fl(points[i], BLI_rng_get_float(rng));
+    BLI_kdtree_3d_insert(tree, i, points[i]);
+  }
+  BLI_kdtree_3d_balance(tree);
+  BLI_rng_free(rng);
+  *r_points = points;
+  return tree;
+}
+
+static int brute_force_nearest(const float (*points)[3], int points_len, const float co[3])
+{
+  int index = -1;
+  float dist_sq_min = FLT_MAX;
+  for (int i = 0; i < points_len; i++) {
+    const float dist_sq = len_squared_v3v3(points[i], co);
+    if (dist_sq < dist_sq_min) {
+      dist_sq_min = dist_sq;
+      index = i;
+    }
+  }
+  return index;
+}
+
+/* -------------------------------------------------------------------- */
+/* Tests */
+
+TEST(kdtree, Empty)
+{
+  KDTree_3d *tree = BLI_kdtree_3d_new(0);
+  BLI_kdtree_3d_balance(tree);
+  const float co[1][3] = {{0.0f, 0.0f, 0.0f}};
+  KDTreeNearest_3d nearest;
+  BLI_kdtree_3d_find_nearest_batch(tree, co, 1, &nearest);
+  EXPECT_EQ(nearest.index, -1);
+  BLI_kdtree_3d_free(tree);
+}
+
+/* Large enough to be balanced in parallel. */
+static void find_nearest_test(int points_len, int queries_len, int random_seed)
+{
+  float(*points)[3];
+  KDTree_3d *tree = kdtree_random_points(points_len, random_seed, &points);
+
+  struct RNG *rng = BLI_rng_new(random_seed + 1);
+  float(*co)[3] = (float(*)[3])MEM_mallocN(sizeof(*co) * queries_len, __func__);
+  for (int i = 0; i < queries_len; i++) {
+    BLI_rng_get_float_unit_v3(rng, co[i]);
+    mul_v3_fl(co[i], 1.5f * BLI_rng_get_float(rng));
+  }
+
+  KDTreeNearest_3d *nearest = (KDTreeNearest_3d *)MEM_mallocN(sizeof(*nearest) * queries_len,
+                                                              __func__);
+  BLI_kdtree_3d_find_nearest_batch(tree, co, (uint)queries_len, nearest);
+
+  for (int i = 0; i < queries_len; i++) {
+    const int index = brute_force_nearest(points, points_len, co[i]);
+    EXPECT_EQ(BLI_kdtree_3d_find_nearest(tree, co[i], NULL), index);
+    EXPECT_EQ(nearest[i].index, index);
+    EXPECT_EQ_ARRAY(nearest[i].co, points[index], 3);
+  }
+
+  MEM_freeN(nearest);
+  MEM_freeN(co);
+  MEM_freeN(points);
+  BLI_rng_free(rng);
+  BLI_kdtree_3d_free(tree);
+}
+
+TEST(kdtree, FindNearest_100)
+{
+  find_nearest_test(100, 100, 12);
+}
+TEST(kdtree, FindNearest_20000)
+{
+  find_nearest_test(20000, 500, 123);
+}
+
+/* Batched k-nearest and range queries must give the same results as one query at a time. */
+TEST(kdtree, Batch_20000)
+{
+  const int points_len = 20000, queries_len = 1000, nearest_len_capacity = 8;
+  const float range = 0.05f;
+  float(*points)[3];
+  KDTree_3d *tree = kdtree_random_points(points_len, 1234, &points);
+
+  KDTreeNearest_3d *nearest_n = (KDTreeNearest_3d *)MEM_mallocN(
+      sizeof(*nearest_n) * queries_len * nearest_len_capacity, __func__);
+  int *nearest_n_len = (int *)MEM_mallocN(sizeof(int) * queries_len, __func__);
+  KDTreeNearest_3d **nearest_range = (KDTreeNearest_3d **)MEM_mallocN(
+      sizeof(*nearest_range) * queries_len, __func__);
+  int *nearest_range_len = (int *)MEM_mallocN(sizeof(int) * queries_len, __func__);
+
+  /* Query with the points of the tree, as for merging or neighbor searches. */
+  BLI_kdtree_3d_find_nearest_n_batch(
+      tree, points, (uint)queries_len, nearest_n, (uint)nearest_len_capacity, nearest_n_len);
+  BLI_kdtree_3d_range_search_batch(
+      tree, points, (uint)queries_len, range, nearest_range, nearest_range_len);
+
+  int found_len = 0;
+  for (int i = 0; i < queries_len; i++) {
+    KDTreeNearest_3d nearest_single[nearest_len_capacity];
+    const int nearest_single_len = BLI_kdtree_3d_find_nearest_n(
+        tree, points[i], nearest_single, (uint)nearest_len_capacity);
+    EXPECT_EQ(nearest_n_len[i], nearest_single_len);
+    for (int j = 0; j < nearest_single_len; j++) {
+      EXPECT_EQ(nearest_n[i * nearest_len_capacity + j].dist, nearest_single[j].dist);
+    }
+
+    KDTreeNearest_3d *range_single = NULL;
+    const int range_single_len = BLI_kdtree_3d_range_search(
+        tree, points[i], &range_single, range);
+    EXPECT_EQ(nearest_range_len[i], range_single_len);
+    for (int j = 0; j < range_single_len; j++) {
+      EXPECT_EQ(nearest_range[i][j].dist, range_single[j].dist);
+    }
+    found_len += range_single_len;
+
+    if (range_single) {
+      MEM_freeN(range_single);
+    }
+    if (nearest_range[i]) {
+      MEM_freeN(nearest_range[i]);
+    }
+  }
+  /* Ensure the test is meaningful, there are more points in range than the query point. */
+  EXPECT_GT(found_len, queries_len);
+
+  MEM_freeN(nearest_n);
+  MEM_freeN(nearest_n_len);
+  MEM_freeN(nearest_range);
+  MEM_freeN(nearest_range_len);
+  MEM_freeN(points);
+  BLI_kdtree_3d_free(tree);
+}
+
+TEST(kdtree, CalcDuplicatesFast)
+{
+  const int points_len = 100;
+  KDTree_3d *tree = BLI_kdtree_3d_new(points_len * 2);
+  float co[3];
+  for (int i = 0; i < points_len; i++) {
+    co[0] = (float)i;
+    co[1] = co[2] = 0.0f;
+    BLI_kdtree_3d_insert(tree, i, co);
+    co[1] = 0.001f;
+    BLI_kdtree_3d_insert(tree, points_len + i, co);
+  }
+  BLI_kdtree_3d_balance(tree);
+
+  int duplicates[points_len * 2];
+  for (int i = 0; i < points_len * 2; i++) {
+    duplicates[i] = -1;
+  }
+  EXPECT_EQ(BLI_kdtree_3d_calc_duplicates_fast(tree, 0.01f, true, duplicates), points_len);
+  for (int i = 0; i < points_len; i++) {
+    EXPECT_EQ(duplicates[points_len + i], i);
+  }
+  BLI_kdtree_3d_free(tree);
+}
@@ -0,0 +1,214 @@
+/* Apache License, Version 2.0 */
+
+#include "testing/testing.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "MEM_guardedalloc.h"
+
+extern "C" {
+#include "BLI_mempool.h"
+#include "BLI_utildefines.h"
+}
+
+#define NUM_THREADS 4
+#define NUM_ELEMS 10000
+
+namespace {
+
+struct TestElem {
+  int thread;
+  int index;
+};
+
+void alloc_elems(BLI_mempool *pool, TestElem **elems, const int thread)
+{
+  for (int i = 0; i < NUM_ELEMS; i++) {
+    elems[i] = (TestElem *)BLI_mempool_alloc(pool);
+    elems[i]->thread = thread;
+    elems[i]->index = i;
+  }
+}
+
+void free_elems(BLI_mempool *pool, TestElem **elems, const int step)
+{
+  for (int i = 0; i < NUM_ELEMS; i += step) {
+    BLI_mempool_free(pool, elems[i]);
+    elems[i] = NULL;
+  }
+}
+
+void alloc_elems_threaded(BLI_mempool *pool, std::vector<TestElem *> &elems)
+{
+  std::vector<std::thread> threads;
+  for (int t = 0; t < NUM_THREADS; t++) {
+    threads.emplace_back(alloc_elems, pool, &elems[(size_t)t * NUM_ELEMS], t);
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
+
+std::vector<TestElem *> pool_elems(BLI_mempool *pool)
+{
+  std::vector<TestElem *> elems;
+  BLI_mempool_iter iter;
+  BLI_mempool_iternew(pool, &iter);
+  while (TestElem *elem = (TestElem *)BLI_mempool_iterstep(&iter)) {
+    elems.push_back(elem);
+  }
+  std::sort(elems.begin(), elems.end());
+  return elems;
+}
+
+std::vector<TestElem *> live_elems(std::vector<TestElem *> elems)
+{
+  elems.erase(std::remove(elems.begin(), elems.end(), nullptr), elems.end());
+  std::sort(elems.begin(), elems.end());
+  return elems;
+}
+
+}  // namespace
+
+TEST(mempool, ThreadedAlloc)
+{
+  BLI_mempool *pool = BLI_mempool_create(
+      sizeof(TestElem), 0, 512, BLI_MEMPOOL_ALLOW_ITER | BLI_MEMPOOL_THREADED);
+  std::vector<TestElem *> elems(NUM_THREADS * NUM_ELEMS);
+
+  alloc_elems_threaded(pool, elems);
+  EXPECT_EQ(BLI_mempool_len(pool), NUM_THREADS * NUM_ELEMS);
+  for (int t = 0; t < NUM_THREADS; t++) {
+    for (int i = 0; i < NUM_ELEMS; i++) {
+      const TestElem *elem = elems[(size_t)(t * NUM_ELEMS + i)];
+      EXPECT_EQ(elem->thread, t);
+      EXPECT_EQ(elem->index, i);
+    }
+  }
+  EXPECT_EQ(pool_elems(pool), live_elems(elems));
+
+  BLI_mempool_destroy(pool);
+}
+
+TEST(mempool, ThreadedFree)
+{
+  BLI_mempool *pool = BLI_mempool_create(
+      sizeof(TestElem), 1000, 512, BLI_MEMPOOL_ALLOW_ITER | BLI_MEMPOOL_THREADED);
+  std::vector<TestElem *> elems(NUM_THREADS * NUM_ELEMS);
+  alloc_elems_threaded(pool, elems);
+
+  /* Free part of the elements of another thread, while allocating more. */
+  std::vector<TestElem *> elems_extra(NUM_THREADS * NUM_ELEMS);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < NUM_THREADS; t++) {
+    threads.emplace_back([&, t]() {
+      free_elems(pool, &elems[(size_t)((t + 1) % NUM_THREADS) * NUM_ELEMS], 3);
+      alloc_elems(pool, &elems_extra[(size_t)t * NUM_ELEMS], t);
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  std::vector<TestElem *> elems_all = elems;
+  elems_all.insert(elems_all.end(), elems_extra.begin(), elems_extra.end());
+  elems_all = live_elems(elems_all);
+  EXPECT_EQ(std::adjacent_find(elems_all.begin(), elems_all.end()), elems_all.end());
+  EXPECT_EQ(BLI_mempool_len(pool), (int)elems_all.size());
+  EXPECT_EQ(pool_elems(pool), elems_all);
+
+  /* Free everything from a single thread. */
+  for (TestElem *elem : elems_all) {
+    BLI_mempool_free(pool, elem);
+  }
+  EXPECT_EQ(BLI_mempool_len(pool), 0);
+  EXPECT_TRUE(pool_elems(pool).empty());
+
+  BLI_mempool_destroy(pool);
+}
+
+TEST(mempool, ThreadedClear)
+{
+  BLI_mempool *pool = BLI_mempool_create(
+      sizeof(TestElem), 0, 512, BLI_MEMPOOL_ALLOW_ITER | BLI_MEMPOOL_THREADED);
+  std::vector<TestElem *> elems(NUM_THREADS * NUM_ELEMS);
+
+  for (int run = 0; run < 3; run++) {
+    alloc_elems_threaded(pool, elems);
+    EXPECT_EQ(BLI_mempool_len(pool), NUM_THREADS * NUM_ELEMS);
+    EXPECT_EQ(pool_elems(pool), live_elems(elems));
+
+    BLI_mempool_clear_ex(pool, run == 1 ? 1000 : -1);
+    EXPECT_EQ(BLI_mempool_len(pool), 0);
+    EXPECT_TRUE(pool_elems(pool).empty());
+  }
+
+  BLI_mempool_destroy(pool);
+}
+
+TEST(mempool, ThreadedTable)
+{
+  BLI_mempool *pool = BLI_mempool_create(
+      sizeof(TestElem), 0, 512, BLI_MEMPOOL_ALLOW_ITER | BLI_MEMPOOL_THREADED);
+  std::vector<TestElem *> elems(NUM_THREADS * NUM_ELEMS);
+  alloc_elems_threaded(pool, elems);
+
+  TestElem **table = (TestElem **)BLI_mempool_as_tableN(pool, __func__);
+  std::vector<TestElem *> elems_table(table, table + NUM_THREADS * NUM_ELEMS);
+  std::sort(elems_table.begin(), elems_table.end());
+  EXPECT_EQ(elems_table, live_elems(elems));
+  MEM_freeN(table);
+
+  BLI_mempool_destroy(pool);
+}
+
+TEST(mempool, ThreadedSlotCollision)
+{
+  /* More pools than thread slots, so some of them share a slot. */
+  std::vector<BLI_mempool *> pools;
+  for (int i = 0; i < 33; i++) {
+    pools.push_back(BLI_mempool_create(sizeof(TestElem), 0, 512, BLI_MEMPOOL_THREADED));
+  }
+
+  /* Free elements of the thread are used again after another pool took the slot. */
+  for (int run = 0; run < 3; run++) {
+    void *elem_first = BLI_mempool_alloc(pools[0]);
+    BLI_mempool_free(pools[0], elem_first);
+    for (BLI_mempool *pool : pools) {
+      BLI_mempool_free(pool, BLI_mempool_alloc(pool));
+    }
+    void *elem = BLI_mempool_alloc(pools[0]);
+    EXPECT_EQ(elem, elem_first);
+    BLI_mempool_free(pools[0], elem);
+  }
+
+  for (BLI_mempool *pool : pools) {
+    BLI_mempool_destroy(pool);
+  }
+}
+
+TEST(mempool, ThreadedRelease)
+{
+  BLI_mempool *pool = BLI_mempool_create(sizeof(TestElem), 0, 512, BLI_MEMPOOL_THREADED);
+  std::vector<TestElem *> elems(NUM_ELEMS);
+  std::thread(alloc_elems, pool, elems.data(), 0).join();
+
+  /* Freeing from another thread hands all but a few chunks back to the pool. */
+  for (TestElem *elem : elems) {
+    BLI_mempool_free(pool, elem);
+  }
+  std::vector<TestElem *> elems_extra;
+  std::thread([&]() {
+    for (int i = 0; i < NUM_ELEMS / 2; i++) {
+      elems_extra.push_back((TestElem *)BLI_mempool_alloc(pool));
+    }
+  }).join();
+  std::sort(elems.begin(), elems.end());
+  for (TestElem *elem : elems_extra) {
+    EXPECT_TRUE(std::binary_search(elems.begin(), elems.end(), elem));
+  }
+
+  BLI_mempool_destroy(pool);
+}
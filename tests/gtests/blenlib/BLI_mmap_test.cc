@@ -0,0 +1,98 @@
+/* Apache License, Version 2.0 */
+
+#include "testing/testing.h"
+
+#include <fcntl.h>
+#include <string>
+#include <vector>
+
+#ifndef WIN32
+#  include <unistd.h>
+#else
+#  include <io.h>
+#endif
+
+#include "BLI_fileops.h"
+#include "BLI_mmap.h"
+#include "BLI_utildefines.h"
+
+#define PAGE_LEN 4096
+#define FILE_LEN (PAGE_LEN * 4)
+
+class MmapTest : public testing::Test {
+ protected:
+  std::string filepath;
+  std::vector<char> data;
+  int file = -1;
+
+  virtual void SetUp()
+  {
+    filepath = testing::internal::TempDir() + "BLI_mmap_test.bin";
+    for (int i = 0; i < FILE_LEN; i++) {
+      data.push_back((char)(i % 251 + 1));
+    }
+    FILE *stream = BLI_fopen(filepath.c_str(), "wb");
+    ASSERT_NE(nullptr, stream);
+    ASSERT_EQ(data.size(), fwrite(data.data(), 1, data.size(), stream));
+    fclose(stream);
+    file = BLI_open(filepath.c_str(), O_BINARY | O_RDWR, 0);
+    ASSERT_NE(-1, file);
+  }
+
+  virtual void TearDown()
+  {
+    close(file);
+    BLI_delete(filepath.c_str(), false, false);
+  }
+};
+
+TEST_F(MmapTest, Read)
+{
+  BLI_mmap_file *mmap_file = BLI_mmap_open(file);
+  ASSERT_NE(nullptr, mmap_file);
+  EXPECT_EQ(FILE_LEN, BLI_mmap_get_length(mmap_file));
+
+  char buffer[100];
+  EXPECT_TRUE(BLI_mmap_read(mmap_file, buffer, PAGE_LEN + 10, sizeof(buffer)));
+  EXPECT_EQ(0, memcmp(buffer, &data[PAGE_LEN + 10], sizeof(buffer)));
+  /* Reading beyond the end of the file isn't an IO error. */
+  EXPECT_FALSE(BLI_mmap_read(mmap_file, buffer, FILE_LEN - 10, sizeof(buffer)));
+  EXPECT_FALSE(BLI_mmap_any_io_error(mmap_file));
+
+  BLI_mmap_free(mmap_file);
+}
+
+#ifndef WIN32
+/* Pages beyond the end of a file which was truncated after mapping it fail to load. */
+TEST_F(MmapTest, TruncatedRead)
+{
+  BLI_mmap_file *mmap_file = BLI_mmap_open(file);
+  ASSERT_NE(nullptr, mmap_file);
+  ASSERT_EQ(0, ftruncate(file, PAGE_LEN));
+
+  char buffer[100];
+  EXPECT_FALSE(BLI_mmap_read(mmap_file, buffer, PAGE_LEN * 2, sizeof(buffer)));
+  EXPECT_TRUE(BLI_mmap_any_io_error(mmap_file));
+  /* All reads fail from then on, also of pages still in the file. */
+  EXPECT_FALSE(BLI_mmap_read(mmap_file, buffer, 0, sizeof(buffer)));
+  EXPECT_EQ(nullptr, BLI_mmap_get_pointer(mmap_file, 0, sizeof(buffer)));
+
+  BLI_mmap_free(mmap_file);
+}
+
+TEST_F(MmapTest, TruncatedPointer)
+{
+  BLI_mmap_file *mmap_file = BLI_mmap_open(file);
+  ASSERT_NE(nullptr, mmap_file);
+  const char *memory = (const char *)BLI_mmap_get_pointer(mmap_file, 0, FILE_LEN);
+  ASSERT_NE(nullptr, memory);
+  EXPECT_EQ(data[PAGE_LEN * 3], memory[PAGE_LEN * 3]);
+  ASSERT_EQ(0, ftruncate(file, PAGE_LEN));
+
+  /* Memory which failed to load reads as zeros. */
+  EXPECT_EQ(0, ((volatile const char *)memory)[PAGE_LEN * 3]);
+  EXPECT_TRUE(BLI_mmap_any_io_error(mmap_file));
+
+  BLI_mmap_free(mmap_file);
+}
+#endif
@@ -296,3 +296,198 @@ TEST(task, ListBaseIter100k)
 {
   task_listbase_test("ListBase parallel iteration - Threaded - 100000 items", 100000, true);
 }
+
+/* *** Task pool scaling with the number of threads. *** */
+
+#define SCALING_NUM_RUN_AVERAGED 10
+#define SCALING_TREE_DEPTH 14
+
+typedef struct TaskScalingData {
+  int depth;
+  uint seed;
+} TaskScalingData;
+
+static void task_scaling_work(uint seed, uint *num_done)
+{
+  const uint limit = gen_pseudo_random_number(seed);
+  for (uint i = seed; i < limit;) {
+    i += gen_pseudo_random_number(i);
+  }
+  atomic_add_and_fetch_uint32(num_done, 1);
+}
+
+/* Each task spawns two children from its own thread, leaves do the actual work. */
+static void task_scaling_tree_func(TaskPool *__restrict pool, void *taskdata, int thread_id)
+{
+  const TaskScalingData *data = (const TaskScalingData *)taskdata;
+  uint *num_done = (uint *)BLI_task_pool_userdata(pool);
+
+  if (data->depth == 0) {
+    task_scaling_work(data->seed, num_done);
+    return;
+  }
+
+  for (int i = 0; i < 2; i++) {
+    TaskScalingData *child = (TaskScalingData *)MEM_mallocN(sizeof(*child), __func__);
+    child->depth = data->depth - 1;
+    child->seed = data->seed * 2 + (uint)i;
+    BLI_task_pool_push_from_thread(pool, task_scaling_tree_func, child, true, NULL, thread_id);
+  }
+}
+
+static void task_scaling_flat_func(TaskPool *__restrict pool,
+                                   void *taskdata,
+                                   int UNUSED(thread_id))
+{
+  uint *num_done = (uint *)BLI_task_pool_userdata(pool);
+  task_scaling_work((uint)POINTER_AS_INT(taskdata), num_done);
+}
+
+static double task_scaling_tree_do(TaskScheduler *scheduler)
+{
+  uint num_done = 0;
+  const double init_time = PIL_check_seconds_timer();
+
+  TaskPool *pool = BLI_task_pool_create(scheduler, &num_done, TASK_PRIORITY_HIGH);
+  TaskScalingData *root = (TaskScalingData *)MEM_mallocN(sizeof(*root), __func__);
+  root->depth = SCALING_TREE_DEPTH;
+  root->seed = 1;
+  BLI_task_pool_push(pool, task_scaling_tree_func, root, true, NULL);
+  BLI_task_pool_work_and_wait(pool);
+  BLI_task_pool_free(pool);
+
+  const double time = PIL_check_seconds_timer() - init_time;
+  EXPECT_EQ(num_done, 1u << SCALING_TREE_DEPTH);
+  return time;
+}
+
+static double task_scaling_flat_do(TaskScheduler *scheduler)
+{
+  const int num_tasks = 1 << SCALING_TREE_DEPTH;
+  uint num_done = 0;
+  const double init_time = PIL_check_seconds_timer();
+
+  TaskPool *pool = BLI_task_pool_create(scheduler, &num_done, TASK_PRIORITY_HIGH);
+  for (int i = 0; i < num_tasks; i++) {
+    BLI_task_pool_push_from_thread(
+        pool, task_scaling_flat_func, POINTER_FROM_INT(i), false, NULL, 0);
+  }
+  BLI_task_pool_work_and_wait(pool);
+  BLI_task_pool_free(pool);
+
+  const double time = PIL_check_seconds_timer() - init_time;
+  EXPECT_EQ(num_done, (uint)num_tasks);
+  return time;
+}
+
+/* Print time and speed-up over a single thread for increasing number of threads. */
+static void task_scaling_test(const char *id, double (*test_fn)(TaskScheduler *scheduler))
+{
+  printf("\n========== STARTING %s ==========\n", id);
+  printf("\tThreads     Time     Speed-up\n");
+
+  BLI_threadapi_init();
+
+  const int max_threads = MAX2(BLI_system_thread_count(), 8);
+  double single_thread_time = 0.0;
+  for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+    TaskScheduler *scheduler = BLI_task_scheduler_create(num_threads);
+
+    double averaged_timing = 0.0;
+    for (int i = 0; i < SCALING_NUM_RUN_AVERAGED; i++) {
+      averaged_timing += test_fn(scheduler);
+    }
+    averaged_timing /= SCALING_NUM_RUN_AVERAGED;
+
+    BLI_task_scheduler_free(scheduler);
+
+    if (num_threads == 1) {
+      single_thread_time = averaged_timing;
+    }
+    printf("\t%7d  %fs  %7.2fx\n",
+           num_threads,
+           averaged_timing,
+           single_thread_time / averaged_timing);
+  }
+
+  BLI_threadapi_exit();
+
+  printf("========== ENDED %s ==========\n\n", id);
+}
+
+TEST(task, PoolScalingTree)
+{
+  task_scaling_test("Task pool scaling - Tasks spawned from tasks", task_scaling_tree_do);
+}
+
+TEST(task, PoolScalingFlat)
+{
+  task_scaling_test("Task pool scaling - Tasks pushed from main thread", task_scaling_flat_do);
+}
+
+/* *** Memory bound loops on NUMA systems. *** */
+
+#define NUMA_NUM_ITEMS (16 * 1024 * 1024)
+#define NUMA_NUM_PASSES 20
+
+static void task_numa_init_func(void *userdata,
+                                int index,
+                                const TaskParallelTLS *__restrict UNUSED(tls))
+{
+  float *data = (float *)userdata;
+  data[index] = (float)(index & 1023);
+}
+
+static void task_numa_update_func(void *userdata,
+                                  int index,
+                                  const TaskParallelTLS *__restrict UNUSED(tls))
+{
+  float *data = (float *)userdata;
+  data[index] = data[index] * 0.5f + 1.0f;
+}
+
+/* Memory is first touched by a parallel loop, then updated by loops with the same scheduling
+ * mode. With NUMA local scheduling the pages are allocated on the node which updates them, the
+ * difference with dynamic scheduling is the cost of accessing memory of other nodes. */
+static double task_numa_test_do(const eTaskSchedulingMode scheduling_mode)
+{
+  TaskParallelSettings settings;
+  BLI_parallel_range_settings_defaults(&settings);
+  settings.scheduling_mode = scheduling_mode;
+
+  float *data = (float *)MEM_mallocN(sizeof(float) * NUMA_NUM_ITEMS, __func__);
+  BLI_task_parallel_range(0, NUMA_NUM_ITEMS, data, task_numa_init_func, &settings);
+
+  const double init_time = PIL_check_seconds_timer();
+  for (int i = 0; i < NUMA_NUM_PASSES; i++) {
+    BLI_task_parallel_range(0, NUMA_NUM_ITEMS, data, task_numa_update_func, &settings);
+  }
+  const double time = PIL_check_seconds_timer() - init_time;
+
+  MEM_freeN(data);
+  return time;
+}
+
+TEST(task, RangeNumaFirstTouch)
+{
+  printf("\n========== STARTING Range NUMA first touch ==========\n");
+
+  BLI_threadapi_init();
+
+  TaskScheduler *scheduler = BLI_task_scheduler_get();
+  printf("\tNUMA nodes: %d, threads: %d\n",
+         BLI_task_scheduler_num_numa_nodes(scheduler),
+         BLI_task_scheduler_num_threads(scheduler));
+
+  const double dynamic_time = task_numa_test_do(TASK_SCHEDULING_DYNAMIC);
+  const double numa_time = task_numa_test_do(TASK_SCHEDULING_NUMA_LOCAL);
+  printf("\tDynamic scheduling: %fs for %d passes\n", dynamic_time, NUMA_NUM_PASSES);
+  printf("\tNUMA local scheduling: %fs for %d passes (%.2fx)\n",
+         numa_time,
+         NUMA_NUM_PASSES,
+         dynamic_time / numa_time);
+
+  BLI_threadapi_exit();
+
+  printf("========== ENDED Range NUMA first touch ==========\n\n");
+}
@@ -65,6 +65,34 @@ TEST(task, RangeIter)
   BLI_threadapi_exit();
 }
 
+TEST(task, RangeIterNumaLocal)
+{
+  int data[NUM_ITEMS + 1] = {0};
+  int sum = 0;
+
+  BLI_threadapi_init();
+
+  TaskParallelSettings settings;
+  BLI_parallel_range_settings_defaults(&settings);
+  settings.scheduling_mode = TASK_SCHEDULING_NUMA_LOCAL;
+  settings.min_iter_per_thread = 1;
+
+  settings.userdata_chunk = &sum;
+  settings.userdata_chunk_size = sizeof(sum);
+  settings.func_finalize = task_range_iter_finalize_func;
+
+  BLI_task_parallel_range(0, NUM_ITEMS, data, task_range_iter_func, &settings);
+
+  int expected_sum = 0;
+  for (int i = 0; i < NUM_ITEMS; i++) {
+    EXPECT_EQ(data[i], i);
+    expected_sum += i;
+  }
+  EXPECT_EQ(data[NUM_ITEMS], expected_sum);
+
+  BLI_threadapi_exit();
+}
+
 TEST(task, RangeIterPool)
 {
   const int num_tasks = 10;
@@ -253,3 +281,54 @@ TEST(task, ListBaseIter)
   MEM_freeN(items_buffer);
   BLI_threadapi_exit();
 }
+
+/* *** Nested fork-join with task groups. *** */
+
+#define NUM_GROUPS 16
+#define NUM_GROUP_ITEMS 64
+
+static void task_group_item_func(TaskPool *__restrict pool, void *taskdata, int UNUSED(threadid))
+{
+  int *data = (int *)BLI_task_pool_userdata(pool);
+  atomic_add_and_fetch_int32(&data[POINTER_AS_INT(taskdata)], 1);
+}
+
+static void task_group_func(TaskPool *__restrict pool, void *taskdata, int threadid)
+{
+  int *data = (int *)BLI_task_pool_userdata(pool);
+  const int group_index = POINTER_AS_INT(taskdata);
+
+  TaskGroup *group = BLI_task_group_create(pool, threadid);
+  for (int i = 0; i < NUM_GROUP_ITEMS; i++) {
+    BLI_task_group_push(
+        group, task_group_item_func, POINTER_FROM_INT(group_index), false, NULL);
+  }
+  BLI_task_group_work_and_wait_reentrant(group);
+  BLI_task_group_free(group);
+
+  /* Only the tasks of this group are guaranteed to be done here. */
+  EXPECT_EQ(data[group_index], NUM_GROUP_ITEMS);
+}
+
+TEST(task, GroupNested)
+{
+  int data[NUM_GROUPS] = {0};
+
+  BLI_threadapi_init();
+
+  TaskScheduler *scheduler = BLI_task_scheduler_get();
+  TaskPool *pool = BLI_task_pool_create(scheduler, data, TASK_PRIORITY_HIGH);
+  BLI_task_pool_set_reentrant(pool, true);
+
+  for (int i = 0; i < NUM_GROUPS; i++) {
+    BLI_task_pool_push(pool, task_group_func, POINTER_FROM_INT(i), false, NULL);
+  }
+  BLI_task_pool_work_and_wait(pool);
+  BLI_task_pool_free(pool);
+
+  for (int i = 0; i < NUM_GROUPS; i++) {
+    EXPECT_EQ(data[i], NUM_GROUP_ITEMS);
+  }
+
+  BLI_threadapi_exit();
+}
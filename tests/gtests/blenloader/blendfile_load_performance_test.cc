@@ -0,0 +1,126 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2020 by Blender Foundation.
+ */
+#include "blendfile_loading_base_test.h"
+
+#include "MEM_guardedalloc.h"
+
+extern "C" {
+#include "BKE_appdir.h"
+#include "BKE_customdata.h"
+#include "BKE_global.h"
+#include "BKE_main.h"
+#include "BKE_mesh.h"
+#include "BKE_text.h"
+
+#include "BLI_fileops.h"
+#include "BLI_path_util.h"
+#include "BLI_string.h"
+
+#include "BLO_readfile.h"
+#include "BLO_writefile.h"
+
+#include "DNA_mesh_types.h"
+#include "DNA_meshdata_types.h"
+
+#include "PIL_time.h"
+}
+
+/* Number of times each file is loaded, the average is reported. */
+#define NUM_RUN_AVERAGED 10
+
+#define TEXTS_NUM 50
+#define TEXT_LINES_NUM 5000
+#define MESHES_NUM 50
+#define MESH_VERTS_NUM 100000
+
+class BlendfileLoadPerformanceTest : public BlendfileLoadingBaseTest {
+ protected:
+  /* Write a synthetic file with many IDs and data blocks, exercising the OldNewMap. */
+  void synthetic_file_write(const char *filepath, const int write_flags);
+  void loads_per_second(const char *id, const int write_flags);
+};
+
+void BlendfileLoadPerformanceTest::synthetic_file_write(const char *filepath,
+                                                        const int write_flags)
+{
+  Main *bmain = BKE_main_new();
+
+  for (int i = 0; i < TEXTS_NUM; i++) {
+    Text *text = BKE_text_add(bmain, "PerformanceText");
+    for (int j = 0; j < TEXT_LINES_NUM; j++) {
+      char line[64];
+      BLI_snprintf(line, sizeof(line), "text %d line %d\n", i, j);
+      BKE_text_write(text, line);
+    }
+  }
+
+  for (int i = 0; i < MESHES_NUM; i++) {
+    Mesh *mesh = BKE_mesh_add(bmain, "PerformanceMesh");
+    mesh->totvert = MESH_VERTS_NUM;
+    CustomData_add_layer(&mesh->vdata, CD_MVERT, CD_CALLOC, NULL, MESH_VERTS_NUM);
+    BKE_mesh_update_customdata_pointers(mesh, false);
+    for (int j = 0; j < MESH_VERTS_NUM; j++) {
+      mesh->mvert[j].co[0] = (float)j;
+      mesh->mvert[j].co[1] = (float)i;
+    }
+  }
+
+  EXPECT_TRUE(BLO_write_file(bmain, filepath, write_flags, NULL, NULL));
+  BKE_main_free(bmain);
+}
+
+void BlendfileLoadPerformanceTest::loads_per_second(const char *id, const int write_flags)
+{
+  char filepath[FILE_MAX];
+
+  BKE_tempdir_init(NULL);
+  BLI_join_dirfile(filepath, sizeof(filepath), BKE_tempdir_session(), "performance_test.blend");
+
+  printf("\n========== STARTING %s ==========\n", id);
+
+  synthetic_file_write(filepath, write_flags);
+
+  double time_total = 0.0;
+  for (int i = 0; i < NUM_RUN_AVERAGED; i++) {
+    const double time_start = PIL_check_seconds_timer();
+    bfile = BLO_read_from_file(filepath, BLO_READ_SKIP_NONE, NULL);
+    time_total += PIL_check_seconds_timer() - time_start;
+
+    ASSERT_NE(nullptr, bfile);
+    blendfile_free();
+  }
+
+  printf("%s: %.4fs per load, %.2f loads per second (averaged over %d runs)\n",
+         id,
+         time_total / NUM_RUN_AVERAGED,
+         NUM_RUN_AVERAGED / time_total,
+         NUM_RUN_AVERAGED);
+  printf("========== ENDED %s ==========\n\n", id);
+
+  BLI_delete(filepath, false, false);
+}
+
+TEST_F(BlendfileLoadPerformanceTest, Uncompressed)
+{
+  loads_per_second("Uncompressed", 0);
+}
+
+TEST_F(BlendfileLoadPerformanceTest, Compressed)
+{
+  loads_per_second("Compressed", G_FILE_COMPRESS);
+}
@@ -17,7 +17,45 @@
  */
 #include "blendfile_loading_base_test.h"
 
+#include "MEM_guardedalloc.h"
+
+extern "C" {
+#include "BKE_appdir.h"
+#include "BKE_customdata.h"
+#include "BKE_global.h"
+#include "BKE_lib_id.h"
+#include "BKE_main.h"
+#include "BKE_material.h"
+#include "BKE_mesh.h"
+#include "BKE_object.h"
+#include "BKE_text.h"
+
+#include "BLI_fileops.h"
+#include "BLI_listbase.h"
+#include "BLI_path_util.h"
+#include "BLI_string.h"
+
+#include "BLO_readfile.h"
+#include "BLO_undofile.h"
+#include "BLO_writefile.h"
+
+#include "DNA_material_types.h"
+#include "DNA_mesh_types.h"
+#include "DNA_meshdata_types.h"
+#include "DNA_object_types.h"
+#include "DNA_text_types.h"
+
+#include "intern/readfile.h"
+}
+
 class BlendfileLoadingTest : public BlendfileLoadingBaseTest {
+ protected:
+  /* Write a mesh using the given write flags, then read it back into this->bfile. */
+  void mesh_round_trip(const int write_flags);
+  /* Write a text with many lines (stored as separate data blocks) and read it back. */
+  void text_round_trip(const int write_flags);
+  /* Write many meshes using materials (linked in parallel when reading) and read them back. */
+  void many_ids_round_trip(const int write_flags);
 };
 
 TEST_F(BlendfileLoadingTest, CanaryTest)
@@ -29,3 +67,328 @@ TEST_F(BlendfileLoadingTest, CanaryTest)
   depsgraph_create(DAG_EVAL_RENDER);
   EXPECT_NE(nullptr, this->depsgraph);
 }
+
+void BlendfileLoadingTest::mesh_round_trip(const int write_flags)
+{
+  /* Enough vertices for the mesh to be split over several compressed blocks. */
+  const int verts_num = 200000;
+  char filepath[FILE_MAX];
+
+  BKE_tempdir_init(NULL);
+  BLI_join_dirfile(filepath, sizeof(filepath), BKE_tempdir_session(), "round_trip_test.blend");
+
+  Main *bmain = BKE_main_new();
+  Mesh *mesh = BKE_mesh_add(bmain, "RoundTripMesh");
+  mesh->totvert = verts_num;
+  CustomData_add_layer(&mesh->vdata, CD_MVERT, CD_CALLOC, NULL, verts_num);
+  BKE_mesh_update_customdata_pointers(mesh, false);
+  for (int i = 0; i < verts_num; i++) {
+    mesh->mvert[i].co[0] = (float)i;
+    mesh->mvert[i].co[1] = (float)(i % 7);
+    mesh->mvert[i].co[2] = (float)(i * 3);
+  }
+  EXPECT_TRUE(BLO_write_file(bmain, filepath, write_flags, NULL, NULL));
+  BKE_main_free(bmain);
+
+  bfile = BLO_read_from_file(filepath, BLO_READ_SKIP_NONE, NULL);
+  BLI_delete(filepath, false, false);
+  ASSERT_NE(nullptr, bfile);
+
+  const Mesh *mesh_read = static_cast<const Mesh *>(bfile->main->meshes.first);
+  ASSERT_NE(nullptr, mesh_read);
+  EXPECT_STREQ("MERoundTripMesh", mesh_read->id.name);
+  ASSERT_EQ(verts_num, mesh_read->totvert);
+  const MVert *mvert = static_cast<const MVert *>(
+      CustomData_get_layer(&mesh_read->vdata, CD_MVERT));
+  ASSERT_NE(nullptr, mvert);
+  for (int i = 0; i < verts_num; i++) {
+    EXPECT_EQ((float)i, mvert[i].co[0]);
+    EXPECT_EQ((float)(i % 7), mvert[i].co[1]);
+    EXPECT_EQ((float)(i * 3), mvert[i].co[2]);
+  }
+}
+
+TEST_F(BlendfileLoadingTest, CompressedRoundTrip)
+{
+  mesh_round_trip(G_FILE_COMPRESS);
+}
+
+TEST_F(BlendfileLoadingTest, UncompressedRoundTrip)
+{
+  /* Uncompressed files are memory-mapped when reading. */
+  mesh_round_trip(0);
+}
+
+void BlendfileLoadingTest::text_round_trip(const int write_flags)
+{
+  const int lines_num = 1000;
+  char filepath[FILE_MAX];
+
+  BKE_tempdir_init(NULL);
+  BLI_join_dirfile(filepath, sizeof(filepath), BKE_tempdir_session(), "round_trip_test.blend");
+
+  Main *bmain = BKE_main_new();
+  Text *text = BKE_text_add(bmain, "RoundTripText");
+  for (int i = 0; i < lines_num; i++) {
+    char line[64];
+    BLI_snprintf(line, sizeof(line), "line %d\n", i);
+    BKE_text_write(text, line);
+  }
+  EXPECT_TRUE(BLO_write_file(bmain, filepath, write_flags, NULL, NULL));
+  BKE_main_free(bmain);
+
+  bfile = BLO_read_from_file(filepath, BLO_READ_SKIP_NONE, NULL);
+  BLI_delete(filepath, false, false);
+  ASSERT_NE(nullptr, bfile);
+
+  const Text *text_read = static_cast<const Text *>(bfile->main->texts.first);
+  ASSERT_NE(nullptr, text_read);
+  int line_index = 0;
+  LISTBASE_FOREACH (const TextLine *, text_line, &text_read->lines) {
+    if (line_index < lines_num) {
+      char line[64];
+      BLI_snprintf(line, sizeof(line), "line %d", line_index);
+      EXPECT_STREQ(line, text_line->line);
+    }
+    line_index++;
+  }
+  /* Trailing empty line after the last new-line. */
+  EXPECT_EQ(lines_num + 1, line_index);
+}
+
+TEST_F(BlendfileLoadingTest, ManyDataBlocksRoundTrip)
+{
+  /* Texts with many lines are decoded in parallel (uncompressed files only). */
+  text_round_trip(0);
+  blendfile_free();
+  text_round_trip(G_FILE_COMPRESS);
+}
+
+void BlendfileLoadingTest::many_ids_round_trip(const int write_flags)
+{
+  const int meshes_num = 200;
+  char filepath[FILE_MAX];
+
+  BKE_tempdir_init(NULL);
+  BLI_join_dirfile(filepath, sizeof(filepath), BKE_tempdir_session(), "round_trip_test.blend");
+
+  Main *bmain = BKE_main_new();
+  for (int i = 0; i < meshes_num; i++) {
+    char name[MAX_ID_NAME - 2];
+    BLI_snprintf(name, sizeof(name), "Material%d", i);
+    Material *ma = BKE_material_add(bmain, name);
+    BLI_snprintf(name, sizeof(name), "Mesh%d", i);
+    Mesh *mesh = BKE_mesh_add(bmain, name);
+    id_fake_user_set(&mesh->id);
+    mesh->totvert = i + 1;
+    CustomData_add_layer(&mesh->vdata, CD_MVERT, CD_CALLOC, NULL, mesh->totvert);
+    BKE_mesh_update_customdata_pointers(mesh, false);
+    for (int j = 0; j < mesh->totvert; j++) {
+      mesh->mvert[j].co[0] = (float)i;
+      mesh->mvert[j].co[1] = (float)j;
+    }
+    mesh->mat = static_cast<Material **>(MEM_callocN(sizeof(*mesh->mat), __func__));
+    mesh->mat[0] = ma;
+    mesh->totcol = 1;
+    id_us_plus(&ma->id);
+  }
+  EXPECT_TRUE(BLO_write_file(bmain, filepath, write_flags, NULL, NULL));
+  BKE_main_free(bmain);
+
+  bfile = BLO_read_from_file(filepath, BLO_READ_SKIP_NONE, NULL);
+  BLI_delete(filepath, false, false);
+  ASSERT_NE(nullptr, bfile);
+
+  ASSERT_EQ(meshes_num, BLI_listbase_count(&bfile->main->meshes));
+  EXPECT_EQ(meshes_num, BLI_listbase_count(&bfile->main->materials));
+  LISTBASE_FOREACH (const Mesh *, mesh, &bfile->main->meshes) {
+    EXPECT_EQ(0, mesh->id.tag & LIB_TAG_NEED_LINK);
+    const int i = atoi(mesh->id.name + 6);
+    ASSERT_EQ(i + 1, mesh->totvert);
+    const MVert *mvert = static_cast<const MVert *>(CustomData_get_layer(&mesh->vdata, CD_MVERT));
+    ASSERT_NE(nullptr, mvert);
+    for (int j = 0; j < mesh->totvert; j++) {
+      EXPECT_EQ((float)i, mvert[j].co[0]);
+      EXPECT_EQ((float)j, mvert[j].co[1]);
+    }
+
+    ASSERT_EQ(1, mesh->totcol);
+    ASSERT_NE(nullptr, mesh->mat[0]);
+    char name[MAX_ID_NAME];
+    BLI_snprintf(name, sizeof(name), "MAMaterial%d", i);
+    EXPECT_STREQ(name, mesh->mat[0]->id.name);
+    EXPECT_EQ(1, mesh->mat[0]->id.us);
+  }
+}
+
+TEST_F(BlendfileLoadingTest, ManyIDsRoundTrip)
+{
+  /* Meshes and materials are direct linked and lib linked in parallel. */
+  many_ids_round_trip(0);
+  blendfile_free();
+  many_ids_round_trip(G_FILE_COMPRESS);
+}
+
+TEST_F(BlendfileLoadingTest, MemfileAsyncWrite)
+{
+  char filepath[FILE_MAX];
+
+  BKE_tempdir_init(NULL);
+  BLI_join_dirfile(filepath, sizeof(filepath), BKE_tempdir_session(), "memfile_test.blend");
+
+  Main *bmain = BKE_main_new();
+  Text *text = BKE_text_add(bmain, "MemfileText");
+  BKE_text_write(text, "first\n");
+
+  /* Second undo step shares unchanged chunks with the first one. */
+  MemFile memfile_first = {{NULL}};
+  MemFile memfile_second = {{NULL}};
+  EXPECT_TRUE(BLO_write_file_mem(bmain, NULL, &memfile_first, 0));
+  BKE_text_write(text, "second\n");
+  EXPECT_TRUE(BLO_write_file_mem(bmain, &memfile_first, &memfile_second, 0));
+  BKE_main_free(bmain);
+
+  /* The undo steps may be freed while the write is running. */
+  struct MemFileWriteAsync *write_async = BLO_memfile_write_file_async(&memfile_second, filepath);
+  BLO_memfile_free(&memfile_first);
+  BLO_memfile_free(&memfile_second);
+  EXPECT_TRUE(BLO_memfile_write_async_finish(write_async, false));
+
+  bfile = BLO_read_from_file(filepath, BLO_READ_SKIP_NONE, NULL);
+  BLI_delete(filepath, false, false);
+  ASSERT_NE(nullptr, bfile);
+
+  const Text *text_read = static_cast<const Text *>(bfile->main->texts.first);
+  ASSERT_NE(nullptr, text_read);
+  const TextLine *text_line = static_cast<const TextLine *>(text_read->lines.first);
+  ASSERT_NE(nullptr, text_line);
+  EXPECT_STREQ("first", text_line->line);
+  ASSERT_NE(nullptr, text_line->next);
+  EXPECT_STREQ("second", text_line->next->line);
+}
+
+TEST_F(BlendfileLoadingTest, MemfileMovedChunksShared)
+{
+  Main *bmain = BKE_main_new();
+  for (int i = 0; i < 10; i++) {
+    char name[MAX_ID_NAME - 2];
+    BLI_snprintf(name, sizeof(name), "Text%d", i);
+    Text *text = BKE_text_add(bmain, name);
+    for (int j = 0; j < 100; j++) {
+      BKE_text_write(text, "unchanged text line\n");
+    }
+  }
+
+  MemFile memfile_first = {{NULL}};
+  MemFile memfile_second = {{NULL}};
+  EXPECT_TRUE(BLO_write_file_mem(bmain, NULL, &memfile_first, 0));
+
+  /* Insert a text before all others, moving the data of the existing texts. */
+  Text *text_new = BKE_text_add(bmain, "AAA");
+  BKE_text_write(text_new, "new text line\n");
+  EXPECT_TRUE(BLO_write_file_mem(bmain, &memfile_first, &memfile_second, 0));
+  BKE_main_free(bmain);
+
+  /* Unchanged texts are detected as identical and not stored again. */
+  EXPECT_LT(memfile_second.size, memfile_first.size_total / 4);
+  int chunks_identical = 0;
+  LISTBASE_FOREACH (const MemFileChunk *, chunk, &memfile_second.chunks) {
+    chunks_identical += chunk->is_identical;
+  }
+  EXPECT_GE(chunks_identical, 10);
+
+  BLO_memfile_free(&memfile_first);
+  BLO_memfile_free(&memfile_second);
+}
+
+TEST_F(BlendfileLoadingTest, MemfileUndoReadsChangedIDs)
+{
+  Main *bmain = BKE_main_new();
+  Text *text_unchanged = BKE_text_add(bmain, "Unchanged");
+  for (int i = 0; i < 100; i++) {
+    BKE_text_write(text_unchanged, "unchanged text line\n");
+  }
+  Text *text_changed = BKE_text_add(bmain, "Changed");
+  BKE_text_write(text_changed, "before\n");
+
+  MemFile memfile_first = {{NULL}};
+  MemFile memfile_second = {{NULL}};
+  EXPECT_TRUE(BLO_write_file_mem(bmain, NULL, &memfile_first, 0));
+  BLO_memfile_clear_future(&memfile_first);
+  BKE_text_write(text_changed, "after\n");
+  EXPECT_TRUE(BLO_write_file_mem(bmain, &memfile_first, &memfile_second, 0));
+
+  /* Undo to the first step, only the changed text is read from the memfile. */
+  BlendFileReadParams params = {0};
+  params.undo_direction = -1;
+  bfile = BLO_read_from_memfile(bmain, "", &memfile_first, &params, NULL);
+  BKE_main_free(bmain);
+  BLO_memfile_free(&memfile_first);
+  BLO_memfile_free(&memfile_second);
+  ASSERT_NE(nullptr, bfile);
+
+  EXPECT_EQ(2, BLI_listbase_count(&bfile->main->texts));
+  LISTBASE_FOREACH (Text *, text, &bfile->main->texts) {
+    if (STREQ(text->id.name + 2, "Unchanged")) {
+      EXPECT_EQ(text_unchanged, text);
+      EXPECT_EQ(101, BLI_listbase_count(&text->lines));
+    }
+    else {
+      const TextLine *text_line = static_cast<const TextLine *>(text->lines.first);
+      ASSERT_NE(nullptr, text_line);
+      EXPECT_STREQ("before", text_line->line);
+      EXPECT_EQ(2, BLI_listbase_count(&text->lines));
+    }
+  }
+}
+
+TEST_F(BlendfileLoadingTest, LinkUsingIDIndex)
+{
+  char filepath[FILE_MAX];
+
+  BKE_tempdir_init(NULL);
+  BLI_join_dirfile(filepath, sizeof(filepath), BKE_tempdir_session(), "id_index_test.blend");
+
+  Main *bmain = BKE_main_new();
+  for (int i = 0; i < 100; i++) {
+    char name[MAX_ID_NAME - 2];
+    BLI_snprintf(name, sizeof(name), "Text%d", i);
+    Text *text = BKE_text_add(bmain, name);
+    BKE_text_write(text, "unused text line\n");
+  }
+  Mesh *mesh = BKE_mesh_add(bmain, "LinkedMesh");
+  Object *ob = BKE_object_add_only_object(bmain, OB_MESH, "LinkedObject");
+  ob->data = mesh;
+  id_us_plus(&mesh->id);
+  id_fake_user_set(&ob->id);
+  EXPECT_TRUE(BLO_write_file(bmain, filepath, 0, NULL, NULL));
+  BKE_main_free(bmain);
+
+  bmain = BKE_main_new();
+  BlendHandle *bh = BLO_blendhandle_from_file(filepath, NULL);
+  ASSERT_NE(nullptr, bh);
+  Main *mainl = BLO_library_link_begin(bmain, &bh, filepath);
+  ID *id = BLO_library_link_named_part(mainl, &bh, ID_OB, "LinkedObject");
+  EXPECT_NE(nullptr, id);
+  EXPECT_EQ(nullptr, BLO_library_link_named_part(mainl, &bh, ID_OB, "MissingObject"));
+
+  /* Only the blocks before the file global data are read sequentially,
+   * the linked IDs are read using the index. */
+  const FileData *fd = reinterpret_cast<const FileData *>(bh);
+  ASSERT_NE(nullptr, fd->id_index);
+  EXPECT_LE(BLI_listbase_count(&fd->bhead_list), 3);
+
+  BLO_library_link_end(mainl, &bh, 0, bmain, NULL, NULL, NULL);
+  BLO_blendhandle_close(bh);
+  BLI_delete(filepath, false, false);
+
+  const Object *ob_linked = static_cast<const Object *>(bmain->objects.first);
+  ASSERT_NE(nullptr, ob_linked);
+  EXPECT_STREQ("OBLinkedObject", ob_linked->id.name);
+  EXPECT_NE(nullptr, ob_linked->id.lib);
+  ASSERT_NE(nullptr, ob_linked->data);
+  EXPECT_STREQ("MELinkedMesh", static_cast<const ID *>(ob_linked->data)->name);
+  EXPECT_EQ(1, BLI_listbase_count(&bmain->meshes));
+  EXPECT_TRUE(BLI_listbase_is_empty(&bmain->texts));
+  BKE_main_free(bmain);
+}
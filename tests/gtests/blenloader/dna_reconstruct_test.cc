@@ -0,0 +1,594 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2020 by Blender Foundation.
+ */
+#include "testing/testing.h"
+
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "MEM_guardedalloc.h"
+
+extern "C" {
+#include "BLI_string.h"
+#include "BLI_utildefines.h"
+
+#include "DNA_genfile.h"
+#include "DNA_sdna_types.h"
+}
+
+namespace {
+
+/* -------------------------------------------------------------------- */
+/** \name SDNA Builder
+ *
+ * Writes the encoded SDNA data (as #DNA_sdna_from_data reads it) for a handful of test structs.
+ * Basic types must be added before the structs.
+ * \{ */
+
+class SDNABuilder {
+ public:
+  explicit SDNABuilder(int pointer_size) : pointer_size_(pointer_size)
+  {
+    add_type("char", 1);
+    add_type("short", 2);
+    add_type("int", 4);
+    add_type("float", 4);
+    add_type("double", 8);
+    add_type("void", 0);
+  }
+
+  void add_type(const std::string &type, int size)
+  {
+    types_.push_back(type);
+    types_size_.push_back(short(size));
+  }
+
+  void add_struct(const std::string &type,
+                  const std::vector<std::pair<std::string, std::string>> &members)
+  {
+    add_type(type, 0);
+    std::vector<short> def = {short(types_.size() - 1), short(members.size())};
+    int size = 0;
+    for (const auto &member : members) {
+      def.push_back(type_nr(member.first));
+      def.push_back(name_nr(member.second));
+      size += member_size(member.first, member.second);
+    }
+    types_size_.back() = short(size);
+    structs_.push_back(def);
+  }
+
+  SDNA *build() const
+  {
+    std::vector<char> data;
+    auto append_id = [&](const char id[4]) { data.insert(data.end(), id, id + 4); };
+    auto append_int = [&](int value) {
+      const char *cp = (const char *)&value;
+      data.insert(data.end(), cp, cp + sizeof(value));
+    };
+    auto append_short = [&](short value) {
+      const char *cp = (const char *)&value;
+      data.insert(data.end(), cp, cp + sizeof(value));
+    };
+    auto append_strings = [&](const std::vector<std::string> &strings) {
+      append_int(int(strings.size()));
+      for (const std::string &str : strings) {
+        data.insert(data.end(), str.c_str(), str.c_str() + str.size() + 1);
+      }
+      while (data.size() % 4) {
+        data.push_back(0);
+      }
+    };
+
+    append_id("SDNA");
+    append_id("NAME");
+    append_strings(names_);
+    append_id("TYPE");
+    append_strings(types_);
+    append_id("TLEN");
+    for (short size : types_size_) {
+      append_short(size);
+    }
+    if (types_size_.size() & 1) {
+      append_short(0);
+    }
+    append_id("STRC");
+    append_int(int(structs_.size()));
+    for (const std::vector<short> &def : structs_) {
+      for (short value : def) {
+        append_short(value);
+      }
+    }
+
+    const char *error_message = NULL;
+    SDNA *sdna = DNA_sdna_from_data(data.data(), int(data.size()), false, true, &error_message);
+    EXPECT_EQ(error_message, nullptr);
+    return sdna;
+  }
+
+ private:
+  short type_nr(const std::string &type) const
+  {
+    for (size_t i = 0; i < types_.size(); i++) {
+      if (types_[i] == type) {
+        return short(i);
+      }
+    }
+    ADD_FAILURE() << "unknown type " << type;
+    return 0;
+  }
+
+  short name_nr(const std::string &name)
+  {
+    for (size_t i = 0; i < names_.size(); i++) {
+      if (names_[i] == name) {
+        return short(i);
+      }
+    }
+    names_.push_back(name);
+    return short(names_.size() - 1);
+  }
+
+  int member_size(const std::string &type, const std::string &name) const
+  {
+    int array_len = 1;
+    for (size_t i = name.find('['); i != std::string::npos; i = name.find('[', i + 1)) {
+      array_len *= atoi(name.c_str() + i + 1);
+    }
+    const bool is_pointer = name[0] == '*' || (name[0] == '(' && name[1] == '*');
+    return array_len * (is_pointer ? pointer_size_ : types_size_[type_nr(type)]);
+  }
+
+  int pointer_size_;
+  std::vector<std::string> names_;
+  std::vector<std::string> types_;
+  std::vector<short> types_size_;
+  std::vector<std::vector<short>> structs_;
+};
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name Reference Reconstruction
+ *
+ * The element-wise reconstruction which was used before the steps were compiled once per struct,
+ * the compiled steps must give the same result byte for byte.
+ * \{ */
+
+static bool ref_ispointer(const char *name)
+{
+  return (name[0] == '*' || (name[0] == '(' && name[1] == '*'));
+}
+
+static int ref_sdna_type_nr(const char *dna_type)
+{
+  if (STR_ELEM(dna_type, "char", "const char")) {
+    return SDNA_TYPE_CHAR;
+  }
+  if (STR_ELEM(dna_type, "short")) {
+    return SDNA_TYPE_SHORT;
+  }
+  if (STR_ELEM(dna_type, "int")) {
+    return SDNA_TYPE_INT;
+  }
+  if (STR_ELEM(dna_type, "float")) {
+    return SDNA_TYPE_FLOAT;
+  }
+  if (STR_ELEM(dna_type, "double")) {
+    return SDNA_TYPE_DOUBLE;
+  }
+  return -1;
+}
+
+static void ref_cast_elem(
+    const char *ctype, const char *otype, int name_array_len, char *curdata, const char *olddata)
+{
+  const int otypenr = ref_sdna_type_nr(otype);
+  const int ctypenr = ref_sdna_type_nr(ctype);
+  if (otypenr == -1 || ctypenr == -1) {
+    return;
+  }
+  const int oldlen = DNA_elem_type_size(eSDNA_Type(otypenr));
+  const int curlen = DNA_elem_type_size(eSDNA_Type(ctypenr));
+
+  while (name_array_len > 0) {
+    double val = 0.0;
+    switch (otypenr) {
+      case SDNA_TYPE_CHAR:
+        val = *olddata;
+        break;
+      case SDNA_TYPE_SHORT:
+        val = *((short *)olddata);
+        break;
+      case SDNA_TYPE_INT:
+        val = *((int *)olddata);
+        break;
+      case SDNA_TYPE_FLOAT:
+        val = *((float *)olddata);
+        break;
+      case SDNA_TYPE_DOUBLE:
+        val = *((double *)olddata);
+        break;
+    }
+    switch (ctypenr) {
+      case SDNA_TYPE_CHAR:
+        *curdata = val;
+        break;
+      case SDNA_TYPE_SHORT:
+        *((short *)curdata) = val;
+        break;
+      case SDNA_TYPE_INT:
+        *((int *)curdata) = val;
+        break;
+      case SDNA_TYPE_FLOAT:
+        if (otypenr < 2) {
+          val /= 255;
+        }
+        *((float *)curdata) = val;
+        break;
+      case SDNA_TYPE_DOUBLE:
+        if (otypenr < 2) {
+          val /= 255;
+        }
+        *((double *)curdata) = val;
+        break;
+    }
+    olddata += oldlen;
+    curdata += curlen;
+    name_array_len--;
+  }
+}
+
+static void ref_cast_pointer(
+    int curlen, int oldlen, int name_array_len, char *curdata, const char *olddata)
+{
+  while (name_array_len > 0) {
+    if (curlen == oldlen) {
+      memcpy(curdata, olddata, curlen);
+    }
+    else if (curlen == 4 && oldlen == 8) {
+      *((int *)curdata) = *((int64_t *)olddata) >> 3;
+    }
+    else if (curlen == 8 && oldlen == 4) {
+      *((int64_t *)curdata) = *((int *)olddata);
+    }
+    olddata += oldlen;
+    curdata += curlen;
+    name_array_len--;
+  }
+}
+
+static int ref_elem_strcmp(const char *name, const char *oname)
+{
+  int a = 0;
+  while (1) {
+    if (name[a] != oname[a]) {
+      return 1;
+    }
+    if (name[a] == '[' || oname[a] == '[') {
+      break;
+    }
+    if (name[a] == 0 || oname[a] == 0) {
+      break;
+    }
+    a++;
+  }
+  return 0;
+}
+
+static const char *ref_find_elem(const SDNA *sdna,
+                                 const char *type,
+                                 const char *name,
+                                 const short *old,
+                                 const char *olddata,
+                                 const short **sppo)
+{
+  const int elemcount = old[1];
+  old += 2;
+  for (int a = 0; a < elemcount; a++, old += 2) {
+    const char *otype = sdna->types[old[0]];
+    const char *oname = sdna->names[old[1]];
+    if (ref_elem_strcmp(name, oname) == 0) {
+      if (strcmp(type, otype) == 0) {
+        *sppo = old;
+        return olddata;
+      }
+      return NULL;
+    }
+    olddata += DNA_elem_size_nr(sdna, old[0], old[1]);
+  }
+  return NULL;
+}
+
+static void ref_reconstruct_elem(const SDNA *newsdna,
+                                 const SDNA *oldsdna,
+                                 const char *type,
+                                 const int new_name_nr,
+                                 char *curdata,
+                                 const short *old,
+                                 const char *olddata)
+{
+  const char *name = newsdna->names[new_name_nr];
+  const char *cp = strchr(name, '[');
+  const int countpos = cp ? int(cp - name) : 0;
+
+  const int elemcount = old[1];
+  old += 2;
+  for (int a = 0; a < elemcount; a++, old += 2) {
+    const int old_name_nr = old[1];
+    const char *otype = oldsdna->types[old[0]];
+    const char *oname = oldsdna->names[old[1]];
+    const int len = DNA_elem_size_nr(oldsdna, old[0], old[1]);
+
+    if (strcmp(name, oname) == 0) {
+      if (ref_ispointer(name)) {
+        ref_cast_pointer(newsdna->pointer_size,
+                         oldsdna->pointer_size,
+                         newsdna->names_array_len[new_name_nr],
+                         curdata,
+                         olddata);
+      }
+      else if (strcmp(type, otype) == 0) {
+        memcpy(curdata, olddata, len);
+      }
+      else {
+        ref_cast_elem(type, otype, newsdna->names_array_len[new_name_nr], curdata, olddata);
+      }
+      return;
+    }
+    if (countpos != 0 && oname[countpos] == '[' && strncmp(name, oname, countpos) == 0) {
+      const int new_name_array_len = newsdna->names_array_len[new_name_nr];
+      const int old_name_array_len = oldsdna->names_array_len[old_name_nr];
+      const int min_name_array_len = MIN2(new_name_array_len, old_name_array_len);
+
+      if (ref_ispointer(name)) {
+        ref_cast_pointer(
+            newsdna->pointer_size, oldsdna->pointer_size, min_name_array_len, curdata, olddata);
+      }
+      else if (strcmp(type, otype) == 0) {
+        const int mul = (len / old_name_array_len) * min_name_array_len;
+        memcpy(curdata, olddata, mul);
+        if (old_name_array_len > new_name_array_len && strcmp(type, "char") == 0) {
+          curdata[mul - 1] = '\0';
+        }
+      }
+      else {
+        ref_cast_elem(type, otype, min_name_array_len, curdata, olddata);
+      }
+      return;
+    }
+    olddata += len;
+  }
+}
+
+static void ref_reconstruct_struct(const SDNA *newsdna,
+                                   const SDNA *oldsdna,
+                                   const char *compflags,
+                                   int oldSDNAnr,
+                                   const char *data,
+                                   int curSDNAnr,
+                                   char *cur)
+{
+  if (oldSDNAnr == -1 || curSDNAnr == -1) {
+    return;
+  }
+
+  const short *spo = oldsdna->structs[oldSDNAnr];
+  if (compflags[oldSDNAnr] == SDNA_CMP_EQUAL) {
+    memcpy(cur, data, oldsdna->types_size[spo[0]]);
+    return;
+  }
+
+  const int firststructtypenr = *(newsdna->structs[0]);
+  const short *spc = newsdna->structs[curSDNAnr];
+  const int elemcount = spc[1];
+  spc += 2;
+  char *cpc = cur;
+  for (int a = 0; a < elemcount; a++, spc += 2) {
+    const char *type = newsdna->types[spc[0]];
+    const char *name = newsdna->names[spc[1]];
+    int elen = DNA_elem_size_nr(newsdna, spc[0], spc[1]);
+
+    if (name[0] == '_' || (name[0] == '*' && name[1] == '_')) {
+      cpc += elen;
+    }
+    else if (spc[0] >= firststructtypenr && !ref_ispointer(name)) {
+      const short *sppo;
+      const char *cpo = ref_find_elem(oldsdna, type, name, spo, data, &sppo);
+      if (cpo) {
+        const int sub_old_nr = DNA_struct_find_nr(oldsdna, type);
+        const int sub_cur_nr = DNA_struct_find_nr(newsdna, type);
+        int mul = newsdna->names_array_len[spc[1]];
+        int mulo = oldsdna->names_array_len[sppo[1]];
+        const int eleno = DNA_elem_size_nr(oldsdna, sppo[0], sppo[1]) / mulo;
+        char *cpc_end = cpc + elen;
+        elen /= mul;
+
+        while (mul--) {
+          ref_reconstruct_struct(newsdna, oldsdna, compflags, sub_old_nr, cpo, sub_cur_nr, cpc);
+          cpo += eleno;
+          cpc += elen;
+          mulo--;
+          if (mulo <= 0) {
+            break;
+          }
+        }
+        /* The element-wise version only skipped the reconstructed elements here, shifting the
+         * members after a struct array which grew. The compiled steps use the member offsets. */
+        cpc = cpc_end;
+      }
+      else {
+        cpc += elen;
+      }
+    }
+    else {
+      ref_reconstruct_elem(newsdna, oldsdna, type, spc[1], cpc, spo, data);
+      cpc += elen;
+    }
+  }
+}
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name Tests
+ * \{ */
+
+struct ReconstructTest {
+  SDNA *oldsdna;
+  SDNA *newsdna;
+  const char *compflags;
+  DNA_ReconstructInfo *reconstruct_info;
+
+  ReconstructTest(SDNA *oldsdna_, SDNA *newsdna_) : oldsdna(oldsdna_), newsdna(newsdna_)
+  {
+    compflags = DNA_struct_get_compareflags(oldsdna, newsdna);
+    reconstruct_info = DNA_reconstruct_info_create(oldsdna, newsdna, compflags);
+  }
+
+  ~ReconstructTest()
+  {
+    DNA_reconstruct_info_free(reconstruct_info);
+    MEM_freeN((void *)compflags);
+    DNA_sdna_free(oldsdna);
+    DNA_sdna_free(newsdna);
+  }
+
+  /** Reconstruct \a blocks of the old struct \a type, filled with a fixed pattern. */
+  void expect_identical(const char *type, int blocks)
+  {
+    const int old_struct_nr = DNA_struct_find_nr(oldsdna, type);
+    const int new_struct_nr = DNA_struct_find_nr(newsdna, type);
+    ASSERT_NE(old_struct_nr, -1);
+    ASSERT_NE(new_struct_nr, -1);
+    EXPECT_NE(compflags[old_struct_nr], SDNA_CMP_EQUAL);
+
+    const int oldlen = oldsdna->types_size[oldsdna->structs[old_struct_nr][0]];
+    const int curlen = newsdna->types_size[newsdna->structs[new_struct_nr][0]];
+
+    std::vector<char> old_data(size_t(oldlen) * blocks);
+    for (size_t i = 0; i < old_data.size(); i++) {
+      /* Keep the bytes small so casts from floating point types stay in range. */
+      old_data[i] = char((i * 7) % 31 + 1);
+    }
+
+    std::vector<char> expected(size_t(curlen) * blocks, 0);
+    for (int a = 0; a < blocks; a++) {
+      ref_reconstruct_struct(newsdna,
+                             oldsdna,
+                             compflags,
+                             old_struct_nr,
+                             old_data.data() + size_t(a) * oldlen,
+                             new_struct_nr,
+                             expected.data() + size_t(a) * curlen);
+    }
+
+    char *result = (char *)DNA_struct_reconstruct(
+        reconstruct_info, old_struct_nr, blocks, old_data.data());
+    ASSERT_NE(result, nullptr);
+    for (size_t i = 0; i < expected.size(); i++) {
+      if (result[i] != expected[i]) {
+        ADD_FAILURE() << type << ": first difference at block " << i / curlen << ", offset "
+                      << i % curlen;
+        break;
+      }
+    }
+    MEM_freeN(result);
+  }
+};
+
+static void add_old_structs(SDNABuilder &builder)
+{
+  builder.add_struct("ListBase", {{"void", "*first"}, {"void", "*last"}});
+  /* Not a struct in the old file, only a type name. */
+  builder.add_type("Gone", 4);
+  builder.add_struct("Inner", {{"int", "a"}, {"float", "b"}});
+  builder.add_struct("Equal", {{"int", "x"}, {"int", "y"}});
+}
+
+static void add_new_structs(SDNABuilder &builder)
+{
+  builder.add_struct("ListBase", {{"void", "*first"}, {"void", "*last"}});
+  builder.add_struct("Gone", {{"int", "g"}});
+  builder.add_struct("Inner", {{"float", "b"}, {"int", "a"}, {"int", "added"}});
+  builder.add_struct("Equal", {{"int", "x"}, {"int", "y"}});
+}
+
+TEST(dna_reconstruct, RenamedResizedNestedMembers)
+{
+  SDNABuilder old_builder(4);
+  add_old_structs(old_builder);
+  old_builder.add_struct("Test",
+                         {{"int", "keep"},
+                          {"short", "resized[2]"},
+                          {"int", "renamed_old"},
+                          {"char", "str[8]"},
+                          {"short", "cast"},
+                          {"int", "arr[3]"},
+                          {"Inner", "inner"},
+                          {"Inner", "inner_arr[2]"},
+                          {"Equal", "eq[2]"},
+                          {"Gone", "gone"},
+                          {"void", "*ptr"},
+                          {"void", "*ptr_arr[2]"},
+                          {"double", "removed"}});
+
+  SDNABuilder new_builder(8);
+  add_new_structs(new_builder);
+  new_builder.add_struct("Test",
+                         {{"double", "arr[2]"},
+                          {"int", "added"},
+                          {"Inner", "inner_arr[3]"},
+                          {"char", "str[4]"},
+                          {"int", "renamed"},
+                          {"float", "cast"},
+                          {"short", "resized[4]"},
+                          {"Equal", "eq[1]"},
+                          {"void", "*ptr_arr[3]"},
+                          {"Inner", "inner"},
+                          {"Gone", "gone"},
+                          {"void", "*ptr"},
+                          {"int", "keep"},
+                          {"char", "_pad[4]"}});
+
+  SDNA *oldsdna = old_builder.build();
+  EXPECT_TRUE(DNA_sdna_patch_struct_member(oldsdna, "Test", "renamed_old", "renamed"));
+
+  ReconstructTest test(oldsdna, new_builder.build());
+  test.expect_identical("Test", 3);
+  test.expect_identical("Inner", 2);
+}
+
+TEST(dna_reconstruct, NestedStructArrayShrunk)
+{
+  SDNABuilder old_builder(8);
+  add_old_structs(old_builder);
+  old_builder.add_struct("Test", {{"Inner", "inner_arr[4]"}, {"short", "resized[4]"}});
+
+  SDNABuilder new_builder(8);
+  add_new_structs(new_builder);
+  new_builder.add_struct("Test", {{"short", "resized[1]"}, {"Inner", "inner_arr[2]"}});
+
+  ReconstructTest test(old_builder.build(), new_builder.build());
+  test.expect_identical("Test", 5);
+}
+
+/** \} */
+
+}  // namespace
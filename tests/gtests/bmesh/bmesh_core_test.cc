@@ -1,7 +1,16 @@
 #include "testing/testing.h"
 
+#include "MEM_guardedalloc.h"
+
 #include "BLI_math.h"
+#include "BLI_mempool.h"
 #include "BLI_utildefines.h"
+
+#include "BKE_customdata.h"
+#include "BKE_idtype.h"
+#include "BKE_lib_id.h"
+#include "BKE_mesh.h"
+
 #include "bmesh.h"
 
 TEST(bmesh_core, BMVertCreate)
@@ -38,3 +47,86 @@ TEST(bmesh_core, BMVertCreate)
   EXPECT_EQ(BM_mesh_elem_count(bm, BM_VERT), 3);
   BM_mesh_free(bm);
 }
+
+TEST(bmesh_core, BMeshFromMeshCustomData)
+{
+  /* Large enough for the custom-data to be copied in parallel. */
+  const int grid_len = 64;
+  BKE_idtype_init();
+  BMeshCreateParams bm_params = {0};
+  BMesh *bm = BM_mesh_create(&bm_mesh_allocsize_default, &bm_params);
+  BM_data_layer_add(bm, &bm->vdata, CD_PROP_FLT);
+  BM_data_layer_add(bm, &bm->edata, CD_PROP_INT);
+  BM_data_layer_add(bm, &bm->ldata, CD_PROP_FLT);
+  BM_data_layer_add(bm, &bm->pdata, CD_PROP_INT);
+
+  BMVert **verts = (BMVert **)MEM_mallocN(sizeof(*verts) * grid_len * grid_len, __func__);
+  for (int i = 0; i < grid_len * grid_len; i++) {
+    const float co[3] = {(float)(i % grid_len), (float)(i / grid_len), 0.0f};
+    verts[i] = BM_vert_create(bm, co, NULL, BM_CREATE_NOP);
+  }
+  for (int y = 0; y < grid_len - 1; y++) {
+    for (int x = 0; x < grid_len - 1; x++) {
+      const int i = y * grid_len + x;
+      BMVert *quad[4] = {verts[i], verts[i + 1], verts[i + grid_len + 1], verts[i + grid_len]};
+      BM_face_create_verts(bm, quad, 4, NULL, BM_CREATE_NOP, true);
+    }
+  }
+  MEM_freeN(verts);
+
+  const int cd_vert_offset = CustomData_get_offset(&bm->vdata, CD_PROP_FLT);
+  const int cd_edge_offset = CustomData_get_offset(&bm->edata, CD_PROP_INT);
+  const int cd_loop_offset = CustomData_get_offset(&bm->ldata, CD_PROP_FLT);
+  const int cd_face_offset = CustomData_get_offset(&bm->pdata, CD_PROP_INT);
+  BMIter iter, liter;
+  BMVert *v;
+  BMEdge *e;
+  BMFace *f;
+  BMLoop *l;
+  int i, j;
+  BM_ITER_MESH_INDEX (v, &iter, bm, BM_VERTS_OF_MESH, i) {
+    BM_ELEM_CD_SET_FLOAT(v, cd_vert_offset, (float)i * 0.5f);
+  }
+  BM_ITER_MESH_INDEX (e, &iter, bm, BM_EDGES_OF_MESH, i) {
+    BM_ELEM_CD_SET_INT(e, cd_edge_offset, i * 3);
+  }
+  j = 0;
+  BM_ITER_MESH_INDEX (f, &iter, bm, BM_FACES_OF_MESH, i) {
+    BM_ELEM_CD_SET_INT(f, cd_face_offset, i * 7);
+    BM_ITER_ELEM (l, &liter, f, BM_LOOPS_OF_FACE) {
+      BM_ELEM_CD_SET_FLOAT(l, cd_loop_offset, (float)j++ * 0.25f);
+    }
+  }
+
+  BMeshToMeshParams to_me_params = {0};
+  Mesh *me_settings = BKE_mesh_new_nomain(0, 0, 0, 0, 0);
+  Mesh *me = BKE_mesh_from_bmesh_nomain(bm, &to_me_params, me_settings);
+  BKE_id_free(NULL, me_settings);
+  BMesh *bm_dst = BM_mesh_create(&bm_mesh_allocsize_default, &bm_params);
+  BMeshFromMeshParams from_me_params = {0};
+  BM_mesh_bm_from_me(bm_dst, me, &from_me_params);
+
+  EXPECT_EQ(bm_dst->totvert, bm->totvert);
+  EXPECT_EQ(bm_dst->totedge, bm->totedge);
+  EXPECT_EQ(bm_dst->totloop, bm->totloop);
+  EXPECT_EQ(bm_dst->totface, bm->totface);
+  EXPECT_EQ(BLI_mempool_len(bm_dst->vdata.pool), bm->totvert);
+  EXPECT_EQ(BLI_mempool_len(bm_dst->ldata.pool), bm->totloop);
+  BM_ITER_MESH_INDEX (v, &iter, bm_dst, BM_VERTS_OF_MESH, i) {
+    EXPECT_EQ(BM_ELEM_CD_GET_FLOAT(v, cd_vert_offset), (float)i * 0.5f);
+  }
+  BM_ITER_MESH_INDEX (e, &iter, bm_dst, BM_EDGES_OF_MESH, i) {
+    EXPECT_EQ(BM_ELEM_CD_GET_INT(e, cd_edge_offset), i * 3);
+  }
+  j = 0;
+  BM_ITER_MESH_INDEX (f, &iter, bm_dst, BM_FACES_OF_MESH, i) {
+    EXPECT_EQ(BM_ELEM_CD_GET_INT(f, cd_face_offset), i * 7);
+    BM_ITER_ELEM (l, &liter, f, BM_LOOPS_OF_FACE) {
+      EXPECT_EQ(BM_ELEM_CD_GET_FLOAT(l, cd_loop_offset), (float)j++ * 0.25f);
+    }
+  }
+
+  BKE_id_free(NULL, me);
+  BM_mesh_free(bm_dst);
+  BM_mesh_free(bm);
+}
@@ -0,0 +1,186 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2020 by Blender Foundation.
+ */
+#include "blendfile_loading_base_test.h"
+
+#include <set>
+#include <string>
+
+#include "MEM_guardedalloc.h"
+
+extern "C" {
+#include "BKE_constraint.h"
+#include "BKE_customdata.h"
+#include "BKE_main.h"
+#include "BKE_mesh.h"
+#include "BKE_modifier.h"
+#include "BKE_object.h"
+#include "BKE_scene.h"
+
+#include "BLI_listbase.h"
+#include "BLI_math_vector.h"
+
+#include "DEG_depsgraph.h"
+#include "DEG_depsgraph_build.h"
+#include "DEG_depsgraph_query.h"
+
+#include "DNA_constraint_types.h"
+#include "DNA_mesh_types.h"
+#include "DNA_meshdata_types.h"
+#include "DNA_modifier_types.h"
+#include "DNA_object_types.h"
+#include "DNA_scene_types.h"
+}
+
+#include "intern/depsgraph.h"
+#include "intern/depsgraph_relation.h"
+#include "intern/node/deg_node_component.h"
+#include "intern/node/deg_node_id.h"
+#include "intern/node/deg_node_operation.h"
+
+#define MESH_TOTVERT 8
+
+class DepsgraphIncrementalTest : public BlendfileLoadingBaseTest {
+ protected:
+  Main *bmain = nullptr;
+  Scene *scene = nullptr;
+  ViewLayer *view_layer = nullptr;
+  Object *object = nullptr;
+  Object *target = nullptr;
+
+  virtual void SetUp() override
+  {
+    bmain = BKE_main_new();
+    scene = BKE_scene_add(bmain, "Scene");
+    view_layer = static_cast<ViewLayer *>(scene->view_layers.first);
+
+    object = BKE_object_add(bmain, scene, view_layer, OB_MESH, "Object");
+    Mesh *mesh = static_cast<Mesh *>(object->data);
+    mesh->totvert = MESH_TOTVERT;
+    CustomData_add_layer(&mesh->vdata, CD_MVERT, CD_CALLOC, NULL, MESH_TOTVERT);
+    BKE_mesh_update_customdata_pointers(mesh, false);
+    for (int i = 0; i < MESH_TOTVERT; i++) {
+      mesh->mvert[i].co[0] = (float)i;
+    }
+
+    target = BKE_object_add(bmain, scene, view_layer, OB_EMPTY, "Target");
+    copy_v3_fl3(target->loc, 1.0f, 2.0f, 3.0f);
+
+    depsgraph = DEG_graph_new(bmain, scene, view_layer, DAG_EVAL_VIEWPORT);
+    DEG_graph_build_from_view_layer(depsgraph, bmain, scene, view_layer);
+    BKE_scene_graph_update_tagged(depsgraph, bmain);
+  }
+
+  virtual void TearDown() override
+  {
+    depsgraph_free();
+    BKE_main_free(bmain);
+
+    BlendfileLoadingBaseTest::TearDown();
+  }
+
+  /* Update relations of the object through the incremental path, and evaluate. */
+  void object_relations_update()
+  {
+    DEG_relations_tag_update_id(bmain, &object->id);
+    DEG_id_tag_update_ex(bmain, &object->id, ID_RECALC_TRANSFORM | ID_RECALC_GEOMETRY);
+
+    /* Nodes of other IDs are kept, a full build frees them. */
+    DEG::Depsgraph *deg_graph = reinterpret_cast<DEG::Depsgraph *>(depsgraph);
+    EXPECT_FALSE(deg_graph->need_update_all);
+    DEG::ComponentNode *target_transform = deg_graph->find_id_node(&target->id)->find_component(
+        DEG::NodeType::TRANSFORM);
+    const size_t target_operations_len = target_transform->operations.size();
+    DEG::OperationNode *target_operation = target_transform->operations[0];
+
+    BKE_scene_graph_update_tagged(depsgraph, bmain);
+
+    target_transform = deg_graph->find_id_node(&target->id)->find_component(
+        DEG::NodeType::TRANSFORM);
+    ASSERT_EQ(target_operations_len, target_transform->operations.size());
+    EXPECT_EQ(target_operation, target_transform->operations[0]);
+  }
+
+  /* Operations and relations of the graph, by identifier. */
+  static std::set<std::string> graph_relations(const Depsgraph *graph)
+  {
+    const DEG::Depsgraph *deg_graph = reinterpret_cast<const DEG::Depsgraph *>(graph);
+    std::set<std::string> relations;
+    for (DEG::OperationNode *op_node : deg_graph->operations) {
+      relations.insert(op_node->full_identifier());
+      for (DEG::Relation *rel : op_node->inlinks) {
+        std::string from = (rel->from->type == DEG::NodeType::OPERATION) ?
+                               static_cast<DEG::OperationNode *>(rel->from)->full_identifier() :
+                               rel->from->identifier();
+        relations.insert(from + " -> " + op_node->full_identifier() + " (" + rel->name + ")");
+      }
+    }
+    return relations;
+  }
+
+  /* Compare the graph to one built from scratch, both evaluated. */
+  void expect_matches_full_build(const int totvert, const float location[3])
+  {
+    Depsgraph *depsgraph_full = DEG_graph_new(bmain, scene, view_layer, DAG_EVAL_VIEWPORT);
+    DEG_graph_build_from_view_layer(depsgraph_full, bmain, scene, view_layer);
+    BKE_scene_graph_update_tagged(depsgraph_full, bmain);
+
+    EXPECT_EQ(graph_relations(depsgraph_full), graph_relations(depsgraph));
+
+    for (Depsgraph *graph : {depsgraph, depsgraph_full}) {
+      Object *object_eval = DEG_get_evaluated_object(graph, object);
+      Mesh *mesh_eval = BKE_object_get_evaluated_mesh(object_eval);
+      ASSERT_NE(nullptr, mesh_eval);
+      EXPECT_EQ(totvert, mesh_eval->totvert);
+      EXPECT_V3_NEAR(location, object_eval->obmat[3], 1e-6f);
+    }
+
+    DEG_graph_free(depsgraph_full);
+  }
+};
+
+TEST_F(DepsgraphIncrementalTest, ModifierAddRemove)
+{
+  const float origin[3] = {0.0f, 0.0f, 0.0f};
+  expect_matches_full_build(MESH_TOTVERT, origin);
+
+  /* Array of two copies by default. */
+  ModifierData *md = modifier_new(eModifierType_Array);
+  BLI_addtail(&object->modifiers, md);
+  object_relations_update();
+  expect_matches_full_build(MESH_TOTVERT * 2, origin);
+
+  BLI_remlink(&object->modifiers, md);
+  modifier_free(md);
+  object_relations_update();
+  expect_matches_full_build(MESH_TOTVERT, origin);
+}
+
+TEST_F(DepsgraphIncrementalTest, ConstraintAddRemove)
+{
+  const float origin[3] = {0.0f, 0.0f, 0.0f};
+
+  bConstraint *con = BKE_constraint_add_for_object(
+      object, "Copy Location", CONSTRAINT_TYPE_LOCLIKE);
+  static_cast<bLocateLikeConstraint *>(con->data)->tar = target;
+  object_relations_update();
+  expect_matches_full_build(MESH_TOTVERT, target->loc);
+
+  BKE_constraint_remove(&object->constraints, con);
+  object_relations_update();
+  expect_matches_full_build(MESH_TOTVERT, origin);
+}
@@ -0,0 +1,220 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2020 by Blender Foundation.
+ */
+#include "blendfile_loading_base_test.h"
+
+#include <set>
+#include <string>
+
+#include "MEM_guardedalloc.h"
+
+extern "C" {
+#include "BKE_appdir.h"
+#include "BKE_constraint.h"
+#include "BKE_global.h"
+#include "BKE_lib_id.h"
+#include "BKE_main.h"
+#include "BKE_modifier.h"
+#include "BKE_object.h"
+#include "BKE_scene.h"
+#include "BKE_text.h"
+
+#include "BLI_fileops.h"
+#include "BLI_fileops_types.h"
+#include "BLI_listbase.h"
+#include "BLI_path_util.h"
+#include "BLI_string.h"
+
+#include "BLO_readfile.h"
+#include "BLO_writefile.h"
+
+#include "DEG_depsgraph.h"
+#include "DEG_depsgraph_build.h"
+
+#include "DNA_constraint_types.h"
+#include "DNA_modifier_types.h"
+#include "DNA_object_types.h"
+#include "DNA_scene_types.h"
+}
+
+#include "intern/depsgraph.h"
+#include "intern/depsgraph_relation.h"
+#include "intern/node/deg_node_component.h"
+#include "intern/node/deg_node_id.h"
+#include "intern/node/deg_node_operation.h"
+
+class DepsgraphPersistentCacheTest : public BlendfileLoadingBaseTest {
+ protected:
+  char filepath[FILE_MAX];
+  char cache_dir[FILE_MAX];
+
+  virtual void SetUp() override
+  {
+    BKE_tempdir_init(NULL);
+    BLI_join_dirfile(
+        filepath, sizeof(filepath), BKE_tempdir_session(), "persistent_cache_test.blend");
+    BLI_join_dirfile(cache_dir, sizeof(cache_dir), BKE_tempdir_session(), "depsgraph_cache");
+    DEG_build_cache_set_directory(cache_dir);
+
+    Main *bmain = BKE_main_new();
+    Scene *scene = BKE_scene_add(bmain, "Scene");
+    ViewLayer *view_layer = static_cast<ViewLayer *>(scene->view_layers.first);
+    Object *object = BKE_object_add(bmain, scene, view_layer, OB_MESH, "Object");
+    BLI_addtail(&object->modifiers, modifier_new(eModifierType_Array));
+    BKE_object_add(bmain, scene, view_layer, OB_EMPTY, "Target");
+    EXPECT_TRUE(BLO_write_file(bmain, filepath, 0, NULL, NULL));
+    BKE_main_free(bmain);
+  }
+
+  virtual void TearDown() override
+  {
+    BlendfileLoadingBaseTest::TearDown();
+
+    DEG_build_cache_set_directory(NULL);
+    BLI_delete(cache_dir, true, true);
+    BLI_delete(filepath, false, false);
+  }
+
+  /* Read the file the way it's done when opening it, with fresh session UUIDs. */
+  void reload()
+  {
+    depsgraph_free();
+    blendfile_free();
+    BKE_lib_libblock_session_uuid_reset();
+    bfile = BLO_read_from_file(filepath, BLO_READ_SKIP_NONE, NULL);
+    ASSERT_NE(nullptr, bfile);
+    bfile->main->use_depsgraph_build_cache = true;
+  }
+
+  /* Build a new graph, returns whether its relations were restored from the cache. */
+  bool build()
+  {
+    depsgraph_free();
+    Scene *scene = static_cast<Scene *>(bfile->main->scenes.first);
+    ViewLayer *view_layer = static_cast<ViewLayer *>(scene->view_layers.first);
+    depsgraph = DEG_graph_new(bfile->main, scene, view_layer, DAG_EVAL_VIEWPORT);
+
+    const int debug = G.debug;
+    G.debug |= G_DEBUG_DEPSGRAPH_BUILD;
+    testing::internal::CaptureStdout();
+    DEG_graph_build_from_view_layer(depsgraph, bfile->main, scene, view_layer);
+    const std::string output = testing::internal::GetCapturedStdout();
+    G.debug = debug;
+
+    return output.find("Depsgraph relations restored from build cache.") != std::string::npos;
+  }
+
+  Object *object_find(const char *name)
+  {
+    return static_cast<Object *>(BLI_findstring(
+        &bfile->main->objects, name, offsetof(ID, name) + 2));
+  }
+
+  int cache_files_len()
+  {
+    struct direntry *files;
+    const unsigned int files_len = BLI_filelist_dir_contents(cache_dir, &files);
+    int len = 0;
+    for (unsigned int i = 0; i < files_len; i++) {
+      len += BLI_path_extension_check(files[i].relname, ".depsgraph");
+    }
+    BLI_filelist_free(files, files_len);
+    return len;
+  }
+
+  /* Operations and relations of the graph, by identifier. */
+  std::set<std::string> graph_relations()
+  {
+    const DEG::Depsgraph *deg_graph = reinterpret_cast<const DEG::Depsgraph *>(depsgraph);
+    std::set<std::string> relations;
+    for (DEG::OperationNode *op_node : deg_graph->operations) {
+      relations.insert(op_node->full_identifier());
+      for (DEG::Relation *rel : op_node->inlinks) {
+        std::string from = (rel->from->type == DEG::NodeType::OPERATION) ?
+                               static_cast<DEG::OperationNode *>(rel->from)->full_identifier() :
+                               rel->from->identifier();
+        relations.insert(from + " -> " + op_node->full_identifier() + " (" + rel->name + ")");
+      }
+    }
+    return relations;
+  }
+};
+
+TEST_F(DepsgraphPersistentCacheTest, HitAfterReload)
+{
+  reload();
+  EXPECT_FALSE(build());
+  EXPECT_EQ(1, cache_files_len());
+  const std::set<std::string> relations = graph_relations();
+
+  /* Restored from memory. */
+  EXPECT_TRUE(build());
+  EXPECT_EQ(relations, graph_relations());
+
+  /* Restored from the file, as in another process. */
+  DEG_build_cache_set_directory(cache_dir);
+  reload();
+  EXPECT_TRUE(build());
+  EXPECT_EQ(relations, graph_relations());
+  EXPECT_EQ(1, cache_files_len());
+}
+
+TEST_F(DepsgraphPersistentCacheTest, MissWhenFileChanged)
+{
+  reload();
+  EXPECT_FALSE(build());
+
+  /* Objects in the graph are unchanged, the size of the file is different. */
+  BKE_text_add(bfile->main, "Text");
+  EXPECT_TRUE(BLO_write_file(bfile->main, filepath, 0, NULL, NULL));
+  reload();
+  EXPECT_FALSE(build());
+  EXPECT_EQ(2, cache_files_len());
+}
+
+TEST_F(DepsgraphPersistentCacheTest, MissWhenNotReadFromFile)
+{
+  reload();
+  bfile->main->use_depsgraph_build_cache = false;
+  EXPECT_FALSE(build());
+  EXPECT_EQ(0, cache_files_len());
+}
+
+TEST_F(DepsgraphPersistentCacheTest, InvalidatedByTag)
+{
+  reload();
+  EXPECT_FALSE(build());
+  reload();
+  EXPECT_TRUE(build());
+  const std::set<std::string> relations = graph_relations();
+
+  /* Changing data after reading leaves the file stat the same, the tag disables the cache. */
+  Object *object = object_find("Object");
+  bConstraint *con = BKE_constraint_add_for_object(
+      object, "Copy Location", CONSTRAINT_TYPE_LOCLIKE);
+  static_cast<bLocateLikeConstraint *>(con->data)->tar = object_find("Target");
+  DEG_relations_tag_update_id(bfile->main, &object->id);
+  EXPECT_FALSE(bfile->main->use_depsgraph_build_cache);
+
+  EXPECT_FALSE(build());
+  EXPECT_NE(relations, graph_relations());
+  EXPECT_EQ(1, cache_files_len());
+
+  /* Relations built for changed data are not stored either. */
+  EXPECT_FALSE(build());
+  EXPECT_EQ(1, cache_files_len());
+}
@@ -0,0 +1,89 @@
+/* Apache License, Version 2.0 */
+
+#include "testing/testing.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "BLI_utildefines.h"
+}
+
+#include "MEM_guardedalloc.h"
+
+#define NUM_RUNS 50
+#define NUM_BLOCKS 100000
+
+namespace {
+
+/* Mostly small blocks of varying size, kept alive for a while, as in modifier evaluation. */
+size_t test_block_len(const int i)
+{
+  return (i % 16 == 0) ? 4096 : (size_t)((i * 37) % 256) + 8;
+}
+
+template<bool use_mem> void alloc_free_blocks()
+{
+  std::vector<void *> blocks(NUM_BLOCKS / 4);
+  for (int run = 0; run < NUM_RUNS; run++) {
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+      void *&block = blocks[(size_t)i % blocks.size()];
+      if (block) {
+        if (use_mem) {
+          MEM_freeN(block);
+        }
+        else {
+          free(block);
+        }
+      }
+      block = use_mem ? MEM_mallocN(test_block_len(i), __func__) : malloc(test_block_len(i));
+      *(char *)block = 1;
+    }
+  }
+  for (void *block : blocks) {
+    if (use_mem) {
+      MEM_freeN(block);
+    }
+    else {
+      free(block);
+    }
+  }
+}
+
+template<bool use_mem> double alloc_free_test_do(const int threads_len)
+{
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < threads_len; t++) {
+    threads.emplace_back(alloc_free_blocks<use_mem>);
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void alloc_free_test(const int threads_len)
+{
+  const double mem_time = alloc_free_test_do<true>(threads_len);
+  const double system_time = alloc_free_test_do<false>(threads_len);
+  printf("\t%d thread(s), %d allocations each: MEM_mallocN %fs, malloc %fs\n",
+         threads_len,
+         NUM_RUNS * NUM_BLOCKS,
+         mem_time,
+         system_time);
+}
+
+}  // namespace
+
+TEST(guardedalloc, LockfreeAllocFree1Thread)
+{
+  alloc_free_test(1);
+}
+
+TEST(guardedalloc, LockfreeAllocFree8Threads)
+{
+  alloc_free_test(8);
+}
@@ -0,0 +1,183 @@
+/* Apache License, Version 2.0 */
+
+#include "testing/testing.h"
+
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "BLI_utildefines.h"
+}
+
+#include "MEM_guardedalloc.h"
+
+namespace {
+
+std::map<std::string, double> profile_read(void)
+{
+  const std::string filepath = testing::internal::TempDir() + "guardedalloc_profile.folded";
+  EXPECT_TRUE(MEM_profile_write(filepath.c_str()));
+
+  std::map<std::string, double> stacks;
+  std::ifstream file(filepath);
+  std::string line;
+  while (std::getline(file, line)) {
+    const size_t split = line.rfind(' ');
+    stacks[line.substr(0, split)] += std::stod(line.substr(split + 1));
+  }
+  return stacks;
+}
+
+struct TimelinePoint {
+  double time, alloc_bytes, live_bytes, peak_bytes;
+};
+
+std::map<std::string, std::vector<TimelinePoint>> profile_read_timeline(void)
+{
+  const std::string filepath = testing::internal::TempDir() + "guardedalloc_profile.csv";
+  EXPECT_TRUE(MEM_profile_write_timeline(filepath.c_str()));
+
+  std::map<std::string, std::vector<TimelinePoint>> timelines;
+  std::ifstream file(filepath);
+  std::string line;
+  std::getline(file, line);
+  EXPECT_EQ(line, "time,name,alloc_bytes,live_bytes,peak_bytes");
+  while (std::getline(file, line)) {
+    const size_t name_start = line.find(",\"") + 2;
+    const size_t name_end = line.find("\",", name_start);
+    TimelinePoint point;
+    std::string value;
+    std::istringstream values(line.substr(0, name_start - 2) + line.substr(name_end + 1));
+    std::getline(values, value, ',');
+    point.time = std::stod(value);
+    std::getline(values, value, ',');
+    point.alloc_bytes = std::stod(value);
+    std::getline(values, value, ',');
+    point.live_bytes = std::stod(value);
+    std::getline(values, value, ',');
+    point.peak_bytes = std::stod(value);
+    timelines[line.substr(name_start, name_end - name_start)].push_back(point);
+  }
+  return timelines;
+}
+
+/* Profiler recording all allocations of the guarded allocator, started for each test. */
+class ProfileTest : public testing::Test {
+ protected:
+  virtual void SetUp()
+  {
+    MEM_use_guarded_allocator();
+    EXPECT_TRUE(MEM_profile_enable(0));
+  }
+
+  virtual void TearDown()
+  {
+    MEM_profile_disable();
+    EXPECT_FALSE(MEM_profile_is_enabled());
+  }
+};
+
+}  // namespace
+
+TEST(guardedalloc, ProfileLockfree)
+{
+  /* Other tests switch to the guarded allocator, run in a new process which doesn't. */
+  testing::FLAGS_gtest_death_test_style = "threadsafe";
+  EXPECT_EXIT(
+      {
+        const bool enabled = MEM_profile_enable(0) || MEM_profile_is_enabled();
+        exit(enabled ? 1 : 0);
+      },
+      testing::ExitedWithCode(0),
+      "");
+}
+
+TEST_F(ProfileTest, Contexts)
+{
+  void *a = MEM_mallocN(100, "profile_a");
+  MEM_profile_context_begin("outer");
+  void *b = MEM_callocN(200, "profile_b");
+  MEM_profile_context_begin("inner;with separator");
+  void *c = MEM_mallocN(300, "profile_c");
+  MEM_freeN(c);
+  c = MEM_mallocN(300, "profile_c");
+  MEM_profile_context_end();
+  MEM_profile_context_end();
+  void *d = MEM_mallocN(400, "profile_a");
+
+  std::map<std::string, double> stacks = profile_read();
+  EXPECT_EQ(stacks["profile_a"], 500.0);
+  EXPECT_EQ(stacks["outer;profile_b"], 200.0);
+  EXPECT_EQ(stacks["outer;inner:with separator;profile_c"], 600.0);
+
+  MEM_freeN(a);
+  MEM_freeN(b);
+  MEM_freeN(c);
+  MEM_freeN(d);
+}
+
+TEST_F(ProfileTest, NamesNotStatic)
+{
+  /* Names are compared by content and stay valid after the buffer they come from changes. */
+  char name[32];
+  strcpy(name, "profile_dynamic");
+  void *a = MEM_mallocN(100, name);
+  char *name_copy = strdup(name);
+  void *b = MEM_mallocN(200, name_copy);
+  strcpy(name, "profile_overwritten");
+
+  std::map<std::string, double> stacks = profile_read();
+  EXPECT_EQ(stacks["profile_dynamic"], 300.0);
+
+  MEM_freeN(a);
+  MEM_freeN(b);
+  free(name_copy);
+}
+
+TEST_F(ProfileTest, Disable)
+{
+  void *a = MEM_mallocN(100, "profile_disable");
+  MEM_profile_disable();
+  EXPECT_TRUE(MEM_profile_enable(0));
+
+  /* Blocks allocated before are not counted when freed. */
+  void *b = MEM_mallocN(200, "profile_disable");
+  MEM_freeN(a);
+  std::map<std::string, double> stacks = profile_read();
+  EXPECT_EQ(stacks.size(), 1);
+  EXPECT_EQ(stacks["profile_disable"], 200.0);
+  std::map<std::string, std::vector<TimelinePoint>> timelines = profile_read_timeline();
+  ASSERT_EQ(timelines["profile_disable"].size(), 1);
+  EXPECT_EQ(timelines["profile_disable"][0].live_bytes, 200.0);
+
+  MEM_freeN(b);
+}
+
+TEST_F(ProfileTest, Timeline)
+{
+  /* Sleep past the first interval, so the allocations end up in separate intervals. */
+  void *a = MEM_mallocN(100, "profile_timeline");
+  void *b = MEM_mallocN(200, "profile_timeline");
+  MEM_freeN(b);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  MEM_freeN(a);
+  a = MEM_mallocN(400, "profile_timeline");
+
+  std::map<std::string, std::vector<TimelinePoint>> timelines = profile_read_timeline();
+  const std::vector<TimelinePoint> &timeline = timelines["profile_timeline"];
+  ASSERT_EQ(timeline.size(), 2);
+  EXPECT_LT(timeline[0].time, timeline[1].time);
+  EXPECT_EQ(timeline[0].alloc_bytes, 300.0);
+  EXPECT_EQ(timeline[0].live_bytes, 100.0);
+  EXPECT_EQ(timeline[0].peak_bytes, 300.0);
+  EXPECT_EQ(timeline[1].alloc_bytes, 400.0);
+  EXPECT_EQ(timeline[1].live_bytes, 400.0);
+  EXPECT_EQ(timeline[1].peak_bytes, 400.0);
+
+  MEM_freeN(a);
+}
@@ -0,0 +1,177 @@
+/* Apache License, Version 2.0 */
+
+#include "testing/testing.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "BLI_utildefines.h"
+}
+
+#include "MEM_guardedalloc.h"
+
+#define NUM_THREADS 4
+#define NUM_BLOCKS 10000
+
+namespace {
+
+size_t test_block_len(const int i)
+{
+  /* Cover all size classes and some blocks too large to be cached. */
+  return (size_t)((i * 37) % 1200) + 1;
+}
+
+void alloc_blocks(void **blocks, const int offset)
+{
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    blocks[i] = MEM_mallocN(test_block_len(i + offset), __func__);
+    memset(blocks[i], i & 0xff, test_block_len(i + offset));
+  }
+}
+
+void free_blocks(void **blocks)
+{
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    MEM_freeN(blocks[i]);
+  }
+}
+
+}  // namespace
+
+TEST(guardedalloc, LockfreeThreadCacheLen)
+{
+  for (int i = 0; i < 1200; i++) {
+    void *ptr = MEM_mallocN((size_t)i, __func__);
+    EXPECT_GE(MEM_allocN_len(ptr), (size_t)i);
+    EXPECT_LT(MEM_allocN_len(ptr), (size_t)i + 4);
+    MEM_freeN(ptr);
+  }
+}
+
+TEST(guardedalloc, LockfreeThreadCacheCalloc)
+{
+  /* Recycled blocks have to be cleared. */
+  for (int i = 0; i < 100; i++) {
+    char *ptr = (char *)MEM_mallocN(100, __func__);
+    memset(ptr, 0xff, 100);
+    MEM_freeN(ptr);
+
+    ptr = (char *)MEM_callocN(100, __func__);
+    for (int j = 0; j < 100; j++) {
+      EXPECT_EQ(ptr[j], 0);
+    }
+    MEM_freeN(ptr);
+  }
+}
+
+TEST(guardedalloc, LockfreeThreadCacheRealloc)
+{
+  int *ptr = (int *)MEM_mallocN(sizeof(int), __func__);
+  ptr[0] = 0;
+  for (int i = 1; i < 1000; i++) {
+    ptr = (int *)MEM_reallocN(ptr, sizeof(int) * (size_t)(i + 1));
+    ptr[i] = i;
+  }
+  for (int i = 0; i < 1000; i++) {
+    EXPECT_EQ(ptr[i], i);
+  }
+  MEM_freeN(ptr);
+}
+
+TEST(guardedalloc, LockfreeThreadCacheStats)
+{
+  const unsigned int blocks_in_use = MEM_get_memory_blocks_in_use();
+  const size_t memory_in_use = MEM_get_memory_in_use();
+
+  std::vector<void *> blocks(NUM_BLOCKS * NUM_THREADS);
+  size_t len = 0;
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    len += (test_block_len(i) + 3) & ~(size_t)3;
+  }
+
+  /* Allocate in one thread, free in another, so blocks move between the threads. */
+  std::vector<std::thread> threads;
+  for (int t = 0; t < NUM_THREADS; t++) {
+    threads.emplace_back(alloc_blocks, &blocks[(size_t)t * NUM_BLOCKS], 0);
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(MEM_get_memory_blocks_in_use(), blocks_in_use + NUM_BLOCKS * NUM_THREADS);
+  EXPECT_EQ(MEM_get_memory_in_use(), memory_in_use + len * NUM_THREADS);
+  EXPECT_GE(MEM_get_peak_memory(), memory_in_use + len * NUM_THREADS);
+
+  threads.clear();
+  for (int t = 0; t < NUM_THREADS; t++) {
+    threads.emplace_back(free_blocks, &blocks[(size_t)((t + 1) % NUM_THREADS) * NUM_BLOCKS]);
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(MEM_get_memory_blocks_in_use(), blocks_in_use);
+  EXPECT_EQ(MEM_get_memory_in_use(), memory_in_use);
+
+  /* Blocks released by the exited threads are reused. */
+  alloc_blocks(blocks.data(), 1);
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    const char *ptr = (const char *)blocks[i];
+    EXPECT_EQ(ptr[test_block_len(i + 1) - 1], (char)(i & 0xff));
+  }
+  free_blocks(blocks.data());
+  EXPECT_EQ(MEM_get_memory_blocks_in_use(), blocks_in_use);
+  EXPECT_EQ(MEM_get_memory_in_use(), memory_in_use);
+}
+
+TEST(guardedalloc, LockfreeThreadCachePeakCrossThreadFree)
+{
+  /* Threads keep their allocations below the flush limit, another thread frees them all and
+   * flushes more than was ever added to the global counter. The peak must not wrap around. */
+  const size_t block_len = 512;
+  const int blocks_per_thread = (900 * 1024) / (int)block_len;
+
+  MEM_reset_peak_memory();
+  const size_t memory_in_use = MEM_get_memory_in_use();
+
+  std::vector<void *> blocks((size_t)blocks_per_thread * NUM_THREADS);
+  std::atomic<int> threads_allocated(0);
+  std::atomic<bool> threads_release(false);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < NUM_THREADS; t++) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < blocks_per_thread; i++) {
+        blocks[(size_t)t * blocks_per_thread + i] = MEM_mallocN(block_len, __func__);
+      }
+      threads_allocated++;
+      /* Stay alive so the counters of this thread aren't flushed on exit. */
+      while (!threads_release) {
+        std::this_thread::yield();
+      }
+      /* Allocating after the other thread flushed its frees adds to a global counter below
+       * the actual memory in use. */
+      for (int i = 0; i < blocks_per_thread; i++) {
+        MEM_freeN(MEM_mallocN(block_len, __func__));
+      }
+    });
+  }
+  while (threads_allocated != NUM_THREADS) {
+    std::this_thread::yield();
+  }
+
+  std::thread free_thread([&]() {
+    for (void *ptr : blocks) {
+      MEM_freeN(ptr);
+    }
+  });
+  free_thread.join();
+
+  threads_release = true;
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(MEM_get_memory_in_use(), memory_in_use);
+  EXPECT_LE(MEM_get_peak_memory(), memory_in_use + blocks.size() * block_len * 2);
+}